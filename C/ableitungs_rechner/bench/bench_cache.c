@@ -0,0 +1,244 @@
+/*
+ * bench_cache.c - Persistent derivative cache
+ *
+ * Differentiates N generated expressions the way batch mode does (parse,
+ * derive, simplify, print) and stores them in a cache file, then answers
+ * them again from the cache (normalise, hash, look up), printing the
+ * time per expression for both. Last, reader processes look up keys in a
+ * loop while this process keeps inserting into a small cache, so that it
+ * fills up and is started over several times; every value a reader gets
+ * must be the one stored under its key.
+ *
+ * Usage: bench_cache [count] [cache file]
+ */
+#define _POSIX_C_SOURCE 199309L
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ast.h"
+#include "cache.h"
+#include "derive.h"
+#include "parser.h"
+#include "printer.h"
+#include "simplify.h"
+
+#define READERS 4
+#define STRESS_BYTES (1u << 20)
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t next_random(uint64_t *state)
+{
+	uint64_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return *state = x;
+}
+
+/* the i-th expression, the same in every process */
+static int make_expr(char *buf, size_t cap, unsigned int i)
+{
+	static const char *const forms[] = {
+		"sin(%u*x)*exp(-x/%u)",
+		"ln(1 + x^%u)/(x + %u)",
+		"x^%u*cos(x)^2 + tan(%u*x)",
+		"sqrt(1 + x^2)*sin(x + %u)^%u",
+	};
+
+	return snprintf(buf, cap, forms[i % 4], i / 4 + 2, i % 7 + 2);
+}
+
+/* what batch mode does for a line it hasn't seen */
+static int derive_text(struct expr_arena *arena, const char *text,
+		       struct fmt_buf *out)
+{
+	struct parse_error err;
+	uint32_t root;
+
+	arena_reset(arena);
+	root = parse_expression(arena, text, &err);
+	if (root == NODE_NONE)
+		return -1;
+	root = simplify(arena, derive(arena, root, VAR_X), NULL);
+	return root == NODE_NONE ? -1 : ast_format(out, arena, root);
+}
+
+static void key_of(const char *text, struct cache_key *key)
+{
+	char norm[128];
+	size_t len = cache_normalize(norm, text, strlen(text));
+
+	cache_hash(norm, len, 1, key);
+}
+
+static int bench_speed(const char *path, unsigned int count)
+{
+	struct deriv_cache cache;
+	struct expr_arena arena;
+	struct fmt_buf out = { 0 };
+	struct cache_key key;
+	unsigned int i, hits = 0;
+	double start, cold, warm;
+	char text[128];
+
+	unlink(path);
+	if (cache_open(&cache, path, 0) < 0 || arena_init(&arena, 0) < 0)
+		return -1;
+
+	start = now_s();
+	for (i = 0; i < count; i++) {
+		make_expr(text, sizeof(text), i);
+		out.len = 0;
+		if (derive_text(&arena, text, &out) < 0)
+			return -1;
+		key_of(text, &key);
+		cache_put(&cache, &key, out.buf, out.len);
+	}
+	cold = now_s() - start;
+
+	start = now_s();
+	for (i = 0; i < count; i++) {
+		make_expr(text, sizeof(text), i);
+		out.len = 0;
+		key_of(text, &key);
+		hits += cache_get(&cache, &key, &out);
+	}
+	warm = now_s() - start;
+
+	printf("%u expressions, %u hits\n", count, hits);
+	printf("differentiate and store %10.2f us per expression\n",
+	       cold * 1e6 / count);
+	printf("look up                 %10.2f us per expression (%.0fx)\n\n",
+	       warm * 1e6 / count, cold / warm);
+	fmt_release(&out);
+	arena_destroy(&arena);
+	cache_close(&cache);
+	return hits == count ? 0 : -1;
+}
+
+/* look up random keys until @done reads EOF; exit status 1 on a bad value */
+static int reader(const char *path, unsigned int count, int done, int id)
+{
+	struct deriv_cache cache;
+	struct expr_arena arena;
+	struct fmt_buf got = { 0 }, want = { 0 };
+	unsigned long lookups = 0, hits = 0, bad = 0;
+	uint64_t seed = 0x9e3779b97f4a7c15ull * (id + 1);
+	struct pollfd pfd = { .fd = done, .events = POLLIN };
+	struct cache_key key;
+	char text[128];
+
+	if (cache_open(&cache, path, STRESS_BYTES) < 0 ||
+	    arena_init(&arena, 0) < 0)
+		return 1;
+	while ((lookups & 1023) || poll(&pfd, 1, 0) == 0) {
+		unsigned int i = next_random(&seed) % count;
+
+		make_expr(text, sizeof(text), i);
+		key_of(text, &key);
+		got.len = 0;
+		lookups++;
+		if (!cache_get(&cache, &key, &got))
+			continue;
+		hits++;
+		want.len = 0;
+		if (derive_text(&arena, text, &want) < 0 ||
+		    got.len != want.len || memcmp(got.buf, want.buf, got.len))
+			bad++;
+	}
+	printf("reader %d: %8lu lookups, %8lu hits, %lu bad\n", id, lookups,
+	       hits, bad);
+	fmt_release(&got);
+	fmt_release(&want);
+	arena_destroy(&arena);
+	cache_close(&cache);
+	return bad ? 1 : 0;
+}
+
+/* insert into a small cache while READERS processes read it */
+static int bench_readers(const char *path, unsigned int count)
+{
+	struct deriv_cache cache;
+	struct expr_arena arena;
+	struct fmt_buf out = { 0 };
+	struct cache_key key;
+	pid_t pids[READERS];
+	unsigned int i, round;
+	int fds[2], status, ret = 0, k;
+	char text[128];
+	double start;
+
+	unlink(path);
+	if (cache_open(&cache, path, STRESS_BYTES) < 0 ||
+	    arena_init(&arena, 0) < 0 || pipe(fds) < 0)
+		return -1;
+	fflush(stdout);
+	for (k = 0; k < READERS; k++) {
+		pids[k] = fork();
+		if (pids[k] == 0) {
+			close(fds[1]);
+			exit(reader(path, count, fds[0], k));
+		}
+	}
+	close(fds[0]);
+
+	/* enough rounds over the keys to start the file over a few times */
+	start = now_s();
+	for (round = 0; round < 8; round++) {
+		for (i = 0; i < count; i++) {
+			make_expr(text, sizeof(text), i);
+			out.len = 0;
+			if (derive_text(&arena, text, &out) < 0)
+				return -1;
+			key_of(text, &key);
+			cache_put(&cache, &key, out.buf, out.len);
+		}
+	}
+	printf("writer: %u puts into a %u KiB cache in %.3f s\n", 8 * count,
+	       STRESS_BYTES >> 10, now_s() - start);
+	fflush(stdout);
+	close(fds[1]);
+	for (k = 0; k < READERS; k++) {
+		if (pids[k] < 0 || waitpid(pids[k], &status, 0) < 0 ||
+		    !WIFEXITED(status) || WEXITSTATUS(status))
+			ret = -1;
+	}
+	fmt_release(&out);
+	arena_destroy(&arena);
+	cache_close(&cache);
+	unlink(path);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int count = argc > 1 ? (unsigned int)atoi(argv[1]) : 20000;
+	const char *path = argc > 2 ? argv[2] : "bench_cache.tmp";
+
+	if (!count)
+		count = 1;
+	if (bench_speed(path, count) < 0) {
+		fprintf(stderr, "%s: can't create it or a lookup missed\n",
+			path);
+		return 1;
+	}
+	if (bench_readers(path, count) < 0) {
+		fprintf(stderr, "%s: a reader got a wrong value\n", path);
+		return 1;
+	}
+	return 0;
+}
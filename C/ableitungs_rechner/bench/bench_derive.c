@@ -0,0 +1,127 @@
+/*
+ * bench_derive.c - Growth of repeated symbolic derivatives
+ *
+ * Differentiates nested expressions ten times in a row and prints, per
+ * order, the number of distinct nodes in the hash-consed DAG next to the
+ * size the same derivative would have as a plain tree, along with the
+ * time taken and the length of the output printed with temporaries.
+ *
+ * Usage: bench_derive [order] [expression]
+ */
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ast.h"
+#include "derive.h"
+#include "parser.h"
+#include "printer.h"
+
+static const char *const default_exprs[] = {
+	"sin(cos(x)*exp(x))*ln(1 + x^2)",
+	"exp(sin(x^2))/(1 + x^2)",
+	"x^x*sqrt(1 + tan(x))",
+	"sin(x)*cos(x)*exp(x)*ln(x)*tan(x)",
+	/* constant factors whose product overflows */
+	"2*(1e308*x)*x^2",
+};
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+/* distinct nodes reachable from root, and the size as a tree */
+static void measure(const struct expr_arena *arena, uint32_t root,
+		    uint32_t *dag, double *tree)
+{
+	double *size = calloc((size_t)root + 1, sizeof(*size));
+	char *live = calloc((size_t)root + 1, 1);
+	uint32_t i;
+
+	*dag = 0;
+	live[root] = 1;
+	for (i = root + 1; i-- > 0;) {
+		const struct node *n = ast_node(arena, i);
+
+		if (!live[i])
+			continue;
+		(*dag)++;
+		if (n->type > NODE_VAR)
+			live[n->lhs] = 1;
+		if (n->type > NODE_VAR && n->type < NODE_NEG)
+			live[n->rhs] = 1;
+	}
+	for (i = 0; i <= root; i++) {
+		const struct node *n = ast_node(arena, i);
+
+		size[i] = 1;
+		if (n->type > NODE_VAR)
+			size[i] += size[n->lhs];
+		if (n->type > NODE_VAR && n->type < NODE_NEG)
+			size[i] += size[n->rhs];
+	}
+	*tree = size[root];
+	free(size);
+	free(live);
+}
+
+static void run(const char *expr, int order)
+{
+	struct expr_arena arena;
+	struct parse_error err;
+	uint32_t node, dag;
+	double tree, start, total = 0.0;
+	int k;
+
+	arena_init(&arena, 0);
+	node = parse_expression(&arena, expr, &err);
+	if (node == NODE_NONE) {
+		fprintf(stderr, "%s: %s at position %zu\n", expr, err.msg,
+			err.offset + 1);
+		exit(1);
+	}
+
+	printf("f(x) = %s\n", expr);
+	printf("order   dag nodes      tree nodes   time (ms)   printed bytes\n");
+	for (k = 1; k <= order; k++) {
+		char *text;
+
+		start = now_ms();
+		node = derive(&arena, node, VAR_X);
+		total += now_ms() - start;
+		if (node == NODE_NONE) {
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+
+		measure(&arena, node, &dag, &tree);
+		text = ast_to_string_shared(&arena, node, "f");
+		printf("%5d %11u %15.4g %11.2f %15zu\n", k, dag, tree, total,
+		       text ? strlen(text) : 0);
+		free(text);
+	}
+	printf("arena: %u nodes, %u constants, %u memo entries\n\n",
+	       arena.num_nodes, arena.num_consts, arena.memo_count);
+	arena_destroy(&arena);
+}
+
+int main(int argc, char *argv[])
+{
+	int order = argc > 1 ? atoi(argv[1]) : 10;
+	size_t i;
+
+	if (argc > 2) {
+		run(argv[2], order);
+		return 0;
+	}
+	for (i = 0; i < sizeof(default_exprs) / sizeof(*default_exprs); i++)
+		run(default_exprs[i], order);
+	return 0;
+}
@@ -0,0 +1,154 @@
+/*
+ * bench_dual.c - Forward-mode derivatives against symbolic ones
+ *
+ * For each expression, derivative values over an array of points are
+ * computed twice: symbolically (derive() or gradient(), compile f and
+ * its derivatives into one program, run the VM) and with dual numbers
+ * (compile f alone, run dual_eval()). Times include building and
+ * compiling the derivatives, which is what a caller who only wants
+ * numbers pays. The largest relative difference between the two is
+ * printed as well.
+ *
+ * Usage: bench_dual [points]
+ */
+#define _POSIX_C_SOURCE 199309L
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "ast.h"
+#include "derive.h"
+#include "dual.h"
+#include "gradient.h"
+#include "parser.h"
+#include "symtab.h"
+#include "vm.h"
+
+#define MAX_VARS 4
+
+static const char *const default_exprs[] = {
+	"3*x^4 - 2*x^3 + x - 7",
+	"sin(cos(x)*exp(x))*ln(1 + x^2)",
+	"exp(sin(x^2))/(1 + x^2)",
+	"x^x*sqrt(1 + tan(x))",
+	"sin(x*y)*exp(y/z) + ln(x + w^2)*z",
+	"(x - y)^2 + (y - z)^2 + (z - w)^2 + exp(-x*y*z*w)",
+};
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double rel_diff(double a, double b)
+{
+	double scale = fabs(a) > 1.0 ? fabs(a) : 1.0;
+
+	if (isnan(a) && isnan(b))
+		return 0.0;
+	return fabs(a - b) / scale;
+}
+
+static void fail(void)
+{
+	fprintf(stderr, "out of memory\n");
+	exit(1);
+}
+
+static void run(const char *expr, size_t n)
+{
+	struct expr_arena arena;
+	struct symtab symbols;
+	struct parse_error err;
+	struct vm_program sym_prog, dual_prog;
+	uint32_t roots[MAX_VARS + 1], vars[MAX_VARS], num_vars, i;
+	double *in[MAX_VARS], *sym_out[MAX_VARS + 1], *val, *der[MAX_VARS];
+	double start, t_sym, t_dual, max_diff = 0.0;
+	size_t p;
+
+	if (symtab_init(&symbols) < 0 || arena_init(&arena, 0) < 0)
+		fail();
+	arena.symbols = &symbols;
+	roots[0] = parse_expression(&arena, expr, &err);
+	if (roots[0] == NODE_NONE) {
+		fprintf(stderr, "%s: %s at position %zu\n", expr, err.msg,
+			err.offset + 1);
+		exit(1);
+	}
+	num_vars = symbols.num;
+	for (i = 0; i < num_vars; i++) {
+		vars[i] = i;
+		in[i] = malloc(sizeof(double) * n);
+		der[i] = malloc(sizeof(double) * n);
+		if (!in[i] || !der[i])
+			fail();
+		for (p = 0; p < n; p++)
+			in[i][p] = 0.1 + 2.0 * (double)p / n + 0.3 * i;
+	}
+	for (i = 0; i <= num_vars; i++)
+		if (!(sym_out[i] = malloc(sizeof(double) * n)))
+			fail();
+	if (!(val = malloc(sizeof(double) * n)))
+		fail();
+
+	/* symbolic: derivatives, one program for f and them, the VM */
+	start = now_s();
+	if (num_vars == 1)
+		roots[1] = derive(&arena, roots[0], VAR_X);
+	else if (gradient(&arena, roots[0], vars, num_vars, roots + 1) < 0)
+		fail();
+	if (roots[1] == NODE_NONE ||
+	    vm_compile(&arena, roots, num_vars + 1, &sym_prog) < 0 ||
+	    vm_eval(&sym_prog, (const double *const *)in, n, sym_out) < 0)
+		fail();
+	t_sym = now_s() - start;
+
+	/* dual numbers: f alone, one direction per variable */
+	start = now_s();
+	if (vm_compile(&arena, roots, 1, &dual_prog) < 0 ||
+	    dual_eval(&dual_prog, (const double *const *)in, NULL, num_vars,
+		      n, &val, der) < 0)
+		fail();
+	t_dual = now_s() - start;
+
+	for (p = 0; p < n; p++) {
+		max_diff = fmax(max_diff, rel_diff(sym_out[0][p], val[p]));
+		for (i = 0; i < num_vars; i++)
+			max_diff = fmax(max_diff, rel_diff(sym_out[i + 1][p],
+							   der[i][p]));
+	}
+
+	printf("%s (%u variable%s)\n", expr, num_vars, num_vars > 1 ? "s" : "");
+	printf("  symbolic + VM: %8.2f ms  %10.3g points/s\n", t_sym * 1e3,
+	       n / t_sym);
+	printf("  dual numbers:  %8.2f ms  %10.3g points/s\n", t_dual * 1e3,
+	       n / t_dual);
+	printf("  max relative difference: %.3g\n", max_diff);
+
+	vm_free(&sym_prog);
+	vm_free(&dual_prog);
+	for (i = 0; i < num_vars; i++) {
+		free(in[i]);
+		free(der[i]);
+	}
+	for (i = 0; i <= num_vars; i++)
+		free(sym_out[i]);
+	free(val);
+	arena_destroy(&arena);
+	symtab_destroy(&symbols);
+}
+
+int main(int argc, char *argv[])
+{
+	size_t n = argc > 1 ? strtoull(argv[1], NULL, 10) : 1000000;
+	size_t i;
+
+	for (i = 0; i < sizeof(default_exprs) / sizeof(*default_exprs); i++)
+		run(default_exprs[i], n);
+	return 0;
+}
@@ -0,0 +1,158 @@
+/*
+ * bench_format.c - Format throughput of polynomials
+ *
+ * Builds a polynomial whose coefficients are half integers (as in most
+ * derivatives) and half random doubles, and times poly_format() into a
+ * growable buffer and through a 64 KB buffer flushed to /dev/null,
+ * against the old one-sprintf-per-piece formatting with "%.15g"/"%.17g".
+ * The text is then parsed back with poly_parse(), which has to return
+ * every coefficient bit for bit.
+ *
+ * Usage: bench_format [terms]
+ */
+#define _POSIX_C_SOURCE 199309L
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "format.h"
+#include "poly.h"
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t next_random(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+/* what poly_to_string() did before, for comparison */
+static size_t format_sprintf(char *buf, const struct polynomial *poly)
+{
+	size_t i, len = 0;
+
+	for (i = 0; i < poly->num_terms; i++) {
+		double coeff = fabs(poly->terms[i].coeff);
+		uint64_t exp = poly->terms[i].exp;
+		char *num;
+
+		if (i)
+			len += sprintf(buf + len, poly->terms[i].coeff < 0 ?
+				       " - " : " + ");
+		else if (poly->terms[i].coeff < 0)
+			len += sprintf(buf + len, "-");
+		num = buf + len;
+		if (coeff == floor(coeff) && coeff < 1e15) {
+			len += sprintf(num, "%.0f", coeff);
+		} else {
+			len += sprintf(num, "%.15g", coeff);
+			if (strtod(num, NULL) != coeff)
+				len = num - buf + sprintf(num, "%.17g", coeff);
+		}
+		if (exp == 1)
+			len += sprintf(buf + len, "x");
+		else if (exp > 1)
+			len += sprintf(buf + len, "x^%" PRIu64, exp);
+	}
+	return len;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t terms = argc > 1 ? strtoull(argv[1], NULL, 10) : 2000000;
+	struct polynomial poly, back;
+	struct fmt_buf out = { 0 }, chunked;
+	uint64_t state = 0x9e3779b97f4a7c15ull;
+	size_t i, offset, mismatches = 0, len_old;
+	double start, t_fmt, t_chunked, t_old;
+	char *old;
+	FILE *null;
+
+	/* the sprintf() version needs up to 48 bytes a term */
+	if (!terms || terms > (SIZE_MAX - 1) / 48) {
+		fprintf(stderr, "Usage: %s [terms]\n", argv[0]);
+		return 2;
+	}
+	old = malloc(terms * 48 + 1);
+	if (!old) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	null = fopen("/dev/null", "w");
+	if (!null) {
+		fprintf(stderr, "/dev/null: can't open\n");
+		return 1;
+	}
+
+	poly_init(&poly);
+	poly_init(&back);
+	for (i = 0; i < terms; i++) {
+		uint64_t r = next_random(&state);
+		double coeff = i & 1 ? (double)(r >> 40) :
+			       1 + (r >> 11) * 0x1p-53 * 1000;
+
+		if (poly_push(&poly, r & 1 ? -coeff : coeff, terms - i) < 0) {
+			fprintf(stderr, "out of memory\n");
+			return 1;
+		}
+	}
+	poly_normalize(&poly);
+
+	start = now_s();
+	poly_format(&out, &poly);
+	t_fmt = now_s() - start;
+
+	fmt_init(&chunked, NULL, 1 << 16, null);
+	start = now_s();
+	poly_format(&chunked, &poly);
+	fmt_flush(&chunked);
+	t_chunked = now_s() - start;
+
+	start = now_s();
+	len_old = format_sprintf(old, &poly);
+	t_old = now_s() - start;
+
+	if (out.failed || chunked.failed) {
+		fprintf(stderr, "formatting failed\n");
+		return 1;
+	}
+	if (poly_parse(&back, out.buf, out.len, &offset) < 0) {
+		fprintf(stderr, "parse error at position %zu\n", offset + 1);
+		return 1;
+	}
+	for (i = 0; i < terms; i++)
+		mismatches += back.num_terms != terms ||
+			      back.terms[i].exp != poly.terms[i].exp ||
+			      memcmp(&back.terms[i].coeff, &poly.terms[i].coeff,
+				     sizeof(double)) != 0;
+
+	printf("%zu terms, %.1f MB (%.1f MB with sprintf)\n", terms,
+	       out.len / 1e6, len_old / 1e6);
+	printf("  poly_format:          %7.3f s  %10.3g terms/s  %8.1f MB/s\n",
+	       t_fmt, terms / t_fmt, out.len / 1e6 / t_fmt);
+	printf("  poly_format, chunked: %7.3f s  %10.3g terms/s  %8.1f MB/s\n",
+	       t_chunked, terms / t_chunked, out.len / 1e6 / t_chunked);
+	printf("  sprintf:              %7.3f s  %10.3g terms/s  %8.1f MB/s\n",
+	       t_old, terms / t_old, len_old / 1e6 / t_old);
+	printf("  round-trip mismatches: %zu\n", mismatches);
+
+	fmt_release(&out);
+	fmt_release(&chunked);
+	fclose(null);
+	poly_free(&poly);
+	poly_free(&back);
+	free(old);
+	return 0;
+}
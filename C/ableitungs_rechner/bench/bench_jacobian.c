@@ -0,0 +1,137 @@
+/*
+ * bench_jacobian.c - Sparse Jacobians of large systems
+ *
+ * Parses a chain of n equations in n variables, each coupling a variable
+ * to its neighbours like a discretised differential equation,
+ *
+ *	f_i = v(i-1) - 2*v(i) + v(i+1) + h*sin(v(i))*exp(v(i+1)/(1 + v(i)^2))
+ *
+ * and builds the sparse Jacobian with jacobian_build(). For comparison
+ * the same entries are then built with one derive() per entry. Entries
+ * of sample rows are checked against each other at a random point.
+ *
+ * Usage: bench_jacobian [n ...]
+ */
+#define _POSIX_C_SOURCE 199309L
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ast.h"
+#include "derive.h"
+#include "eval.h"
+#include "gradient.h"
+#include "parser.h"
+#include "symtab.h"
+
+#define SAMPLE_ROWS 64
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench(size_t n)
+{
+	struct expr_arena arena;
+	struct symtab symbols;
+	struct parse_error err;
+	struct jacobian jac;
+	uint32_t *roots = malloc(sizeof(*roots) * n);
+	double *vars = NULL, start, t_parse, t_jac, t_derive, max_err = 0.0;
+	size_t i, k, nodes;
+	char line[256];
+
+	if (!roots || symtab_init(&symbols) < 0 || arena_init(&arena, 0) < 0)
+		return -1;
+	arena.symbols = &symbols;
+
+	start = now_s();
+	for (i = 0; i < n; i++) {
+		size_t prev = (i + n - 1) % n, next = (i + 1) % n;
+
+		snprintf(line, sizeof(line),
+			 "v%zu - 2*v%zu + v%zu + 0.01*sin(v%zu)*"
+			 "exp(v%zu/(1 + v%zu^2))", prev, i, next, i, next, i);
+		roots[i] = parse_expression(&arena, line, &err);
+		if (roots[i] == NODE_NONE) {
+			fprintf(stderr, "%s at position %zu\n", err.msg,
+				err.offset + 1);
+			return -1;
+		}
+	}
+	t_parse = now_s() - start;
+	nodes = arena.num_nodes;
+
+	start = now_s();
+	if (jacobian_build(&arena, roots, n, &jac) < 0)
+		return -1;
+	t_jac = now_s() - start;
+
+	/* the same entries one derive() at a time */
+	start = now_s();
+	for (i = 0; i < n; i++)
+		for (k = jac.row_start[i]; k < jac.row_start[i + 1]; k++)
+			if (derive(&arena, roots[i], jac.col[k]) == NODE_NONE)
+				return -1;
+	t_derive = now_s() - start;
+
+	vars = malloc(sizeof(*vars) * symbols.num);
+	if (!vars)
+		return -1;
+	srand(1);
+	for (i = 0; i < symbols.num; i++)
+		vars[i] = (double)rand() / RAND_MAX;
+	for (i = 0; i < n; i += n / SAMPLE_ROWS + 1) {
+		for (k = jac.row_start[i]; k < jac.row_start[i + 1]; k++) {
+			double a = ast_eval(&arena, jac.entry[k], vars);
+			double b = ast_eval(&arena, derive(&arena, roots[i],
+							   jac.col[k]), vars);
+
+			max_err = fmax(max_err, fabs(a - b) / fmax(fabs(b), 1.0));
+		}
+	}
+
+	printf("%zu variables, %zu nodes, %zu non-zeros (%.2g%% dense)\n",
+	       (size_t)symbols.num - 1, nodes, jac.nnz, 100.0 * jac.nnz / n / n);
+	printf("  parse:            %8.2f ms\n", t_parse * 1e3);
+	printf("  jacobian_build:   %8.2f ms  %10.3g entries/s\n", t_jac * 1e3,
+	       jac.nnz / t_jac);
+	printf("  derive per entry: %8.2f ms  %10.3g entries/s\n",
+	       t_derive * 1e3, jac.nnz / t_derive);
+	printf("  max relative difference: %.3g\n", max_err);
+
+	jacobian_free(&jac);
+	arena_destroy(&arena);
+	symtab_destroy(&symbols);
+	free(roots);
+	free(vars);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	static const size_t default_sizes[] = { 1000, 4000, 16000 };
+	int i;
+
+	if (argc > 1) {
+		for (i = 1; i < argc; i++)
+			if (bench(strtoull(argv[i], NULL, 10)) < 0)
+				goto fail;
+		return 0;
+	}
+	for (i = 0; i < 3; i++)
+		if (bench(default_sizes[i]) < 0)
+			goto fail;
+	return 0;
+
+fail:
+	fprintf(stderr, "out of memory\n");
+	return 1;
+}
@@ -0,0 +1,124 @@
+/*
+ * bench_jit.c - Native code against the bytecode VM
+ *
+ * Compiles f and f' into one program, then evaluates it over an array of
+ * points with the VM and with the code generated by jit_compile(), and
+ * reports points per second for both. The two run the same operations in
+ * the same order, so their results should agree bit for bit.
+ * ABLEITER_NO_AVX2=1 measures the SSE2 code.
+ *
+ * Usage: bench_jit [points] [expression]
+ */
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ast.h"
+#include "derive.h"
+#include "jit.h"
+#include "parser.h"
+#include "vm.h"
+
+static const char *const default_exprs[] = {
+	"3*x^4 - 2*x^3 + x - 7",
+	"(x^2 + 1)/(x^4 + 3*x + 5) - sqrt(x)*x^-3",
+	"sin(cos(x)*exp(x))*ln(1 + x^2)",
+	"x^x*sqrt(1 + tan(x))",
+};
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(const char *expr, size_t n)
+{
+	struct expr_arena arena;
+	struct parse_error err;
+	struct vm_program prog;
+	struct jit_program jit;
+	uint32_t roots[2];
+	double *x, *out[2], *ref[2];
+	const double *inputs[1];
+	double start, t_vm, t_jit;
+	size_t i, mismatches = 0;
+	int j, native;
+
+	arena_init(&arena, 0);
+	roots[0] = parse_expression(&arena, expr, &err);
+	if (roots[0] == NODE_NONE) {
+		fprintf(stderr, "%s: %s at position %zu\n", expr, err.msg,
+			err.offset + 1);
+		exit(1);
+	}
+	roots[1] = derive(&arena, roots[0], VAR_X);
+	if (roots[1] == NODE_NONE || vm_compile(&arena, roots, 2, &prog) < 0) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	native = jit_compile(&prog, &jit) == 0;
+
+	x = malloc(sizeof(*x) * n);
+	for (j = 0; j < 2; j++) {
+		out[j] = malloc(sizeof(**out) * n);
+		ref[j] = malloc(sizeof(**ref) * n);
+	}
+	if (!x || !out[0] || !out[1] || !ref[0] || !ref[1]) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	for (i = 0; i < n; i++)
+		x[i] = 0.1 + 2.0 * i / n;
+	inputs[VAR_X] = x;
+
+	start = now_s();
+	vm_eval(&prog, inputs, n, ref);
+	t_vm = now_s() - start;
+
+	start = now_s();
+	jit_eval(&jit, inputs, n, out);
+	t_jit = now_s() - start;
+
+	for (j = 0; j < 2; j++)
+		for (i = 0; i < n; i++)
+			mismatches += memcmp(&out[j][i], &ref[j][i],
+					     sizeof(double)) != 0;
+
+	printf("f(x) = %s\n", expr);
+	printf("  %u instructions, %u registers, %zu bytes of %s code\n",
+	       prog.num_insns, prog.num_regs, jit.code_size,
+	       !native ? "no native" : jit.lanes == 4 ? "AVX" : "SSE2");
+	printf("  vm:  %8.3f s  %10.3g points/s\n", t_vm, n / t_vm);
+	printf("  jit: %8.3f s  %10.3g points/s  (%.1fx)\n", t_jit, n / t_jit,
+	       t_vm / t_jit);
+	printf("  results differing from the vm: %zu\n\n", mismatches);
+
+	for (j = 0; j < 2; j++) {
+		free(out[j]);
+		free(ref[j]);
+	}
+	free(x);
+	jit_free(&jit);
+	vm_free(&prog);
+	arena_destroy(&arena);
+}
+
+int main(int argc, char *argv[])
+{
+	size_t n = argc > 1 ? strtoull(argv[1], NULL, 10) : 10000000;
+	size_t i;
+
+	if (argc > 2) {
+		run(argv[2], n);
+		return 0;
+	}
+	for (i = 0; i < sizeof(default_exprs) / sizeof(*default_exprs); i++)
+		run(default_exprs[i], n);
+	return 0;
+}
@@ -0,0 +1,100 @@
+/*
+ * bench_parse.c - Parse throughput of polynomials and numbers
+ *
+ * Builds a polynomial with random decimal coefficients in memory and
+ * times poly_parse() on it (MB/s and terms/s), then converts the same
+ * coefficients once with parse_number() and once with strtod() to show
+ * what the in-place conversion saves. Both conversions must agree.
+ *
+ * Usage: bench_parse [terms]
+ */
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "number.h"
+#include "poly.h"
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t next_random(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t terms = argc > 1 ? strtoull(argv[1], NULL, 10) : 2000000;
+	size_t cap = terms * 48 + 1, len = 0, i, offset, mismatches = 0;
+	char *text = malloc(cap), **starts = malloc(sizeof(*starts) * terms);
+	double *a = malloc(sizeof(*a) * terms), *b = malloc(sizeof(*b) * terms);
+	struct polynomial poly;
+	uint64_t state = 0x9e3779b97f4a7c15ull;
+	double start, t_poly, t_fast, t_strtod;
+
+	if (!text || !starts || !a || !b) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	/* "123.456789x^4711 - 0.5x^17 + ..." with distinct exponents */
+	for (i = 0; i < terms; i++) {
+		uint64_t r = next_random(&state);
+
+		if (i)
+			len += sprintf(text + len, r & 1 ? " - " : " + ");
+		starts[i] = text + len;
+		len += sprintf(text + len, "%u.%06ux^%zu",
+			       (unsigned int)(r >> 8 & 0xffff),
+			       (unsigned int)(r >> 32) % 1000000, terms - i);
+	}
+
+	poly_init(&poly);
+	start = now_s();
+	if (poly_parse(&poly, text, len, &offset) < 0) {
+		fprintf(stderr, "parse error at position %zu\n", offset + 1);
+		return 1;
+	}
+	t_poly = now_s() - start;
+
+	start = now_s();
+	for (i = 0; i < terms; i++)
+		parse_number(starts[i], text + len, &a[i]);
+	t_fast = now_s() - start;
+
+	start = now_s();
+	for (i = 0; i < terms; i++)
+		b[i] = strtod(starts[i], NULL);
+	t_strtod = now_s() - start;
+
+	for (i = 0; i < terms; i++)
+		mismatches += memcmp(&a[i], &b[i], sizeof(double)) != 0;
+
+	printf("%zu terms, %.1f MB\n", poly.num_terms, len / 1e6);
+	printf("  poly_parse:   %7.3f s  %8.1f MB/s  %10.3g terms/s\n", t_poly,
+	       len / 1e6 / t_poly, terms / t_poly);
+	printf("  parse_number: %7.3f s  %10.3g numbers/s\n", t_fast,
+	       terms / t_fast);
+	printf("  strtod:       %7.3f s  %10.3g numbers/s\n", t_strtod,
+	       terms / t_strtod);
+	printf("  mismatches: %zu\n", mismatches);
+
+	poly_free(&poly);
+	free(text);
+	free(starts);
+	free(a);
+	free(b);
+	return 0;
+}
@@ -0,0 +1,255 @@
+/*
+ * bench_polymul.c - Polynomial multiplication methods and crossovers
+ *
+ * Multiplies dense polynomials with small random integer coefficients
+ * of growing size with every method poly_mul_with() offers, checks that
+ * they all agree with the exact NTT product (and that products of even
+ * polynomials with fractional coefficients come out even with every
+ * method but the NTT, which can't take them), and prints the sizes where
+ * Karatsuba overtakes schoolbook and the NTT overtakes Karatsuba, which
+ * KARATSUBA_MIN and NTT_MIN in src/polymul.c are set from. Then poly_pow()
+ * and poly_compose() are timed with automatic method choice against
+ * the heap merge alone.
+ *
+ * Usage: bench_polymul [max size]
+ */
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "poly.h"
+
+#define MIN_TIME 0.05		/* seconds of repetitions per measurement */
+#define SLOW_MAX 8192		/* largest size for the quadratic methods */
+
+static const char *const names[] = {
+	"auto", "heap", "schoolbook", "karatsuba", "ntt",
+};
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t next_random(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+static int random_poly(struct polynomial *poly, size_t n, uint64_t *state)
+{
+	size_t i;
+
+	poly_init(poly);
+	for (i = n; i-- > 0;)
+		if (poly_push(poly, (double)(next_random(state) % 201) - 100.0,
+			      i) < 0)
+			return -1;
+	poly_normalize(poly);
+	return 0;
+}
+
+static int equal(const struct polynomial *a, const struct polynomial *b)
+{
+	return a->num_terms == b->num_terms &&
+	       memcmp(a->terms, b->terms, sizeof(*a->terms) * a->num_terms) == 0;
+}
+
+/* sum of (0.1 (i + 1) + 0.013) x^(2i) if @shift, else of 1.7/(i + 3) x^(2i) */
+static int even_poly(struct polynomial *poly, size_t n, int shift)
+{
+	size_t i;
+
+	poly_init(poly);
+	for (i = n; i-- > 0;)
+		if (poly_push(poly, shift ? 0.1 * (i + 1) + 0.013 :
+					    1.7 / (i + 3), 2 * i) < 0)
+			return -1;
+	return 0;
+}
+
+/* methods whose product of two even polynomials isn't even with 2n - 1 terms */
+static int check_even(size_t n)
+{
+	struct polynomial a, b, prod;
+	int m, wrong = 0;
+	size_t i;
+
+	poly_init(&prod);
+	if (even_poly(&a, n, 1) < 0 || even_poly(&b, n, 0) < 0)
+		return -1;
+	for (m = POLY_MUL_AUTO; m < POLY_MUL_NTT; m++) {
+		if (poly_mul_with(&a, &b, m, &prod) < 0)
+			return -1;
+		for (i = 0; i < prod.num_terms; i++)
+			if (prod.terms[i].exp % 2)
+				break;
+		wrong += i < prod.num_terms || prod.num_terms != 2 * n - 1;
+	}
+	poly_free(&a);
+	poly_free(&b);
+	poly_free(&prod);
+	return wrong;
+}
+
+/* seconds per product, 0 if the method failed */
+static double time_mul(const struct polynomial *a, const struct polynomial *b,
+		       enum poly_mul_method method, struct polynomial *out)
+{
+	double start = now_s(), t;
+	int reps = 0;
+
+	do {
+		if (poly_mul_with(a, b, method, out) < 0)
+			return 0.0;
+		reps++;
+		t = now_s() - start;
+	} while (t < MIN_TIME);
+	return t / reps;
+}
+
+static int bench_mul(size_t max)
+{
+	struct polynomial a, b, ref, prod;
+	uint64_t state = 0x9e3779b97f4a7c15ull;
+	size_t n, kara_at = 0, ntt_at = 0;
+	int m, mismatches = 0, wrong;
+
+	printf("%8s", "size");
+	for (m = POLY_MUL_HEAP; m <= POLY_MUL_NTT; m++)
+		printf(" %12s", names[m]);
+	printf("   (ms per product)\n");
+
+	poly_init(&ref);
+	poly_init(&prod);
+	for (n = 8; n <= max; n *= 2) {
+		double t[POLY_MUL_NTT + 1] = { 0 };
+
+		if (random_poly(&a, n, &state) < 0 ||
+		    random_poly(&b, n, &state) < 0 ||
+		    poly_mul_with(&a, &b, POLY_MUL_NTT, &ref) < 0)
+			return -1;
+		printf("%8zu", n);
+		for (m = POLY_MUL_HEAP; m <= POLY_MUL_NTT; m++) {
+			if (m < POLY_MUL_KARATSUBA && n > SLOW_MAX) {
+				printf(" %12s", "-");
+				continue;
+			}
+			t[m] = time_mul(&a, &b, m, &prod);
+			mismatches += !equal(&prod, &ref);
+			printf(" %12.4f", t[m] * 1e3);
+		}
+		printf("\n");
+
+		/* first size from which on the faster method stays faster */
+		if (t[POLY_MUL_SCHOOLBOOK] > 0.0) {
+			if (t[POLY_MUL_KARATSUBA] >= t[POLY_MUL_SCHOOLBOOK])
+				kara_at = 0;
+			else if (!kara_at)
+				kara_at = n;
+		}
+		if (t[POLY_MUL_NTT] >= t[POLY_MUL_KARATSUBA])
+			ntt_at = 0;
+		else if (!ntt_at)
+			ntt_at = n;
+		poly_free(&a);
+		poly_free(&b);
+	}
+	printf("karatsuba beats schoolbook from %zu, ntt beats karatsuba "
+	       "from %zu terms\n", kara_at, ntt_at);
+	printf("mismatches against the exact product: %d\n", mismatches);
+	for (n = 40; n <= 2000; n *= 50) {
+		wrong = check_even(n);
+		if (wrong < 0)
+			return -1;
+		printf("odd terms in products of even polynomials with %zu "
+		       "fractional terms: %d methods\n", n, wrong);
+	}
+	poly_free(&ref);
+	poly_free(&prod);
+	return 0;
+}
+
+/* poly_pow() by repeated heap products, as before the fast methods */
+static int pow_heap(const struct polynomial *poly, uint64_t k,
+		    struct polynomial *out)
+{
+	struct polynomial result;
+
+	poly_init(&result);
+	if (poly_push(&result, 1.0, 0) < 0)
+		return -1;
+	while (k--)
+		if (poly_mul_with(&result, poly, POLY_MUL_HEAP, &result) < 0)
+			return -1;
+	poly_free(out);
+	*out = result;
+	return 0;
+}
+
+static int bench_pow_compose(void)
+{
+	static const uint64_t powers[] = { 64, 512, 2048 };
+	struct polynomial p, q, r, s;
+	uint64_t state = 0x2545f4914f6cdd1dull;
+	double start, t_fast, t_heap;
+	size_t i;
+
+	poly_init(&p);
+	poly_init(&r);
+	poly_init(&s);
+	if (poly_push(&p, 1.0, 3) < 0 || poly_push(&p, -1.0, 2) < 0 ||
+	    poly_push(&p, 1.0, 1) < 0 || poly_push(&p, 1.0, 0) < 0)
+		return -1;
+	for (i = 0; i < sizeof(powers) / sizeof(powers[0]); i++) {
+		start = now_s();
+		if (poly_pow(&p, powers[i], &r) < 0)
+			return -1;
+		t_fast = now_s() - start;
+		start = now_s();
+		if (pow_heap(&p, powers[i], &s) < 0)
+			return -1;
+		t_heap = now_s() - start;
+		printf("(x^3 - x^2 + x + 1)^%-5llu  %9.3f ms  heap %9.3f ms\n",
+		       (unsigned long long)powers[i], t_fast * 1e3,
+		       t_heap * 1e3);
+	}
+	poly_free(&p);
+
+	/* p(q(x)) with deg p = 2000, deg q = 8 */
+	if (random_poly(&p, 2001, &state) < 0 ||
+	    random_poly(&q, 9, &state) < 0)
+		return -1;
+	start = now_s();
+	if (poly_compose(&p, &q, &r) < 0)
+		return -1;
+	t_fast = now_s() - start;
+	printf("p(q(x)), deg p = 2000, deg q = 8: %9.3f ms, %zu terms\n",
+	       t_fast * 1e3, r.num_terms);
+
+	poly_free(&p);
+	poly_free(&q);
+	poly_free(&r);
+	poly_free(&s);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t max = argc > 1 ? strtoull(argv[1], NULL, 10) : 65536;
+
+	if (bench_mul(max) < 0 || bench_pow_compose() < 0) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	return 0;
+}
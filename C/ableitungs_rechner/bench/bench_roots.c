@@ -0,0 +1,277 @@
+/*
+ * bench_roots.c - Root finding throughput
+ *
+ * Newton and Halley from many starting points, on a polynomial with
+ * seven known real roots (lanes against a plain loop over the points
+ * one at a time) and on an expression through the VM; then all complex
+ * roots of random polynomials of growing degree with Aberth-Ehrlich.
+ * Prints roots per second, how many starting points converged, and the
+ * worst residual: the distance to the nearest known root, the relative
+ * Newton correction |f/f'| / (|x| + 1) left at the root (|f| alone means
+ * nothing for roots near x = -2838, where exp(-x/4) nearly overflows),
+ * and for Aberth the backward error |p(z)| / sum |a_i| |z|^i.
+ *
+ * Usage: bench_roots [points]
+ */
+#define _POSIX_C_SOURCE 199309L
+
+#include <complex.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "ast.h"
+#include "derive.h"
+#include "eval.h"
+#include "parser.h"
+#include "poly.h"
+#include "roots.h"
+
+#define TOL 1e-12
+
+static const double known[] = { -2.5, -1.5, -0.5, 0.25, 1.0, 2.0, 3.0 };
+#define NUM_KNOWN (sizeof(known) / sizeof(known[0]))
+
+static const char *const method_names[] = { "newton", "halley" };
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t next_random(uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+static double uniform(uint64_t *state, double lo, double hi)
+{
+	return lo + (hi - lo) * (double)(next_random(state) >> 11) * 0x1p-53;
+}
+
+/* Newton one point at a time, the loop callers used to write */
+static double newton_scalar(const struct polynomial *poly, double x)
+{
+	int iter;
+
+	for (iter = 0; iter < ROOT_MAX_ITER; iter++) {
+		double f = 0.0, d = 0.0, xn;
+		uint64_t e = poly->terms[0].exp, k;
+		size_t t = 0;
+
+		for (k = e + 1; k-- > 0;) {
+			d = d * x + f;
+			f = f * x;
+			if (t < poly->num_terms && poly->terms[t].exp == k)
+				f += poly->terms[t++].coeff;
+		}
+		if (f == 0.0)
+			return x;
+		xn = x - f / d;
+		if (!isfinite(xn))
+			return NAN;
+		if (fabs(xn - x) <= TOL * (fabs(xn) + TOL))
+			return xn;
+		x = xn;
+	}
+	return NAN;
+}
+
+static void report(const char *what, double t, size_t n, const double *roots,
+		   double worst)
+{
+	size_t i, converged = 0;
+
+	for (i = 0; i < n; i++)
+		converged += !isnan(roots[i]);
+	printf("  %-22s %8.3f s  %10.3g roots/s  %6.2f%% converged  "
+	       "worst %.2g\n", what, t, converged / t,
+	       100.0 * converged / n, worst);
+}
+
+static double worst_known(const double *roots, size_t n)
+{
+	double worst = 0.0;
+	size_t i, k;
+
+	for (i = 0; i < n; i++) {
+		double best = INFINITY;
+
+		if (isnan(roots[i]))
+			continue;
+		for (k = 0; k < NUM_KNOWN; k++)
+			best = fmin(best, fabs(roots[i] - known[k]));
+		worst = fmax(worst, best);
+	}
+	return worst;
+}
+
+static int bench_poly(const double *starts, size_t n, double *roots)
+{
+	struct polynomial poly, factor;
+	double start, t;
+	size_t i;
+	int m;
+
+	poly_init(&poly);
+	poly_init(&factor);
+	if (poly_push(&poly, 1.0, 0) < 0)
+		return -1;
+	for (i = 0; i < NUM_KNOWN; i++) {
+		factor.num_terms = 0;
+		if (poly_push(&factor, 1.0, 1) < 0 ||
+		    poly_push(&factor, -known[i], 0) < 0 ||
+		    poly_mul(&poly, &factor, &poly) < 0)
+			return -1;
+	}
+	printf("polynomial of degree %zu, %zu starting points\n",
+	       NUM_KNOWN, n);
+
+	start = now_s();
+	for (i = 0; i < n; i++)
+		roots[i] = newton_scalar(&poly, starts[i]);
+	t = now_s() - start;
+	report("newton, one by one", t, n, roots, worst_known(roots, n));
+
+	for (m = ROOT_NEWTON; m <= ROOT_HALLEY; m++) {
+		char what[32];
+
+		start = now_s();
+		poly_roots_from(&poly, m, starts, n, TOL, roots);
+		t = now_s() - start;
+		sprintf(what, "%s, %d lanes", method_names[m], ROOT_LANES);
+		report(what, t, n, roots, worst_known(roots, n));
+	}
+	poly_free(&poly);
+	poly_free(&factor);
+	return 0;
+}
+
+static int bench_expr(const double *starts, size_t n, double *roots)
+{
+	static const char input[] = "exp(-x/4)*sin(3*x) - 0.1";
+	struct expr_arena arena;
+	struct parse_error err;
+	double start, t;
+	uint32_t root, deriv;
+	int m;
+
+	if (arena_init(&arena, 0) < 0)
+		return -1;
+	root = parse_expression(&arena, input, &err);
+	if (root == NODE_NONE)
+		return -1;
+	deriv = derive(&arena, root, VAR_X);
+	if (deriv == NODE_NONE)
+		return -1;
+	printf("%s, %zu starting points\n", input, n);
+	for (m = ROOT_NEWTON; m <= ROOT_HALLEY; m++) {
+		double worst = 0.0, x;
+		size_t i;
+
+		start = now_s();
+		if (expr_roots_from(&arena, root, VAR_X, m, starts, n, TOL,
+				    roots) < 0)
+			return -1;
+		t = now_s() - start;
+		for (i = 0; i < n; i++) {
+			if (isnan(roots[i]))
+				continue;
+			x = roots[i];
+			worst = fmax(worst, fabs(ast_eval(&arena, root, &x) /
+						 ast_eval(&arena, deriv, &x)) /
+					    (fabs(x) + 1.0));
+		}
+		report(method_names[m], t, n, roots, worst);
+	}
+	arena_destroy(&arena);
+	return 0;
+}
+
+static double backward_error(const struct polynomial *poly, double re,
+			     double im)
+{
+	double complex z = re + im * I, p = 0.0;
+	double scale = 0.0, az = cabs(z);
+	size_t t;
+
+	for (t = 0; t < poly->num_terms; t++) {
+		double complex zk = cpow(z, (double)poly->terms[t].exp);
+
+		p += poly->terms[t].coeff * zk;
+		scale += fabs(poly->terms[t].coeff) *
+			 pow(az, (double)poly->terms[t].exp);
+	}
+	return cabs(p) / scale;
+}
+
+static int bench_aberth(void)
+{
+	static const size_t degrees[] = { 16, 64, 256, 1024 };
+	uint64_t state = 0x2545f4914f6cdd1dull;
+	size_t d, i;
+
+	printf("all complex roots, Aberth-Ehrlich\n");
+	for (d = 0; d < sizeof(degrees) / sizeof(degrees[0]); d++) {
+		size_t deg = degrees[d], reps = 0, found = 0;
+		double *re = malloc(sizeof(*re) * deg);
+		double *im = malloc(sizeof(*im) * deg);
+		double start, t, worst = 0.0;
+		struct polynomial poly;
+
+		if (!re || !im)
+			return -1;
+		poly_init(&poly);
+		for (i = deg + 1; i-- > 0;)
+			if (poly_push(&poly, uniform(&state, -1.0, 1.0), i) < 0)
+				return -1;
+
+		start = now_s();
+		do {
+			int r = poly_roots_all(&poly, 1e-14, re, im);
+
+			if (r < 0)
+				return -1;
+			found += (size_t)r;
+			reps++;
+			t = now_s() - start;
+		} while (t < 0.2);
+		for (i = 0; i < deg; i++)
+			worst = fmax(worst, backward_error(&poly, re[i], im[i]));
+		printf("  degree %5zu  %10.3g roots/s  worst backward error "
+		       "%.2g\n", deg, found / t, worst);
+		poly_free(&poly);
+		free(re);
+		free(im);
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	size_t n = argc > 1 ? strtoull(argv[1], NULL, 10) : 1000000, i;
+	double *starts = malloc(sizeof(*starts) * n);
+	double *roots = malloc(sizeof(*roots) * n);
+	uint64_t state = 0x9e3779b97f4a7c15ull;
+
+	if (!starts || !roots)
+		goto oom;
+	for (i = 0; i < n; i++)
+		starts[i] = uniform(&state, -4.0, 4.0);
+	if (bench_poly(starts, n, roots) < 0 ||
+	    bench_expr(starts, n, roots) < 0 || bench_aberth() < 0)
+		goto oom;
+	free(starts);
+	free(roots);
+	return 0;
+oom:
+	fprintf(stderr, "out of memory\n");
+	return 1;
+}
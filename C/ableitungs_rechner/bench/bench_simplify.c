@@ -0,0 +1,184 @@
+/*
+ * bench_simplify.c - Rewrite-rule simplification of derivatives
+ *
+ * Differentiates the expressions from bench_derive repeatedly and
+ * simplifies every order, printing the distinct nodes before and after,
+ * the time taken and the length of the printed result. Then per rule how
+ * often its shape matched, how often it rewrote and the time it took.
+ * Last, expressions that are simplified already, deep and wide and of
+ * growing size, to show the cost per node stays flat.
+ *
+ * Usage: bench_simplify [order]
+ */
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ast.h"
+#include "derive.h"
+#include "parser.h"
+#include "printer.h"
+#include "simplify.h"
+
+static const char *const exprs[] = {
+	"sin(cos(x)*exp(x))*ln(1 + x^2)",
+	"exp(sin(x^2))/(1 + x^2)",
+	"x^x*sqrt(1 + tan(x))",
+	"sin(x)*cos(x)*exp(x)*ln(x)*tan(x)",
+	"sin(x)/cos(x)*exp(-x)",
+	"(2*x + 1)^3/(x*(2*x + 1))",
+};
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t printed(const struct expr_arena *arena, uint32_t root)
+{
+	char *text = ast_to_string_shared(arena, root, "f");
+	size_t len = text ? strlen(text) : 0;
+
+	free(text);
+	return len;
+}
+
+static int run(const char *expr, int order, struct simplify_stats *total)
+{
+	struct expr_arena arena;
+	struct parse_error err;
+	uint32_t node, simple;
+	int k, i;
+
+	if (arena_init(&arena, 0) < 0)
+		return -1;
+	node = parse_expression(&arena, expr, &err);
+	if (node == NODE_NONE)
+		return -1;
+	printf("f(x) = %s\n", expr);
+	printf("order  nodes before  after   time (ms)  printed before  after\n");
+	for (k = 1; k <= order; k++) {
+		struct simplify_stats stats = { 0 };
+		double start;
+
+		node = derive(&arena, node, VAR_X);
+		start = now_s();
+		simple = simplify(&arena, node, &stats);
+		if (simple == NODE_NONE)
+			return -1;
+		printf("%5d %13u %6u %11.3f %15zu %6zu\n", k,
+		       stats.nodes_before, stats.nodes_after,
+		       (now_s() - start) * 1e3, printed(&arena, node),
+		       printed(&arena, simple));
+		for (i = 0; i < NUM_RULES; i++) {
+			total->tries[i] += stats.tries[i];
+			total->hits[i] += stats.hits[i];
+			total->seconds[i] += stats.seconds[i];
+		}
+		total->nodes_before += stats.nodes_before;
+		total->nodes_after += stats.nodes_after;
+	}
+	printf("\n");
+	arena_destroy(&arena);
+	return 0;
+}
+
+static void report_rules(const struct simplify_stats *total)
+{
+	int i;
+
+	printf("%-30s %10s %8s %10s\n", "rule", "tries", "hits", "time (ms)");
+	for (i = 0; i < NUM_RULES; i++)
+		printf("%-30s %10llu %8llu %10.3f\n", simplify_rule_name(i),
+		       (unsigned long long)total->tries[i],
+		       (unsigned long long)total->hits[i],
+		       total->seconds[i] * 1e3);
+	printf("all orders: %u nodes before, %u after (%.1f%% fewer)\n\n",
+	       total->nodes_before, total->nodes_after,
+	       100.0 - 100.0 * total->nodes_after / total->nodes_before);
+}
+
+/*
+ * sin(... sin(sin(x + 1) + 2) ... + n), deep, or the sum of
+ * i*exp(i*x) for i = 1 .. n, wide; nothing in either can be rewritten
+ */
+static uint32_t build_simple(struct expr_arena *arena, uint32_t n, int wide)
+{
+	uint32_t x = ast_var(arena, VAR_X), acc = wide ? NODE_NONE : x, i;
+
+	for (i = 1; i <= n; i++) {
+		uint32_t c = ast_const(arena, (double)i);
+
+		if (!wide) {
+			acc = ast_func(arena, FUNC_SIN,
+				       ast_binary(arena, NODE_ADD, acc, c));
+			continue;
+		}
+		c = ast_binary(arena, NODE_MUL, c,
+			       ast_func(arena, FUNC_EXP,
+					ast_binary(arena, NODE_MUL, c, x)));
+		acc = acc == NODE_NONE ? c : ast_binary(arena, NODE_ADD, acc, c);
+	}
+	return acc;
+}
+
+static int bench_simple(void)
+{
+	uint32_t n;
+	int wide;
+
+	printf("already simplified   size       nodes  ns per node  unchanged\n");
+	for (wide = 0; wide <= 1; wide++) {
+		for (n = 1000; n <= 1000000; n *= 10) {
+			struct expr_arena arena;
+			struct simplify_stats stats = { 0 };
+			uint32_t root, simple;
+			double start, t;
+
+			if (arena_init(&arena, 0) < 0)
+				return -1;
+			root = build_simple(&arena, n, wide);
+			if (root == NODE_NONE)
+				return -1;
+			start = now_s();
+			simple = simplify(&arena, root, NULL);
+			t = now_s() - start;
+			if (simple == NODE_NONE)
+				return -1;
+			simplify(&arena, root, &stats);
+			printf("%-15s %9u %11u %12.1f  %s\n",
+			       wide ? "wide sum" : "deep chain", n,
+			       stats.nodes_before, t * 1e9 / stats.nodes_before,
+			       simple == root ? "yes" : "no");
+			arena_destroy(&arena);
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct simplify_stats total = { 0 };
+	int order = argc > 1 ? atoi(argv[1]) : 6;
+	size_t i;
+
+	for (i = 0; i < sizeof(exprs) / sizeof(exprs[0]); i++) {
+		if (run(exprs[i], order, &total) < 0) {
+			fprintf(stderr, "%s: parse error or out of memory\n",
+				exprs[i]);
+			return 1;
+		}
+	}
+	report_rules(&total);
+	if (bench_simple() < 0) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,174 @@
+/*
+ * bench_tape.c - Gradients of a scalar function of many variables
+ *
+ * Builds the extended Rosenbrock function with a coupling term,
+ *
+ *	f = sum 100*(v(i+1) - v(i)^2)^2 + (1 - v(i))^2 + sin(v(i)*v(i+1))
+ *
+ * in n variables, records it onto a tape and times one evaluation
+ * against one gradient, with every value kept and with checkpointing.
+ * The memory of the value slots is printed for both. Sample partials
+ * are checked against the symbolic gradient, and the checkpointed
+ * gradient against the plain one.
+ *
+ * Usage: bench_tape [n ...]
+ */
+#define _POSIX_C_SOURCE 199309L
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ast.h"
+#include "eval.h"
+#include "gradient.h"
+#include "tape.h"
+
+#define CHECKPOINT 4096
+#define SAMPLE_VARS 64
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint32_t num(struct expr_arena *arena, double v)
+{
+	return ast_const(arena, v);
+}
+
+static uint32_t build(struct expr_arena *arena, uint32_t n)
+{
+	uint32_t sum = num(arena, 0.0), i;
+
+	for (i = 0; i + 1 < n; i++) {
+		uint32_t v = ast_var(arena, i), w = ast_var(arena, i + 1);
+		uint32_t t1, t2, t3;
+
+		t1 = ast_binary(arena, NODE_SUB, w,
+				ast_binary(arena, NODE_POW, v, num(arena, 2)));
+		t1 = ast_binary(arena, NODE_MUL, num(arena, 100),
+				ast_binary(arena, NODE_POW, t1, num(arena, 2)));
+		t2 = ast_binary(arena, NODE_SUB, num(arena, 1), v);
+		t2 = ast_binary(arena, NODE_POW, t2, num(arena, 2));
+		t3 = ast_func(arena, FUNC_SIN, ast_binary(arena, NODE_MUL, v, w));
+		sum = ast_binary(arena, NODE_ADD, sum,
+				 ast_binary(arena, NODE_ADD, t1,
+					    ast_binary(arena, NODE_ADD, t2,
+						       t3)));
+	}
+	return sum;
+}
+
+/* mean seconds per call of one mode over @reps calls */
+static double time_gradient(struct tape *tape, const double *vars,
+			    double *grad, int reps)
+{
+	double start = now_s();
+	int r;
+
+	for (r = 0; r < reps; r++)
+		tape_gradient(tape, vars, grad);
+	return (now_s() - start) / reps;
+}
+
+static int bench(uint32_t n)
+{
+	struct expr_arena arena;
+	struct tape plain, ckpt;
+	uint32_t root, *ids = malloc(sizeof(*ids) * n);
+	uint32_t *partials = malloc(sizeof(*partials) * n);
+	double *vars = malloc(sizeof(*vars) * n);
+	double *g1 = malloc(sizeof(*g1) * n), *g2 = malloc(sizeof(*g2) * n);
+	double start, t_rec, t_eval, t_plain, t_ckpt, max_err = 0.0;
+	size_t mismatches = 0;
+	uint32_t i;
+	int reps, r;
+
+	if (!ids || !partials || !vars || !g1 || !g2 ||
+	    arena_init(&arena, 0) < 0)
+		return -1;
+	for (i = 0; i < n; i++) {
+		ids[i] = i;
+		vars[i] = 0.5 + 0.001 * (double)(i % 1000);
+	}
+	root = build(&arena, n);
+
+	tape_init(&plain);
+	tape_init(&ckpt);
+	start = now_s();
+	if (tape_record(&plain, &arena, root, 0) < 0)
+		return -1;
+	t_rec = now_s() - start;
+	if (tape_record(&ckpt, &arena, root, CHECKPOINT) < 0)
+		return -1;
+
+	reps = (int)(2e7 / plain.num_insns) + 1;
+	start = now_s();
+	for (r = 0; r < reps; r++)
+		tape_eval(&plain, vars);
+	t_eval = (now_s() - start) / reps;
+	t_plain = time_gradient(&plain, vars, g1, reps);
+	t_ckpt = time_gradient(&ckpt, vars, g2, reps);
+
+	for (i = 0; i < n; i++)
+		mismatches += memcmp(&g1[i], &g2[i], sizeof(double)) != 0;
+
+	if (gradient(&arena, root, ids, n, partials) < 0)
+		return -1;
+	for (i = 0; i < SAMPLE_VARS; i++) {
+		uint32_t v = (uint32_t)((uint64_t)i * n / SAMPLE_VARS);
+		double want = ast_eval(&arena, partials[v], vars);
+		double err = fabs(g1[v] - want) / fmax(fabs(want), 1.0);
+
+		if (err > max_err)
+			max_err = err;
+	}
+
+	printf("%u variables, %u instructions\n", n, plain.num_insns);
+	printf("  record:                 %9.3f ms\n", t_rec * 1e3);
+	printf("  evaluate:               %9.3f ms\n", t_eval * 1e3);
+	printf("  gradient:               %9.3f ms  %5.2fx evaluate  "
+	       "%8.1f KiB of values\n", t_plain * 1e3, t_plain / t_eval,
+	       plain.num_slots * 2 * sizeof(double) / 1024.0);
+	printf("  gradient, checkpointed: %9.3f ms  %5.2fx evaluate  "
+	       "%8.1f KiB of values\n", t_ckpt * 1e3, t_ckpt / t_eval,
+	       ckpt.num_slots * 2 * sizeof(double) / 1024.0);
+	printf("  checkpointed mismatches: %zu, max relative error against "
+	       "symbolic: %.3g\n", mismatches, max_err);
+
+	tape_free(&plain);
+	tape_free(&ckpt);
+	arena_destroy(&arena);
+	free(ids);
+	free(partials);
+	free(vars);
+	free(g1);
+	free(g2);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	static const uint32_t defaults[] = { 1000, 100000, 1000000 };
+	int i;
+
+	if (argc > 1) {
+		for (i = 1; i < argc; i++)
+			if (bench((uint32_t)strtoul(argv[i], NULL, 10)) < 0)
+				goto oom;
+		return 0;
+	}
+	for (i = 0; i < (int)(sizeof(defaults) / sizeof(defaults[0])); i++)
+		if (bench(defaults[i]) < 0)
+			goto oom;
+	return 0;
+oom:
+	fprintf(stderr, "out of memory\n");
+	return 1;
+}
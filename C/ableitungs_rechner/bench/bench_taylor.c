@@ -0,0 +1,160 @@
+/*
+ * bench_taylor.c - Cost of high-order derivatives
+ *
+ * Polynomials: times the first and the k-th derivative with
+ * poly_derive_n() against k calls of poly_derive(), whose coefficients it
+ * must match bit for bit.
+ *
+ * Expressions: times k symbolic derivatives with derive_n() and the first
+ * k+1 Taylor coefficients with ast_taylor(), and checks that k! times
+ * each coefficient agrees with the symbolic derivative evaluated at the
+ * expansion point.
+ *
+ * Usage: bench_taylor [order] [expression]
+ */
+#define _POSIX_C_SOURCE 199309L
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ast.h"
+#include "derive.h"
+#include "eval.h"
+#include "parser.h"
+#include "poly.h"
+#include "taylor.h"
+
+#define POLY_TERMS 1000000
+#define CHECK_ORDERS 8		/* symbolic derivatives compared */
+#define REPEAT 1000		/* ast_taylor() calls timed */
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench_poly(unsigned int order)
+{
+	struct polynomial poly, once, direct, repeated;
+	double start, t_once, t_direct, t_repeated;
+	size_t i, mismatches = 0;
+	unsigned int k;
+
+	poly_init(&poly);
+	poly_init(&once);
+	poly_init(&direct);
+	poly_init(&repeated);
+	for (i = 0; i < POLY_TERMS; i++)
+		if (poly_push(&poly, 1.0 + (double)(i % 7) / 8,
+			      POLY_TERMS - i) < 0)
+			return -1;
+	poly_normalize(&poly);
+
+	start = now_s();
+	if (poly_derive(&poly, &once) < 0)
+		return -1;
+	t_once = now_s() - start;
+
+	start = now_s();
+	if (poly_derive_n(&poly, order, &direct) < 0)
+		return -1;
+	t_direct = now_s() - start;
+
+	start = now_s();
+	if (poly_derive(&poly, &repeated) < 0)
+		return -1;
+	for (k = 1; k < order; k++)
+		if (poly_derive(&repeated, &repeated) < 0)
+			return -1;
+	t_repeated = now_s() - start;
+
+	mismatches = direct.num_terms != repeated.num_terms;
+	for (i = 0; !mismatches && i < direct.num_terms; i++)
+		mismatches += direct.terms[i].exp != repeated.terms[i].exp ||
+			      memcmp(&direct.terms[i].coeff,
+				     &repeated.terms[i].coeff,
+				     sizeof(double)) != 0;
+
+	printf("polynomial, %d terms\n", POLY_TERMS);
+	printf("  poly_derive:             %8.2f ms\n", t_once * 1e3);
+	printf("  poly_derive_n(%u):       %8.2f ms\n", order, t_direct * 1e3);
+	printf("  %u x poly_derive:        %8.2f ms\n", order, t_repeated * 1e3);
+	printf("  mismatches: %zu\n", mismatches);
+
+	poly_free(&poly);
+	poly_free(&once);
+	poly_free(&direct);
+	poly_free(&repeated);
+	return 0;
+}
+
+static int bench_expr(const char *input, unsigned int order)
+{
+	struct expr_arena arena;
+	struct parse_error err;
+	double vars[1] = { 0.5 };
+	double *coeffs = malloc(sizeof(*coeffs) * (order + 1));
+	double start, t_symbolic, t_taylor, factorial = 1.0, max_err = 0.0;
+	uint32_t root, deriv;
+	unsigned int k, checked = order < CHECK_ORDERS ? order : CHECK_ORDERS;
+	int i;
+
+	if (!coeffs || arena_init(&arena, 0) < 0)
+		return -1;
+	root = parse_expression(&arena, input, &err);
+	if (root == NODE_NONE) {
+		fprintf(stderr, "%s at position %zu\n", err.msg, err.offset + 1);
+		return -1;
+	}
+
+	start = now_s();
+	for (i = 0; i < REPEAT; i++)
+		if (ast_taylor(&arena, root, VAR_X, vars, order + 1, coeffs) < 0)
+			return -1;
+	t_taylor = (now_s() - start) / REPEAT;
+
+	start = now_s();
+	deriv = derive_n(&arena, root, VAR_X, checked);
+	t_symbolic = now_s() - start;
+	if (deriv == NODE_NONE)
+		return -1;
+
+	for (k = 0; k <= checked; k++) {
+		double d = ast_eval(&arena, derive_n(&arena, root, VAR_X, k),
+				    vars);
+		double e = fabs(coeffs[k] * factorial - d) / fmax(fabs(d), 1.0);
+
+		max_err = fmax(max_err, e);
+		factorial *= k + 1;
+	}
+
+	printf("%s at x = %g\n", input, vars[0]);
+	printf("  derive_n(%u):            %8.3f ms, %u nodes in the arena\n",
+	       checked, t_symbolic * 1e3, arena.num_nodes);
+	printf("  ast_taylor, %u coeffs:   %8.3f ms\n", order + 1,
+	       t_taylor * 1e3);
+	printf("  max relative difference up to order %u: %.3g\n", checked,
+	       max_err);
+
+	arena_destroy(&arena);
+	free(coeffs);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int order = argc > 1 ? (unsigned int)atoi(argv[1]) : 50;
+	const char *expr = argc > 2 ? argv[2] : "sin(x)*exp(x)/(1 + x^2)";
+
+	if (bench_poly(order) < 0 || bench_expr(expr, order) < 0) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,135 @@
+/*
+ * bench_vm.c - Throughput of the bytecode VM against walking the tree
+ *
+ * Evaluates f and f' (compiled into one program, so they share their
+ * common subexpressions) over an array of points, once with the batched
+ * VM and once by calling the recursive evaluator per point, and reports
+ * points per second for both along with the largest relative difference.
+ *
+ * Usage: bench_vm [points] [expression]
+ */
+#define _POSIX_C_SOURCE 199309L
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "ast.h"
+#include "derive.h"
+#include "eval.h"
+#include "parser.h"
+#include "vm.h"
+
+static const char *const default_exprs[] = {
+	"3*x^4 - 2*x^3 + x - 7",
+	"sin(cos(x)*exp(x))*ln(1 + x^2)",
+	"exp(sin(x^2))/(1 + x^2)",
+	"x^x*sqrt(1 + tan(x))",
+};
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double rel_diff(double a, double b)
+{
+	double scale = fabs(a) > 1.0 ? fabs(a) : 1.0;
+
+	if (isnan(a) && isnan(b))
+		return 0.0;
+	return fabs(a - b) / scale;
+}
+
+static void run(const char *expr, size_t n)
+{
+	struct expr_arena arena;
+	struct parse_error err;
+	struct vm_program prog;
+	uint32_t roots[2];
+	double *x, *out[2], *ref[2];
+	const double *inputs[1];
+	double start, t_vm, t_tree, max_diff = 0.0;
+	size_t i;
+	int j;
+
+	arena_init(&arena, 0);
+	roots[0] = parse_expression(&arena, expr, &err);
+	if (roots[0] == NODE_NONE) {
+		fprintf(stderr, "%s: %s at position %zu\n", expr, err.msg,
+			err.offset + 1);
+		exit(1);
+	}
+	roots[1] = derive(&arena, roots[0], VAR_X);
+	if (roots[1] == NODE_NONE || vm_compile(&arena, roots, 2, &prog) < 0) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	x = malloc(sizeof(*x) * n);
+	for (j = 0; j < 2; j++) {
+		out[j] = malloc(sizeof(**out) * n);
+		ref[j] = malloc(sizeof(**ref) * n);
+	}
+	if (!x || !out[0] || !out[1] || !ref[0] || !ref[1]) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	for (i = 0; i < n; i++)
+		x[i] = 0.1 + 2.0 * i / n;
+	inputs[VAR_X] = x;
+
+	start = now_s();
+	vm_eval(&prog, inputs, n, out);
+	t_vm = now_s() - start;
+
+	start = now_s();
+	for (i = 0; i < n; i++) {
+		ref[0][i] = ast_eval(&arena, roots[0], &x[i]);
+		ref[1][i] = ast_eval(&arena, roots[1], &x[i]);
+	}
+	t_tree = now_s() - start;
+
+	for (j = 0; j < 2; j++) {
+		for (i = 0; i < n; i++) {
+			double d = rel_diff(out[j][i], ref[j][i]);
+
+			if (d > max_diff)
+				max_diff = d;
+		}
+	}
+
+	printf("f(x) = %s\n", expr);
+	printf("  %u instructions, %u registers, %u constants\n",
+	       prog.num_insns, prog.num_regs, prog.num_consts);
+	printf("  tree walk: %8.3f s  %10.3g points/s\n", t_tree, n / t_tree);
+	printf("  vm:        %8.3f s  %10.3g points/s  (%.1fx)\n", t_vm,
+	       n / t_vm, t_tree / t_vm);
+	printf("  max relative difference: %.3g\n\n", max_diff);
+
+	for (j = 0; j < 2; j++) {
+		free(out[j]);
+		free(ref[j]);
+	}
+	free(x);
+	vm_free(&prog);
+	arena_destroy(&arena);
+}
+
+int main(int argc, char *argv[])
+{
+	size_t n = argc > 1 ? strtoull(argv[1], NULL, 10) : 10000000;
+	size_t i;
+
+	if (argc > 2) {
+		run(argv[2], n);
+		return 0;
+	}
+	for (i = 0; i < sizeof(default_exprs) / sizeof(*default_exprs); i++)
+		run(default_exprs[i], n);
+	return 0;
+}
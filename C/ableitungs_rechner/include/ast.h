@@ -0,0 +1,109 @@
+#ifndef AST_H
+#define AST_H
+
+#include <stdint.h>
+
+/*
+ * Expression trees live in a per-expression arena. Nodes are 12 bytes and
+ * refer to their children by 32-bit index, constants go to a separate pool.
+ * A node's children always have smaller indices than the node itself, so a
+ * plain loop over the indices visits every child before its parents.
+ *
+ * Nodes are hash-consed: creating a node that already exists returns the
+ * existing one, so an expression is a DAG in which structurally equal
+ * subexpressions are the same node and can be compared by index. The arena
+ * also keeps a memo table from (node, tag) to node for passes like derive.
+ * Variables are ids; an arena may point to a symbol table naming them.
+ */
+
+struct symtab;
+
+#define NODE_NONE UINT32_MAX	/* invalid node (parse error, out of memory) */
+#define VAR_X 0			/* x, the variable without a symbol table */
+
+enum node_type {
+	NODE_CONST,	/* lhs: constant pool index */
+	NODE_VAR,	/* lhs: variable id */
+	NODE_ADD,
+	NODE_SUB,
+	NODE_MUL,
+	NODE_DIV,
+	NODE_POW,
+	NODE_NEG,	/* lhs: operand */
+	NODE_FUNC,	/* op: enum func_id, lhs: argument */
+};
+
+enum func_id {
+	FUNC_SIN,
+	FUNC_COS,
+	FUNC_TAN,
+	FUNC_EXP,
+	FUNC_LN,
+	FUNC_SQRT,
+	NUM_FUNCS,
+};
+
+struct node {
+	uint8_t type;		/* enum node_type */
+	uint8_t op;		/* enum func_id for NODE_FUNC */
+	uint16_t pad;
+	uint32_t lhs;		/* child, constant index or variable id */
+	uint32_t rhs;		/* right child of binary operators */
+};
+
+struct expr_arena {
+	struct node *nodes;
+	uint32_t num_nodes;
+	uint32_t cap_nodes;
+	double *consts;
+	uint32_t num_consts;
+	uint32_t cap_consts;
+	uint32_t *slots;	/* hash-consing table, NODE_NONE if empty */
+	uint32_t slot_mask;
+	uint64_t *memo_keys;	/* node << 32 | tag, UINT64_MAX if empty */
+	uint32_t *memo_vals;
+	uint32_t memo_mask;
+	uint32_t memo_count;
+	struct symtab *symbols;	/* variable names, NULL if x is the only one */
+};
+
+int arena_init(struct expr_arena *arena, uint32_t node_hint);
+void arena_reset(struct expr_arena *arena);
+void arena_destroy(struct expr_arena *arena);
+
+uint32_t ast_const(struct expr_arena *arena, double value);
+uint32_t ast_var(struct expr_arena *arena, uint32_t var);
+uint32_t ast_binary(struct expr_arena *arena, enum node_type type,
+		    uint32_t lhs, uint32_t rhs);
+uint32_t ast_neg(struct expr_arena *arena, uint32_t child);
+uint32_t ast_func(struct expr_arena *arena, enum func_id func, uint32_t arg);
+
+uint32_t ast_memo_get(const struct expr_arena *arena, uint32_t node,
+		      uint32_t tag);
+int ast_memo_put(struct expr_arena *arena, uint32_t node, uint32_t tag,
+		 uint32_t value);
+
+const char *ast_func_name(enum func_id func);
+int ast_func_lookup(const char *name, int len);
+
+static inline const struct node *ast_node(const struct expr_arena *arena,
+					  uint32_t id)
+{
+	return &arena->nodes[id];
+}
+
+/**
+ * ast_is_const - Check whether a node is a given constant
+ * @arena: Arena holding the node
+ * @id: Node to check
+ * @value: Constant to compare with
+ */
+static inline int ast_is_const(const struct expr_arena *arena, uint32_t id,
+			       double value)
+{
+	const struct node *n = &arena->nodes[id];
+
+	return n->type == NODE_CONST && arena->consts[n->lhs] == value;
+}
+
+#endif /* AST_H */
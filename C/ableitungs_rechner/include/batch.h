@@ -0,0 +1,6 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+int batch_run(const char *path, int num_threads, const char *cache_path);
+
+#endif /* BATCH_H */
@@ -0,0 +1,59 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "format.h"
+
+/*
+ * Persistent derivative cache: one file of fixed size, mapped shared,
+ * holding a header, an open-addressing index of (hash, offset) slots and
+ * an append-only data area of records. Keys are 128-bit hashes of the
+ * normalised input, values the printed derivative.
+ *
+ * Lookups take no lock. A writer appends the record first and publishes
+ * it by storing the slot's offset last, so any process that sees the
+ * offset sees the whole record. Writers serialise with flock() between
+ * processes and a mutex between threads. A full cache is replaced by an
+ * empty one through rename(), so the file never outgrows its size and
+ * processes that still have the old file mapped keep a consistent view
+ * until they move on. A process unmaps and closes a replaced file as
+ * soon as the lookups running in it are done, so the old inode is freed
+ * on disk and descriptors don't pile up however often the file turns
+ * over.
+ */
+
+#define CACHE_DEFAULT_BYTES (64u << 20)
+#define CACHE_MIN_BYTES (1u << 20)
+
+struct cache_key {
+	uint64_t hash[2];
+};
+
+struct cache_map;
+
+struct deriv_cache {
+	char *path;
+	struct cache_map *map;		/* current file */
+	unsigned int epoch;		/* which readers[] lookups count in */
+	unsigned long readers[2];	/* lookups running, per epoch */
+	uint64_t max_bytes;	/* size of a new file */
+	int read_only;
+	pthread_mutex_t lock;
+};
+
+void cache_hash(const void *data, size_t len, uint64_t seed,
+		struct cache_key *key);
+size_t cache_normalize(char *dst, const char *src, size_t len);
+
+int cache_open(struct deriv_cache *cache, const char *path,
+	       uint64_t max_bytes);
+void cache_close(struct deriv_cache *cache);
+int cache_get(struct deriv_cache *cache, const struct cache_key *key,
+	      struct fmt_buf *out);
+int cache_put(struct deriv_cache *cache, const struct cache_key *key,
+	      const char *value, size_t len);
+
+#endif /* CACHE_H */
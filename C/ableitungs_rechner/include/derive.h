@@ -0,0 +1,12 @@
+#ifndef DERIVE_H
+#define DERIVE_H
+
+#include <stdint.h>
+
+#include "ast.h"
+
+uint32_t derive(struct expr_arena *arena, uint32_t root, uint32_t var);
+uint32_t derive_n(struct expr_arena *arena, uint32_t root, uint32_t var,
+		  unsigned int k);
+
+#endif /* DERIVE_H */
@@ -0,0 +1,24 @@
+#ifndef DUAL_H
+#define DUAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vm.h"
+
+/*
+ * Forward-mode automatic differentiation on compiled programs. Each
+ * register carries a value and its derivatives along up to
+ * DUAL_MAX_DIRS directions (multi-component dual numbers), for a batch of
+ * points at a time, so one run gives exact derivative values without
+ * building a derivative expression.
+ */
+
+#define DUAL_BATCH 256		/* points per register */
+#define DUAL_MAX_DIRS 16
+
+int dual_eval(const struct vm_program *prog, const double *const *inputs,
+	      const double *seeds, uint32_t num_dirs, size_t n,
+	      double *const *values, double *const *derivs);
+
+#endif /* DUAL_H */
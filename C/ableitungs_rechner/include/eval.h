@@ -0,0 +1,11 @@
+#ifndef EVAL_H
+#define EVAL_H
+
+#include <stdint.h>
+
+#include "ast.h"
+
+double ast_eval(const struct expr_arena *arena, uint32_t root,
+		const double *vars);
+
+#endif /* EVAL_H */
@@ -0,0 +1,46 @@
+#ifndef FORMAT_H
+#define FORMAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Text output buffers. A zeroed buffer grows on the heap as needed; one
+ * set up with fmt_init() may instead use a caller's array, and with a
+ * stream it is written out whenever it fills up, so long output leaves in
+ * large chunks instead of one stdio call per piece. One byte is always
+ * kept free for fmt_finish()'s terminating NUL.
+ */
+struct fmt_buf {
+	char *buf;
+	size_t len;
+	size_t cap;
+	FILE *stream;		/* flushed to when full, NULL to keep */
+	int fixed;		/* buf belongs to the caller, never grown */
+	int failed;		/* out of memory, room or a write failed */
+};
+
+#define FMT_NUM_MAX 32		/* longest output of format_double() */
+
+void fmt_init(struct fmt_buf *fb, char *buf, size_t cap, FILE *stream);
+char *fmt_make_space(struct fmt_buf *fb, size_t n);
+void fmt_put(struct fmt_buf *fb, const char *s, size_t n);
+void fmt_double(struct fmt_buf *fb, double v);
+void fmt_u64(struct fmt_buf *fb, uint64_t v);
+int fmt_flush(struct fmt_buf *fb);
+char *fmt_finish(struct fmt_buf *fb);
+void fmt_release(struct fmt_buf *fb);
+
+int format_double(char *buf, double v);
+int format_u64(char *buf, uint64_t v);
+
+/* room for @n more bytes at the end of the buffer, NULL if there is none */
+static inline char *fmt_space(struct fmt_buf *fb, size_t n)
+{
+	if (fb->len + n < fb->cap)
+		return fb->buf + fb->len;
+	return fmt_make_space(fb, n);
+}
+
+#endif /* FORMAT_H */
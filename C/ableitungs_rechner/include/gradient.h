@@ -0,0 +1,30 @@
+#ifndef GRADIENT_H
+#define GRADIENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ast.h"
+
+/*
+ * Sparse Jacobian in compressed rows: the entries of row i are
+ * col[row_start[i]] .. col[row_start[i + 1] - 1], sorted by variable id,
+ * with the derivative expressions in entry[] at the same positions. Only
+ * variables a row depends on get an entry.
+ */
+struct jacobian {
+	size_t rows;
+	size_t *row_start;	/* rows + 1 offsets */
+	uint32_t *col;		/* variable id */
+	uint32_t *entry;	/* derivative node */
+	size_t nnz;
+	size_t cap;
+};
+
+int gradient(struct expr_arena *arena, uint32_t root, const uint32_t *vars,
+	     size_t num_vars, uint32_t *partials);
+int jacobian_build(struct expr_arena *arena, const uint32_t *roots,
+		   size_t num_roots, struct jacobian *jac);
+void jacobian_free(struct jacobian *jac);
+
+#endif /* GRADIENT_H */
@@ -0,0 +1,33 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stddef.h>
+
+#include "vm.h"
+
+/*
+ * Native x86-64 code for a compiled program. The generated function runs
+ * the straight-line instructions on 4 points at a time with AVX (2 with
+ * SSE2), keeping the first registers of the program in ymm/xmm registers.
+ * Where machine code can't be used (other architectures, no executable
+ * mappings, ABLEITER_NO_JIT set) the program is interpreted instead.
+ */
+
+typedef void (*jit_fn)(const double *const *inputs, double *const *outputs,
+		       size_t bytes, double *scratch, const double *consts);
+
+struct jit_program {
+	const struct vm_program *prog;
+	jit_fn fn;		/* NULL if the program is interpreted */
+	void *code;		/* executable mapping holding fn */
+	size_t code_size;
+	double *consts;		/* one vector per constant, plus 1.0 and -0.0 */
+	int lanes;		/* points per iteration of fn */
+};
+
+int jit_compile(const struct vm_program *prog, struct jit_program *jit);
+void jit_free(struct jit_program *jit);
+int jit_eval(const struct jit_program *jit, const double *const *inputs,
+	     size_t n, double *const *outputs);
+
+#endif /* JIT_H */
@@ -0,0 +1,40 @@
+#ifndef LEXER_H
+#define LEXER_H
+
+#include <stddef.h>
+
+enum token_type {
+	TOK_NUM,
+	TOK_IDENT,
+	TOK_PLUS,
+	TOK_MINUS,
+	TOK_MUL,
+	TOK_DIV,
+	TOK_POW,
+	TOK_LPAREN,
+	TOK_RPAREN,
+	TOK_END,
+	TOK_ERROR,
+};
+
+/*
+ * Tokens point into the input string; nothing is copied. The lexeme of
+ * TOK_IDENT is start[0..len), TOK_NUM also carries its value.
+ */
+struct token {
+	enum token_type type;
+	const char *start;
+	int len;
+	double value;
+};
+
+struct lexer {
+	const char *input;
+	const char *pos;
+	const char *end;
+};
+
+void lexer_init(struct lexer *lx, const char *input);
+int lexer_next(struct lexer *lx, struct token *tok);
+
+#endif /* LEXER_H */
@@ -0,0 +1,23 @@
+#ifndef NUMBER_H
+#define NUMBER_H
+
+#include <stdint.h>
+
+/* bits of char_class[] */
+enum {
+	CC_DIGIT = 1,		/* 0-9 */
+	CC_ALPHA = 2,		/* letters and '_' */
+	CC_BLANK = 4,		/* ' ', '\t', '\r' */
+	CC_POLY = 8,		/* may appear in a plain polynomial */
+};
+
+extern const uint8_t char_class[256];
+
+static inline int cc_is(char c, int bits)
+{
+	return char_class[(unsigned char)c] & bits;
+}
+
+const char *parse_number(const char *p, const char *end, double *value);
+
+#endif /* NUMBER_H */
@@ -0,0 +1,19 @@
+#ifndef PARSER_H
+#define PARSER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ast.h"
+
+#define MAX_DEPTH 10000		/* nesting limit for parentheses and ^ */
+
+struct parse_error {
+	const char *msg;
+	size_t offset;		/* byte offset of the error in the input */
+};
+
+uint32_t parse_expression(struct expr_arena *arena, const char *input,
+			  struct parse_error *err);
+
+#endif /* PARSER_H */
@@ -0,0 +1,65 @@
+#ifndef POLY_H
+#define POLY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "format.h"
+
+/*
+ * Sparse polynomials in x. Only non-zero terms are stored, sorted by
+ * descending exponent with like terms combined, so sums, products and
+ * derivatives are merges over the term arrays. poly_push() appends
+ * without keeping that order; poly_normalize() restores it.
+ */
+
+struct term {
+	double coeff;	/* Coefficient */
+	uint64_t exp;	/* Exponent */
+};
+
+struct polynomial {
+	struct term *terms;
+	size_t num_terms;
+	size_t cap_terms;
+};
+
+void poly_init(struct polynomial *poly);
+void poly_free(struct polynomial *poly);
+int poly_push(struct polynomial *poly, double coeff, uint64_t exp);
+void poly_normalize(struct polynomial *poly);
+
+int poly_matches(const char *input, size_t len);
+int poly_parse(struct polynomial *poly, const char *input, size_t len,
+	       size_t *err_offset);
+int poly_format(struct fmt_buf *out, const struct polynomial *poly);
+char *poly_to_string(const struct polynomial *poly);
+
+enum poly_mul_method {
+	POLY_MUL_AUTO,		/* by shape and size */
+	POLY_MUL_HEAP,		/* sparse, merges the term streams */
+	POLY_MUL_SCHOOLBOOK,	/* dense, every coefficient pair */
+	POLY_MUL_KARATSUBA,	/* dense, schoolbook for small pieces */
+	POLY_MUL_NTT,		/* dense and exact, integer coefficients only */
+};
+
+int poly_add(const struct polynomial *a, const struct polynomial *b,
+	     struct polynomial *out);
+int poly_mul(const struct polynomial *a, const struct polynomial *b,
+	     struct polynomial *out);
+int poly_mul_with(const struct polynomial *a, const struct polynomial *b,
+		  enum poly_mul_method method, struct polynomial *out);
+int poly_pow(const struct polynomial *poly, uint64_t k, struct polynomial *out);
+int poly_compose(const struct polynomial *p, const struct polynomial *q,
+		 struct polynomial *out);
+int poly_derive(const struct polynomial *poly, struct polynomial *out);
+int poly_derive_n(const struct polynomial *poly, uint64_t k,
+		  struct polynomial *out);
+void poly_taylor(const struct polynomial *poly, double a, size_t n,
+		 double *coeffs);
+
+int poly_uses_avx2(void);
+int poly_eval_batch(const struct polynomial *poly, const double *xs, size_t n,
+		    double *out_f, double *out_df);
+
+#endif /* POLY_H */
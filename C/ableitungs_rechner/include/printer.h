@@ -0,0 +1,15 @@
+#ifndef PRINTER_H
+#define PRINTER_H
+
+#include <stdint.h>
+
+#include "ast.h"
+#include "format.h"
+
+int ast_format(struct fmt_buf *out, const struct expr_arena *arena,
+	       uint32_t root);
+char *ast_to_string(const struct expr_arena *arena, uint32_t root);
+char *ast_to_string_shared(const struct expr_arena *arena, uint32_t root,
+			   const char *name);
+
+#endif /* PRINTER_H */
@@ -0,0 +1,35 @@
+#ifndef ROOTS_H
+#define ROOTS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ast.h"
+#include "poly.h"
+
+/*
+ * Root finding on top of the derivative engine. Newton and Halley run
+ * many starting points at once, one per lane; a lane whose point has
+ * converged (or given up) takes the next starting point right away, so
+ * the lanes stay busy while work remains. Aberth-Ehrlich finds all
+ * complex roots of a polynomial together.
+ */
+
+#define ROOT_LANES 16		/* points iterated together on polynomials */
+#define ROOT_MAX_ITER 100	/* Newton or Halley steps per point */
+#define ROOT_MAX_DEGREE (1 << 16)	/* for poly_roots_all() */
+
+enum root_method {
+	ROOT_NEWTON,
+	ROOT_HALLEY,
+};
+
+void poly_roots_from(const struct polynomial *poly, enum root_method method,
+		     const double *starts, size_t n, double tol, double *roots);
+int expr_roots_from(struct expr_arena *arena, uint32_t root, uint32_t var,
+		    enum root_method method, const double *starts, size_t n,
+		    double tol, double *roots);
+int poly_roots_all(const struct polynomial *poly, double tol, double *re,
+		   double *im);
+
+#endif /* ROOTS_H */
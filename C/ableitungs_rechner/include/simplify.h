@@ -0,0 +1,60 @@
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+
+#include <stdint.h>
+
+#include "ast.h"
+
+/*
+ * Rule-based simplification on top of what the arena's constructors
+ * already fold. Every rule applies to one root operator and operand
+ * shape (a node type, or a function for calls), and each node is only
+ * tried against the rules indexed under its own shape. Results are
+ * memoised under SIMPLIFY_TAG, so simplifying again, or simplifying a
+ * derivative that shares nodes with a simplified one, costs a lookup per
+ * node already done.
+ */
+
+#define SIMPLIFY_TAG (UINT32_MAX - 1)	/* memo tag, above every variable id */
+
+enum simplify_rule {
+	RULE_ADD_NEG,		/* a + -b -> a - b */
+	RULE_NEG_ADD,		/* -a + b -> b - a */
+	RULE_NEG_SUB,		/* -a - b -> -(a + b) */
+	RULE_CONST_LAST,	/* c + a -> a + c */
+	RULE_LIKE_TERMS,	/* c1*a + b + c2*a -> (c1 + c2)*a + b */
+	RULE_PYTHAGORAS,	/* sin(a)^2 + b + cos(a)^2 -> b + 1 */
+	RULE_NEG_DIFF,		/* -(a - b) -> b - a */
+	RULE_LIKE_FACTORS,	/* a^m*b*a^n -> a^(m + n)*b, factors sorted */
+	RULE_CANCEL,		/* (a^m*b)/a^n -> a^(m - n)*b */
+	RULE_POW_POW,		/* (a^m)^n -> a^(m*n), n an integer */
+	RULE_POW_PROD,		/* (a*b)^n -> a^n*b^n, n an integer */
+	RULE_DIV_DIV,		/* (a/b)/c -> a/(b*c), a/(b/c) -> (a*c)/b */
+	RULE_EXP_MUL,		/* exp(a)*exp(b) -> exp(a + b) */
+	RULE_EXP_DIV,		/* exp(a)/exp(b) -> exp(a - b) */
+	RULE_LN_EXP,		/* ln(exp(a)) -> a */
+	RULE_EXP_LN,		/* exp(ln(a)) -> a */
+	RULE_SQRT_SQUARE,	/* sqrt(a)^2 -> a */
+	RULE_ODD_FUNC,		/* sin(-a) -> -sin(a), tan(-a) -> -tan(a) */
+	RULE_EVEN_FUNC,		/* cos(-a) -> cos(a) */
+	RULE_TAN,		/* sin(a)/cos(a) -> tan(a) */
+	NUM_RULES,
+};
+
+/*
+ * Filled in by simplify() if asked for. Node counts are the distinct
+ * nodes reachable from the root; the per-rule figures add up over calls.
+ */
+struct simplify_stats {
+	uint32_t nodes_before;
+	uint32_t nodes_after;
+	uint64_t tries[NUM_RULES];	/* shape matched, rule looked closer */
+	uint64_t hits[NUM_RULES];	/* rule rewrote the node */
+	double seconds[NUM_RULES];	/* time spent in the rule */
+};
+
+uint32_t simplify(struct expr_arena *arena, uint32_t root,
+		  struct simplify_stats *stats);
+const char *simplify_rule_name(enum simplify_rule rule);
+
+#endif /* SIMPLIFY_H */
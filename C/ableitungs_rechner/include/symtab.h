@@ -0,0 +1,33 @@
+#ifndef SYMTAB_H
+#define SYMTAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Variable names and their ids. Ids are handed out in order of first
+ * appearance, starting with "x" as VAR_X, so a table can be indexed by
+ * id and expressions in x alone mean the same with or without a table.
+ */
+
+#define SYM_NONE UINT32_MAX	/* unknown name, or out of memory */
+
+struct symtab {
+	char **names;		/* NUL-terminated, by id */
+	uint32_t num;
+	uint32_t cap;
+	uint32_t *slots;	/* open addressing by name hash, SYM_NONE if empty */
+	uint32_t slot_mask;
+};
+
+int symtab_init(struct symtab *st);
+void symtab_destroy(struct symtab *st);
+uint32_t symtab_lookup(const struct symtab *st, const char *name, size_t len);
+uint32_t symtab_intern(struct symtab *st, const char *name, size_t len);
+
+static inline const char *symtab_name(const struct symtab *st, uint32_t id)
+{
+	return st->names[id];
+}
+
+#endif /* SYMTAB_H */
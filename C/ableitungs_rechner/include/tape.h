@@ -0,0 +1,47 @@
+#ifndef TAPE_H
+#define TAPE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ast.h"
+#include "vm.h"
+
+/*
+ * Reverse-mode automatic differentiation for scalar functions of many
+ * variables. An expression is recorded once into a flat tape of VM
+ * instructions (one per DAG node, any number of variables); every
+ * evaluation runs the tape forward, and one backward sweep over it
+ * gives the whole gradient. The tape only depends on the expression,
+ * so it is reused for any number of points.
+ *
+ * With checkpointing, the tape is cut into segments of a fixed number
+ * of instructions. Only values used by a later segment are stored for
+ * the whole tape; the others live in a window of one segment and are
+ * recomputed segment by segment during the backward sweep.
+ */
+
+struct tape {
+	struct vm_insn *code;	/* operands and dst are slots in val[] */
+	uint32_t num_insns;
+	uint32_t cap_insns;
+	double *consts;
+	uint32_t num_consts;
+	uint32_t cap_consts;
+	uint32_t num_vars;	/* highest variable id used + 1 */
+	uint32_t segment;	/* instructions per checkpoint segment */
+	uint32_t num_kept;	/* values kept across segments */
+	uint32_t output;	/* slot of the result */
+	double *val;		/* kept values, then one segment's window */
+	double *adj;		/* adjoints, laid out like val */
+	size_t num_slots;
+};
+
+void tape_init(struct tape *tape);
+int tape_record(struct tape *tape, const struct expr_arena *arena,
+		uint32_t root, uint32_t checkpoint);
+double tape_eval(struct tape *tape, const double *vars);
+double tape_gradient(struct tape *tape, const double *vars, double *grad);
+void tape_free(struct tape *tape);
+
+#endif /* TAPE_H */
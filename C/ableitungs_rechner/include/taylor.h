@@ -0,0 +1,12 @@
+#ifndef TAYLOR_H
+#define TAYLOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ast.h"
+
+int ast_taylor(const struct expr_arena *arena, uint32_t root, uint32_t var,
+	       const double *vars, size_t n, double *coeffs);
+
+#endif /* TAYLOR_H */
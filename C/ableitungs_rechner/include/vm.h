@@ -0,0 +1,70 @@
+#ifndef VM_H
+#define VM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ast.h"
+
+/*
+ * Register bytecode for evaluating expressions over many points. Every
+ * register holds VM_BATCH values (structure of arrays), so one instruction
+ * processes a whole batch of points and the dispatch cost is paid once per
+ * batch instead of once per point.
+ */
+
+#define VM_BATCH 256		/* points per register */
+#define VM_MAX_VARS 64		/* variable ids the VM can load */
+
+enum vm_opcode {
+	OP_CONST,	/* dst = k[b] */
+	OP_VAR,		/* dst = input a */
+	OP_ADD,		/* dst = a + b */
+	OP_SUB,
+	OP_MUL,
+	OP_DIV,
+	OP_POW,
+	OP_ADDK,	/* dst = a + k[b] */
+	OP_SUBK,	/* dst = a - k[b] */
+	OP_RSUBK,	/* dst = k[b] - a */
+	OP_MULK,	/* dst = a * k[b] */
+	OP_DIVK,	/* dst = a / k[b] */
+	OP_RDIVK,	/* dst = k[b] / a */
+	OP_POWK,	/* dst = a ^ k[b] */
+	OP_RPOWK,	/* dst = k[b] ^ a */
+	OP_POWI,	/* dst = a ^ b, b a small signed integer */
+	OP_NEG,
+	OP_SIN,
+	OP_COS,
+	OP_TAN,
+	OP_EXP,
+	OP_LN,
+	OP_SQRT,
+};
+
+struct vm_insn {
+	uint8_t op;		/* enum vm_opcode */
+	uint8_t pad[3];
+	uint32_t dst;
+	uint32_t a;
+	uint32_t b;		/* register, constant index or exponent */
+};
+
+struct vm_program {
+	struct vm_insn *code;
+	uint32_t num_insns;
+	double *consts;
+	uint32_t num_consts;
+	uint32_t num_regs;
+	uint32_t num_vars;	/* highest variable id used + 1 */
+	uint32_t *outputs;	/* register of each compiled root */
+	uint32_t num_outputs;
+};
+
+int vm_compile(const struct expr_arena *arena, const uint32_t *roots,
+	       uint32_t num_roots, struct vm_program *prog);
+void vm_free(struct vm_program *prog);
+int vm_eval(const struct vm_program *prog, const double *const *inputs,
+	    size_t n, double *const *outputs);
+
+#endif /* VM_H */
@@ -0,0 +1,621 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ast.h"
+
+static const char *const func_names[NUM_FUNCS] = {
+	[FUNC_SIN] = "sin",
+	[FUNC_COS] = "cos",
+	[FUNC_TAN] = "tan",
+	[FUNC_EXP] = "exp",
+	[FUNC_LN] = "ln",
+	[FUNC_SQRT] = "sqrt",
+};
+
+#define MIN_SLOTS 128
+
+static void fill_empty(void *block, size_t size)
+{
+	memset(block, 0xff, size);
+}
+
+/**
+ * arena_init - Set up an empty expression arena
+ * @arena: Arena to initialise
+ * @node_hint: Expected number of nodes (0 for a small default)
+ *
+ * Returns 0 on success, -1 if the initial blocks can't be allocated
+ */
+int arena_init(struct expr_arena *arena, uint32_t node_hint)
+{
+	if (node_hint < 64)
+		node_hint = 64;
+
+	memset(arena, 0, sizeof(*arena));
+	arena->nodes = malloc(sizeof(*arena->nodes) * node_hint);
+	arena->consts = malloc(sizeof(*arena->consts) * 64);
+	arena->slots = malloc(sizeof(*arena->slots) * MIN_SLOTS);
+	arena->memo_keys = malloc(sizeof(*arena->memo_keys) * MIN_SLOTS);
+	arena->memo_vals = malloc(sizeof(*arena->memo_vals) * MIN_SLOTS);
+	arena->cap_nodes = node_hint;
+	arena->cap_consts = 64;
+	arena->slot_mask = MIN_SLOTS - 1;
+	arena->memo_mask = MIN_SLOTS - 1;
+
+	if (!arena->nodes || !arena->consts || !arena->slots ||
+	    !arena->memo_keys || !arena->memo_vals) {
+		arena_destroy(arena);
+		return -1;
+	}
+	fill_empty(arena->slots, sizeof(*arena->slots) * MIN_SLOTS);
+	fill_empty(arena->memo_keys, sizeof(*arena->memo_keys) * MIN_SLOTS);
+	return 0;
+}
+
+/**
+ * arena_reset - Drop every node and constant, keeping the memory
+ * @arena: Arena to reset
+ */
+void arena_reset(struct expr_arena *arena)
+{
+	arena->num_nodes = 0;
+	arena->num_consts = 0;
+	arena->memo_count = 0;
+	fill_empty(arena->slots,
+		   sizeof(*arena->slots) * ((size_t)arena->slot_mask + 1));
+	fill_empty(arena->memo_keys,
+		   sizeof(*arena->memo_keys) * ((size_t)arena->memo_mask + 1));
+}
+
+/**
+ * arena_destroy - Free an arena and every expression in it
+ * @arena: Arena to free
+ */
+void arena_destroy(struct expr_arena *arena)
+{
+	free(arena->nodes);
+	free(arena->consts);
+	free(arena->slots);
+	free(arena->memo_keys);
+	free(arena->memo_vals);
+	memset(arena, 0, sizeof(*arena));
+}
+
+static int arena_grow(void **block, uint32_t *cap, size_t size)
+{
+	uint32_t new_cap;
+	void *p;
+
+	/* NODE_NONE itself must never become a valid index */
+	if (*cap >= UINT32_MAX / 2)
+		return -1;
+
+	new_cap = *cap * 2;
+	p = realloc(*block, size * new_cap);
+	if (!p)
+		return -1;
+
+	*block = p;
+	*cap = new_cap;
+	return 0;
+}
+
+static uint64_t double_bits(double v)
+{
+	uint64_t bits;
+
+	memcpy(&bits, &v, sizeof(bits));
+	return bits;
+}
+
+/*
+ * Nodes are keyed by their contents, except that constants are keyed by
+ * the bits of their value rather than by their pool index.
+ */
+static uint64_t node_key(const struct expr_arena *arena, const struct node *n)
+{
+	if (n->type == NODE_CONST)
+		return double_bits(arena->consts[n->lhs]);
+	return n->lhs;
+}
+
+static uint32_t node_hash(uint8_t type, uint8_t op, uint64_t key, uint32_t rhs)
+{
+	uint64_t h = key * 0x9E3779B97F4A7C15ull;
+
+	h ^= ((uint64_t)rhs << 16 | (uint64_t)op << 8 | type) *
+	     0xC2B2AE3D27D4EB4Full;
+	h ^= h >> 32;
+	h *= 0xD6E8FEB86659FD93ull;
+	h ^= h >> 32;
+	return (uint32_t)h;
+}
+
+static int intern_grow(struct expr_arena *arena)
+{
+	uint32_t mask = arena->slot_mask * 2 + 1;
+	uint32_t *slots;
+	uint32_t id, i;
+
+	if (mask >= UINT32_MAX / 2)
+		return -1;
+	slots = malloc(sizeof(*slots) * ((size_t)mask + 1));
+	if (!slots)
+		return -1;
+	fill_empty(slots, sizeof(*slots) * ((size_t)mask + 1));
+
+	/* every node is unique, so each just takes the first free slot */
+	for (id = 0; id < arena->num_nodes; id++) {
+		const struct node *n = &arena->nodes[id];
+
+		i = node_hash(n->type, n->op, node_key(arena, n), n->rhs) & mask;
+		while (slots[i] != NODE_NONE)
+			i = (i + 1) & mask;
+		slots[i] = id;
+	}
+
+	free(arena->slots);
+	arena->slots = slots;
+	arena->slot_mask = mask;
+	return 0;
+}
+
+/*
+ * Return the node with the given contents, creating it if it doesn't exist
+ * yet. For NODE_CONST the value is passed instead of a pool index.
+ */
+static uint32_t arena_push(struct expr_arena *arena, enum node_type type,
+			   uint8_t op, uint32_t lhs, uint32_t rhs, double value)
+{
+	uint64_t key = type == NODE_CONST ? double_bits(value) : lhs;
+	uint32_t i = node_hash(type, op, key, rhs) & arena->slot_mask;
+	uint32_t id;
+	struct node *n;
+
+	for (; (id = arena->slots[i]) != NODE_NONE;
+	     i = (i + 1) & arena->slot_mask) {
+		n = &arena->nodes[id];
+		if (n->type == type && n->op == op && n->rhs == rhs &&
+		    node_key(arena, n) == key)
+			return id;
+	}
+
+	if (type == NODE_CONST) {
+		if (arena->num_consts == arena->cap_consts &&
+		    arena_grow((void **)&arena->consts, &arena->cap_consts,
+			       sizeof(*arena->consts)) < 0)
+			return NODE_NONE;
+		arena->consts[arena->num_consts] = value;
+		lhs = arena->num_consts++;
+	}
+
+	if (arena->num_nodes == arena->cap_nodes &&
+	    arena_grow((void **)&arena->nodes, &arena->cap_nodes,
+		       sizeof(*arena->nodes)) < 0)
+		return NODE_NONE;
+
+	id = arena->num_nodes++;
+	n = &arena->nodes[id];
+	n->type = type;
+	n->op = op;
+	n->pad = 0;
+	n->lhs = lhs;
+	n->rhs = rhs;
+
+	/* keep the table at most half full */
+	if ((uint64_t)arena->num_nodes * 2 > (uint64_t)arena->slot_mask + 1) {
+		if (intern_grow(arena) < 0) {
+			arena->num_nodes--;
+			return NODE_NONE;
+		}
+	} else {
+		arena->slots[i] = id;
+	}
+	return id;
+}
+
+/**
+ * ast_const - Create a constant node
+ * @arena: Arena to allocate from
+ * @value: Value of the constant
+ *
+ * Returns the node, or NODE_NONE if the arena is out of memory
+ */
+uint32_t ast_const(struct expr_arena *arena, double value)
+{
+	return arena_push(arena, NODE_CONST, 0, 0, 0, value);
+}
+
+/**
+ * ast_var - Create a variable node
+ * @arena: Arena to allocate from
+ * @var: Variable id
+ */
+uint32_t ast_var(struct expr_arena *arena, uint32_t var)
+{
+	return arena_push(arena, NODE_VAR, 0, var, 0, 0.0);
+}
+
+static double const_value(const struct expr_arena *arena, uint32_t id)
+{
+	return arena->consts[arena->nodes[id].lhs];
+}
+
+static uint32_t fold_binary(struct expr_arena *arena, enum node_type type,
+			    double a, double b)
+{
+	double v;
+
+	switch (type) {
+	case NODE_ADD:
+		v = a + b;
+		break;
+	case NODE_SUB:
+		v = a - b;
+		break;
+	case NODE_MUL:
+		v = a * b;
+		break;
+	case NODE_DIV:
+		v = a / b;
+		break;
+	default:
+		v = pow(a, b);
+		break;
+	}
+
+	/* leave 1/0, ln(-1) and friends in the tree */
+	if (!isfinite(v))
+		return NODE_NONE;
+	return ast_const(arena, v);
+}
+
+/**
+ * ast_binary - Create a binary operator node
+ * @arena: Arena to allocate from
+ * @type: NODE_ADD, NODE_SUB, NODE_MUL, NODE_DIV or NODE_POW
+ * @lhs: Left operand
+ * @rhs: Right operand
+ *
+ * Folds constant operands and drops the identities 0+a, a-0, 1*a, a*1,
+ * 0*a, a/1, a^0 and a^1, so derivatives don't fill up with dead terms.
+ * Since equal subexpressions are the same node, a-a, a/a, a+a and a*a
+ * are caught by comparing indices.
+ * Products are kept with their constant factor in front, and signs are
+ * pulled out of them.
+ * Returns NODE_NONE if either operand is NODE_NONE or memory runs out.
+ */
+uint32_t ast_binary(struct expr_arena *arena, enum node_type type,
+		    uint32_t lhs, uint32_t rhs)
+{
+	int lc, rc;
+	uint32_t folded;
+
+	if (lhs == NODE_NONE || rhs == NODE_NONE)
+		return NODE_NONE;
+
+	lc = arena->nodes[lhs].type == NODE_CONST;
+	rc = arena->nodes[rhs].type == NODE_CONST;
+	if (lc && rc) {
+		folded = fold_binary(arena, type, const_value(arena, lhs),
+				     const_value(arena, rhs));
+		if (folded != NODE_NONE)
+			return folded;
+	}
+
+	switch (type) {
+	case NODE_ADD:
+		if (ast_is_const(arena, lhs, 0.0))
+			return rhs;
+		if (ast_is_const(arena, rhs, 0.0))
+			return lhs;
+		if (lhs == rhs)
+			return ast_binary(arena, NODE_MUL, ast_const(arena, 2.0),
+					  lhs);
+		break;
+	case NODE_SUB:
+		if (ast_is_const(arena, rhs, 0.0))
+			return lhs;
+		if (ast_is_const(arena, lhs, 0.0))
+			return ast_neg(arena, rhs);
+		if (lhs == rhs)
+			return ast_const(arena, 0.0);
+		if (arena->nodes[rhs].type == NODE_NEG)
+			return ast_binary(arena, NODE_ADD, lhs,
+					  arena->nodes[rhs].lhs);
+		break;
+	case NODE_MUL:
+		/* constants go first: 2*x rather than x*2 */
+		if (rc && !lc) {
+			uint32_t tmp = lhs;
+
+			lhs = rhs;
+			rhs = tmp;
+			lc = 1;
+		}
+		if (ast_is_const(arena, lhs, 0.0))
+			return lhs;
+		if (ast_is_const(arena, lhs, 1.0))
+			return rhs;
+		/* only left over when c*1 didn't fold, c not finite */
+		if (ast_is_const(arena, rhs, 1.0))
+			return lhs;
+		if (ast_is_const(arena, lhs, -1.0))
+			return ast_neg(arena, rhs);
+		if (lhs == rhs)
+			return ast_binary(arena, NODE_POW, lhs,
+					  ast_const(arena, 2.0));
+		/* signs move out of products: a*(-b) -> -(a*b) */
+		if (arena->nodes[rhs].type == NODE_NEG)
+			return ast_neg(arena, ast_binary(arena, NODE_MUL, lhs,
+						  arena->nodes[rhs].lhs));
+		if (arena->nodes[lhs].type == NODE_NEG)
+			return ast_neg(arena, ast_binary(arena, NODE_MUL,
+						  arena->nodes[lhs].lhs, rhs));
+		/*
+		 * a*(c*b) -> c*(a*b), so constants meet and fold. Two
+		 * constants whose product overflows stay apart, or the rule
+		 * below would turn (c1*c2)*b straight back into c1*(c2*b).
+		 */
+		if (arena->nodes[rhs].type == NODE_MUL &&
+		    arena->nodes[arena->nodes[rhs].lhs].type == NODE_CONST) {
+			const struct node r = arena->nodes[rhs];
+
+			if (!lc)
+				return ast_binary(arena, NODE_MUL, r.lhs,
+					ast_binary(arena, NODE_MUL, lhs, r.rhs));
+			if (isfinite(const_value(arena, lhs) *
+				     const_value(arena, r.lhs)))
+				return ast_binary(arena, NODE_MUL,
+					ast_binary(arena, NODE_MUL, lhs, r.lhs),
+					r.rhs);
+		}
+		/* (c*a)*b -> c*(a*b) */
+		if (!lc && arena->nodes[lhs].type == NODE_MUL &&
+		    arena->nodes[arena->nodes[lhs].lhs].type == NODE_CONST) {
+			const struct node l = arena->nodes[lhs];
+
+			return ast_binary(arena, NODE_MUL, l.lhs,
+				ast_binary(arena, NODE_MUL, l.rhs, rhs));
+		}
+		/*
+		 * c*(b/d) -> (c*b)/d and a*(1/d) -> a/d. Pulling divisions
+		 * out of products in general would create new quotients that
+		 * the derive memo has never seen, and repeated derivatives
+		 * would grow exponentially again.
+		 */
+		if (arena->nodes[rhs].type == NODE_DIV &&
+		    (lc || ast_is_const(arena, arena->nodes[rhs].lhs, 1.0))) {
+			const struct node r = arena->nodes[rhs];
+
+			return ast_binary(arena, NODE_DIV,
+				ast_binary(arena, NODE_MUL, lhs, r.lhs), r.rhs);
+		}
+		if (arena->nodes[lhs].type == NODE_DIV &&
+		    ast_is_const(arena, arena->nodes[lhs].lhs, 1.0))
+			return ast_binary(arena, NODE_DIV, rhs,
+					  arena->nodes[lhs].rhs);
+		break;
+	case NODE_DIV:
+		if (ast_is_const(arena, lhs, 0.0))
+			return lhs;
+		if (ast_is_const(arena, rhs, 1.0))
+			return lhs;
+		if (lhs == rhs)
+			return ast_const(arena, 1.0);
+		if (arena->nodes[lhs].type == NODE_NEG)
+			return ast_neg(arena, ast_binary(arena, NODE_DIV,
+						  arena->nodes[lhs].lhs, rhs));
+		if (arena->nodes[rhs].type == NODE_NEG)
+			return ast_neg(arena, ast_binary(arena, NODE_DIV, lhs,
+						  arena->nodes[rhs].lhs));
+		break;
+	case NODE_POW:
+		if (ast_is_const(arena, rhs, 0.0))
+			return ast_const(arena, 1.0);
+		if (ast_is_const(arena, rhs, 1.0))
+			return lhs;
+		if (ast_is_const(arena, lhs, 1.0))
+			return lhs;
+		break;
+	default:
+		return NODE_NONE;
+	}
+
+	return arena_push(arena, type, 0, lhs, rhs, 0.0);
+}
+
+/**
+ * ast_neg - Create a negation node
+ * @arena: Arena to allocate from
+ * @child: Operand
+ *
+ * Negates constants directly, cancels double negation and moves the sign
+ * of c*a onto c.
+ */
+uint32_t ast_neg(struct expr_arena *arena, uint32_t child)
+{
+	const struct node *n;
+
+	if (child == NODE_NONE)
+		return NODE_NONE;
+
+	n = &arena->nodes[child];
+	if (n->type == NODE_CONST)
+		return ast_const(arena, -const_value(arena, child));
+	if (n->type == NODE_NEG)
+		return n->lhs;
+	/* -(c*a) -> (-c)*a, the sign stays on the constant factor */
+	if ((n->type == NODE_MUL || n->type == NODE_DIV) &&
+	    arena->nodes[n->lhs].type == NODE_CONST) {
+		const struct node m = *n;
+
+		return ast_binary(arena, m.type,
+				  ast_const(arena, -const_value(arena, m.lhs)),
+				  m.rhs);
+	}
+
+	return arena_push(arena, NODE_NEG, 0, child, 0, 0.0);
+}
+
+/**
+ * ast_func - Create a function call node
+ * @arena: Arena to allocate from
+ * @func: Function to apply
+ * @arg: Argument
+ *
+ * Evaluates the function right away if the argument is a constant and the
+ * result is finite.
+ */
+uint32_t ast_func(struct expr_arena *arena, enum func_id func, uint32_t arg)
+{
+	if (arg == NODE_NONE)
+		return NODE_NONE;
+
+	if (arena->nodes[arg].type == NODE_CONST) {
+		double a = const_value(arena, arg);
+		double v;
+
+		switch (func) {
+		case FUNC_SIN:
+			v = sin(a);
+			break;
+		case FUNC_COS:
+			v = cos(a);
+			break;
+		case FUNC_TAN:
+			v = tan(a);
+			break;
+		case FUNC_EXP:
+			v = exp(a);
+			break;
+		case FUNC_LN:
+			v = log(a);
+			break;
+		default:
+			v = sqrt(a);
+			break;
+		}
+		if (isfinite(v))
+			return ast_const(arena, v);
+	}
+
+	return arena_push(arena, NODE_FUNC, func, arg, 0, 0.0);
+}
+
+static uint32_t memo_slot(const struct expr_arena *arena, uint64_t key)
+{
+	uint32_t i = node_hash(0, 0, key, 0) & arena->memo_mask;
+
+	while (arena->memo_keys[i] != key && arena->memo_keys[i] != UINT64_MAX)
+		i = (i + 1) & arena->memo_mask;
+	return i;
+}
+
+/**
+ * ast_memo_get - Look up a memoised result
+ * @arena: Arena holding the memo table
+ * @node: Node the result belongs to
+ * @tag: What was computed (e.g. the variable of a derivative)
+ *
+ * Returns the stored node, or NODE_NONE if there is none
+ */
+uint32_t ast_memo_get(const struct expr_arena *arena, uint32_t node,
+		      uint32_t tag)
+{
+	uint64_t key = (uint64_t)node << 32 | tag;
+	uint32_t i = memo_slot(arena, key);
+
+	return arena->memo_keys[i] == key ? arena->memo_vals[i] : NODE_NONE;
+}
+
+/**
+ * ast_memo_put - Memoise a result
+ * @arena: Arena holding the memo table
+ * @node: Node the result belongs to
+ * @tag: What was computed
+ * @value: Result node
+ *
+ * Returns 0 on success, -1 if the table can't grow (the result is then
+ * simply not remembered)
+ */
+int ast_memo_put(struct expr_arena *arena, uint32_t node, uint32_t tag,
+		 uint32_t value)
+{
+	uint64_t key = (uint64_t)node << 32 | tag;
+	uint32_t i;
+
+	if ((uint64_t)(arena->memo_count + 1) * 2 > (uint64_t)arena->memo_mask + 1) {
+		uint32_t old_mask = arena->memo_mask;
+		uint64_t *old_keys = arena->memo_keys;
+		uint32_t *old_vals = arena->memo_vals;
+		uint32_t mask = old_mask * 2 + 1;
+		uint64_t *keys;
+		uint32_t *vals;
+
+		if (mask >= UINT32_MAX / 2)
+			return -1;
+		keys = malloc(sizeof(*keys) * ((size_t)mask + 1));
+		vals = malloc(sizeof(*vals) * ((size_t)mask + 1));
+		if (!keys || !vals) {
+			free(keys);
+			free(vals);
+			return -1;
+		}
+		fill_empty(keys, sizeof(*keys) * ((size_t)mask + 1));
+		arena->memo_keys = keys;
+		arena->memo_vals = vals;
+		arena->memo_mask = mask;
+		for (i = 0; i <= old_mask; i++) {
+			uint32_t j;
+
+			if (old_keys[i] == UINT64_MAX)
+				continue;
+			j = memo_slot(arena, old_keys[i]);
+			keys[j] = old_keys[i];
+			vals[j] = old_vals[i];
+		}
+		free(old_keys);
+		free(old_vals);
+	}
+
+	i = memo_slot(arena, key);
+	if (arena->memo_keys[i] != key) {
+		arena->memo_keys[i] = key;
+		arena->memo_count++;
+	}
+	arena->memo_vals[i] = value;
+	return 0;
+}
+
+/**
+ * ast_func_name - Name of a built-in function
+ * @func: Function id
+ */
+const char *ast_func_name(enum func_id func)
+{
+	return func_names[func];
+}
+
+/**
+ * ast_func_lookup - Find a built-in function by name
+ * @name: Start of the name (not necessarily NUL-terminated)
+ * @len: Length of the name
+ *
+ * Returns the enum func_id, or -1 if there is no such function
+ */
+int ast_func_lookup(const char *name, int len)
+{
+	int i;
+
+	for (i = 0; i < NUM_FUNCS; i++) {
+		if ((int)strlen(func_names[i]) == len &&
+		    !memcmp(func_names[i], name, len))
+			return i;
+	}
+	/* log is the natural logarithm, as in C */
+	if (len == 3 && !memcmp(name, "log", 3))
+		return FUNC_LN;
+	return -1;
+}
@@ -0,0 +1,531 @@
+#define _DEFAULT_SOURCE		/* mmap(), sysconf(), clock_gettime() */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ast.h"
+#include "batch.h"
+#include "cache.h"
+#include "derive.h"
+#include "format.h"
+#include "parser.h"
+#include "poly.h"
+#include "printer.h"
+#include "simplify.h"
+
+/*
+ * Batch mode differentiates one expression per input line and writes one
+ * derivative (or error) per output line. The input is cut into chunks of
+ * whole lines; worker threads differentiate chunks into private output
+ * buffers while the main thread reads ahead and writes finished chunks
+ * strictly in input order. At most SLOTS_PER_THREAD chunks per thread are
+ * in flight, so memory stays bounded however long the input is.
+ */
+#define CHUNK_SIZE (1 << 20)	/* bytes of input per chunk */
+#define SLOTS_PER_THREAD 4
+#define MAX_THREADS 256
+#define ARENA_KEEP (1u << 16)	/* larger arenas are freed after a line */
+#define CACHE_KIND 1		/* key seed: first derivative, simplified */
+
+struct chunk {
+	const char *data;
+	size_t len;
+	char *owned;		/* read buffer behind data, NULL if mapped */
+	struct fmt_buf out;
+	size_t lines;
+	int done;
+};
+
+struct source {
+	int fd;
+	const char *map;	/* whole input if it could be mapped */
+	size_t map_len;
+	size_t pos;
+	char *carry;		/* incomplete last line of a read */
+	size_t carry_len;
+	int eof;
+};
+
+struct pool {
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_cond_t done;
+	struct chunk *slots;
+	size_t num_slots;
+	size_t next;		/* next chunk to differentiate */
+	size_t tail;		/* chunks handed out so far */
+	int quit;
+	struct deriv_cache *cache;	/* NULL for none */
+	size_t cache_hits;
+};
+
+struct worker {
+	struct expr_arena arena;
+	struct polynomial poly;
+	struct polynomial deriv;
+	char *line;
+	size_t line_cap;
+	struct deriv_cache *cache;
+	struct fmt_buf canon;	/* parsed input printed back */
+	size_t cache_hits;
+};
+
+static void out_error(struct fmt_buf *out, const char *msg, size_t offset)
+{
+	char text[128];
+	int len;
+
+	if (offset == (size_t)-1)
+		len = snprintf(text, sizeof(text), "Error: %s\n", msg);
+	else
+		len = snprintf(text, sizeof(text), "Error: %s at position %zu\n",
+			       msg, offset + 1);
+	fmt_put(out, text, (size_t)len < sizeof(text) ? (size_t)len :
+		sizeof(text) - 1);
+}
+
+/* expressions need a NUL-terminated copy, polynomials are parsed in place */
+static const char *terminate(struct worker *w, const char *line, size_t len)
+{
+	if (len + 1 > w->line_cap) {
+		char *copy = realloc(w->line, len + 1);
+
+		if (!copy)
+			return NULL;
+		w->line = copy;
+		w->line_cap = len + 1;
+	}
+	memcpy(w->line, line, len);
+	w->line[len] = '\0';
+	return w->line;
+}
+
+/*
+ * Expression lines are looked up in the cache by their text without
+ * insignificant whitespace, and if that misses, once parsed, by the
+ * parsed expression printed back, which catches inputs that only differ
+ * in redundant parentheses or folded constants. A derivative is stored
+ * under both keys. Returns 1 on a hit, with the derivative in @out.
+ */
+static int cache_lookup(struct worker *w, const char *line, size_t len,
+			struct cache_key *key, struct fmt_buf *out)
+{
+	len = cache_normalize(w->line, line, len);
+	cache_hash(w->line, len, CACHE_KIND, key);
+	return cache_get(w->cache, key, out);
+}
+
+static int cache_lookup_parsed(struct worker *w, uint32_t root,
+			       struct cache_key *key, struct fmt_buf *out)
+{
+	w->canon.len = 0;
+	if (ast_format(&w->canon, &w->arena, root) < 0)
+		return 0;
+	cache_hash(w->canon.buf, w->canon.len, CACHE_KIND, key);
+	return cache_get(w->cache, key, out);
+}
+
+/* differentiate one line (without its newline) into @out */
+static void derive_line(struct worker *w, const char *line, size_t len,
+			struct fmt_buf *out)
+{
+	struct parse_error err;
+	struct cache_key text_key, parsed_key;
+	uint32_t root;
+	size_t offset, mark = out->len;
+	int r;
+
+	if (!len) {
+		fmt_put(out, "\n", 1);
+		return;
+	}
+
+	/* what the polynomial parser rejects, e.g. "3 x^2", may be an expression */
+	if (poly_matches(line, len) &&
+	    poly_parse(&w->poly, line, len, &offset) == 0) {
+		r = poly_derive(&w->poly, &w->deriv) < 0 ? -1 :
+		    poly_format(out, &w->deriv);
+	} else {
+		/* sizes w->line, which the lookup normalises into */
+		if (!terminate(w, line, len)) {
+			out_error(out, "Out of memory", (size_t)-1);
+			return;
+		}
+		if (w->cache && cache_lookup(w, line, len, &text_key, out)) {
+			w->cache_hits++;
+			fmt_put(out, "\n", 1);
+			return;
+		}
+		line = w->cache ? terminate(w, line, len) : w->line;
+		if (!line) {
+			out_error(out, "Out of memory", (size_t)-1);
+			return;
+		}
+		/* an arena left empty by a failed arena_init() is retried */
+		if (w->arena.slot_mask >= ARENA_KEEP || !w->arena.nodes) {
+			arena_destroy(&w->arena);
+			if (arena_init(&w->arena, 0) < 0) {
+				out_error(out, "Out of memory", (size_t)-1);
+				return;
+			}
+		} else {
+			arena_reset(&w->arena);
+		}
+		root = parse_expression(&w->arena, line, &err);
+		if (root == NODE_NONE) {
+			out_error(out, err.msg, err.offset);
+			return;
+		}
+		if (w->cache &&
+		    cache_lookup_parsed(w, root, &parsed_key, out)) {
+			cache_put(w->cache, &text_key, out->buf + mark,
+				  out->len - mark);
+			w->cache_hits++;
+			fmt_put(out, "\n", 1);
+			return;
+		}
+		root = simplify(&w->arena, derive(&w->arena, root, VAR_X),
+				NULL);
+		r = root == NODE_NONE ? -1 : ast_format(out, &w->arena, root);
+		if (w->cache && r >= 0 && !out->failed) {
+			cache_put(w->cache, &text_key, out->buf + mark,
+				  out->len - mark);
+			if (!w->canon.failed)
+				cache_put(w->cache, &parsed_key,
+					  out->buf + mark, out->len - mark);
+		}
+	}
+
+	if (r < 0) {
+		/* drop the partial line; a failed buffer stays failed */
+		out->len = mark;
+		out_error(out, "Out of memory", (size_t)-1);
+		return;
+	}
+	fmt_put(out, "\n", 1);
+}
+
+static void process_chunk(struct worker *w, struct chunk *c)
+{
+	const char *p = c->data, *end = c->data + c->len;
+
+	while (p < end) {
+		const char *nl = memchr(p, '\n', (size_t)(end - p));
+		size_t len = (nl ? nl : end) - p;
+
+		if (len && p[len - 1] == '\r')
+			len--;
+		derive_line(w, p, len, &c->out);
+		c->lines++;
+		p = nl ? nl + 1 : end;
+	}
+}
+
+static void *worker_main(void *arg)
+{
+	struct pool *pool = arg;
+	struct worker w;
+
+	memset(&w, 0, sizeof(w));
+	w.cache = pool->cache;
+	arena_init(&w.arena, 0);
+	poly_init(&w.poly);
+	poly_init(&w.deriv);
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		struct chunk *c;
+
+		while (pool->next == pool->tail && !pool->quit)
+			pthread_cond_wait(&pool->work, &pool->lock);
+		if (pool->next == pool->tail)
+			break;
+		c = &pool->slots[pool->next++ % pool->num_slots];
+		pthread_mutex_unlock(&pool->lock);
+
+		process_chunk(&w, c);
+
+		pthread_mutex_lock(&pool->lock);
+		c->done = 1;
+		pthread_cond_broadcast(&pool->done);
+	}
+	pool->cache_hits += w.cache_hits;
+	pthread_mutex_unlock(&pool->lock);
+
+	arena_destroy(&w.arena);
+	poly_free(&w.poly);
+	poly_free(&w.deriv);
+	free(w.line);
+	fmt_release(&w.canon);
+	return NULL;
+}
+
+/* whole lines from a read() stream; returns 1 for a chunk, 0 at the end */
+static int read_chunk(struct source *src, struct chunk *c)
+{
+	size_t len = src->carry_len, cap = len + CHUNK_SIZE, cut;
+	char *buf = malloc(cap), *p;
+
+	if (!buf)
+		return -1;
+	memcpy(buf, src->carry, len);
+
+	for (;;) {
+		while (!src->eof && len < cap) {
+			ssize_t r = read(src->fd, buf + len, cap - len);
+
+			if (r < 0 && errno == EINTR)
+				continue;
+			if (r < 0) {
+				free(buf);
+				return -1;
+			}
+			if (r == 0)
+				src->eof = 1;
+			len += (size_t)r;
+		}
+		if (src->eof)
+			break;
+		for (cut = len; cut > 0 && buf[cut - 1] != '\n'; cut--)
+			;
+		if (cut)
+			break;
+		/* a single line longer than the buffer */
+		p = realloc(buf, cap * 2);
+		if (!p) {
+			free(buf);
+			return -1;
+		}
+		buf = p;
+		cap *= 2;
+	}
+	cut = src->eof ? len : cut;
+
+	p = realloc(src->carry, len - cut + 1);
+	if (!p) {
+		free(buf);
+		return -1;
+	}
+	src->carry = p;
+	src->carry_len = len - cut;
+	memcpy(src->carry, buf + cut, len - cut);
+
+	if (!cut) {
+		free(buf);
+		return 0;
+	}
+	c->data = buf;
+	c->len = cut;
+	c->owned = buf;
+	return 1;
+}
+
+static int next_chunk(struct source *src, struct chunk *c)
+{
+	const char *nl;
+	size_t end;
+
+	memset(c, 0, sizeof(*c));
+	if (!src->map)
+		return read_chunk(src, c);
+
+	if (src->pos >= src->map_len)
+		return 0;
+	end = src->map_len - src->pos > CHUNK_SIZE ? src->pos + CHUNK_SIZE :
+	      src->map_len;
+	nl = memchr(src->map + end, '\n', src->map_len - end);
+	end = nl ? (size_t)(nl - src->map) + 1 : src->map_len;
+
+	c->data = src->map + src->pos;
+	c->len = end - src->pos;
+	src->pos = end;
+	return 1;
+}
+
+static int open_source(struct source *src, const char *path)
+{
+	struct stat st;
+
+	memset(src, 0, sizeof(*src));
+	src->fd = path ? open(path, O_RDONLY) : STDIN_FILENO;
+	if (src->fd < 0)
+		return -1;
+
+	/* regular files are mapped, pipes are read in chunks */
+	if (fstat(src->fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		void *map = mmap(NULL, (size_t)st.st_size, PROT_READ,
+				 MAP_PRIVATE, src->fd, 0);
+
+		if (map != MAP_FAILED) {
+			madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+			src->map = map;
+			src->map_len = (size_t)st.st_size;
+		}
+	}
+	return 0;
+}
+
+static void close_source(struct source *src)
+{
+	if (src->map)
+		munmap((void *)src->map, src->map_len);
+	if (src->fd != STDIN_FILENO)
+		close(src->fd);
+	free(src->carry);
+}
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * batch_run - Differentiate every line of a file or of stdin
+ * @path: Input file, NULL for stdin
+ * @num_threads: Worker threads, 0 for one per CPU
+ * @cache_path: Derivative cache file shared between runs, NULL for none
+ *
+ * Writes one derivative per input line to stdout, in input order, and a
+ * throughput summary to stderr. With a cache, expressions differentiated
+ * before, by this or any earlier run, are answered from the cache.
+ *
+ * Returns 0 on success, 1 on an I/O error or if memory runs out
+ */
+int batch_run(const char *path, int num_threads, const char *cache_path)
+{
+	pthread_t threads[MAX_THREADS];
+	struct deriv_cache cache;
+	struct source src;
+	struct pool pool;
+	size_t head = 0, lines = 0, bytes = 0;
+	double start = now_s(), elapsed;
+	int started = 0, more = 1, ret = 0, i;
+
+	if (num_threads <= 0)
+		num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (num_threads <= 0)
+		num_threads = 1;
+	if (num_threads > MAX_THREADS)
+		num_threads = MAX_THREADS;
+
+	if (open_source(&src, path) < 0) {
+		fprintf(stderr, "Error: %s: %s\n", path, strerror(errno));
+		return 1;
+	}
+
+	memset(&pool, 0, sizeof(pool));
+	if (cache_path) {
+		if (cache_open(&cache, cache_path, 0) < 0) {
+			fprintf(stderr, "Error: %s: %s\n", cache_path,
+				strerror(errno));
+			close_source(&src);
+			return 1;
+		}
+		pool.cache = &cache;
+	}
+	pool.num_slots = (size_t)num_threads * SLOTS_PER_THREAD;
+	pool.slots = calloc(pool.num_slots, sizeof(*pool.slots));
+	if (!pool.slots) {
+		if (pool.cache)
+			cache_close(pool.cache);
+		close_source(&src);
+		fprintf(stderr, "Error: Out of memory\n");
+		return 1;
+	}
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.work, NULL);
+	pthread_cond_init(&pool.done, NULL);
+	for (i = 0; i < num_threads; i++) {
+		if (pthread_create(&threads[i], NULL, worker_main, &pool))
+			break;
+		started++;
+	}
+	if (!started) {
+		fprintf(stderr, "Error: Can't start worker threads\n");
+		ret = 1;
+		more = 0;
+	}
+
+	pthread_mutex_lock(&pool.lock);
+	while (more || head < pool.tail) {
+		struct chunk *c;
+
+		/* keep the workers fed while there is room */
+		if (more && pool.tail - head < pool.num_slots) {
+			struct chunk next;
+			int r;
+
+			pthread_mutex_unlock(&pool.lock);
+			r = next_chunk(&src, &next);
+			pthread_mutex_lock(&pool.lock);
+			if (r > 0) {
+				bytes += next.len;
+				pool.slots[pool.tail++ % pool.num_slots] = next;
+				pthread_cond_signal(&pool.work);
+				continue;
+			}
+			if (r < 0) {
+				fprintf(stderr, "Error: %s\n", strerror(errno));
+				ret = 1;
+			}
+			more = 0;
+			continue;
+		}
+
+		c = &pool.slots[head % pool.num_slots];
+		while (!c->done)
+			pthread_cond_wait(&pool.done, &pool.lock);
+		pthread_mutex_unlock(&pool.lock);
+
+		if (c->out.failed) {
+			fprintf(stderr, "Error: Out of memory\n");
+			ret = 1;
+		} else if (fwrite(c->out.buf, 1, c->out.len, stdout) !=
+			   c->out.len) {
+			ret = 1;
+		}
+		lines += c->lines;
+		fmt_release(&c->out);
+		free(c->owned);
+		memset(c, 0, sizeof(*c));
+
+		pthread_mutex_lock(&pool.lock);
+		head++;
+	}
+	pool.quit = 1;
+	pthread_cond_broadcast(&pool.work);
+	pthread_mutex_unlock(&pool.lock);
+
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	if (fflush(stdout) != 0)
+		ret = 1;
+
+	elapsed = now_s() - start;
+	fprintf(stderr, "%zu expressions, %.1f MB in %.3f s: "
+		"%.3g expressions/s, %.1f MB/s (%d threads)\n",
+		lines, bytes / 1e6, elapsed, lines / elapsed,
+		bytes / 1e6 / elapsed, started);
+	if (pool.cache)
+		fprintf(stderr, "%zu from the cache\n", pool.cache_hits);
+
+	pthread_cond_destroy(&pool.work);
+	pthread_cond_destroy(&pool.done);
+	pthread_mutex_destroy(&pool.lock);
+	free(pool.slots);
+	if (pool.cache)
+		cache_close(pool.cache);
+	close_source(&src);
+	return ret;
+}
@@ -0,0 +1,556 @@
+#define _DEFAULT_SOURCE		/* flock() */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+
+#define CACHE_MAGIC "ABLCACH1"
+#define CACHE_VERSION 1
+#define BYTES_PER_SLOT 256	/* file bytes per index slot, at most */
+
+struct cache_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t num_slots;	/* power of two */
+	uint64_t file_size;
+	uint64_t data_start;	/* first record, right after the index */
+	uint64_t data_end;	/* where the next record goes */
+	uint64_t count;		/* records */
+	uint64_t replaced;	/* a new file took this one's place */
+	uint64_t reserved;
+};
+
+struct cache_slot {
+	uint64_t hash[2];
+	uint64_t offset;	/* record's file offset, 0 while empty */
+};
+
+/* followed by the value, padded to 8 bytes */
+struct cache_record {
+	uint64_t hash[2];
+	uint64_t len;
+};
+
+struct cache_map {
+	int fd;
+	unsigned char *base;
+	size_t size;
+};
+
+static uint64_t rotl64(uint64_t x, int r)
+{
+	return x << r | x >> (64 - r);
+}
+
+static uint64_t fmix64(uint64_t k)
+{
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdull;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ull;
+	k ^= k >> 33;
+	return k;
+}
+
+/**
+ * cache_hash - 128-bit hash of a byte string
+ * @data: Bytes to hash
+ * @len: Number of bytes
+ * @seed: Seed, different for every kind of value stored under the key
+ * @key: Output
+ *
+ * MurmurHash3 x64_128: 16 bytes per round on two 64-bit lanes, a few
+ * cycles per byte.
+ */
+void cache_hash(const void *data, size_t len, uint64_t seed,
+		struct cache_key *key)
+{
+	const uint64_t c1 = 0x87c37b91114253d5ull, c2 = 0x4cf5ad432745937full;
+	const unsigned char *p = data;
+	uint64_t h1 = seed, h2 = seed, k1, k2;
+	size_t i, blocks = len / 16;
+
+	for (i = 0; i < blocks; i++, p += 16) {
+		memcpy(&k1, p, 8);
+		memcpy(&k2, p + 8, 8);
+		h1 ^= rotl64(k1 * c1, 31) * c2;
+		h1 = (rotl64(h1, 27) + h2) * 5 + 0x52dce729;
+		h2 ^= rotl64(k2 * c2, 33) * c1;
+		h2 = (rotl64(h2, 31) + h1) * 5 + 0x38495ab5;
+	}
+
+	k1 = k2 = 0;
+	for (i = len & 15; i > 8; i--)
+		k2 = k2 << 8 | p[i - 1];
+	for (; i > 0; i--)
+		k1 = k1 << 8 | p[i - 1];
+	if (len & 15) {
+		h2 ^= rotl64(k2 * c2, 33) * c1;
+		h1 ^= rotl64(k1 * c1, 31) * c2;
+	}
+
+	h1 ^= len;
+	h2 ^= len;
+	h1 += h2;
+	h2 += h1;
+	h1 = fmix64(h1);
+	h2 = fmix64(h2);
+	h1 += h2;
+	h2 += h1;
+	key->hash[0] = h1;
+	key->hash[1] = h2;
+}
+
+static int word_char(char c)
+{
+	return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') ||
+	       (c >= 'A' && c <= 'Z') || c == '.' || c == '_';
+}
+
+/**
+ * cache_normalize - Drop the whitespace that doesn't separate tokens
+ * @dst: Output, room for @len bytes
+ * @src: Input text
+ * @len: Length of @src
+ *
+ * "sin( x ) + 2" and "sin(x)+2" come out the same; a space between two
+ * names or numbers stays (as one), so "1 2" doesn't turn into "12".
+ *
+ * Returns the length of the normalised text
+ */
+size_t cache_normalize(char *dst, const char *src, size_t len)
+{
+	size_t i, n = 0;
+	int space = 0;
+
+	for (i = 0; i < len; i++) {
+		char c = src[i];
+
+		if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+			space = 1;
+			continue;
+		}
+		if (space && n && word_char(dst[n - 1]) && word_char(c))
+			dst[n++] = ' ';
+		dst[n++] = c;
+		space = 0;
+	}
+	return n;
+}
+
+static struct cache_slot *slots_of(const struct cache_map *m)
+{
+	return (struct cache_slot *)(m->base + sizeof(struct cache_header));
+}
+
+static struct cache_header *header_of(const struct cache_map *m)
+{
+	return (struct cache_header *)m->base;
+}
+
+static void unmap(struct cache_map *m)
+{
+	munmap(m->base, m->size);
+	close(m->fd);
+	free(m);
+}
+
+/* map a cache file and check its header; NULL if it isn't one */
+static struct cache_map *map_file(int fd, int writable)
+{
+	struct cache_map *m;
+	struct cache_header *h;
+	struct stat st;
+	void *base;
+
+	if (fstat(fd, &st) < 0 || (uint64_t)st.st_size < sizeof(*h))
+		return NULL;
+	base = mmap(NULL, (size_t)st.st_size,
+		    writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED,
+		    fd, 0);
+	if (base == MAP_FAILED)
+		return NULL;
+	h = base;
+	if (memcmp(h->magic, CACHE_MAGIC, 8) || h->version != CACHE_VERSION ||
+	    !h->num_slots || (h->num_slots & (h->num_slots - 1)) ||
+	    h->file_size != (uint64_t)st.st_size ||
+	    h->data_start != sizeof(*h) + (uint64_t)h->num_slots *
+					  sizeof(struct cache_slot) ||
+	    h->data_end < h->data_start || h->data_end > h->file_size) {
+		munmap(base, (size_t)st.st_size);
+		return NULL;
+	}
+	m = malloc(sizeof(*m));
+	if (!m) {
+		munmap(base, (size_t)st.st_size);
+		return NULL;
+	}
+	m->fd = fd;
+	m->base = base;
+	m->size = (size_t)st.st_size;
+	return m;
+}
+
+/* size an empty file for @max_bytes and write its header */
+static int init_file(int fd, uint64_t max_bytes)
+{
+	struct cache_header h;
+	uint32_t slots = 1024;
+
+	while ((uint64_t)slots * 2 * BYTES_PER_SLOT <= max_bytes &&
+	       slots < (1u << 30))
+		slots *= 2;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, CACHE_MAGIC, 8);
+	h.version = CACHE_VERSION;
+	h.num_slots = slots;
+	h.file_size = max_bytes;
+	h.data_start = sizeof(h) + (uint64_t)slots * sizeof(struct cache_slot);
+	h.data_end = h.data_start;
+	if (ftruncate(fd, (off_t)max_bytes) < 0 ||
+	    pwrite(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h))
+		return -1;
+	return 0;
+}
+
+/*
+ * Lookups run between read_begin() and read_end(), counted under the
+ * epoch they started in. install() flips the epoch after publishing a
+ * new map and waits for the old epoch's count to drop to 0: every lookup
+ * that could still hold the old map is done then, and later ones see the
+ * new map. A lookup that raced with the flip counts itself again under
+ * the new epoch, so the wait covers it either way.
+ */
+static unsigned int read_begin(struct deriv_cache *cache)
+{
+	unsigned int e;
+
+	for (;;) {
+		e = __atomic_load_n(&cache->epoch, __ATOMIC_SEQ_CST);
+		__atomic_add_fetch(&cache->readers[e], 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&cache->epoch, __ATOMIC_SEQ_CST) == e)
+			return e;
+		__atomic_sub_fetch(&cache->readers[e], 1, __ATOMIC_SEQ_CST);
+	}
+}
+
+static void read_end(struct deriv_cache *cache, unsigned int e)
+{
+	__atomic_sub_fetch(&cache->readers[e], 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Swap in a new map and unmap the old one as soon as no lookup can use
+ * it; that closes its file too, dropping any lock held on it. Called
+ * with the mutex held, outside read_begin().
+ */
+static void install(struct deriv_cache *cache, struct cache_map *m)
+{
+	struct cache_map *old = cache->map;
+	unsigned int e;
+
+	__atomic_store_n(&cache->map, m, __ATOMIC_SEQ_CST);
+	if (!old)
+		return;
+	e = __atomic_load_n(&cache->epoch, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&cache->epoch, e ^ 1, __ATOMIC_SEQ_CST);
+	while (__atomic_load_n(&cache->readers[e], __ATOMIC_SEQ_CST))
+		sched_yield();
+	unmap(old);
+}
+
+/*
+ * Replace the cache file by an empty one: built under a temporary name,
+ * then renamed over the old, so no process ever sees it half made.
+ * Returns the new map, locked, or NULL with the old one left in place.
+ */
+static struct cache_map *start_over(struct deriv_cache *cache)
+{
+	size_t len = strlen(cache->path) + 32;
+	struct cache_map *m = NULL;
+	char *tmp = malloc(len);
+	int fd;
+
+	if (!tmp)
+		return NULL;
+	snprintf(tmp, len, "%s.%ld.tmp", cache->path, (long)getpid());
+	fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		goto out;
+	if (init_file(fd, cache->max_bytes) < 0 || flock(fd, LOCK_EX) < 0 ||
+	    rename(tmp, cache->path) < 0 || !(m = map_file(fd, 1))) {
+		unlink(tmp);
+		close(fd);
+		goto out;
+	}
+	if (cache->map)
+		__atomic_store_n(&header_of(cache->map)->replaced, 1,
+				 __ATOMIC_RELEASE);
+	install(cache, m);
+out:
+	free(tmp);
+	return m;
+}
+
+/**
+ * cache_open - Open or create a derivative cache file
+ * @cache: Cache to set up
+ * @path: Cache file
+ * @max_bytes: Size of the file if it has to be created (0 for
+ *	       CACHE_DEFAULT_BYTES); an existing file keeps its size
+ *
+ * A file that can't be written is opened for lookups only. A file that
+ * isn't a cache of this version is replaced.
+ *
+ * Returns 0 on success, -1 with errno set on failure
+ */
+int cache_open(struct deriv_cache *cache, const char *path,
+	       uint64_t max_bytes)
+{
+	struct stat st;
+	int fd, ret = -1;
+
+	memset(cache, 0, sizeof(*cache));
+	if (!max_bytes)
+		max_bytes = CACHE_DEFAULT_BYTES;
+	if (max_bytes < CACHE_MIN_BYTES)
+		max_bytes = CACHE_MIN_BYTES;
+	cache->max_bytes = max_bytes;
+	cache->path = malloc(strlen(path) + 1);
+	if (!cache->path)
+		return -1;
+	strcpy(cache->path, path);
+	pthread_mutex_init(&cache->lock, NULL);
+
+	fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0 && (errno == EACCES || errno == EROFS)) {
+		fd = open(path, O_RDONLY);
+		cache->read_only = 1;
+	}
+	if (fd < 0)
+		goto fail;
+
+	/* whoever creates the file sizes it before anyone else maps it */
+	if (flock(fd, cache->read_only ? LOCK_SH : LOCK_EX) < 0 ||
+	    fstat(fd, &st) < 0)
+		goto fail_fd;
+	if (!st.st_size && !cache->read_only && init_file(fd, max_bytes) < 0)
+		goto fail_fd;
+	cache->map = map_file(fd, !cache->read_only);
+	if (cache->map) {
+		cache->max_bytes = header_of(cache->map)->file_size;
+		flock(fd, LOCK_UN);
+		return 0;
+	}
+	/* not a cache, or an older format: replace it */
+	if (!cache->read_only && start_over(cache)) {
+		flock(cache->map->fd, LOCK_UN);
+		ret = 0;
+	}
+	errno = EINVAL;
+fail_fd:
+	close(fd);
+	if (!ret)
+		return 0;
+fail:
+	pthread_mutex_destroy(&cache->lock);
+	free(cache->path);
+	return -1;
+}
+
+/**
+ * cache_close - Unmap a cache and free everything it holds
+ * @cache: Cache to close
+ */
+void cache_close(struct deriv_cache *cache)
+{
+	if (cache->map)
+		unmap(cache->map);
+	pthread_mutex_destroy(&cache->lock);
+	free(cache->path);
+	memset(cache, 0, sizeof(*cache));
+}
+
+/* the record stored under @key, NULL if there is none */
+static const struct cache_record *find(const struct cache_map *m,
+				       const struct cache_key *key,
+				       struct cache_slot **empty)
+{
+	struct cache_slot *slots = slots_of(m);
+	uint32_t mask = header_of(m)->num_slots - 1;
+	uint32_t i = (uint32_t)key->hash[0] & mask, probe;
+
+	for (probe = 0; probe <= mask; probe++, i = (i + 1) & mask) {
+		uint64_t off = __atomic_load_n(&slots[i].offset,
+					       __ATOMIC_ACQUIRE);
+		const struct cache_record *rec;
+
+		if (!off) {
+			if (empty)
+				*empty = &slots[i];
+			return NULL;
+		}
+		if (slots[i].hash[0] != key->hash[0] ||
+		    slots[i].hash[1] != key->hash[1])
+			continue;
+		/* trust nothing in a file other processes write */
+		rec = (const struct cache_record *)(m->base + off);
+		if (off > m->size - sizeof(*rec) ||
+		    rec->len > m->size - sizeof(*rec) - off ||
+		    rec->hash[0] != key->hash[0] ||
+		    rec->hash[1] != key->hash[1])
+			return NULL;
+		return rec;
+	}
+	return NULL;
+}
+
+/*
+ * Map the file that replaced the current one. Called with the mutex held,
+ * outside read_begin(); the current map is unlocked and gone afterwards.
+ */
+static struct cache_map *reopen(struct deriv_cache *cache)
+{
+	struct cache_map *m;
+	int fd = open(cache->path, cache->read_only ? O_RDONLY : O_RDWR);
+
+	if (fd < 0)
+		return NULL;
+	m = map_file(fd, !cache->read_only);
+	if (!m) {
+		close(fd);
+		return NULL;
+	}
+	install(cache, m);
+	return m;
+}
+
+/* one lookup in the current map; *stale is set on a miss in a replaced one */
+static int lookup(struct deriv_cache *cache, const struct cache_key *key,
+		  struct fmt_buf *out, const struct cache_map **stale)
+{
+	unsigned int e = read_begin(cache);
+	const struct cache_map *m = __atomic_load_n(&cache->map,
+						    __ATOMIC_SEQ_CST);
+	const struct cache_record *rec = find(m, key, NULL);
+
+	*stale = NULL;
+	if (rec)
+		fmt_put(out, (const char *)(rec + 1), rec->len);
+	else if (__atomic_load_n(&header_of(m)->replaced, __ATOMIC_ACQUIRE))
+		*stale = m;
+	read_end(cache, e);
+	return rec != NULL;
+}
+
+/**
+ * cache_get - Look up a derivative
+ * @cache: Open cache
+ * @key: Hash of the normalised input
+ * @out: Buffer the stored value is appended to on a hit
+ *
+ * Takes no lock, other than to move on to the file that replaced the
+ * current one: a miss in a file that has been started over is looked up
+ * again in the new one.
+ *
+ * Returns 1 on a hit, 0 on a miss
+ */
+int cache_get(struct deriv_cache *cache, const struct cache_key *key,
+	      struct fmt_buf *out)
+{
+	const struct cache_map *stale;
+
+	if (lookup(cache, key, out, &stale))
+		return 1;
+	if (!stale)
+		return 0;
+	pthread_mutex_lock(&cache->lock);
+	if (cache->map == stale)
+		reopen(cache);
+	pthread_mutex_unlock(&cache->lock);
+	return lookup(cache, key, out, &stale);
+}
+
+/**
+ * cache_put - Store a derivative
+ * @cache: Open cache
+ * @key: Hash of the normalised input
+ * @value: Text to store
+ * @len: Length of @value
+ *
+ * Appends the value and publishes it in the index. When the data area or
+ * the index (at 3/4 load) is full, the file is started over empty first.
+ *
+ * Returns 0 on success or if the key is present already, -1 if the cache
+ * is read-only, the value can never fit or the file can't be written
+ */
+int cache_put(struct deriv_cache *cache, const struct cache_key *key,
+	      const char *value, size_t len)
+{
+	uint64_t need = sizeof(struct cache_record) + ((len + 7) & ~(size_t)7);
+	struct cache_map *m;
+	struct cache_header *h;
+	struct cache_record *rec;
+	struct cache_slot *slot = NULL;
+	int ret = -1;
+
+	if (cache->read_only)
+		return -1;
+	pthread_mutex_lock(&cache->lock);
+	m = cache->map;
+	if (need > header_of(m)->file_size - header_of(m)->data_start ||
+	    flock(m->fd, LOCK_EX) < 0)
+		goto out;
+	/* another process may have started the file over */
+	while (__atomic_load_n(&header_of(m)->replaced, __ATOMIC_ACQUIRE)) {
+		flock(m->fd, LOCK_UN);
+		m = reopen(cache);
+		if (!m || flock(m->fd, LOCK_EX) < 0)
+			goto out;
+	}
+	h = header_of(m);
+	if (find(m, key, &slot)) {
+		ret = 0;
+		goto out_unlock;
+	}
+	if (h->data_end + need > h->file_size ||
+	    (h->count + 1) * 4 > (uint64_t)h->num_slots * 3) {
+		/* on success the old map is unlocked and unmapped */
+		struct cache_map *fresh = start_over(cache);
+
+		if (!fresh)
+			goto out_unlock;
+		m = fresh;
+		h = header_of(m);
+		find(m, key, &slot);
+	}
+	if (!slot)
+		goto out_unlock;
+
+	/* the record first, then the slot, its offset last */
+	rec = (struct cache_record *)(m->base + h->data_end);
+	rec->hash[0] = key->hash[0];
+	rec->hash[1] = key->hash[1];
+	rec->len = len;
+	memcpy(rec + 1, value, len);
+	slot->hash[0] = key->hash[0];
+	slot->hash[1] = key->hash[1];
+	__atomic_store_n(&slot->offset, h->data_end, __ATOMIC_RELEASE);
+	h->data_end += need;
+	h->count++;
+	ret = 0;
+out_unlock:
+	flock(cache->map->fd, LOCK_UN);
+out:
+	pthread_mutex_unlock(&cache->lock);
+	return ret;
+}
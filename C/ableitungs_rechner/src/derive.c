@@ -0,0 +1,204 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "derive.h"
+
+#define DERIVE_LIVE (NODE_NONE - 1)	/* reachable, derivative pending */
+
+/*
+ * Derivative of one node, given the derivatives of its children in d[].
+ * The result shares the operands of the original node instead of copying
+ * them; both live in the same arena.
+ */
+static uint32_t derive_node(struct expr_arena *arena, uint32_t id,
+			    const uint32_t *d, uint32_t var)
+{
+	const struct node n = arena->nodes[id];
+	uint32_t a = n.lhs, b = n.rhs;
+	uint32_t da, db;
+
+	switch (n.type) {
+	case NODE_CONST:
+		return ast_const(arena, 0.0);
+	case NODE_VAR:
+		return ast_const(arena, n.lhs == var ? 1.0 : 0.0);
+	case NODE_NEG:
+		return ast_neg(arena, d[a]);
+	case NODE_FUNC:
+		break;
+	default:
+		da = d[a];
+		db = d[b];
+		break;
+	}
+
+	switch (n.type) {
+	case NODE_ADD:
+	case NODE_SUB:
+		/* (f +- g)' = f' +- g' */
+		return ast_binary(arena, n.type, da, db);
+	case NODE_MUL:
+		/* (f*g)' = f'*g + f*g' */
+		return ast_binary(arena, NODE_ADD,
+				  ast_binary(arena, NODE_MUL, da, b),
+				  ast_binary(arena, NODE_MUL, a, db));
+	case NODE_DIV:
+		/* (f/c)' = f'/c, (f/g)' = (f'*g - f*g')/g^2 */
+		if (ast_is_const(arena, db, 0.0))
+			return ast_binary(arena, NODE_DIV, da, b);
+		return ast_binary(arena, NODE_DIV,
+				  ast_binary(arena, NODE_SUB,
+					     ast_binary(arena, NODE_MUL, da, b),
+					     ast_binary(arena, NODE_MUL, a, db)),
+				  ast_binary(arena, NODE_POW, b,
+					     ast_const(arena, 2.0)));
+	case NODE_POW:
+		/* (f^c)' = c*f^(c-1)*f' */
+		if (ast_is_const(arena, db, 0.0))
+			return ast_binary(arena, NODE_MUL,
+				ast_binary(arena, NODE_MUL, b,
+					ast_binary(arena, NODE_POW, a,
+						ast_binary(arena, NODE_SUB, b,
+							ast_const(arena, 1.0)))),
+				da);
+		/* (c^g)' = c^g*ln(c)*g' */
+		if (ast_is_const(arena, da, 0.0))
+			return ast_binary(arena, NODE_MUL,
+				ast_binary(arena, NODE_MUL, id,
+					   ast_func(arena, FUNC_LN, a)),
+				db);
+		/* (f^g)' = f^g*(g'*ln(f) + g*f'/f) */
+		return ast_binary(arena, NODE_MUL, id,
+			ast_binary(arena, NODE_ADD,
+				ast_binary(arena, NODE_MUL, db,
+					   ast_func(arena, FUNC_LN, a)),
+				ast_binary(arena, NODE_DIV,
+					ast_binary(arena, NODE_MUL, b, da),
+					a)));
+	case NODE_FUNC:
+		break;
+	default:
+		return NODE_NONE;
+	}
+
+	/* chain rule: f(u)' = f'(u)*u' */
+	da = d[a];
+	switch (n.op) {
+	case FUNC_SIN:
+		return ast_binary(arena, NODE_MUL,
+				  ast_func(arena, FUNC_COS, a), da);
+	case FUNC_COS:
+		return ast_neg(arena,
+			       ast_binary(arena, NODE_MUL,
+					  ast_func(arena, FUNC_SIN, a), da));
+	case FUNC_TAN:
+		return ast_binary(arena, NODE_DIV, da,
+				  ast_binary(arena, NODE_POW,
+					     ast_func(arena, FUNC_COS, a),
+					     ast_const(arena, 2.0)));
+	case FUNC_EXP:
+		return ast_binary(arena, NODE_MUL, id, da);
+	case FUNC_LN:
+		return ast_binary(arena, NODE_DIV, da, a);
+	case FUNC_SQRT:
+		return ast_binary(arena, NODE_DIV, da,
+				  ast_binary(arena, NODE_MUL,
+					     ast_const(arena, 2.0), id));
+	default:
+		return NODE_NONE;
+	}
+}
+
+/**
+ * derive - Differentiate an expression
+ * @arena: Arena holding the expression; the derivative is added to it
+ * @root: Expression to differentiate
+ * @var: Variable to differentiate by
+ *
+ * Works without recursion, so it handles arbitrarily deep trees: a
+ * backward pass over the indices marks the nodes reachable from @root,
+ * then a forward pass derives them children first. Apart from the arena's
+ * own growth this allocates a single index map.
+ *
+ * Derivatives are memoised per (node, variable) in the arena, so a shared
+ * subexpression is derived once, and repeated differentiation only derives
+ * the nodes the previous derivative added.
+ *
+ * Returns the root of the derivative, or NODE_NONE if memory runs out
+ */
+uint32_t derive(struct expr_arena *arena, uint32_t root, uint32_t var)
+{
+	uint32_t *d;
+	uint32_t i, result;
+
+	if (root == NODE_NONE)
+		return NODE_NONE;
+	result = ast_memo_get(arena, root, var);
+	if (result != NODE_NONE)
+		return result;
+
+	d = malloc(sizeof(*d) * ((size_t)root + 1));
+	if (!d)
+		return NODE_NONE;
+	memset(d, 0xff, sizeof(*d) * ((size_t)root + 1));
+
+	d[root] = DERIVE_LIVE;
+	for (i = root + 1; i-- > 0;) {
+		const struct node *n = &arena->nodes[i];
+
+		if (d[i] != DERIVE_LIVE)
+			continue;
+		/* derived before (maybe as part of another expression) */
+		d[i] = ast_memo_get(arena, i, var);
+		if (d[i] != NODE_NONE)
+			continue;
+		d[i] = DERIVE_LIVE;
+		switch (n->type) {
+		case NODE_CONST:
+		case NODE_VAR:
+			break;
+		case NODE_NEG:
+		case NODE_FUNC:
+			d[n->lhs] = DERIVE_LIVE;
+			break;
+		default:
+			d[n->lhs] = DERIVE_LIVE;
+			d[n->rhs] = DERIVE_LIVE;
+			break;
+		}
+	}
+
+	for (i = 0; i <= root; i++) {
+		if (d[i] != DERIVE_LIVE)
+			continue;
+		d[i] = derive_node(arena, i, d, var);
+		if (d[i] == NODE_NONE)
+			break;
+		ast_memo_put(arena, i, var, d[i]);
+	}
+
+	result = i > root ? d[root] : NODE_NONE;
+	free(d);
+	return result;
+}
+
+/**
+ * derive_n - Differentiate an expression k times
+ * @arena: Arena holding the expression; the derivatives are added to it
+ * @root: Expression to differentiate
+ * @var: Variable to differentiate by
+ * @k: Order of the derivative, 0 for @root itself
+ *
+ * Each order is derived from the one before. Through the memo that only
+ * derives the nodes the previous order added, and asking again for an
+ * order already built costs one lookup per order.
+ *
+ * Returns the root of the k-th derivative, or NODE_NONE if memory runs out
+ */
+uint32_t derive_n(struct expr_arena *arena, uint32_t root, uint32_t var,
+		  unsigned int k)
+{
+	while (k-- > 0 && root != NODE_NONE && !ast_is_const(arena, root, 0.0))
+		root = derive(arena, root, var);
+	return root;
+}
@@ -0,0 +1,316 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dual.h"
+
+/*
+ * A register is 1 + dirs rows of DUAL_BATCH doubles: the values, then the
+ * derivative along each direction. Every instruction computes its values
+ * and, where the rule needs one, the local derivative f per point, then
+ * applies the chain rule row by row: t = f*ta (+ g*tb). The rows have
+ * fixed trip counts, so the compiler vectorizes them like the VM kernels;
+ * as in the VM, a destination never shares a register with its operands.
+ *
+ * Most subexpressions depend on only some of the directions (with one
+ * direction per variable, (x - y)^2 has no derivative along z), so every
+ * instruction carries a mask of the directions its result can depend on,
+ * and rows outside it are zeroed instead of computed.
+ */
+#define VAL(expr)						\
+	do {							\
+		for (i = 0; i < DUAL_BATCH; i++)		\
+			d[i] = (expr);				\
+	} while (0)
+
+#define TAN(expr)						\
+	do {							\
+		for (j = 1; j <= dirs; j++) {			\
+			double *restrict dt = d + j * DUAL_BATCH;	\
+			const double *restrict ta = a + j * DUAL_BATCH;	\
+			const double *restrict tb = b + j * DUAL_BATCH;	\
+								\
+			(void)ta;				\
+			(void)tb;				\
+			if (!(mask >> (j - 1) & 1)) {		\
+				memset(dt, 0, sizeof(*dt) * DUAL_BATCH); \
+				continue;			\
+			}					\
+			for (i = 0; i < DUAL_BATCH; i++)	\
+				dt[i] = (expr);			\
+		}						\
+	} while (0)
+
+/* the directions each instruction's result depends on */
+static void dual_masks(const struct vm_program *prog, const double *seeds,
+		       uint32_t dirs, uint32_t *masks, uint32_t *regs)
+{
+	uint32_t pc, j;
+
+	for (pc = 0; pc < prog->num_insns; pc++) {
+		const struct vm_insn *insn = &prog->code[pc];
+		uint32_t m = 0;
+
+		switch (insn->op) {
+		case OP_CONST:
+			break;
+		case OP_VAR:
+			for (j = 0; j < dirs; j++)
+				if (seeds ? seeds[insn->a * dirs + j] != 0.0 :
+				    insn->a == j)
+					m |= 1u << j;
+			break;
+		case OP_ADD:
+		case OP_SUB:
+		case OP_MUL:
+		case OP_DIV:
+		case OP_POW:
+			m = regs[insn->a] | regs[insn->b];
+			break;
+		default:
+			m = regs[insn->a];
+			break;
+		}
+		masks[pc] = regs[insn->dst] = m;
+	}
+}
+
+static void dual_powi(double *restrict d, const double *restrict a, int k)
+{
+	double base[DUAL_BATCH];
+	unsigned int e = k < 0 ? -(unsigned int)k : (unsigned int)k;
+	int i;
+
+	for (i = 0; i < DUAL_BATCH; i++) {
+		d[i] = 1.0;
+		base[i] = a[i];
+	}
+	while (e) {
+		if (e & 1) {
+			for (i = 0; i < DUAL_BATCH; i++)
+				d[i] *= base[i];
+		}
+		e >>= 1;
+		if (e) {
+			for (i = 0; i < DUAL_BATCH; i++)
+				base[i] *= base[i];
+		}
+	}
+	if (k < 0) {
+		for (i = 0; i < DUAL_BATCH; i++)
+			d[i] = 1.0 / d[i];
+	}
+}
+
+static void dual_run_batch(const struct vm_program *prog, double *regs,
+			   uint32_t dirs, const uint32_t *masks,
+			   const double *const *inputs, const double *seeds,
+			   size_t base, int m)
+{
+	size_t stride = (size_t)(dirs + 1) * DUAL_BATCH;
+	double f[DUAL_BATCH], g[DUAL_BATCH];
+	uint32_t pc, j;
+	int i;
+
+	for (pc = 0; pc < prog->num_insns; pc++) {
+		const struct vm_insn *insn = &prog->code[pc];
+		double *restrict d = regs + (size_t)insn->dst * stride;
+		const double *restrict a = regs + (size_t)insn->a * stride;
+		const double *restrict b = regs + (size_t)insn->b * stride;
+		double k = insn->op >= OP_ADDK && insn->op <= OP_RPOWK ?
+			   prog->consts[insn->b] : 0.0;
+		uint32_t mask = masks[pc];
+
+		switch (insn->op) {
+		case OP_CONST:
+			VAL(prog->consts[insn->b]);
+			memset(d + DUAL_BATCH, 0,
+			       sizeof(*d) * DUAL_BATCH * dirs);
+			continue;
+		case OP_VAR:
+			memcpy(d, inputs[insn->a] + base, sizeof(*d) * m);
+			for (i = m; i < DUAL_BATCH; i++)
+				d[i] = d[m - 1];
+			for (j = 1; j <= dirs; j++) {
+				double s = seeds ? seeds[insn->a * dirs + j - 1] :
+					   insn->a == j - 1;
+
+				for (i = 0; i < DUAL_BATCH; i++)
+					d[j * DUAL_BATCH + i] = s;
+			}
+			continue;
+		case OP_ADD:
+			VAL(a[i] + b[i]);
+			TAN(ta[i] + tb[i]);
+			continue;
+		case OP_SUB:
+			VAL(a[i] - b[i]);
+			TAN(ta[i] - tb[i]);
+			continue;
+		case OP_MUL:
+			VAL(a[i] * b[i]);
+			TAN(ta[i] * b[i] + a[i] * tb[i]);
+			continue;
+		case OP_DIV:
+			VAL(a[i] / b[i]);
+			TAN((ta[i] - d[i] * tb[i]) / b[i]);
+			continue;
+		case OP_POW:
+			/* a^b*ln(a) only where b varies, ln(a) may be NaN */
+			VAL(pow(a[i], b[i]));
+			for (i = 0; i < DUAL_BATCH; i++) {
+				f[i] = b[i] * pow(a[i], b[i] - 1.0);
+				g[i] = d[i] * log(a[i]);
+			}
+			TAN(f[i] * ta[i] + (tb[i] != 0.0 ? g[i] * tb[i] : 0.0));
+			continue;
+		case OP_ADDK:
+			VAL(a[i] + k);
+			TAN(ta[i]);
+			continue;
+		case OP_SUBK:
+			VAL(a[i] - k);
+			TAN(ta[i]);
+			continue;
+		case OP_RSUBK:
+			VAL(k - a[i]);
+			TAN(-ta[i]);
+			continue;
+		case OP_MULK:
+			VAL(a[i] * k);
+			TAN(ta[i] * k);
+			continue;
+		case OP_DIVK:
+			VAL(a[i] / k);
+			TAN(ta[i] / k);
+			continue;
+		case OP_NEG:
+			VAL(-a[i]);
+			TAN(-ta[i]);
+			continue;
+		default:
+			break;
+		}
+
+		/* the rest have one operand and a local derivative f */
+		switch (insn->op) {
+		case OP_RDIVK:
+			VAL(k / a[i]);
+			for (i = 0; i < DUAL_BATCH; i++)
+				f[i] = -d[i] / a[i];
+			break;
+		case OP_POWK:
+			VAL(pow(a[i], k));
+			for (i = 0; i < DUAL_BATCH; i++)
+				f[i] = k * pow(a[i], k - 1.0);
+			break;
+		case OP_RPOWK:
+			VAL(pow(k, a[i]));
+			for (i = 0; i < DUAL_BATCH; i++)
+				f[i] = d[i] * log(k);
+			break;
+		case OP_POWI:
+			dual_powi(d, a, (int32_t)insn->b);
+			if ((int32_t)insn->b == 0) {
+				memset(f, 0, sizeof(f));
+				break;
+			}
+			dual_powi(f, a, (int32_t)insn->b - 1);
+			for (i = 0; i < DUAL_BATCH; i++)
+				f[i] *= (int32_t)insn->b;
+			break;
+		case OP_SIN:
+			VAL(sin(a[i]));
+			for (i = 0; i < DUAL_BATCH; i++)
+				f[i] = cos(a[i]);
+			break;
+		case OP_COS:
+			VAL(cos(a[i]));
+			for (i = 0; i < DUAL_BATCH; i++)
+				f[i] = -sin(a[i]);
+			break;
+		case OP_TAN:
+			VAL(tan(a[i]));
+			for (i = 0; i < DUAL_BATCH; i++)
+				f[i] = 1.0 + d[i] * d[i];
+			break;
+		case OP_EXP:
+			VAL(exp(a[i]));
+			memcpy(f, d, sizeof(f));
+			break;
+		case OP_LN:
+			VAL(log(a[i]));
+			for (i = 0; i < DUAL_BATCH; i++)
+				f[i] = 1.0 / a[i];
+			break;
+		case OP_SQRT:
+			VAL(sqrt(a[i]));
+			for (i = 0; i < DUAL_BATCH; i++)
+				f[i] = 0.5 / d[i];
+			break;
+		}
+		TAN(f[i] * ta[i]);
+	}
+}
+
+/**
+ * dual_eval - Evaluate a program and its directional derivatives
+ * @prog: Program from vm_compile()
+ * @inputs: One array of @n values per variable id (inputs[VAR_X] for x)
+ * @seeds: Derivative of each variable along each direction, as
+ *	   seeds[var * @num_dirs + dir]; NULL for direction i = variable i
+ * @num_dirs: Number of directions, at most DUAL_MAX_DIRS
+ * @n: Number of points
+ * @values: One array of @n results per compiled root, or NULL
+ * @derivs: One array of @n derivatives per root and direction, as
+ *	    derivs[root * @num_dirs + dir]
+ *
+ * With one direction and @seeds NULL this is f'(x); with a direction per
+ * variable it is the gradient.
+ *
+ * Returns 0 on success, -1 if there are too many directions or the
+ * registers can't be allocated
+ */
+int dual_eval(const struct vm_program *prog, const double *const *inputs,
+	      const double *seeds, uint32_t num_dirs, size_t n,
+	      double *const *values, double *const *derivs)
+{
+	size_t stride = (size_t)(num_dirs + 1) * DUAL_BATCH, base;
+	double *regs;
+	uint32_t *masks, r, j;
+
+	if (num_dirs > DUAL_MAX_DIRS)
+		return -1;
+	regs = malloc(sizeof(*regs) * stride *
+		      (prog->num_regs ? prog->num_regs : 1));
+	/* the register file doubles as the masks' scratch space */
+	masks = malloc(sizeof(*masks) *
+		       (prog->num_insns ? prog->num_insns : 1));
+	if (!regs || !masks) {
+		free(regs);
+		free(masks);
+		return -1;
+	}
+	dual_masks(prog, seeds, num_dirs, masks, (uint32_t *)regs);
+
+	for (base = 0; base < n; base += DUAL_BATCH) {
+		int m = n - base < DUAL_BATCH ? (int)(n - base) : DUAL_BATCH;
+
+		dual_run_batch(prog, regs, num_dirs, masks, inputs, seeds,
+			       base, m);
+		for (r = 0; r < prog->num_outputs; r++) {
+			const double *reg = regs + prog->outputs[r] * stride;
+
+			if (values)
+				memcpy(values[r] + base, reg, sizeof(double) * m);
+			for (j = 0; j < num_dirs; j++)
+				memcpy(derivs[r * num_dirs + j] + base,
+				       reg + (j + 1) * DUAL_BATCH,
+				       sizeof(double) * m);
+		}
+	}
+
+	free(regs);
+	free(masks);
+	return 0;
+}
@@ -0,0 +1,61 @@
+#include <math.h>
+
+#include "eval.h"
+
+/**
+ * ast_eval - Evaluate an expression at one point by walking the tree
+ * @arena: Arena holding the expression
+ * @root: Expression to evaluate
+ * @vars: Value of each variable id (vars[VAR_X] for x)
+ *
+ * The straightforward reference for the bytecode VM: shared
+ * subexpressions are evaluated once per use, like in a plain tree.
+ *
+ * Returns the value of the expression
+ */
+double ast_eval(const struct expr_arena *arena, uint32_t root,
+		const double *vars)
+{
+	const struct node *n = ast_node(arena, root);
+	double l, r;
+
+	switch (n->type) {
+	case NODE_CONST:
+		return arena->consts[n->lhs];
+	case NODE_VAR:
+		return vars[n->lhs];
+	case NODE_NEG:
+		return -ast_eval(arena, n->lhs, vars);
+	case NODE_FUNC:
+		l = ast_eval(arena, n->lhs, vars);
+		switch (n->op) {
+		case FUNC_SIN:
+			return sin(l);
+		case FUNC_COS:
+			return cos(l);
+		case FUNC_TAN:
+			return tan(l);
+		case FUNC_EXP:
+			return exp(l);
+		case FUNC_LN:
+			return log(l);
+		default:
+			return sqrt(l);
+		}
+	}
+
+	l = ast_eval(arena, n->lhs, vars);
+	r = ast_eval(arena, n->rhs, vars);
+	switch (n->type) {
+	case NODE_ADD:
+		return l + r;
+	case NODE_SUB:
+		return l - r;
+	case NODE_MUL:
+		return l * r;
+	case NODE_DIV:
+		return l / r;
+	default:
+		return pow(l, r);
+	}
+}
@@ -0,0 +1,559 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "format.h"
+
+static const char digit_pairs[201] =
+	"0001020304050607080910111213141516171819"
+	"2021222324252627282930313233343536373839"
+	"4041424344454647484950515253545556575859"
+	"6061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+/**
+ * format_u64 - Format an unsigned integer in decimal
+ * @buf: Output, at least 21 bytes
+ * @v: Value to format
+ *
+ * Returns the length of the string
+ */
+int format_u64(char *buf, uint64_t v)
+{
+	char tmp[20];
+	char *p = tmp + sizeof(tmp);
+	int len;
+
+	/* two digits per division, from the right */
+	while (v >= 100) {
+		unsigned d = (unsigned)(v % 100) * 2;
+
+		v /= 100;
+		p -= 2;
+		p[0] = digit_pairs[d];
+		p[1] = digit_pairs[d + 1];
+	}
+	if (v >= 10) {
+		p -= 2;
+		p[0] = digit_pairs[v * 2];
+		p[1] = digit_pairs[v * 2 + 1];
+	} else {
+		*--p = (char)('0' + v);
+	}
+	len = (int)(tmp + sizeof(tmp) - p);
+	memcpy(buf, p, (size_t)len);
+	buf[len] = '\0';
+	return len;
+}
+
+/*
+ * Shortest digits with Grisu3 (Loitsch, "Printing Floating-Point Numbers
+ * Quickly and Accurately with Integers"): scale the value and the bounds
+ * of its rounding interval by a cached power of ten so the integer part
+ * fits 32 bits, then generate digits until they fall inside the
+ * interval. About one value in 200 can't be decided with 64-bit
+ * arithmetic; those are found by searching printf precisions instead.
+ */
+struct diy_fp {
+	uint64_t f;
+	int e;			/* value is f * 2^e */
+};
+
+struct cached_pow {
+	uint64_t f;
+	int16_t e;
+	int16_t k;		/* 10^k = f * 2^e, rounded */
+};
+
+#define CACHED_MIN_K (-348)
+#define CACHED_STEP 8
+#define MIN_TARGET_EXP (-60)	/* scaled exponents land in [-60, -32] */
+
+static const struct cached_pow cached_pows[] = {
+	{ 0xfa8fd5a0081c0288ULL, -1220, -348 },
+	{ 0xbaaee17fa23ebf76ULL, -1193, -340 },
+	{ 0x8b16fb203055ac76ULL, -1166, -332 },
+	{ 0xcf42894a5dce35eaULL, -1140, -324 },
+	{ 0x9a6bb0aa55653b2dULL, -1113, -316 },
+	{ 0xe61acf033d1a45dfULL, -1087, -308 },
+	{ 0xab70fe17c79ac6caULL, -1060, -300 },
+	{ 0xff77b1fcbebcdc4fULL, -1034, -292 },
+	{ 0xbe5691ef416bd60cULL, -1007, -284 },
+	{ 0x8dd01fad907ffc3cULL, -980, -276 },
+	{ 0xd3515c2831559a83ULL, -954, -268 },
+	{ 0x9d71ac8fada6c9b5ULL, -927, -260 },
+	{ 0xea9c227723ee8bcbULL, -901, -252 },
+	{ 0xaecc49914078536dULL, -874, -244 },
+	{ 0x823c12795db6ce57ULL, -847, -236 },
+	{ 0xc21094364dfb5637ULL, -821, -228 },
+	{ 0x9096ea6f3848984fULL, -794, -220 },
+	{ 0xd77485cb25823ac7ULL, -768, -212 },
+	{ 0xa086cfcd97bf97f4ULL, -741, -204 },
+	{ 0xef340a98172aace5ULL, -715, -196 },
+	{ 0xb23867fb2a35b28eULL, -688, -188 },
+	{ 0x84c8d4dfd2c63f3bULL, -661, -180 },
+	{ 0xc5dd44271ad3cdbaULL, -635, -172 },
+	{ 0x936b9fcebb25c996ULL, -608, -164 },
+	{ 0xdbac6c247d62a584ULL, -582, -156 },
+	{ 0xa3ab66580d5fdaf6ULL, -555, -148 },
+	{ 0xf3e2f893dec3f126ULL, -529, -140 },
+	{ 0xb5b5ada8aaff80b8ULL, -502, -132 },
+	{ 0x87625f056c7c4a8bULL, -475, -124 },
+	{ 0xc9bcff6034c13053ULL, -449, -116 },
+	{ 0x964e858c91ba2655ULL, -422, -108 },
+	{ 0xdff9772470297ebdULL, -396, -100 },
+	{ 0xa6dfbd9fb8e5b88fULL, -369, -92 },
+	{ 0xf8a95fcf88747d94ULL, -343, -84 },
+	{ 0xb94470938fa89bcfULL, -316, -76 },
+	{ 0x8a08f0f8bf0f156bULL, -289, -68 },
+	{ 0xcdb02555653131b6ULL, -263, -60 },
+	{ 0x993fe2c6d07b7facULL, -236, -52 },
+	{ 0xe45c10c42a2b3b06ULL, -210, -44 },
+	{ 0xaa242499697392d3ULL, -183, -36 },
+	{ 0xfd87b5f28300ca0eULL, -157, -28 },
+	{ 0xbce5086492111aebULL, -130, -20 },
+	{ 0x8cbccc096f5088ccULL, -103, -12 },
+	{ 0xd1b71758e219652cULL, -77, -4 },
+	{ 0x9c40000000000000ULL, -50, 4 },
+	{ 0xe8d4a51000000000ULL, -24, 12 },
+	{ 0xad78ebc5ac620000ULL, 3, 20 },
+	{ 0x813f3978f8940984ULL, 30, 28 },
+	{ 0xc097ce7bc90715b3ULL, 56, 36 },
+	{ 0x8f7e32ce7bea5c70ULL, 83, 44 },
+	{ 0xd5d238a4abe98068ULL, 109, 52 },
+	{ 0x9f4f2726179a2245ULL, 136, 60 },
+	{ 0xed63a231d4c4fb27ULL, 162, 68 },
+	{ 0xb0de65388cc8ada8ULL, 189, 76 },
+	{ 0x83c7088e1aab65dbULL, 216, 84 },
+	{ 0xc45d1df942711d9aULL, 242, 92 },
+	{ 0x924d692ca61be758ULL, 269, 100 },
+	{ 0xda01ee641a708deaULL, 295, 108 },
+	{ 0xa26da3999aef774aULL, 322, 116 },
+	{ 0xf209787bb47d6b85ULL, 348, 124 },
+	{ 0xb454e4a179dd1877ULL, 375, 132 },
+	{ 0x865b86925b9bc5c2ULL, 402, 140 },
+	{ 0xc83553c5c8965d3dULL, 428, 148 },
+	{ 0x952ab45cfa97a0b3ULL, 455, 156 },
+	{ 0xde469fbd99a05fe3ULL, 481, 164 },
+	{ 0xa59bc234db398c25ULL, 508, 172 },
+	{ 0xf6c69a72a3989f5cULL, 534, 180 },
+	{ 0xb7dcbf5354e9beceULL, 561, 188 },
+	{ 0x88fcf317f22241e2ULL, 588, 196 },
+	{ 0xcc20ce9bd35c78a5ULL, 614, 204 },
+	{ 0x98165af37b2153dfULL, 641, 212 },
+	{ 0xe2a0b5dc971f303aULL, 667, 220 },
+	{ 0xa8d9d1535ce3b396ULL, 694, 228 },
+	{ 0xfb9b7cd9a4a7443cULL, 720, 236 },
+	{ 0xbb764c4ca7a44410ULL, 747, 244 },
+	{ 0x8bab8eefb6409c1aULL, 774, 252 },
+	{ 0xd01fef10a657842cULL, 800, 260 },
+	{ 0x9b10a4e5e9913129ULL, 827, 268 },
+	{ 0xe7109bfba19c0c9dULL, 853, 276 },
+	{ 0xac2820d9623bf429ULL, 880, 284 },
+	{ 0x80444b5e7aa7cf85ULL, 907, 292 },
+	{ 0xbf21e44003acdd2dULL, 933, 300 },
+	{ 0x8e679c2f5e44ff8fULL, 960, 308 },
+	{ 0xd433179d9c8cb841ULL, 986, 316 },
+	{ 0x9e19db92b4e31ba9ULL, 1013, 324 },
+	{ 0xeb96bf6ebadf77d9ULL, 1039, 332 },
+	{ 0xaf87023b9bf0ee6bULL, 1066, 340 },
+};
+
+static const uint32_t pow10_32[] = {
+	0, 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000,
+	1000000000,
+};
+
+static uint64_t mul_high(uint64_t a, uint64_t b)
+{
+#ifdef __SIZEOF_INT128__
+	unsigned __int128 p = (unsigned __int128)a * b;
+
+	/* rounded to nearest */
+	return (uint64_t)(p >> 64) + ((uint64_t)p >> 63);
+#else
+	uint64_t a_lo = (uint32_t)a, a_hi = a >> 32;
+	uint64_t b_lo = (uint32_t)b, b_hi = b >> 32;
+	uint64_t ll = a_lo * b_lo, lh = a_lo * b_hi;
+	uint64_t hl = a_hi * b_lo, hh = a_hi * b_hi;
+	uint64_t mid = (ll >> 32) + (uint32_t)lh + (uint32_t)hl;
+
+	mid += 1u << 31;
+	return hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+#endif
+}
+
+static struct diy_fp diy_mul(struct diy_fp x, struct diy_fp y)
+{
+	struct diy_fp r = { mul_high(x.f, y.f), x.e + y.e + 64 };
+
+	return r;
+}
+
+static struct diy_fp diy_normalize(struct diy_fp x)
+{
+	while (!(x.f & 0xffc0000000000000ULL)) {
+		x.f <<= 10;
+		x.e -= 10;
+	}
+	while (!(x.f >> 63)) {
+		x.f <<= 1;
+		x.e--;
+	}
+	return x;
+}
+
+/* cached 10^k that scales a normalized 2^e into range; returns k */
+static int cached_pow(int e, struct diy_fp *c)
+{
+	int k = (int)ceil((MIN_TARGET_EXP - e - 1) * 0.30102999566398114);
+	int i = (k - CACHED_MIN_K - 1) / CACHED_STEP + 1;
+
+	c->f = cached_pows[i].f;
+	c->e = cached_pows[i].e;
+	return cached_pows[i].k;
+}
+
+/* move the last digit down while that gets closer to the value */
+static int round_weed(char *digits, int len, uint64_t dist, uint64_t delta,
+		      uint64_t rest, uint64_t ten_kappa, uint64_t ulp)
+{
+	uint64_t small = dist - ulp, big = dist + ulp;
+
+	while (rest < small && delta - rest >= ten_kappa &&
+	       (rest + ten_kappa < small ||
+		small - rest >= rest + ten_kappa - small)) {
+		digits[len - 1]--;
+		rest += ten_kappa;
+	}
+	if (rest < big && delta - rest >= ten_kappa &&
+	    (rest + ten_kappa < big || big - rest > rest + ten_kappa - big))
+		return 0;
+	return 2 * ulp <= rest && rest <= delta - 4 * ulp;
+}
+
+static int digit_gen(struct diy_fp low, struct diy_fp w, struct diy_fp high,
+		     char *digits, int *len, int *kappa)
+{
+	uint64_t unit = 1;
+	uint64_t too_low = low.f - unit, too_high = high.f + unit;
+	uint64_t unsafe = too_high - too_low;
+	int shift = -w.e;
+	uint64_t one = 1ULL << shift;
+	uint32_t p1 = (uint32_t)(too_high >> shift);
+	uint64_t p2 = too_high & (one - 1);
+	uint32_t div;
+	int guess = ((64 - shift + 1) * 1233 >> 12) + 1;
+
+	if (p1 < pow10_32[guess])
+		guess--;
+	div = pow10_32[guess];
+	*kappa = guess;
+	*len = 0;
+
+	while (*kappa > 0) {
+		uint64_t rest;
+
+		digits[(*len)++] = (char)('0' + p1 / div);
+		p1 %= div;
+		(*kappa)--;
+		rest = ((uint64_t)p1 << shift) + p2;
+		if (rest < unsafe)
+			return round_weed(digits, *len, too_high - w.f, unsafe,
+					  rest, (uint64_t)div << shift, unit);
+		div /= 10;
+	}
+	for (;;) {
+		p2 *= 10;
+		unit *= 10;
+		unsafe *= 10;
+		digits[(*len)++] = (char)('0' + (p2 >> shift));
+		p2 &= one - 1;
+		(*kappa)--;
+		if (p2 < unsafe)
+			return round_weed(digits, *len,
+					  (too_high - w.f) * unit, unsafe, p2,
+					  one, unit);
+	}
+}
+
+/* digits of a positive finite @v; it equals digits * 10^*exp */
+static int grisu3(double v, char *digits, int *len, int *exp)
+{
+	struct diy_fp d, w, plus, minus, c;
+	uint64_t bits, frac;
+	int biased, k, kappa;
+
+	memcpy(&bits, &v, sizeof(bits));
+	frac = bits & 0xfffffffffffffULL;
+	biased = (int)(bits >> 52) & 0x7ff;
+	if (biased) {
+		d.f = frac | 1ULL << 52;
+		d.e = biased - 1075;
+	} else {
+		d.f = frac;
+		d.e = -1074;
+	}
+	w = diy_normalize(d);
+
+	/* the interval is asymmetric just above a power of two */
+	plus.f = (d.f << 1) + 1;
+	plus.e = d.e - 1;
+	plus = diy_normalize(plus);
+	if (!frac && biased > 1) {
+		minus.f = (d.f << 2) - 1;
+		minus.e = d.e - 2;
+	} else {
+		minus.f = (d.f << 1) - 1;
+		minus.e = d.e - 1;
+	}
+	minus.f <<= minus.e - plus.e;
+	minus.e = plus.e;
+
+	k = cached_pow(w.e, &c);
+	w = diy_mul(w, c);
+	plus = diy_mul(plus, c);
+	minus = diy_mul(minus, c);
+
+	if (!digit_gen(minus, w, plus, digits, len, &kappa))
+		return -1;
+	*exp = kappa - k;
+	return 0;
+}
+
+/* shortest "%.*e" that reads back as @v, for what Grisu3 leaves open */
+static void search_digits(double v, char *digits, int *len, int *exp)
+{
+	char text[40];
+	int prec, i, n = 0;
+
+	for (prec = 1; prec < 17; prec++) {
+		snprintf(text, sizeof(text), "%.*e", prec - 1, v);
+		if (strtod(text, NULL) == v)
+			break;
+	}
+	if (prec == 17)
+		snprintf(text, sizeof(text), "%.16e", v);
+	for (i = 0; text[i] != 'e'; i++)
+		if (text[i] != '.')
+			digits[n++] = text[i];
+	*len = n;
+	*exp = atoi(text + i + 1) - (n - 1);
+}
+
+/*
+ * Lay out digits * 10^exp like JavaScript does: plain decimals while the
+ * decimal point is within 21 digits left or 6 right of them, otherwise
+ * d.ddde±x. Plain decimals keep polynomial output readable by the
+ * polynomial parser.
+ */
+static int place_digits(char *buf, const char *digits, int len, int exp)
+{
+	int point = len + exp, n = 0;
+
+	if (point > 0 && point <= 21) {
+		if (exp >= 0) {
+			memcpy(buf, digits, (size_t)len);
+			memset(buf + len, '0', (size_t)exp);
+			n = point;
+		} else {
+			memcpy(buf, digits, (size_t)point);
+			buf[point] = '.';
+			memcpy(buf + point + 1, digits + point,
+			       (size_t)(len - point));
+			n = len + 1;
+		}
+	} else if (point <= 0 && point > -6) {
+		buf[n++] = '0';
+		buf[n++] = '.';
+		memset(buf + n, '0', (size_t)-point);
+		n += -point;
+		memcpy(buf + n, digits, (size_t)len);
+		n += len;
+	} else {
+		buf[n++] = digits[0];
+		if (len > 1) {
+			buf[n++] = '.';
+			memcpy(buf + n, digits + 1, (size_t)(len - 1));
+			n += len - 1;
+		}
+		buf[n++] = 'e';
+		if (point - 1 < 0)
+			buf[n++] = '-';
+		n += format_u64(buf + n, (uint64_t)abs(point - 1));
+	}
+	buf[n] = '\0';
+	return n;
+}
+
+/**
+ * format_double - Format a value with the fewest digits that read back
+ * @buf: Output, at least FMT_NUM_MAX bytes
+ * @v: Value to format
+ *
+ * Integers below 2^53 are printed exactly without a fraction. Other
+ * values get the shortest digit string that parses back to exactly @v,
+ * as plain decimals or, for very large and small magnitudes, with an
+ * exponent. Infinity is printed as 1e999, which the parsers read back as
+ * infinity, and NaN as sqrt(-1), which at least the expression parser
+ * accepts.
+ *
+ * Returns the length of the string
+ */
+int format_double(char *buf, double v)
+{
+	char digits[20];
+	int sign = signbit(v) != 0, len, exp;
+
+	if (sign) {
+		*buf = '-';
+		v = -v;
+	}
+	if (v < 9007199254740992.0 && v == (double)(uint64_t)v)
+		return sign + format_u64(buf + sign, (uint64_t)v);
+	if (!isfinite(v))
+		return sign + sprintf(buf + sign, isnan(v) ? "sqrt(-1)" : "1e999");
+
+	if (grisu3(v, digits, &len, &exp) < 0)
+		search_digits(v, digits, &len, &exp);
+	while (len > 1 && digits[len - 1] == '0') {
+		len--;
+		exp++;
+	}
+	return sign + place_digits(buf + sign, digits, len, exp);
+}
+
+/**
+ * fmt_init - Set up an output buffer
+ * @fb: Buffer to set up
+ * @buf: Caller's array to format into, or NULL to allocate
+ * @cap: Size of @buf, or of the first allocation
+ * @stream: Where to write the text when the buffer is full, or NULL
+ *
+ * Without a stream a caller's array can't grow; running out of room in it
+ * marks the buffer failed.
+ */
+void fmt_init(struct fmt_buf *fb, char *buf, size_t cap, FILE *stream)
+{
+	memset(fb, 0, sizeof(*fb));
+	fb->stream = stream;
+	if (buf) {
+		fb->buf = buf;
+		fb->cap = cap;
+		fb->fixed = 1;
+	} else if (cap) {
+		fb->buf = malloc(cap);
+		fb->cap = fb->buf ? cap : 0;
+	}
+}
+
+/**
+ * fmt_flush - Write the buffered text to the buffer's stream
+ * @fb: Buffer to flush
+ *
+ * Returns 0 on success, -1 if the write failed or the buffer has no stream
+ */
+int fmt_flush(struct fmt_buf *fb)
+{
+	if (!fb->stream) {
+		fb->failed = 1;
+		return -1;
+	}
+	if (fb->len && fwrite(fb->buf, 1, fb->len, fb->stream) != fb->len)
+		fb->failed = 1;
+	fb->len = 0;
+	return fb->failed ? -1 : 0;
+}
+
+/* slow path of fmt_space(): flush, grow or fail */
+char *fmt_make_space(struct fmt_buf *fb, size_t n)
+{
+	size_t cap;
+	char *p;
+
+	if (fb->failed)
+		return NULL;
+	if (fb->stream && fmt_flush(fb) < 0)
+		return NULL;
+	if (fb->len + n < fb->cap)
+		return fb->buf + fb->len;
+	if (fb->fixed) {
+		fb->failed = 1;
+		return NULL;
+	}
+
+	cap = fb->cap ? fb->cap * 2 : 256;
+	while (cap <= fb->len + n)
+		cap *= 2;
+	p = realloc(fb->buf, cap);
+	if (!p) {
+		fb->failed = 1;
+		return NULL;
+	}
+	fb->buf = p;
+	fb->cap = cap;
+	return fb->buf + fb->len;
+}
+
+void fmt_put(struct fmt_buf *fb, const char *s, size_t n)
+{
+	char *p;
+
+	/* bigger than the whole buffer: straight through to the stream */
+	if (fb->stream && n >= fb->cap && !fb->failed) {
+		if (fmt_flush(fb) == 0 && fwrite(s, 1, n, fb->stream) != n)
+			fb->failed = 1;
+		return;
+	}
+	p = fmt_space(fb, n);
+	if (p) {
+		memcpy(p, s, n);
+		fb->len += n;
+	}
+}
+
+void fmt_double(struct fmt_buf *fb, double v)
+{
+	char *p = fmt_space(fb, FMT_NUM_MAX);
+
+	if (p)
+		fb->len += (size_t)format_double(p, v);
+}
+
+void fmt_u64(struct fmt_buf *fb, uint64_t v)
+{
+	char *p = fmt_space(fb, 21);
+
+	if (p)
+		fb->len += (size_t)format_u64(p, v);
+}
+
+/**
+ * fmt_finish - Terminate the buffered text
+ * @fb: Buffer without a stream
+ *
+ * Returns the NUL-terminated text, which is the caller's if the buffer was
+ * allocated, or NULL (freeing the buffer) if anything failed
+ */
+char *fmt_finish(struct fmt_buf *fb)
+{
+	if (!fb->failed && !fb->buf)
+		fmt_make_space(fb, 0);
+	if (fb->failed) {
+		fmt_release(fb);
+		return NULL;
+	}
+	fb->buf[fb->len] = '\0';
+	return fb->buf;
+}
+
+/* free an allocated buffer */
+void fmt_release(struct fmt_buf *fb)
+{
+	if (!fb->fixed)
+		free(fb->buf);
+	fb->buf = NULL;
+	fb->len = 0;
+	fb->cap = 0;
+}
@@ -0,0 +1,407 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "gradient.h"
+
+/*
+ * All partial derivatives of an expression come out of one backward
+ * sweep (reverse accumulation done symbolically): the root gets the
+ * adjoint 1, and going from parents to children every node passes its
+ * adjoint, times the local derivative, on to its children. A variable's
+ * adjoint is then its partial derivative. Every node is visited once
+ * however many variables there are, and the adjoints of shared
+ * subexpressions are shared by all partials. Subexpressions without
+ * variables are never entered.
+ *
+ * A Jacobian runs one sweep per row over just the nodes that row
+ * reaches, so its cost follows the size of the rows, not rows times the
+ * whole arena, and the variables reached are its sparsity pattern.
+ */
+struct sweep {
+	struct expr_arena *arena;
+	uint32_t limit;		/* nodes that existed before any sweep */
+	uint8_t *constant;	/* node has no variables */
+	uint32_t *stamp;	/* last row that reached the node, plus one */
+	uint32_t *adj;		/* adjoint, NODE_NONE while there is none */
+	uint32_t *order;	/* nodes reached by the current row */
+	size_t num_order;
+	uint32_t *stack;
+	int failed;
+};
+
+static int sweep_init(struct sweep *s, struct expr_arena *arena)
+{
+	uint32_t i;
+
+	memset(s, 0, sizeof(*s));
+	s->arena = arena;
+	s->limit = arena->num_nodes;
+	s->constant = malloc(s->limit ? s->limit : 1);
+	s->stamp = calloc(s->limit ? s->limit : 1, sizeof(*s->stamp));
+	s->adj = malloc(sizeof(*s->adj) * (s->limit ? s->limit : 1));
+	s->order = malloc(sizeof(*s->order) * (s->limit ? s->limit : 1));
+	s->stack = malloc(sizeof(*s->stack) * (s->limit ? s->limit : 1));
+	if (!s->constant || !s->stamp || !s->adj || !s->order || !s->stack)
+		return -1;
+
+	/* children come first, so one forward pass finds the constants */
+	for (i = 0; i < s->limit; i++) {
+		const struct node *n = ast_node(arena, i);
+
+		switch (n->type) {
+		case NODE_CONST:
+			s->constant[i] = 1;
+			break;
+		case NODE_VAR:
+			s->constant[i] = 0;
+			break;
+		case NODE_NEG:
+		case NODE_FUNC:
+			s->constant[i] = s->constant[n->lhs];
+			break;
+		default:
+			s->constant[i] = s->constant[n->lhs] &&
+					 s->constant[n->rhs];
+			break;
+		}
+	}
+	return 0;
+}
+
+static void sweep_free(struct sweep *s)
+{
+	free(s->constant);
+	free(s->stamp);
+	free(s->adj);
+	free(s->order);
+	free(s->stack);
+}
+
+static int cmp_desc(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? 1 : x > y ? -1 : 0;
+}
+
+/* collect the non-constant nodes under @root, parents first */
+static void reach(struct sweep *s, uint32_t root, uint32_t row)
+{
+	size_t depth = 0;
+
+	s->num_order = 0;
+	if (s->constant[root])
+		return;
+	s->stamp[root] = row + 1;
+	s->stack[depth++] = root;
+	while (depth) {
+		uint32_t id = s->stack[--depth];
+		const struct node *n = ast_node(s->arena, id);
+		uint32_t kids[2];
+		int num_kids = 0, k;
+
+		s->order[s->num_order++] = id;
+		s->adj[id] = NODE_NONE;
+		if (n->type == NODE_NEG || n->type == NODE_FUNC) {
+			kids[num_kids++] = n->lhs;
+		} else if (n->type != NODE_VAR) {
+			kids[num_kids++] = n->lhs;
+			kids[num_kids++] = n->rhs;
+		}
+		for (k = 0; k < num_kids; k++) {
+			if (s->constant[kids[k]] || s->stamp[kids[k]] == row + 1)
+				continue;
+			s->stamp[kids[k]] = row + 1;
+			s->stack[depth++] = kids[k];
+		}
+	}
+	qsort(s->order, s->num_order, sizeof(*s->order), cmp_desc);
+}
+
+static uint32_t mul(struct sweep *s, uint32_t a, uint32_t b)
+{
+	return ast_binary(s->arena, NODE_MUL, a, b);
+}
+
+/* adj[child] += term, or -= term */
+static void accumulate(struct sweep *s, uint32_t child, uint32_t term,
+		       int negate)
+{
+	uint32_t *adj = &s->adj[child];
+
+	if (term == NODE_NONE) {
+		s->failed = 1;
+		return;
+	}
+	if (*adj == NODE_NONE)
+		*adj = negate ? ast_neg(s->arena, term) : term;
+	else
+		*adj = ast_binary(s->arena, negate ? NODE_SUB : NODE_ADD, *adj,
+				  term);
+	if (*adj == NODE_NONE)
+		s->failed = 1;
+}
+
+/* pass the adjoint @g of node @id on to its children */
+static void backward_node(struct sweep *s, uint32_t id, uint32_t g)
+{
+	struct expr_arena *arena = s->arena;
+	const struct node n = arena->nodes[id];
+	uint32_t a = n.lhs, b = n.rhs;
+	int ca = s->constant[a], cb = n.type > NODE_VAR &&
+				     n.type < NODE_NEG ? s->constant[b] : 1;
+
+	switch (n.type) {
+	case NODE_ADD:
+	case NODE_SUB:
+		if (!ca)
+			accumulate(s, a, g, 0);
+		if (!cb)
+			accumulate(s, b, g, n.type == NODE_SUB);
+		return;
+	case NODE_MUL:
+		if (!ca)
+			accumulate(s, a, mul(s, g, b), 0);
+		if (!cb)
+			accumulate(s, b, mul(s, a, g), 0);
+		return;
+	case NODE_DIV:
+		/* d(a/b)/da = 1/b, d(a/b)/db = -(a/b)/b */
+		if (!ca)
+			accumulate(s, a, ast_binary(arena, NODE_DIV, g, b), 0);
+		if (!cb)
+			accumulate(s, b, ast_binary(arena, NODE_DIV,
+						    mul(s, g, id), b), 1);
+		return;
+	case NODE_POW:
+		/* d(a^b)/da = b*a^(b-1), d(a^b)/db = a^b*ln(a) */
+		if (!ca)
+			accumulate(s, a, mul(s, mul(s, b,
+				ast_binary(arena, NODE_POW, a,
+					ast_binary(arena, NODE_SUB, b,
+						   ast_const(arena, 1.0)))),
+				g), 0);
+		if (!cb)
+			accumulate(s, b, mul(s, mul(s, id,
+				ast_func(arena, FUNC_LN, a)), g), 0);
+		return;
+	case NODE_NEG:
+		accumulate(s, a, g, 1);
+		return;
+	case NODE_FUNC:
+		break;
+	default:
+		return;
+	}
+
+	switch (n.op) {
+	case FUNC_SIN:
+		accumulate(s, a, mul(s, ast_func(arena, FUNC_COS, a), g), 0);
+		break;
+	case FUNC_COS:
+		accumulate(s, a, mul(s, ast_func(arena, FUNC_SIN, a), g), 1);
+		break;
+	case FUNC_TAN:
+		accumulate(s, a, ast_binary(arena, NODE_DIV, g,
+				ast_binary(arena, NODE_POW,
+					   ast_func(arena, FUNC_COS, a),
+					   ast_const(arena, 2.0))), 0);
+		break;
+	case FUNC_EXP:
+		accumulate(s, a, mul(s, id, g), 0);
+		break;
+	case FUNC_LN:
+		accumulate(s, a, ast_binary(arena, NODE_DIV, g, a), 0);
+		break;
+	default:
+		accumulate(s, a, ast_binary(arena, NODE_DIV, g,
+				mul(s, ast_const(arena, 2.0), id)), 0);
+		break;
+	}
+}
+
+/* one backward sweep from @root; leaves each variable's partial in adj[] */
+static int sweep_row(struct sweep *s, uint32_t root, uint32_t row)
+{
+	size_t i;
+
+	reach(s, root, row);
+	if (!s->num_order)
+		return 0;
+	s->adj[root] = ast_const(s->arena, 1.0);
+	if (s->adj[root] == NODE_NONE)
+		return -1;
+	for (i = 0; i < s->num_order && !s->failed; i++) {
+		uint32_t id = s->order[i];
+
+		if (s->adj[id] != NODE_NONE &&
+		    ast_node(s->arena, id)->type != NODE_VAR)
+			backward_node(s, id, s->adj[id]);
+	}
+	return s->failed ? -1 : 0;
+}
+
+/**
+ * gradient - All partial derivatives of an expression
+ * @arena: Arena holding the expression; the derivatives are added to it
+ * @root: Expression to differentiate
+ * @vars: Variable ids to differentiate by
+ * @num_vars: Number of entries in @vars
+ * @partials: Output, the derivative by each of @vars (the constant 0 for
+ *	      variables @root doesn't use)
+ *
+ * Returns 0 on success, -1 if memory runs out
+ */
+int gradient(struct expr_arena *arena, uint32_t root, const uint32_t *vars,
+	     size_t num_vars, uint32_t *partials)
+{
+	struct sweep s;
+	uint32_t *by_var = NULL, max_var = 0, zero;
+	size_t i;
+	int ret = -1;
+
+	if (root == NODE_NONE)
+		return -1;
+	for (i = 0; i < num_vars; i++)
+		if (vars[i] > max_var)
+			max_var = vars[i];
+
+	if (sweep_init(&s, arena) < 0 || sweep_row(&s, root, 0) < 0)
+		goto out;
+	zero = ast_const(arena, 0.0);
+	by_var = malloc(sizeof(*by_var) * ((size_t)max_var + 1));
+	if (zero == NODE_NONE || !by_var)
+		goto out;
+
+	for (i = 0; i <= max_var; i++)
+		by_var[i] = zero;
+	for (i = 0; i < s.num_order; i++) {
+		const struct node *n = ast_node(arena, s.order[i]);
+
+		if (n->type == NODE_VAR && n->lhs <= max_var &&
+		    s.adj[s.order[i]] != NODE_NONE)
+			by_var[n->lhs] = s.adj[s.order[i]];
+	}
+	for (i = 0; i < num_vars; i++)
+		partials[i] = by_var[vars[i]];
+	ret = 0;
+
+out:
+	free(by_var);
+	sweep_free(&s);
+	return ret;
+}
+
+struct jac_entry {
+	uint32_t col;
+	uint32_t entry;
+};
+
+static int cmp_col(const void *a, const void *b)
+{
+	uint32_t x = ((const struct jac_entry *)a)->col;
+	uint32_t y = ((const struct jac_entry *)b)->col;
+
+	return x < y ? -1 : x > y;
+}
+
+static int jacobian_reserve(struct jacobian *jac, size_t extra)
+{
+	size_t cap = jac->cap ? jac->cap : 64;
+	uint32_t *col, *entry;
+
+	if (jac->nnz + extra <= jac->cap)
+		return 0;
+	while (cap < jac->nnz + extra)
+		cap *= 2;
+	col = realloc(jac->col, sizeof(*col) * cap);
+	if (!col)
+		return -1;
+	jac->col = col;
+	entry = realloc(jac->entry, sizeof(*entry) * cap);
+	if (!entry)
+		return -1;
+	jac->entry = entry;
+	jac->cap = cap;
+	return 0;
+}
+
+/**
+ * jacobian_build - Sparse Jacobian of a vector of expressions
+ * @arena: Arena holding the expressions; the derivatives are added to it
+ * @roots: One expression per row
+ * @num_roots: Number of rows
+ * @jac: Output, released with jacobian_free()
+ *
+ * The sparsity pattern is structural: a row has an entry for each
+ * variable its expression contains, unless the derivative simplifies to
+ * the constant 0.
+ *
+ * Returns 0 on success, -1 if memory runs out
+ */
+int jacobian_build(struct expr_arena *arena, const uint32_t *roots,
+		   size_t num_roots, struct jacobian *jac)
+{
+	struct sweep s;
+	struct jac_entry *row = NULL;
+	size_t r, i;
+
+	memset(jac, 0, sizeof(*jac));
+	jac->rows = num_roots;
+	jac->row_start = malloc(sizeof(*jac->row_start) * (num_roots + 1));
+	if (sweep_init(&s, arena) < 0 || !jac->row_start)
+		goto fail;
+	row = malloc(sizeof(*row) * (s.limit ? s.limit : 1));
+	if (!row)
+		goto fail;
+
+	for (r = 0; r < num_roots; r++) {
+		size_t n = 0;
+
+		jac->row_start[r] = jac->nnz;
+		if (roots[r] == NODE_NONE || sweep_row(&s, roots[r], r) < 0)
+			goto fail;
+		for (i = 0; i < s.num_order; i++) {
+			uint32_t id = s.order[i];
+
+			if (ast_node(arena, id)->type != NODE_VAR ||
+			    s.adj[id] == NODE_NONE ||
+			    ast_is_const(arena, s.adj[id], 0.0))
+				continue;
+			row[n].col = ast_node(arena, id)->lhs;
+			row[n].entry = s.adj[id];
+			n++;
+		}
+		qsort(row, n, sizeof(*row), cmp_col);
+		if (jacobian_reserve(jac, n) < 0)
+			goto fail;
+		for (i = 0; i < n; i++) {
+			jac->col[jac->nnz] = row[i].col;
+			jac->entry[jac->nnz] = row[i].entry;
+			jac->nnz++;
+		}
+	}
+	jac->row_start[num_roots] = jac->nnz;
+
+	free(row);
+	sweep_free(&s);
+	return 0;
+
+fail:
+	free(row);
+	sweep_free(&s);
+	jacobian_free(jac);
+	return -1;
+}
+
+/**
+ * jacobian_free - Release a Jacobian built by jacobian_build()
+ * @jac: Jacobian to release
+ */
+void jacobian_free(struct jacobian *jac)
+{
+	free(jac->row_start);
+	free(jac->col);
+	free(jac->entry);
+	memset(jac, 0, sizeof(*jac));
+}
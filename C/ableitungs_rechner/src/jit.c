@@ -0,0 +1,588 @@
+#define _DEFAULT_SOURCE		/* MAP_ANONYMOUS, posix_memalign() */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jit.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define HAVE_JIT 1
+#include <sys/mman.h>
+#endif
+
+/*
+ * Register use of the generated function (System V ABI):
+ *
+ *   rbx  inputs		r12  outputs
+ *   r13  byte count	rbp  byte offset of the current points
+ *   r14  constants	r15  scratch (home slot of every VM register)
+ *
+ * VM registers below NUM_MAPPED live in vector registers of the same
+ * number; the others are loaded into T0/T1 from their home slot when used.
+ * sin(), exp() and friends are called through small C helpers, around
+ * which the mapped registers are written back, since the ABI lets the
+ * callee clobber all vector registers.
+ */
+#define NUM_MAPPED 14
+#define T0 14
+#define T1 15
+#define SLOT 32			/* bytes per home slot and constant */
+
+#define RAX 0
+#define RBX 3
+#define RBP 5
+#define R12 12
+#define R14 14
+#define R15 15
+
+/* 66 0F xx opcodes of packed double instructions */
+#define VEC_LOAD 0x10		/* movupd */
+#define VEC_STORE 0x11
+#define VEC_SQRT 0x51
+#define VEC_XOR 0x57
+#define VEC_ADD 0x58
+#define VEC_MUL 0x59
+#define VEC_SUB 0x5c
+#define VEC_DIV 0x5e
+#define VEC_MOVE 0x28		/* movapd between registers */
+
+struct emitter {
+	uint8_t *buf;
+	size_t len;
+	size_t cap;
+	int avx;
+	int failed;
+};
+
+/* register or [base + disp32] or [base + index] memory operand */
+struct operand {
+	int reg;
+	int base;
+	int index;
+	int32_t disp;
+};
+
+static void emit(struct emitter *e, const void *bytes, size_t n)
+{
+	if (e->len + n > e->cap) {
+		size_t cap = e->cap ? e->cap * 2 : 4096;
+		uint8_t *p;
+
+		while (cap < e->len + n)
+			cap *= 2;
+		p = realloc(e->buf, cap);
+		if (!p) {
+			e->failed = 1;
+			return;
+		}
+		e->buf = p;
+		e->cap = cap;
+	}
+	memcpy(e->buf + e->len, bytes, n);
+	e->len += n;
+}
+
+static void emit_byte(struct emitter *e, uint8_t b)
+{
+	emit(e, &b, 1);
+}
+
+static void emit_u32(struct emitter *e, uint32_t v)
+{
+	uint8_t b[4] = { v, v >> 8, v >> 16, v >> 24 };
+
+	emit(e, b, 4);
+}
+
+static struct operand vreg(int reg)
+{
+	struct operand op = { reg, -1, -1, 0 };
+
+	return op;
+}
+
+static struct operand mem(int base, int32_t disp)
+{
+	struct operand op = { -1, base, -1, disp };
+
+	return op;
+}
+
+static struct operand mem_index(int base, int index)
+{
+	struct operand op = { -1, base, index, 0 };
+
+	return op;
+}
+
+static void emit_modrm(struct emitter *e, int reg, const struct operand *rm)
+{
+	if (rm->reg >= 0) {
+		emit_byte(e, 0xc0 | (reg & 7) << 3 | (rm->reg & 7));
+	} else if (rm->index >= 0) {
+		emit_byte(e, (reg & 7) << 3 | 4);
+		emit_byte(e, (rm->index & 7) << 3 | (rm->base & 7));
+	} else {
+		emit_byte(e, 0x80 | (reg & 7) << 3 | (rm->base & 7));
+		if ((rm->base & 7) == 4)
+			emit_byte(e, 0x24);
+		emit_u32(e, (uint32_t)rm->disp);
+	}
+}
+
+/*
+ * One packed double instruction: VEX.256 (reg = src1 op rm) with AVX,
+ * legacy SSE2 (reg = reg op rm) otherwise.
+ */
+static void emit_vec(struct emitter *e, uint8_t opcode, int reg, int src1,
+		     const struct operand *rm)
+{
+	int r = reg >> 3 & 1;
+	int x = rm->index >= 0 ? rm->index >> 3 & 1 : 0;
+	int b = (rm->reg >= 0 ? rm->reg : rm->base) >> 3 & 1;
+
+	if (e->avx) {
+		emit_byte(e, 0xc4);
+		emit_byte(e, (!r) << 7 | (!x) << 6 | (!b) << 5 | 0x01);
+		emit_byte(e, (~src1 & 15) << 3 | 0x04 | 0x01);
+	} else {
+		emit_byte(e, 0x66);
+		if (r || x || b)
+			emit_byte(e, 0x40 | r << 2 | x << 1 | b);
+		emit_byte(e, 0x0f);
+	}
+	emit_byte(e, opcode);
+	emit_modrm(e, reg, rm);
+}
+
+static void vec_load(struct emitter *e, int dst, struct operand src)
+{
+	emit_vec(e, VEC_LOAD, dst, 0, &src);
+}
+
+static void vec_store(struct emitter *e, struct operand dst, int src)
+{
+	emit_vec(e, VEC_STORE, src, 0, &dst);
+}
+
+static void vec_move(struct emitter *e, int dst, int src)
+{
+	struct operand op = vreg(src);
+
+	if (dst != src)
+		emit_vec(e, VEC_MOVE, dst, 0, &op);
+}
+
+/* dst = a op b; with SSE2 dst must not be b unless it is also a */
+static void vec_op(struct emitter *e, uint8_t opcode, int dst, int a,
+		   struct operand b)
+{
+	if (!e->avx) {
+		vec_move(e, dst, a);
+		a = 0;
+	}
+	emit_vec(e, opcode, dst, a, &b);
+}
+
+static struct operand home(uint32_t reg)
+{
+	return mem(R15, (int32_t)(reg * SLOT));
+}
+
+static struct operand konst(uint32_t k)
+{
+	return mem(R14, (int32_t)(k * SLOT));
+}
+
+/* vector register holding VM register @reg, loaded into @tmp if spilled */
+static int use(struct emitter *e, uint32_t reg, int tmp)
+{
+	if (reg < NUM_MAPPED)
+		return reg;
+	vec_load(e, tmp, home(reg));
+	return tmp;
+}
+
+static int def(uint32_t reg)
+{
+	return reg < NUM_MAPPED ? (int)reg : T0;
+}
+
+static void commit(struct emitter *e, uint32_t reg, int vec)
+{
+	if (reg >= NUM_MAPPED)
+		vec_store(e, home(reg), vec);
+}
+
+/* mov rax, [base + disp32] */
+static void load_pointer(struct emitter *e, int base, int32_t disp)
+{
+	struct operand op = mem(base, disp);
+
+	emit_byte(e, 0x48 | (base >> 3 & 1));
+	emit_byte(e, 0x8b);
+	emit_modrm(e, RAX, &op);
+}
+
+/* lea reg, [base + disp32] */
+static void emit_lea(struct emitter *e, int reg, struct operand op)
+{
+	emit_byte(e, 0x48 | (op.base >> 3 & 1));
+	emit_byte(e, 0x8d);
+	emit_modrm(e, reg, &op);
+}
+
+#define HELPER(name, expr)						\
+	static void name(double *d, const double *a, const double *b,	\
+			 int lanes)					\
+	{								\
+		int i;							\
+									\
+		(void)b;						\
+		for (i = 0; i < lanes; i++)				\
+			d[i] = (expr);					\
+	}
+
+HELPER(call_pow, pow(a[i], b[i]))
+HELPER(call_powk, pow(a[i], b[0]))
+HELPER(call_rpowk, pow(b[0], a[i]))
+HELPER(call_sin, sin(a[i]))
+HELPER(call_cos, cos(a[i]))
+HELPER(call_tan, tan(a[i]))
+HELPER(call_exp, exp(a[i]))
+HELPER(call_ln, log(a[i]))
+
+static void emit_call(struct emitter *e, const struct vm_program *prog,
+		      const struct vm_insn *insn)
+{
+	void (*helper)(double *, const double *, const double *, int);
+	uint32_t mapped = prog->num_regs < NUM_MAPPED ? prog->num_regs :
+			  NUM_MAPPED;
+	uint64_t addr;
+	uint32_t r;
+	int i;
+
+	switch (insn->op) {
+	case OP_POW:
+		helper = call_pow;
+		break;
+	case OP_POWK:
+		helper = call_powk;
+		break;
+	case OP_RPOWK:
+		helper = call_rpowk;
+		break;
+	case OP_SIN:
+		helper = call_sin;
+		break;
+	case OP_COS:
+		helper = call_cos;
+		break;
+	case OP_TAN:
+		helper = call_tan;
+		break;
+	case OP_EXP:
+		helper = call_exp;
+		break;
+	default:
+		helper = call_ln;
+		break;
+	}
+
+	for (r = 0; r < mapped; r++)
+		vec_store(e, home(r), r);
+	emit_lea(e, 7, home(insn->dst));		/* rdi */
+	emit_lea(e, 6, home(insn->a));			/* rsi */
+	if (insn->op == OP_POW)
+		emit_lea(e, 2, home(insn->b));		/* rdx */
+	else
+		emit_lea(e, 2, konst(insn->b));
+	emit_byte(e, 0xb9);				/* mov ecx, lanes */
+	emit_u32(e, e->avx ? 4 : 2);
+	emit(e, "\x48\xb8", 2);				/* mov rax, helper */
+	addr = (uint64_t)(uintptr_t)helper;
+	for (i = 0; i < 8; i++)
+		emit_byte(e, addr >> (8 * i));
+	if (e->avx)
+		emit(e, "\xc5\xf8\x77", 3);		/* vzeroupper */
+	emit(e, "\xff\xd0", 2);				/* call rax */
+	for (r = 0; r < mapped; r++)
+		vec_load(e, r, home(r));
+}
+
+/* d *= a^|k| by repeated squaring of a copy of a in T1 */
+static void emit_powi(struct emitter *e, int d, int a, int32_t k)
+{
+	unsigned int n = k < 0 ? -(unsigned int)k : (unsigned int)k;
+
+	vec_move(e, T1, a);
+	while (n) {
+		if (n & 1)
+			vec_op(e, VEC_MUL, d, d, vreg(T1));
+		n >>= 1;
+		if (n)
+			vec_op(e, VEC_MUL, T1, T1, vreg(T1));
+	}
+}
+
+static void emit_insn(struct emitter *e, const struct vm_program *prog,
+		      const struct vm_insn *insn)
+{
+	uint32_t one = prog->num_consts, sign = prog->num_consts + 1;
+	int d = def(insn->dst), a;
+
+	switch (insn->op) {
+	case OP_CONST:
+		vec_load(e, d, konst(insn->b));
+		break;
+	case OP_VAR:
+		load_pointer(e, RBX, (int32_t)(insn->a * sizeof(double *)));
+		vec_load(e, d, mem_index(RAX, RBP));
+		break;
+	case OP_ADD:
+	case OP_SUB:
+	case OP_MUL:
+	case OP_DIV: {
+		static const uint8_t opcodes[] = {
+			VEC_ADD, VEC_SUB, VEC_MUL, VEC_DIV
+		};
+
+		a = use(e, insn->a, T0);
+		vec_op(e, opcodes[insn->op - OP_ADD], d, a,
+		       vreg(use(e, insn->b, T1)));
+		break;
+	}
+	case OP_ADDK:
+	case OP_SUBK:
+	case OP_MULK:
+	case OP_DIVK: {
+		uint8_t opcode = insn->op == OP_ADDK ? VEC_ADD :
+				 insn->op == OP_SUBK ? VEC_SUB :
+				 insn->op == OP_MULK ? VEC_MUL : VEC_DIV;
+
+		vec_op(e, opcode, d, use(e, insn->a, T0), konst(insn->b));
+		break;
+	}
+	case OP_RSUBK:
+	case OP_RDIVK:
+		a = use(e, insn->a, T1);
+		vec_load(e, d, konst(insn->b));
+		vec_op(e, insn->op == OP_RSUBK ? VEC_SUB : VEC_DIV, d, d,
+		       vreg(a));
+		break;
+	case OP_POWI:
+		a = use(e, insn->a, T1);
+		vec_load(e, d, konst(one));
+		emit_powi(e, d, a, (int32_t)insn->b);
+		if ((int32_t)insn->b < 0) {
+			vec_load(e, T1, konst(one));
+			vec_op(e, VEC_DIV, T1, T1, vreg(d));
+			vec_move(e, d, T1);
+		}
+		break;
+	case OP_NEG:
+		vec_op(e, VEC_XOR, d, use(e, insn->a, T0), konst(sign));
+		break;
+	case OP_SQRT: {
+		struct operand src = vreg(use(e, insn->a, T0));
+
+		emit_vec(e, VEC_SQRT, d, 0, &src);
+		break;
+	}
+	default:
+		/* the helper writes the home slot directly */
+		emit_call(e, prog, insn);
+		return;
+	}
+	commit(e, insn->dst, d);
+}
+
+static void emit_function(struct emitter *e, const struct vm_program *prog)
+{
+	size_t loop;
+	uint32_t i;
+
+	/* push rbp, rbx, r12-r15; keep rsp 16-byte aligned for the calls */
+	emit(e, "\x55\x53\x41\x54\x41\x55\x41\x56\x41\x57", 10);
+	emit(e, "\x48\x83\xec\x08", 4);			/* sub rsp, 8 */
+	emit(e, "\x48\x89\xfb", 3);			/* mov rbx, rdi */
+	emit(e, "\x49\x89\xf4", 3);			/* mov r12, rsi */
+	emit(e, "\x49\x89\xd5", 3);			/* mov r13, rdx */
+	emit(e, "\x49\x89\xcf", 3);			/* mov r15, rcx */
+	emit(e, "\x4d\x89\xc6", 3);			/* mov r14, r8 */
+	emit(e, "\x31\xed", 2);				/* xor ebp, ebp */
+
+	loop = e->len;
+	for (i = 0; i < prog->num_insns; i++)
+		emit_insn(e, prog, &prog->code[i]);
+	for (i = 0; i < prog->num_outputs; i++) {
+		int src = use(e, prog->outputs[i], T0);
+
+		load_pointer(e, R12, (int32_t)(i * sizeof(double *)));
+		vec_store(e, mem_index(RAX, RBP), src);
+	}
+
+	emit(e, "\x48\x83\xc5", 3);			/* add rbp, lanes * 8 */
+	emit_byte(e, e->avx ? 32 : 16);
+	emit(e, "\x4c\x39\xed", 3);			/* cmp rbp, r13 */
+	emit(e, "\x0f\x82", 2);				/* jb loop */
+	emit_u32(e, (uint32_t)(loop - (e->len + 4)));
+
+	if (e->avx)
+		emit(e, "\xc5\xf8\x77", 3);		/* vzeroupper */
+	emit(e, "\x48\x83\xc4\x08", 4);			/* add rsp, 8 */
+	emit(e, "\x41\x5f\x41\x5e\x41\x5d\x41\x5c\x5b\x5d\xc3", 11);
+}
+
+/**
+ * jit_compile - Translate a program into native code
+ * @prog: Program from vm_compile(); must outlive @jit
+ * @jit: Filled with the native function; release with jit_free()
+ *
+ * Uses AVX when the CPU has it (ABLEITER_NO_AVX2 keeps it to SSE2) and
+ * falls back to the interpreter if native code isn't possible or
+ * ABLEITER_NO_JIT is set; jit_eval() works either way.
+ *
+ * Returns 0 if native code was generated, -1 if @prog will be interpreted
+ */
+int jit_compile(const struct vm_program *prog, struct jit_program *jit)
+{
+#ifdef HAVE_JIT
+	struct emitter e;
+	void *code;
+	uint32_t k;
+	int i;
+#endif
+
+	memset(jit, 0, sizeof(*jit));
+	jit->prog = prog;
+	jit->lanes = VM_BATCH;
+
+#ifdef HAVE_JIT
+	if (getenv("ABLEITER_NO_JIT"))
+		return -1;
+
+	memset(&e, 0, sizeof(e));
+	__builtin_cpu_init();
+	e.avx = __builtin_cpu_supports("avx") && !getenv("ABLEITER_NO_AVX2");
+
+	if (posix_memalign((void **)&jit->consts, SLOT,
+			   SLOT * ((size_t)prog->num_consts + 2)))
+		return -1;
+	for (k = 0; k < prog->num_consts + 2; k++) {
+		double v = k < prog->num_consts ? prog->consts[k] :
+			   k == prog->num_consts ? 1.0 : -0.0;
+
+		for (i = 0; i < SLOT / (int)sizeof(double); i++)
+			jit->consts[k * SLOT / sizeof(double) + i] = v;
+	}
+
+	emit_function(&e, prog);
+	if (e.failed)
+		goto fail;
+
+	/* write the code, then flip the mapping to read + execute */
+	code = mmap(NULL, e.len, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (code == MAP_FAILED)
+		goto fail;
+	memcpy(code, e.buf, e.len);
+	if (mprotect(code, e.len, PROT_READ | PROT_EXEC) < 0) {
+		munmap(code, e.len);
+		goto fail;
+	}
+
+	free(e.buf);
+	jit->code = code;
+	jit->code_size = e.len;
+	jit->fn = (jit_fn)code;
+	jit->lanes = e.avx ? 4 : 2;
+	return 0;
+
+fail:
+	free(e.buf);
+	free(jit->consts);
+	jit->consts = NULL;
+#endif
+	return -1;
+}
+
+/**
+ * jit_free - Release the native code of a program
+ * @jit: Program from jit_compile()
+ */
+void jit_free(struct jit_program *jit)
+{
+#ifdef HAVE_JIT
+	if (jit->code)
+		munmap(jit->code, jit->code_size);
+#endif
+	free(jit->consts);
+	memset(jit, 0, sizeof(*jit));
+}
+
+/**
+ * jit_eval - Evaluate a program over arrays of points
+ * @jit: Program from jit_compile()
+ * @inputs: One array of @n values per variable id
+ * @n: Number of points
+ * @outputs: One array of @n results per compiled root
+ *
+ * Same contract as vm_eval(), which runs instead if @jit has no native
+ * code.
+ *
+ * Returns 0 on success, -1 if memory runs out
+ */
+int jit_eval(const struct jit_program *jit, const double *const *inputs,
+	     size_t n, double *const *outputs)
+{
+	const struct vm_program *prog = jit->prog;
+	const double *tail_in[VM_MAX_VARS];
+	double tail_vals[VM_MAX_VARS][4];
+	double **tail_out = NULL, *scratch = NULL, *tail_buf = NULL;
+	size_t main_n = n - n % jit->lanes, rest = n - main_n, i;
+	uint32_t j;
+	int ret = -1;
+
+	if (!jit->fn)
+		return vm_eval(prog, inputs, n, outputs);
+
+	if (posix_memalign((void **)&scratch, SLOT,
+			   SLOT * ((size_t)prog->num_regs + 1)))
+		return -1;
+	if (main_n)
+		jit->fn(inputs, outputs, main_n * sizeof(double), scratch,
+			jit->consts);
+
+	/* the last points go through padded copies, like in vm_eval() */
+	if (rest) {
+		tail_out = malloc(sizeof(*tail_out) * (prog->num_outputs + 1));
+		tail_buf = malloc(sizeof(*tail_buf) * 4 *
+				  (prog->num_outputs + 1));
+		if (!tail_out || !tail_buf)
+			goto out;
+		for (j = 0; j < prog->num_vars; j++) {
+			for (i = 0; i < 4; i++)
+				tail_vals[j][i] = inputs[j] ?
+					inputs[j][main_n + (i < rest ? i : rest - 1)] :
+					0.0;
+			tail_in[j] = tail_vals[j];
+		}
+		for (j = 0; j < prog->num_outputs; j++)
+			tail_out[j] = tail_buf + 4 * j;
+		jit->fn(tail_in, tail_out, jit->lanes * sizeof(double),
+			scratch, jit->consts);
+		for (j = 0; j < prog->num_outputs; j++)
+			memcpy(outputs[j] + main_n, tail_out[j],
+			       sizeof(double) * rest);
+	}
+	ret = 0;
+
+out:
+	free(tail_out);
+	free(tail_buf);
+	free(scratch);
+	return ret;
+}
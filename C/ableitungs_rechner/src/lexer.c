@@ -0,0 +1,93 @@
+#include <string.h>
+
+#include "lexer.h"
+#include "number.h"
+
+/**
+ * lexer_init - Start tokenizing a string
+ * @lx: Lexer state
+ * @input: NUL-terminated input; must outlive the tokens
+ */
+void lexer_init(struct lexer *lx, const char *input)
+{
+	lx->input = input;
+	lx->pos = input;
+	lx->end = input + strlen(input);
+}
+
+/**
+ * lexer_next - Read the next token
+ * @lx: Lexer state
+ * @tok: Filled with the token
+ *
+ * Returns 0 on success, -1 on an invalid character (tok->type is TOK_ERROR
+ * and tok->start points at it)
+ */
+int lexer_next(struct lexer *lx, struct token *tok)
+{
+	const char *p;
+
+	while (cc_is(*lx->pos, CC_BLANK))
+		lx->pos++;
+
+	p = lx->pos;
+	tok->start = p;
+	tok->len = 1;
+	tok->value = 0.0;
+
+	if (cc_is(*p, CC_DIGIT) || *p == '.') {
+		p = parse_number(p, lx->end, &tok->value);
+		if (!p) {
+			tok->type = TOK_ERROR;
+			return -1;
+		}
+		tok->type = TOK_NUM;
+		tok->len = p - lx->pos;
+		lx->pos = p;
+		return 0;
+	}
+
+	if (cc_is(*p, CC_ALPHA)) {
+		while (cc_is(*p, CC_ALPHA | CC_DIGIT))
+			p++;
+		tok->type = TOK_IDENT;
+		tok->len = p - lx->pos;
+		lx->pos = p;
+		return 0;
+	}
+
+	switch (*p) {
+	case '\0':
+	case '\n':
+		tok->type = TOK_END;
+		tok->len = 0;
+		return 0;
+	case '+':
+		tok->type = TOK_PLUS;
+		break;
+	case '-':
+		tok->type = TOK_MINUS;
+		break;
+	case '*':
+		tok->type = TOK_MUL;
+		break;
+	case '/':
+		tok->type = TOK_DIV;
+		break;
+	case '^':
+		tok->type = TOK_POW;
+		break;
+	case '(':
+		tok->type = TOK_LPAREN;
+		break;
+	case ')':
+		tok->type = TOK_RPAREN;
+		break;
+	default:
+		tok->type = TOK_ERROR;
+		return -1;
+	}
+
+	lx->pos++;
+	return 0;
+}
@@ -1,205 +1,397 @@
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
 
-#define MAX_TERMS 100
-#define MAX_INPUT 512
-
-struct term {
-	double coeff;	/* Coefficient */
-	int exp;	/* Exponent */
-};
-
-struct polynomial {
-	struct term terms[MAX_TERMS];
-	int num_terms;
-};
+#include "ast.h"
+#include "batch.h"
+#include "derive.h"
+#include "format.h"
+#include "gradient.h"
+#include "parser.h"
+#include "poly.h"
+#include "printer.h"
+#include "simplify.h"
+#include "symtab.h"
+
+#define MAX_INLINE 160	/* longer derivatives are printed with temporaries */
+#define OUT_CHUNK (1 << 16)	/* bytes of output written at a time */
+#define MAX_EXPR_STEPS (1u << 16)	/* derivatives taken before giving up */
+#define MAX_EXPR_NODES (1u << 22)	/* nor grown to more nodes than this */
 
 /**
- * parse_polynomial - Parse polynomial string into terms
- * @input: Input string (e.g., "3x^2+2x-5")
- * @poly: Pointer to polynomial structure
+ * read_line - Read one line of any length
+ * @stream: Input stream
  *
- * Returns 0 on success, -1 on error
+ * Returns the line without its newline (malloc'd), or NULL at end of input
+ * or if memory runs out
  */
-static int parse_polynomial(const char *input, struct polynomial *poly)
+static char *read_line(FILE *stream)
 {
-	int i = 0;
-	int term_idx = 0;
-	char buffer[MAX_INPUT];
-	char *pos = (char *)input;
-
-	poly->num_terms = 0;
-
-	while (*pos != '\0' && term_idx < MAX_TERMS) {
-		double coeff = 0.0;
-		int exp = 0;
-		int sign = 1;
-
-		/* Skip whitespace */
-		while (*pos == ' ' || *pos == '\t')
-			pos++;
-
-		/* Handle sign */
-		if (*pos == '+') {
-			sign = 1;
-			pos++;
-		} else if (*pos == '-') {
-			sign = -1;
-			pos++;
+	size_t len = 0, cap = 256;
+	char *line = malloc(cap);
+
+	if (!line)
+		return NULL;
+	while (fgets(line + len, (int)(cap - len), stream)) {
+		len += strlen(line + len);
+		if (len && line[len - 1] == '\n') {
+			line[len - 1] = '\0';
+			return line;
 		}
+		if (len + 1 == cap) {
+			char *p = realloc(line, cap * 2);
 
-		/* Parse coefficient */
-		i = 0;
-		while (isdigit(*pos) || *pos == '.') {
-			buffer[i++] = *pos;
-			pos++;
-		}
-
-		if (i > 0) {
-			buffer[i] = '\0';
-			coeff = strtod(buffer, NULL);
-		} else if (*pos == 'x') {
-			coeff = 1.0;
-		} else if (*pos == '\0' || *pos == '+' || *pos == '-') {
-			if (i > 0)
-				continue;
-			else
+			if (!p)
 				break;
+			line = p;
+			cap *= 2;
 		}
-
-		/* Parse variable and exponent */
-		if (*pos == 'x') {
-			exp = 1;
-			pos++;
-
-			if (*pos == '^') {
-				pos++;
-				i = 0;
-				while (isdigit(*pos)) {
-					buffer[i++] = *pos;
-					pos++;
-				}
-				if (i > 0) {
-					buffer[i] = '\0';
-					exp = atoi(buffer);
-				}
-			}
-		} else {
-			exp = 0;
-		}
-
-		/* Store term */
-		poly->terms[term_idx].coeff = sign * coeff;
-		poly->terms[term_idx].exp = exp;
-		term_idx++;
-
-		/* Skip whitespace */
-		while (*pos == ' ' || *pos == '\t')
-			pos++;
 	}
+	if (len && !ferror(stream))
+		return line;
+	free(line);
+	return NULL;
+}
 
-	poly->num_terms = term_idx;
-	return (term_idx > 0) ? 0 : -1;
+/**
+ * print_polynomial - Print polynomial in readable format
+ * @poly: Polynomial to print
+ * @name: Name of the polynomial (e.g., "f(x)", "f'(x)")
+ *
+ * Returns 0 on success, -1 if memory runs out or stdout fails
+ */
+static int print_polynomial(const struct polynomial *poly, const char *name)
+{
+	struct fmt_buf out;
+	int ret;
+
+	fmt_init(&out, NULL, OUT_CHUNK, stdout);
+	fmt_put(&out, name, strlen(name));
+	fmt_put(&out, " = ", 3);
+	poly_format(&out, poly);
+	fmt_put(&out, "\n", 1);
+	ret = fmt_flush(&out);
+	fmt_release(&out);
+	return ret;
 }
 
 /**
- * derive_polynomial - Compute derivative of polynomial
- * @poly: Input polynomial
- * @deriv: Output polynomial (derivative)
+ * derivative_name - Name of the k-th derivative of f
+ * @buf: Output, at least 32 bytes
+ * @order: Order of the derivative
  *
- * Computes f'(x) from f(x)
+ * Returns @buf, holding "f'(x)" up to "f'''(x)" and "f^(k)(x)" beyond
  */
-static void derive_polynomial(const struct polynomial *poly,
-			      struct polynomial *deriv)
+static char *derivative_name(char *buf, uint64_t order)
 {
-	int i;
+	if (order <= 3)
+		sprintf(buf, "f%.*s(x)", (int)order, "'''");
+	else
+		sprintf(buf, "f^(%llu)(x)", (unsigned long long)order);
+	return buf;
+}
 
-	deriv->num_terms = 0;
+/**
+ * format_derivative - Format "name = derivative" for printing
+ * @arena: Arena holding the derivative
+ * @deriv: Derivative to format
+ * @name: Name to print it under
+ *
+ * Long derivatives are printed with shared temporaries.
+ *
+ * Returns a malloc'd string ending in a newline, or NULL if memory runs out
+ */
+static char *format_derivative(const struct expr_arena *arena, uint32_t deriv,
+			       const char *name)
+{
+	char df[MAX_INLINE + 2], *line;
+	struct fmt_buf out;
+
+	/*
+	 * Printed inline, a derivative that shares much is exponentially
+	 * long, so stop as soon as it doesn't fit
+	 */
+	fmt_init(&out, df, sizeof(df), NULL);
+	if (ast_format(&out, arena, deriv) < 0 || out.len > MAX_INLINE)
+		return ast_to_string_shared(arena, deriv, name);
+	fmt_finish(&out);
+	line = malloc(strlen(name) + out.len + sizeof(" = \n"));
+	if (line)
+		sprintf(line, "%s = %s\n", name, df);
+	return line;
+}
 
-	for (i = 0; i < poly->num_terms; i++) {
-		if (poly->terms[i].exp > 0) {
-			deriv->terms[deriv->num_terms].coeff =
-				poly->terms[i].coeff * poly->terms[i].exp;
-			deriv->terms[deriv->num_terms].exp =
-				poly->terms[i].exp - 1;
-			deriv->num_terms++;
-		}
+/**
+ * print_gradient - Print the partial derivatives by every variable
+ * @arena: Arena holding the expression, with a symbol table
+ * @root: Expression to differentiate
+ * @vars: Variables @root uses
+ * @num_vars: Number of entries in @vars
+ *
+ * Returns 0 on success, -1 if memory runs out
+ */
+static int print_gradient(struct expr_arena *arena, uint32_t root,
+			  const uint32_t *vars, size_t num_vars)
+{
+	uint32_t *partials = malloc(sizeof(*partials) * num_vars);
+	size_t i;
+	int ret = -1;
+
+	if (!partials || gradient(arena, root, vars, num_vars, partials) < 0)
+		goto out;
+	for (i = 0; i < num_vars; i++) {
+		const char *var = symtab_name(arena->symbols, vars[i]);
+		char *name = malloc(strlen(var) + sizeof("df/d"));
+		char *line;
+
+		if (!name)
+			goto out;
+		sprintf(name, "df/d%s", var);
+		line = format_derivative(arena,
+					 simplify(arena, partials[i], NULL),
+					 name);
+		free(name);
+		if (!line)
+			goto out;
+		fputs(line, stdout);
+		free(line);
 	}
+	ret = 0;
+out:
+	free(partials);
+	return ret;
 }
 
 /**
- * print_polynomial - Print polynomial in readable format
- * @poly: Polynomial to print
- * @name: Name of the polynomial (e.g., "f(x)", "f'(x)")
+ * derive_order - Differentiate an expression in x any number of times
+ * @arena: Arena holding the expression
+ * @root: Expression to differentiate
+ * @order: Order of the derivative
+ *
+ * Nodes are hash-consed, so a derivative equal to an earlier one is the
+ * same node, and from there on the derivatives cycle (sin, cos, -sin,
+ * -cos, sin, ...). Brent's algorithm finds the period, and the rest of
+ * @order is taken modulo it. Others are given up on after MAX_EXPR_STEPS
+ * steps, or as soon as the arena outgrows MAX_EXPR_NODES: most grow
+ * exponentially with the order, as the quotient rule does with 1/x.
+ *
+ * Returns the derivative, or NODE_NONE if memory runs out or it was
+ * given up on
  */
-static void print_polynomial(const struct polynomial *poly, const char *name)
+static uint32_t derive_order(struct expr_arena *arena, uint32_t root,
+			     uint64_t order)
 {
-	int i;
-
-	printf("%s = ", name);
+	uint32_t mark = root;	/* compared with, renewed at powers of 2 */
+	uint64_t power = 1, dist = 0, steps = 0;
+
+	while (order > 0 && root != NODE_NONE &&
+	       !ast_is_const(arena, root, 0.0)) {
+		if (steps++ == MAX_EXPR_STEPS ||
+		    arena->num_nodes > MAX_EXPR_NODES)
+			return NODE_NONE;
+		root = derive(arena, root, VAR_X);
+		order--;
+		dist++;
+		if (root == mark) {
+			order %= dist;
+			mark = NODE_NONE;
+		} else if (dist == power) {
+			mark = root;
+			power *= 2;
+			dist = 0;
+		}
+	}
+	return root;
+}
 
-	if (poly->num_terms == 0) {
-		printf("0\n");
-		return;
+/**
+ * derive_expression - Parse, differentiate and print a general expression
+ * @input: Input string (e.g., "sin(x^2)*exp(x)", or "x*y + z^2" for a
+ *	   gradient)
+ * @order: Order of the derivative, only 1 with several variables
+ *
+ * Returns 0 on success, 1 on error
+ */
+static int derive_expression(const char *input, uint64_t order)
+{
+	struct expr_arena arena;
+	struct symtab symbols;
+	struct parse_error err;
+	uint32_t root, deriv, i, *vars = NULL, num_vars = 0;
+	char *f = NULL, *df = NULL, name[32];
+	int ret = 1;
+
+	if (symtab_init(&symbols) < 0) {
+		fprintf(stderr, "Error: Out of memory\n");
+		return 1;
 	}
+	if (arena_init(&arena, 0) < 0) {
+		fprintf(stderr, "Error: Out of memory\n");
+		symtab_destroy(&symbols);
+		return 1;
+	}
+	arena.symbols = &symbols;
 
-	for (i = 0; i < poly->num_terms; i++) {
-		double coeff = poly->terms[i].coeff;
-		int exp = poly->terms[i].exp;
+	root = parse_expression(&arena, input, &err);
+	if (root == NODE_NONE) {
+		fprintf(stderr, "Error: %s at position %zu\n", err.msg,
+			err.offset + 1);
+		goto out;
+	}
 
-		/* Print sign and coefficient */
-		if (i == 0) {
-			if (coeff >= 0)
-				printf("%.0f", coeff);
-			else
-				printf("%.0f", coeff);
-		} else {
-			if (coeff >= 0)
-				printf(" + %.0f", coeff);
-			else
-				printf(" - %.0f", -coeff);
+	/* the arena holds nothing but the expression yet */
+	vars = malloc(sizeof(*vars) * symbols.num);
+	if (!vars)
+		goto oom;
+	for (i = 0; i <= root; i++)
+		if (ast_node(&arena, i)->type == NODE_VAR)
+			vars[num_vars++] = ast_node(&arena, i)->lhs;
+
+	if (num_vars > 1 || (num_vars == 1 && vars[0] != VAR_X)) {
+		if (order != 1) {
+			fprintf(stderr, "Error: -k needs an expression in x "
+				"alone\n");
+			goto out;
 		}
+		f = ast_to_string(&arena, root);
+		if (!f)
+			goto oom;
+		printf("f = %s\n", f);
+		if (print_gradient(&arena, root, vars, num_vars) < 0)
+			goto oom;
+		ret = 0;
+		goto out;
+	}
 
-		/* Print variable and exponent */
-		if (exp == 0) {
-			/* Already printed coefficient */
-		} else if (exp == 1) {
-			printf("x");
+	derivative_name(name, order);
+	f = ast_to_string(&arena, root);
+	deriv = derive_order(&arena, simplify(&arena, root, NULL), order);
+	if (deriv == NODE_NONE) {
+		fprintf(stderr, "Error: derivative of order %llu too large; "
+			"-k is unbounded only where derivatives repeat or "
+			"reach 0\n", (unsigned long long)order);
+		goto out;
+	}
+	df = format_derivative(&arena, simplify(&arena, deriv, NULL), name);
+	if (!f || !df)
+		goto oom;
+	printf("f(x) = %s\n", f);
+	fputs(df, stdout);
+	ret = 0;
+	goto out;
+
+oom:
+	fprintf(stderr, "Error: Out of memory\n");
+out:
+	free(f);
+	free(df);
+	free(vars);
+	arena_destroy(&arena);
+	symtab_destroy(&symbols);
+	return ret;
+}
+
+/**
+ * run_batch - Handle "ableiter --batch [-j threads] [--cache file] [file]"
+ * @argc: Argument count
+ * @argv: Arguments
+ *
+ * Returns the exit status
+ */
+static int run_batch(int argc, char *argv[])
+{
+	const char *path = NULL, *cache = NULL;
+	int threads = 0, i;
+
+	for (i = 2; i < argc; i++) {
+		if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+			threads = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+			cache = argv[++i];
+		} else if (!path && argv[i][0] != '-') {
+			path = argv[i];
 		} else {
-			printf("x^%d", exp);
+			fprintf(stderr, "Usage: %s --batch [-j threads] "
+				"[--cache file] [file]\n", argv[0]);
+			return 2;
 		}
 	}
+	return batch_run(path, threads, cache);
+}
 
-	printf("\n");
+/**
+ * parse_order - Parse the argument of -k
+ * @arg: Argument
+ * @order: Receives the order
+ *
+ * Returns 0 on success, -1 unless @arg is a decimal number below 2^64
+ */
+static int parse_order(const char *arg, uint64_t *order)
+{
+	unsigned long long v;
+	char *end;
+
+	if (*arg < '0' || *arg > '9')
+		return -1;
+	errno = 0;
+	v = strtoull(arg, &end, 10);
+	if (*end || errno == ERANGE)
+		return -1;
+	*order = v;
+	return 0;
 }
 
-int main(void)
+int main(int argc, char *argv[])
 {
 	struct polynomial poly, deriv;
-	char input[MAX_INPUT];
+	char *input, name[32];
+	size_t offset;
+	uint64_t order = 1;
+	int ret = 1;
+
+	if (argc > 1 && strcmp(argv[1], "--batch") == 0)
+		return run_batch(argc, argv);
+	if (argc > 1 && (argc != 3 || strcmp(argv[1], "-k") != 0 ||
+			 parse_order(argv[2], &order) < 0)) {
+		fprintf(stderr, "Usage: %s [-k order]\n"
+			"       %s --batch [-j threads] [--cache file] "
+			"[file]\n",
+			argv[0], argv[0]);
+		return 2;
+	}
 
 	printf("=== Polynomial Derivative Calculator ===\n");
 	printf("Input format: 3x^2+2x-5 or 4x^3-x+7\n");
+	printf("Expressions with sin, cos, tan, exp, ln, sqrt, * / ^ and ()\n");
+	printf("are differentiated symbolically, e.g. x^2*sin(x)/ln(x)\n");
+	printf("With more variables than x you get the gradient, e.g. x*y + z^2\n");
 	printf("Enter polynomial: ");
 
-	if (fgets(input, sizeof(input), stdin) == NULL)
+	input = read_line(stdin);
+	if (input == NULL)
 		return 1;
 
-	/* Remove newline */
-	input[strcspn(input, "\n")] = '\0';
-
-	if (parse_polynomial(input, &poly) < 0) {
-		fprintf(stderr, "Error: Invalid polynomial format\n");
-		return 1;
+	poly_init(&poly);
+	poly_init(&deriv);
+	/* what the polynomial parser rejects, e.g. "3 x^2", may be an expression */
+	if (!poly_matches(input, strlen(input)) ||
+	    poly_parse(&poly, input, strlen(input), &offset) < 0) {
+		ret = derive_expression(input, order);
+		goto out;
 	}
 
-	print_polynomial(&poly, "f(x)");
-
-	derive_polynomial(&poly, &deriv);
-
-	print_polynomial(&deriv, "f'(x)");
+	if (poly_derive_n(&poly, order, &deriv) < 0 ||
+	    print_polynomial(&poly, "f(x)") < 0 ||
+	    print_polynomial(&deriv, derivative_name(name, order)) < 0) {
+		fprintf(stderr, "Error: Out of memory\n");
+		goto out;
+	}
+	ret = 0;
 
-	return 0;
-}
\ No newline at end of file
+out:
+	poly_free(&poly);
+	poly_free(&deriv);
+	free(input);
+	return ret;
+}
@@ -0,0 +1,222 @@
+#include <string.h>
+
+#include "lexer.h"
+#include "parser.h"
+#include "symtab.h"
+
+/*
+ * Recursive descent over
+ *
+ *	sum     := product (("+" | "-") product)*
+ *	product := unary (("*" | "/") unary | power)*
+ *	unary   := ("+" | "-") unary | power
+ *	power   := primary ("^" unary)?
+ *	primary := NUMBER | "x" | NAME | FUNC "(" sum ")" | "(" sum ")"
+ *
+ * A factor directly followed by an identifier or "(" is an implicit
+ * product, so the polynomial syntax "3x^2+2x-5" parses as well. Names
+ * other than x and the functions are variables, added to the arena's
+ * symbol table; without one they are errors.
+ */
+
+struct parser {
+	struct lexer lx;
+	struct token tok;	/* lookahead */
+	struct expr_arena *arena;
+	struct parse_error *err;
+	int depth;
+};
+
+static uint32_t parse_sum(struct parser *p);
+static uint32_t parse_unary(struct parser *p);
+
+static uint32_t parse_fail(struct parser *p, const char *msg)
+{
+	/* keep the first error, later ones are just fallout */
+	if (!p->err->msg) {
+		p->err->msg = msg;
+		p->err->offset = p->tok.start - p->lx.input;
+	}
+	return NODE_NONE;
+}
+
+static void advance(struct parser *p)
+{
+	if (lexer_next(&p->lx, &p->tok) < 0)
+		parse_fail(p, "invalid character or number");
+}
+
+static int enter(struct parser *p)
+{
+	if (++p->depth > MAX_DEPTH) {
+		parse_fail(p, "expression nested too deeply");
+		return -1;
+	}
+	return 0;
+}
+
+/* any other name is a variable if the arena has a symbol table */
+static uint32_t parse_variable(struct parser *p, struct token t)
+{
+	uint32_t var;
+
+	if (!p->arena->symbols)
+		return parse_fail(p, "unknown identifier");
+	var = symtab_intern(p->arena->symbols, t.start, (size_t)t.len);
+	if (var == SYM_NONE)
+		return parse_fail(p, "out of memory");
+	advance(p);
+	return ast_var(p->arena, var);
+}
+
+static uint32_t parse_primary(struct parser *p)
+{
+	struct token t = p->tok;
+	uint32_t node;
+	int func;
+
+	switch (t.type) {
+	case TOK_NUM:
+		advance(p);
+		return ast_const(p->arena, t.value);
+	case TOK_IDENT:
+		if (t.len == 1 && t.start[0] == 'x') {
+			advance(p);
+			return ast_var(p->arena, VAR_X);
+		}
+		func = ast_func_lookup(t.start, t.len);
+		if (func < 0)
+			return parse_variable(p, t);
+		advance(p);
+		if (p->tok.type != TOK_LPAREN)
+			return parse_fail(p, "expected '(' after function name");
+		advance(p);
+		node = parse_sum(p);
+		if (p->tok.type != TOK_RPAREN)
+			return parse_fail(p, "expected ')'");
+		advance(p);
+		return ast_func(p->arena, func, node);
+	case TOK_LPAREN:
+		advance(p);
+		node = parse_sum(p);
+		if (p->tok.type != TOK_RPAREN)
+			return parse_fail(p, "expected ')'");
+		advance(p);
+		return node;
+	case TOK_END:
+		return parse_fail(p, "unexpected end of input");
+	default:
+		return parse_fail(p, "expected a number, x, a function or '('");
+	}
+}
+
+static uint32_t parse_power(struct parser *p)
+{
+	uint32_t base = parse_primary(p);
+	uint32_t exp;
+
+	if (base == NODE_NONE || p->tok.type != TOK_POW)
+		return base;
+
+	advance(p);
+	if (enter(p) < 0)
+		return NODE_NONE;
+	exp = parse_unary(p);
+	p->depth--;
+	return ast_binary(p->arena, NODE_POW, base, exp);
+}
+
+static uint32_t parse_unary(struct parser *p)
+{
+	uint32_t node;
+
+	if (p->tok.type != TOK_PLUS && p->tok.type != TOK_MINUS)
+		return parse_power(p);
+
+	if (enter(p) < 0)
+		return NODE_NONE;
+	if (p->tok.type == TOK_PLUS) {
+		advance(p);
+		node = parse_unary(p);
+	} else {
+		advance(p);
+		node = ast_neg(p->arena, parse_unary(p));
+	}
+	p->depth--;
+	return node;
+}
+
+static uint32_t parse_product(struct parser *p)
+{
+	uint32_t node = parse_unary(p);
+
+	while (node != NODE_NONE) {
+		enum token_type op = p->tok.type;
+
+		if (op == TOK_MUL || op == TOK_DIV) {
+			advance(p);
+			node = ast_binary(p->arena,
+					  op == TOK_MUL ? NODE_MUL : NODE_DIV,
+					  node, parse_unary(p));
+		} else if (op == TOK_IDENT || op == TOK_LPAREN) {
+			node = ast_binary(p->arena, NODE_MUL, node,
+					  parse_power(p));
+		} else {
+			break;
+		}
+	}
+	return node;
+}
+
+static uint32_t parse_sum(struct parser *p)
+{
+	uint32_t node;
+
+	if (enter(p) < 0)
+		return NODE_NONE;
+
+	node = parse_product(p);
+	while (node != NODE_NONE &&
+	       (p->tok.type == TOK_PLUS || p->tok.type == TOK_MINUS)) {
+		enum node_type type = p->tok.type == TOK_PLUS ?
+				      NODE_ADD : NODE_SUB;
+
+		advance(p);
+		node = ast_binary(p->arena, type, node, parse_product(p));
+	}
+
+	p->depth--;
+	return node;
+}
+
+/**
+ * parse_expression - Parse an expression into an arena
+ * @arena: Arena to allocate the nodes from, and to intern variable names
+ *	   in if it has a symbol table
+ * @input: NUL-terminated input, may end in a newline
+ * @err: Set to the first error and its byte offset on failure
+ *
+ * Returns the root node, or NODE_NONE on error
+ */
+uint32_t parse_expression(struct expr_arena *arena, const char *input,
+			  struct parse_error *err)
+{
+	struct parser p;
+	uint32_t root;
+
+	memset(err, 0, sizeof(*err));
+	p.arena = arena;
+	p.err = err;
+	p.depth = 0;
+	lexer_init(&p.lx, input);
+	advance(&p);
+
+	root = parse_sum(&p);
+	if (root != NODE_NONE && p.tok.type != TOK_END)
+		return parse_fail(&p, "unexpected input");
+	if (root == NODE_NONE && !err->msg) {
+		err->msg = "out of memory";
+		err->offset = p.tok.start - input;
+	}
+	return err->msg ? NODE_NONE : root;
+}
@@ -0,0 +1,742 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "format.h"
+#include "number.h"
+#include "poly.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_AVX2_KERNEL 1
+#include <immintrin.h>
+#endif
+
+/**
+ * poly_init - Initialize an empty polynomial
+ * @poly: Polynomial to initialize
+ */
+void poly_init(struct polynomial *poly)
+{
+	poly->terms = NULL;
+	poly->num_terms = 0;
+	poly->cap_terms = 0;
+}
+
+/**
+ * poly_free - Release the terms of a polynomial
+ * @poly: Polynomial to release; it is left empty and can be reused
+ */
+void poly_free(struct polynomial *poly)
+{
+	free(poly->terms);
+	poly_init(poly);
+}
+
+static int poly_reserve(struct polynomial *poly, size_t need)
+{
+	size_t cap = poly->cap_terms ? poly->cap_terms : 16;
+	struct term *terms;
+
+	if (need <= poly->cap_terms)
+		return 0;
+	while (cap < need)
+		cap *= 2;
+	terms = realloc(poly->terms, sizeof(*terms) * cap);
+	if (!terms)
+		return -1;
+	poly->terms = terms;
+	poly->cap_terms = cap;
+	return 0;
+}
+
+/**
+ * poly_push - Append a term
+ * @poly: Polynomial to append to
+ * @coeff: Coefficient
+ * @exp: Exponent
+ *
+ * The term goes to the end regardless of its exponent; call
+ * poly_normalize() before using the polynomial.
+ *
+ * Returns 0 on success, -1 if memory runs out
+ */
+int poly_push(struct polynomial *poly, double coeff, uint64_t exp)
+{
+	if (poly_reserve(poly, poly->num_terms + 1) < 0)
+		return -1;
+	poly->terms[poly->num_terms].coeff = coeff;
+	poly->terms[poly->num_terms].exp = exp;
+	poly->num_terms++;
+	return 0;
+}
+
+static int compare_terms(const void *a, const void *b)
+{
+	const struct term *ta = a, *tb = b;
+
+	return (ta->exp < tb->exp) - (ta->exp > tb->exp);
+}
+
+/**
+ * poly_normalize - Sort terms, combine like terms and drop zeros
+ * @poly: Polynomial to normalize
+ *
+ * Input that already comes in descending order (the usual way of writing
+ * a polynomial) is only checked, anything else is sorted in O(n log n).
+ */
+void poly_normalize(struct polynomial *poly)
+{
+	size_t i, n = 0, kept = 0;
+
+	for (i = 1; i < poly->num_terms; i++) {
+		if (poly->terms[i].exp > poly->terms[i - 1].exp) {
+			qsort(poly->terms, poly->num_terms,
+			      sizeof(*poly->terms), compare_terms);
+			break;
+		}
+	}
+	for (i = 0; i < poly->num_terms; i++) {
+		if (n && poly->terms[n - 1].exp == poly->terms[i].exp)
+			poly->terms[n - 1].coeff += poly->terms[i].coeff;
+		else
+			poly->terms[n++] = poly->terms[i];
+	}
+	for (i = 0; i < n; i++) {
+		if (poly->terms[i].coeff != 0.0)
+			poly->terms[kept++] = poly->terms[i];
+	}
+	poly->num_terms = kept;
+}
+
+/**
+ * poly_matches - Check whether input fits the polynomial fast path
+ * @input: Input, not necessarily NUL-terminated
+ * @len: Length of the input in bytes
+ *
+ * Polynomials use only digits, '.', 'x', signs and integer exponents;
+ * anything else (functions, '*', '/', parentheses) goes to the expression
+ * engine.
+ */
+int poly_matches(const char *input, size_t len)
+{
+	const char *p = input, *end = input + len;
+
+	while (p < end) {
+		if (!cc_is(*p, CC_POLY))
+			return 0;
+		if (*p++ != '^')
+			continue;
+		if (p == end || !cc_is(*p, CC_DIGIT))
+			return 0;
+		while (p < end && cc_is(*p, CC_DIGIT))
+			p++;
+		if (p < end && (*p == '.' || *p == 'x' || *p == '^'))
+			return 0;
+	}
+	return 1;
+}
+
+static const char *skip_blanks(const char *p, const char *end)
+{
+	while (p < end && cc_is(*p, CC_BLANK))
+		p++;
+	return p;
+}
+
+/**
+ * poly_parse - Parse a polynomial like "3x^2+2x-5"
+ * @poly: Initialized polynomial, replaced by the result (normalized)
+ * @input: Input, not necessarily NUL-terminated; parsed in place
+ * @len: Length of the input in bytes
+ * @err_offset: Receives the byte offset of the error, may be NULL
+ *
+ * Terms are an optional coefficient followed by x or x^n; n may be any
+ * exponent that fits 64 bits. Terms are separated by + or -.
+ *
+ * Returns 0 on success, -1 on a syntax error or if memory runs out
+ */
+int poly_parse(struct polynomial *poly, const char *input, size_t len,
+	       size_t *err_offset)
+{
+	const char *end = input + len;
+	const char *pos = skip_blanks(input, end), *num;
+
+	poly->num_terms = 0;
+	while (pos < end) {
+		double coeff = 1.0;
+		uint64_t exp = 0;
+		int sign = 1;
+
+		if (*pos == '+' || *pos == '-') {
+			sign = *pos == '-' ? -1 : 1;
+			pos = skip_blanks(pos + 1, end);
+		} else if (poly->num_terms) {
+			goto error;
+		}
+
+		num = pos < end && (cc_is(*pos, CC_DIGIT) || *pos == '.') ?
+		      parse_number(pos, end, &coeff) : pos;
+		if (!num)
+			goto error;
+
+		if (num < end && *num == 'x') {
+			pos = num + 1;
+			exp = 1;
+			if (pos < end && *pos == '^') {
+				if (++pos == end || !cc_is(*pos, CC_DIGIT))
+					goto error;
+				for (exp = 0; pos < end && cc_is(*pos, CC_DIGIT);
+				     pos++) {
+					if (exp > (UINT64_MAX - (*pos - '0')) / 10)
+						goto error;
+					exp = exp * 10 + (uint64_t)(*pos - '0');
+				}
+			}
+		} else if (num == pos) {
+			goto error;
+		} else {
+			pos = num;
+		}
+
+		if (poly_push(poly, sign * coeff, exp) < 0)
+			goto error;
+		pos = skip_blanks(pos, end);
+	}
+	if (!poly->num_terms)
+		goto error;
+
+	poly_normalize(poly);
+	return 0;
+
+error:
+	if (err_offset)
+		*err_offset = (size_t)(pos - input);
+	poly->num_terms = 0;
+	return -1;
+}
+
+/**
+ * poly_format - Format a polynomial like "3x^2 + 2x - 5"
+ * @out: Buffer the text is appended to
+ * @poly: Normalized polynomial
+ *
+ * Coefficients are printed with the fewest digits that read back as the
+ * same double.
+ *
+ * Returns 0 on success, -1 if memory or room in @out runs out
+ */
+int poly_format(struct fmt_buf *out, const struct polynomial *poly)
+{
+	size_t i;
+
+	if (!poly->num_terms)
+		fmt_put(out, "0", 1);
+
+	for (i = 0; i < poly->num_terms && !out->failed; i++) {
+		double coeff = poly->terms[i].coeff;
+		uint64_t exp = poly->terms[i].exp;
+		/* sign, coefficient, "x^" and exponent */
+		char *p = fmt_space(out, 3 + FMT_NUM_MAX + 2 + 20);
+		char *start = p;
+
+		if (!p)
+			break;
+		if (i) {
+			memcpy(p, coeff < 0 ? " - " : " + ", 3);
+			p += 3;
+		} else if (coeff < 0) {
+			*p++ = '-';
+		}
+		if (fabs(coeff) != 1.0 || exp == 0)
+			p += format_double(p, fabs(coeff));
+		if (exp) {
+			*p++ = 'x';
+			if (exp > 1) {
+				*p++ = '^';
+				p += format_u64(p, exp);
+			}
+		}
+		out->len += (size_t)(p - start);
+	}
+	return out->failed ? -1 : 0;
+}
+
+/**
+ * poly_to_string - Format a polynomial into a new string
+ * @poly: Normalized polynomial
+ *
+ * See poly_format().
+ *
+ * Returns a malloc'd string, or NULL if memory runs out
+ */
+char *poly_to_string(const struct polynomial *poly)
+{
+	struct fmt_buf out = { 0 };
+
+	poly_format(&out, poly);
+	return fmt_finish(&out);
+}
+
+/* move a freshly built result into @out, which may alias an input */
+static void poly_replace(struct polynomial *out, struct polynomial *result)
+{
+	free(out->terms);
+	*out = *result;
+}
+
+/**
+ * poly_add - Add two polynomials
+ * @a: Normalized polynomial
+ * @b: Normalized polynomial
+ * @out: Initialized polynomial receiving a + b; may be @a or @b
+ *
+ * Returns 0 on success, -1 if memory runs out
+ */
+int poly_add(const struct polynomial *a, const struct polynomial *b,
+	     struct polynomial *out)
+{
+	struct polynomial sum;
+	size_t i = 0, j = 0;
+
+	poly_init(&sum);
+	if (poly_reserve(&sum, a->num_terms + b->num_terms) < 0)
+		return -1;
+
+	while (i < a->num_terms || j < b->num_terms) {
+		struct term t;
+
+		if (j == b->num_terms ||
+		    (i < a->num_terms && a->terms[i].exp > b->terms[j].exp)) {
+			t = a->terms[i++];
+		} else if (i == a->num_terms ||
+			   b->terms[j].exp > a->terms[i].exp) {
+			t = b->terms[j++];
+		} else {
+			t.exp = a->terms[i].exp;
+			t.coeff = a->terms[i++].coeff + b->terms[j++].coeff;
+			if (t.coeff == 0.0)
+				continue;
+		}
+		sum.terms[sum.num_terms++] = t;
+	}
+
+	poly_replace(out, &sum);
+	return 0;
+}
+
+/**
+ * poly_derive - Differentiate a polynomial
+ * @poly: Normalized polynomial
+ * @out: Initialized polynomial receiving the derivative; may be @poly
+ *
+ * Returns 0 on success, -1 if memory runs out
+ */
+int poly_derive(const struct polynomial *poly, struct polynomial *out)
+{
+	struct polynomial deriv;
+	size_t i;
+
+	poly_init(&deriv);
+	if (poly_reserve(&deriv, poly->num_terms) < 0)
+		return -1;
+
+	for (i = 0; i < poly->num_terms; i++) {
+		const struct term *t = &poly->terms[i];
+		double coeff = t->coeff * (double)t->exp;
+
+		if (t->exp == 0 || coeff == 0.0)
+			continue;
+		deriv.terms[deriv.num_terms].coeff = coeff;
+		deriv.terms[deriv.num_terms].exp = t->exp - 1;
+		deriv.num_terms++;
+	}
+
+	poly_replace(out, &deriv);
+	return 0;
+}
+
+#define FF_TILE 256		/* terms scaled together by poly_derive_n() */
+
+/*
+ * c *= e*(e-1)*...*(e-k+1) for a whole tile of exponents below 2^53. The
+ * fixed trip count lets the compiler vectorize the inner loop; unused
+ * entries are 0 and stay 0.
+ */
+static void falling_factorials(double *c, const double *e, uint64_t k)
+{
+	uint64_t j;
+	size_t i;
+
+	for (j = 0; j < k; j++) {
+		for (i = 0; i < FF_TILE; i++)
+			c[i] *= e[i] - (double)j;
+		/* every product has become 0 or infinite: it stays that way */
+		if (j % 32 == 31) {
+			for (i = 0; i < FF_TILE && (c[i] == 0.0 || isinf(c[i]));
+			     i++)
+				;
+			if (i == FF_TILE)
+				break;
+		}
+	}
+}
+
+/**
+ * poly_derive_n - Differentiate a polynomial k times
+ * @poly: Normalized polynomial
+ * @k: Order of the derivative
+ * @out: Initialized polynomial receiving the derivative; may be @poly
+ *
+ * c*x^e becomes c*e*(e-1)*...*(e-k+1)*x^(e-k) in one pass over the terms.
+ * The factors are applied in the order k calls of poly_derive() would,
+ * so the coefficients come out bit for bit the same, but a tile of terms
+ * is multiplied by one factor at a time, which vectorizes and keeps the
+ * tile in L1 instead of streaming the whole polynomial k times.
+ *
+ * Returns 0 on success, -1 if memory runs out
+ */
+int poly_derive_n(const struct polynomial *poly, uint64_t k,
+		  struct polynomial *out)
+{
+	struct polynomial deriv;
+	double c[FF_TILE], e[FF_TILE];
+	size_t i = 0, t, len;
+
+	poly_init(&deriv);
+	if (poly_reserve(&deriv, poly->num_terms) < 0)
+		return -1;
+
+	/*
+	 * Exponents are descending, so the surviving terms come first, and
+	 * among them those whose e - j would round as a double
+	 */
+	for (; i < poly->num_terms && poly->terms[i].exp >= k &&
+	       poly->terms[i].exp >= (1ULL << 53); i++) {
+		const struct term *term = &poly->terms[i];
+		double coeff = term->coeff;
+		uint64_t j;
+
+		for (j = 0; j < k && coeff != 0.0 && !isinf(coeff); j++)
+			coeff *= (double)(term->exp - j);
+		if (coeff != 0.0) {
+			deriv.terms[deriv.num_terms].coeff = coeff;
+			deriv.terms[deriv.num_terms].exp = term->exp - k;
+			deriv.num_terms++;
+		}
+	}
+
+	for (; i < poly->num_terms && poly->terms[i].exp >= k; i += len) {
+		for (len = 0; len < FF_TILE && i + len < poly->num_terms &&
+			      poly->terms[i + len].exp >= k; len++) {
+			c[len] = poly->terms[i + len].coeff;
+			e[len] = (double)poly->terms[i + len].exp;
+		}
+		for (t = len; t < FF_TILE; t++)
+			c[t] = e[t] = 0.0;
+		falling_factorials(c, e, k);
+		for (t = 0; t < len; t++) {
+			if (c[t] == 0.0)
+				continue;
+			deriv.terms[deriv.num_terms].coeff = c[t];
+			deriv.terms[deriv.num_terms].exp =
+				poly->terms[i + t].exp - k;
+			deriv.num_terms++;
+		}
+	}
+
+	poly_replace(out, &deriv);
+	return 0;
+}
+
+/**
+ * poly_taylor - Taylor coefficients of a polynomial around a point
+ * @poly: Normalized polynomial
+ * @a: Expansion point
+ * @n: Number of coefficients
+ * @coeffs: Output, the coefficients of (x - a)^0 to (x - a)^(n-1)
+ *
+ * Each term c*x^e adds c*C(e,k)*a^(e-k) to coefficient k, so all n come
+ * out of one pass over the terms with one pow() per term.
+ */
+void poly_taylor(const struct polynomial *poly, double a, size_t n,
+		 double *coeffs)
+{
+	size_t i;
+
+	memset(coeffs, 0, sizeof(*coeffs) * n);
+	if (!n)
+		return;
+
+	for (i = 0; i < poly->num_terms; i++) {
+		const struct term *t = &poly->terms[i];
+		uint64_t top = t->exp < n - 1 ? t->exp : n - 1, k;
+		double binom = 1.0, pw;
+
+		/* C(e,k) upwards, then a^(e-k) downwards from k = top */
+		for (k = 1; k <= top; k++)
+			binom = binom * (double)(t->exp - k + 1) / (double)k;
+		pw = pow(a, (double)(t->exp - top));
+		for (k = top + 1; k-- > 0;) {
+			coeffs[k] += t->coeff * binom * pw;
+			pw *= a;
+			if (k)
+				binom = binom * (double)k /
+					(double)(t->exp - k + 1);
+		}
+	}
+}
+
+/*
+ * The points are processed in tiles that stay in L1 together with their
+ * running f and f'. Dense polynomials run Horner's scheme for both at once
+ * (f' = f'*x + f, then f = f*x + c) over blocks of coefficients, so a
+ * high degree streams its coefficients through the cache once per tile
+ * rather than once per point. Sparse polynomials instead step from one
+ * power of x to the next by repeated squaring.
+ */
+#define TILE 1024		/* points per tile */
+#define COEF_BLOCK 1024		/* coefficients per Horner pass */
+#define GROUP 16		/* points per register block (4 AVX2 vectors) */
+
+/**
+ * poly_uses_avx2 - Check whether batches use the AVX2/FMA kernel
+ *
+ * Setting ABLEITER_NO_AVX2 in the environment forces the scalar kernel.
+ */
+int poly_uses_avx2(void)
+{
+#ifdef HAVE_AVX2_KERNEL
+	static int supported = -1;
+
+	if (supported < 0) {
+		__builtin_cpu_init();
+		supported = __builtin_cpu_supports("avx2") &&
+			    __builtin_cpu_supports("fma") &&
+			    getenv("ABLEITER_NO_AVX2") == NULL;
+	}
+	return supported;
+#else
+	return 0;
+#endif
+}
+
+static void horner_scalar(const double *coeffs, size_t hi, size_t lo,
+			  const double *restrict x, double *restrict f,
+			  double *restrict df, size_t m)
+{
+	size_t i, k;
+
+	for (i = 0; i < m; i++) {
+		double xi = x[i], fi = f[i], dfi = df[i];
+
+		for (k = hi + 1; k-- > lo;) {
+			dfi = dfi * xi + fi;
+			fi = fi * xi + coeffs[k];
+		}
+		f[i] = fi;
+		df[i] = dfi;
+	}
+}
+
+#ifdef HAVE_AVX2_KERNEL
+/* four independent Horner chains hide the FMA latency */
+__attribute__((target("avx2,fma")))
+static void horner_avx2(const double *coeffs, size_t hi, size_t lo,
+			const double *x, double *f, double *df, size_t m)
+{
+	size_t i, k;
+
+	for (i = 0; i < m; i += GROUP) {
+		__m256d x0 = _mm256_loadu_pd(x + i);
+		__m256d x1 = _mm256_loadu_pd(x + i + 4);
+		__m256d x2 = _mm256_loadu_pd(x + i + 8);
+		__m256d x3 = _mm256_loadu_pd(x + i + 12);
+		__m256d f0 = _mm256_loadu_pd(f + i);
+		__m256d f1 = _mm256_loadu_pd(f + i + 4);
+		__m256d f2 = _mm256_loadu_pd(f + i + 8);
+		__m256d f3 = _mm256_loadu_pd(f + i + 12);
+		__m256d d0 = _mm256_loadu_pd(df + i);
+		__m256d d1 = _mm256_loadu_pd(df + i + 4);
+		__m256d d2 = _mm256_loadu_pd(df + i + 8);
+		__m256d d3 = _mm256_loadu_pd(df + i + 12);
+
+		for (k = hi + 1; k-- > lo;) {
+			__m256d c = _mm256_broadcast_sd(coeffs + k);
+
+			d0 = _mm256_fmadd_pd(d0, x0, f0);
+			d1 = _mm256_fmadd_pd(d1, x1, f1);
+			d2 = _mm256_fmadd_pd(d2, x2, f2);
+			d3 = _mm256_fmadd_pd(d3, x3, f3);
+			f0 = _mm256_fmadd_pd(f0, x0, c);
+			f1 = _mm256_fmadd_pd(f1, x1, c);
+			f2 = _mm256_fmadd_pd(f2, x2, c);
+			f3 = _mm256_fmadd_pd(f3, x3, c);
+		}
+		_mm256_storeu_pd(f + i, f0);
+		_mm256_storeu_pd(f + i + 4, f1);
+		_mm256_storeu_pd(f + i + 8, f2);
+		_mm256_storeu_pd(f + i + 12, f3);
+		_mm256_storeu_pd(df + i, d0);
+		_mm256_storeu_pd(df + i + 4, d1);
+		_mm256_storeu_pd(df + i + 8, d2);
+		_mm256_storeu_pd(df + i + 12, d3);
+	}
+}
+#endif
+
+/* p *= x^e for every point, by squaring a copy of x */
+static void mul_pow(double *restrict p, const double *restrict x,
+		    double *restrict base, uint64_t e, size_t m)
+{
+	size_t i;
+
+	if (!e)
+		return;
+	memcpy(base, x, sizeof(*base) * m);
+	for (;;) {
+		if (e & 1) {
+			for (i = 0; i < m; i++)
+				p[i] *= base[i];
+		}
+		e >>= 1;
+		if (!e)
+			break;
+		for (i = 0; i < m; i++)
+			base[i] *= base[i];
+	}
+}
+
+/*
+ * Terms from the lowest exponent up: p walks through x^(e-1) for each
+ * term, which gives c*e*x^(e-1) for f' and c*x^e for f.
+ */
+static void sparse_tile(const struct polynomial *poly,
+			const double *restrict x, double *restrict f,
+			double *restrict df, double *restrict p,
+			double *restrict base, size_t m)
+{
+	uint64_t q = 0;
+	size_t i, t;
+
+	for (i = 0; i < m; i++) {
+		f[i] = 0.0;
+		df[i] = 0.0;
+		p[i] = 1.0;
+	}
+	for (t = poly->num_terms; t-- > 0;) {
+		const struct term *term = &poly->terms[t];
+		double c = term->coeff;
+		double ce = c * (double)term->exp;
+
+		if (term->exp == 0) {
+			for (i = 0; i < m; i++)
+				f[i] += c;
+			continue;
+		}
+		mul_pow(p, x, base, term->exp - 1 - q, m);
+		q = term->exp - 1;
+		for (i = 0; i < m; i++) {
+			df[i] += ce * p[i];
+			f[i] += c * p[i] * x[i];
+		}
+	}
+}
+
+/* squarings plus multiplications to reach x^e from x^0 step by step */
+static double sparse_cost(const struct polynomial *poly)
+{
+	uint64_t q = 0, gap;
+	double cost = 0.0;
+	size_t t;
+
+	for (t = poly->num_terms; t-- > 0;) {
+		if (!poly->terms[t].exp)
+			continue;
+		for (gap = poly->terms[t].exp - 1 - q; gap; gap >>= 1)
+			cost += 2.0;
+		cost += 4.0;
+		q = poly->terms[t].exp - 1;
+	}
+	return cost;
+}
+
+/**
+ * poly_eval_batch - Evaluate a polynomial and its derivative at many points
+ * @poly: Normalized polynomial
+ * @xs: Points to evaluate at
+ * @n: Number of points
+ * @out_f: Receives f(xs[i]), may be NULL
+ * @out_df: Receives f'(xs[i]), may be NULL
+ *
+ * Picks Horner's scheme over a dense coefficient array or, when the
+ * exponents are spread far apart, repeated squaring between the terms,
+ * whichever takes fewer multiplications per point.
+ *
+ * Returns 0 on success, -1 if memory runs out
+ */
+int poly_eval_batch(const struct polynomial *poly, const double *xs, size_t n,
+		    double *out_f, double *out_df)
+{
+	double *coeffs = NULL, *buf;
+	double *x, *f, *df, *p, *base;
+	uint64_t degree = poly->num_terms ? poly->terms[0].exp : 0;
+	size_t start, m, padded, hi, lo, t;
+	int dense;
+
+	dense = poly->num_terms &&
+		2.0 * (double)degree + 2.0 <= sparse_cost(poly);
+	if (dense) {
+		coeffs = calloc((size_t)degree + 1, sizeof(*coeffs));
+		if (!coeffs)
+			return -1;
+		for (t = 0; t < poly->num_terms; t++)
+			coeffs[poly->terms[t].exp] = poly->terms[t].coeff;
+	}
+
+	buf = malloc(sizeof(*buf) * TILE * 5);
+	if (!buf) {
+		free(coeffs);
+		return -1;
+	}
+	x = buf;
+	f = x + TILE;
+	df = f + TILE;
+	p = df + TILE;
+	base = p + TILE;
+
+	for (start = 0; start < n; start += TILE) {
+		m = n - start < TILE ? n - start : TILE;
+		padded = (m + GROUP - 1) / GROUP * GROUP;
+		memcpy(x, xs + start, sizeof(*x) * m);
+		memset(x + m, 0, sizeof(*x) * (padded - m));
+
+		if (dense) {
+			memset(f, 0, sizeof(*f) * padded);
+			memset(df, 0, sizeof(*df) * padded);
+			for (hi = degree;; hi = lo - 1) {
+				lo = hi >= COEF_BLOCK ? hi - COEF_BLOCK + 1 : 0;
+#ifdef HAVE_AVX2_KERNEL
+				if (poly_uses_avx2())
+					horner_avx2(coeffs, hi, lo, x, f, df,
+						    padded);
+				else
+#endif
+					horner_scalar(coeffs, hi, lo, x, f, df,
+						      padded);
+				if (!lo)
+					break;
+			}
+		} else {
+			sparse_tile(poly, x, f, df, p, base, m);
+		}
+
+		if (out_f)
+			memcpy(out_f + start, f, sizeof(*f) * m);
+		if (out_df)
+			memcpy(out_df + start, df, sizeof(*df) * m);
+	}
+
+	free(buf);
+	free(coeffs);
+	return 0;
+}
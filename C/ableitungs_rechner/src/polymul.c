@@ -0,0 +1,847 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "poly.h"
+
+/*
+ * Products pick their method by the shape of the factors. Sparse or
+ * small factors are merged term by term (mul_heap). Dense ones, whose
+ * exponents fill most of their range, are multiplied as coefficient
+ * arrays: schoolbook below KARATSUBA_MIN coefficients, Karatsuba above.
+ *
+ * If every coefficient is an integer and the products can't exceed
+ * three NTT primes, the product is computed modulo those primes with
+ * number-theoretic transforms and put back together by the Chinese
+ * remainder theorem, so each coefficient is the exact integer rounded
+ * once. Below NTT_MIN this only happens when Karatsuba in doubles could
+ * round. Floating point coefficients are never transformed, since an
+ * FFT's error would swamp their small coefficients. Nor do they go
+ * through Karatsuba, whose sums and differences of products leave the
+ * residue of their cancellation where no two terms meet: whatever
+ * Karatsuba can't do exactly is multiplied by schoolbook at any size.
+ *
+ * The thresholds are the crossovers bench_polymul measures.
+ */
+#define DENSE_RATIO 4		/* dense: exponent range <= 4 x the terms */
+#define DENSE_MAX ((size_t)1 << 30)	/* coefficients of a forced dense run */
+#define KARATSUBA_MIN 32	/* shorter factor, schoolbook below */
+#define NTT_MIN 1024		/* shorter factor, Karatsuba below */
+#define NTT_PRIMES 3
+#define NTT_MAX_LOG 25		/* 2^25 divides every p - 1 */
+#define EXACT_MAX 9007199254740992.0	/* 2^53 */
+
+/* move a freshly built result into @out, which may alias an input */
+static void poly_replace(struct polynomial *out, struct polynomial *result)
+{
+	free(out->terms);
+	*out = *result;
+}
+
+struct heap_entry {
+	uint64_t exp;
+	size_t i;		/* term of the shorter factor */
+	size_t j;		/* next term of the longer factor */
+};
+
+static void heap_sift_down(struct heap_entry *heap, size_t n, size_t k)
+{
+	struct heap_entry e = heap[k];
+
+	for (;;) {
+		size_t c = 2 * k + 1;
+
+		if (c >= n)
+			break;
+		if (c + 1 < n && heap[c + 1].exp > heap[c].exp)
+			c++;
+		if (heap[c].exp <= e.exp)
+			break;
+		heap[k] = heap[c];
+		k = c;
+	}
+	heap[k] = e;
+}
+
+/*
+ * Each term of the shorter factor times the longer one is a sorted
+ * stream; a max-heap merges the streams, so the product comes out sorted
+ * and combined in O(n m log min(n, m)).
+ */
+static int mul_heap(const struct polynomial *a, const struct polynomial *b,
+		    struct polynomial *out)
+{
+	const struct polynomial *s = a->num_terms <= b->num_terms ? a : b;
+	const struct polynomial *l = s == a ? b : a;
+	struct polynomial prod;
+	struct heap_entry *heap;
+	size_t n = s->num_terms, i;
+
+	poly_init(&prod);
+	heap = malloc(sizeof(*heap) * n);
+	if (!heap)
+		return -1;
+	for (i = 0; i < n; i++) {
+		heap[i].exp = s->terms[i].exp + l->terms[0].exp;
+		heap[i].i = i;
+		heap[i].j = 0;
+	}
+	/* already a heap: the exponents of s descend */
+
+	while (n) {
+		struct heap_entry *top = &heap[0];
+		double c = s->terms[top->i].coeff * l->terms[top->j].coeff;
+
+		if (prod.num_terms &&
+		    prod.terms[prod.num_terms - 1].exp == top->exp) {
+			prod.terms[prod.num_terms - 1].coeff += c;
+		} else {
+			if (prod.num_terms &&
+			    prod.terms[prod.num_terms - 1].coeff == 0.0)
+				prod.num_terms--;
+			if (poly_push(&prod, c, top->exp) < 0) {
+				free(heap);
+				poly_free(&prod);
+				return -1;
+			}
+		}
+
+		if (++top->j < l->num_terms)
+			top->exp = s->terms[top->i].exp + l->terms[top->j].exp;
+		else
+			heap[0] = heap[--n];
+		heap_sift_down(heap, n, 0);
+	}
+	if (prod.num_terms && prod.terms[prod.num_terms - 1].coeff == 0.0)
+		prod.num_terms--;
+
+	free(heap);
+	poly_replace(out, &prod);
+	return 0;
+}
+
+/* a polynomial as coefficients of x^low, x^(low + 1), ... */
+struct dense {
+	double *c;
+	size_t n;
+	uint64_t low;
+	double max;		/* largest |coefficient| */
+	int integer;		/* all coefficients are integers below 2^53 */
+};
+
+static size_t span(const struct polynomial *poly)
+{
+	uint64_t range = poly->terms[0].exp -
+			 poly->terms[poly->num_terms - 1].exp;
+
+	return range >= DENSE_MAX ? DENSE_MAX : (size_t)range + 1;
+}
+
+static int is_dense(const struct polynomial *poly)
+{
+	return span(poly) / DENSE_RATIO <= poly->num_terms;
+}
+
+static int to_dense(const struct polynomial *poly, struct dense *d)
+{
+	size_t i;
+
+	d->n = span(poly);
+	d->low = poly->terms[poly->num_terms - 1].exp;
+	d->max = 0.0;
+	d->integer = 1;
+	if (d->n >= DENSE_MAX)
+		return -1;
+	d->c = calloc(d->n, sizeof(*d->c));
+	if (!d->c)
+		return -1;
+	for (i = 0; i < poly->num_terms; i++) {
+		double c = poly->terms[i].coeff;
+
+		d->c[poly->terms[i].exp - d->low] = c;
+		if (fabs(c) > d->max)
+			d->max = fabs(c);
+		if (c != floor(c) || fabs(c) >= EXACT_MAX)
+			d->integer = 0;
+	}
+	return 0;
+}
+
+/* @support, if not NULL, is nonzero only where terms of the factors meet */
+static int from_dense(const double *c, const double *support, size_t n,
+		      uint64_t low, struct polynomial *out)
+{
+	struct polynomial prod;
+	size_t i;
+
+	poly_init(&prod);
+	for (i = n; i-- > 0;) {
+		if (c[i] != 0.0 && (!support || support[i] != 0.0) &&
+		    poly_push(&prod, c[i], low + i) < 0) {
+			poly_free(&prod);
+			return -1;
+		}
+	}
+	poly_replace(out, &prod);
+	return 0;
+}
+
+/* r[0 .. na + nb - 1) = a * b */
+static void schoolbook(double *restrict r, const double *restrict a,
+		       size_t na, const double *restrict b, size_t nb)
+{
+	size_t i, j;
+
+	memset(r, 0, sizeof(*r) * (na + nb - 1));
+	for (i = 0; i < na; i++)
+		for (j = 0; j < nb; j++)
+			r[i + j] += a[i] * b[j];
+}
+
+/*
+ * r[0 .. 2n - 1) = a * b for factors of n coefficients. With
+ * a = a0 + x^h a1 and b likewise, the middle part is
+ * (a0 + a1)(b0 + b1) - a0 b0 - a1 b1, three half size products instead
+ * of four. @scratch holds 4 (n + 64) doubles.
+ */
+static void karatsuba(double *r, const double *a, const double *b, size_t n,
+		      double *scratch)
+{
+	size_t h = n / 2, hi = n - h, i;
+	double *sa = scratch, *sb = sa + hi, *z1 = sb + hi;
+
+	if (n < KARATSUBA_MIN) {
+		schoolbook(r, a, n, b, n);
+		return;
+	}
+
+	karatsuba(r, a, b, h, scratch);
+	r[2 * h - 1] = 0.0;
+	karatsuba(r + 2 * h, a + h, b + h, hi, scratch);
+
+	for (i = 0; i < h; i++) {
+		sa[i] = a[i] + a[h + i];
+		sb[i] = b[i] + b[h + i];
+	}
+	if (hi > h) {
+		sa[h] = a[n - 1];
+		sb[h] = b[n - 1];
+	}
+	karatsuba(z1, sa, sb, hi, z1 + 2 * hi);
+
+	for (i = 0; i < 2 * h - 1; i++)
+		z1[i] -= r[i];
+	for (i = 0; i < 2 * hi - 1; i++)
+		z1[i] -= r[2 * h + i];
+	for (i = 0; i < 2 * hi - 1; i++)
+		r[h + i] += z1[i];
+}
+
+/*
+ * r[0 .. na + nb - 1) = a * b: the longer factor is cut into pieces the
+ * size of the shorter one, a short last piece is zero-padded
+ */
+static int mul_karatsuba(double *r, const double *a, size_t na,
+			 const double *b, size_t nb)
+{
+	double *piece, *prod, *scratch;
+	size_t off, i;
+
+	if (na < nb) {
+		const double *t = a;
+
+		a = b;
+		b = t;
+		off = na;
+		na = nb;
+		nb = off;
+	}
+	if (nb < KARATSUBA_MIN) {
+		schoolbook(r, a, na, b, nb);
+		return 0;
+	}
+
+	piece = malloc(sizeof(*piece) * (nb + 2 * nb + 4 * (nb + 64)));
+	if (!piece)
+		return -1;
+	prod = piece + nb;
+	scratch = prod + 2 * nb;
+
+	memset(r, 0, sizeof(*r) * (na + nb - 1));
+	for (off = 0; off < na; off += nb) {
+		size_t len = na - off < nb ? na - off : nb;
+
+		if (len < KARATSUBA_MIN) {
+			schoolbook(prod, b, nb, a + off, len);
+		} else {
+			memcpy(piece, a + off, sizeof(*piece) * len);
+			memset(piece + len, 0, sizeof(*piece) * (nb - len));
+			karatsuba(prod, piece, b, nb, scratch);
+		}
+		for (i = 0; i < len + nb - 1; i++)
+			r[off + i] += prod[i];
+	}
+	free(piece);
+	return 0;
+}
+
+/*
+ * s[0 .. a->n + b->n - 1) = how many pairs of terms of @a and @b meet at
+ * each exponent. The counts are small integers, which Karatsuba gets
+ * exactly, so s is 0 precisely where a product of @a and @b must be.
+ */
+static int mul_support(double *s, const struct dense *a,
+		       const struct dense *b)
+{
+	double *ma = malloc(sizeof(*ma) * (a->n + b->n)), *mb;
+	size_t i;
+	int ret;
+
+	if (!ma)
+		return -1;
+	mb = ma + a->n;
+	for (i = 0; i < a->n; i++)
+		ma[i] = a->c[i] != 0.0;
+	for (i = 0; i < b->n; i++)
+		mb[i] = b->c[i] != 0.0;
+	ret = mul_karatsuba(s, ma, a->n, mb, b->n);
+	free(ma);
+	return ret;
+}
+
+/*
+ * Arithmetic modulo an NTT prime p < 2^31 in Montgomery form (x R mod p
+ * with R = 2^32), so products need no division.
+ */
+struct mont {
+	uint32_t p;
+	uint32_t pinv;		/* -1/p mod 2^32 */
+	uint32_t r2;		/* R^2 mod p */
+	uint32_t g;		/* primitive root */
+};
+
+static const uint32_t ntt_primes[NTT_PRIMES][2] = {
+	{ 2013265921, 31 },	/* 15 * 2^27 + 1 */
+	{ 1811939329, 13 },	/* 27 * 2^26 + 1 */
+	{ 2113929217, 5 },	/* 63 * 2^25 + 1 */
+};
+
+static void mont_init(struct mont *m, uint32_t p, uint32_t g)
+{
+	uint32_t inv = p;	/* right in the low 3 bits, as p is odd */
+	uint64_t r = ((uint64_t)1 << 32) % p;
+	int i;
+
+	for (i = 0; i < 4; i++)
+		inv *= 2 - p * inv;
+	m->p = p;
+	m->pinv = -inv;
+	m->r2 = (uint32_t)(r * r % p);
+	m->g = g;
+}
+
+static inline uint32_t mont_mul(uint32_t a, uint32_t b, const struct mont *m)
+{
+	uint64_t t = (uint64_t)a * b;
+	uint32_t q = (uint32_t)t * m->pinv;
+	uint32_t u = (uint32_t)((t + (uint64_t)q * m->p) >> 32);
+
+	return u >= m->p ? u - m->p : u;
+}
+
+static inline uint32_t mod_add(uint32_t a, uint32_t b, uint32_t p)
+{
+	uint32_t s = a + b;
+
+	return s >= p ? s - p : s;
+}
+
+static inline uint32_t mod_sub(uint32_t a, uint32_t b, uint32_t p)
+{
+	return a >= b ? a - b : a + p - b;
+}
+
+/* a^e for a in Montgomery form */
+static uint32_t mont_pow(uint32_t a, uint64_t e, const struct mont *m)
+{
+	uint32_t r = mont_mul(1, m->r2, m);
+
+	for (; e; e >>= 1) {
+		if (e & 1)
+			r = mont_mul(r, a, m);
+		a = mont_mul(a, a, m);
+	}
+	return r;
+}
+
+static uint64_t pow_mod(uint64_t a, uint64_t e, uint64_t p)
+{
+	uint64_t r = 1;
+
+	for (a %= p; e; e >>= 1) {
+		if (e & 1)
+			r = r * a % p;
+		a = a * a % p;
+	}
+	return r;
+}
+
+/*
+ * w[len + j] = w_2len^j for every power of two len < n, where w_2len is
+ * a primitive 2len-th root of unity (its inverse if @inverse)
+ */
+static void ntt_roots(uint32_t *w, size_t n, int inverse,
+		      const struct mont *m)
+{
+	uint32_t g = mont_mul(m->g, m->r2, m);
+	size_t len, j;
+
+	for (len = 1; len < n; len <<= 1) {
+		uint64_t e = (m->p - 1) / (2 * len);
+		uint32_t step = mont_pow(g, inverse ? (m->p - 1) - e : e, m);
+
+		w[len] = mont_mul(1, m->r2, m);
+		for (j = 1; j < len; j++)
+			w[len + j] = mont_mul(w[len + j - 1], step, m);
+	}
+}
+
+/* decimation in frequency: natural order in, bit-reversed order out */
+static void ntt_forward(uint32_t *a, size_t n, const uint32_t *w,
+			const struct mont *m)
+{
+	size_t len, i, j;
+
+	for (len = n >> 1; len; len >>= 1) {
+		for (i = 0; i < n; i += 2 * len) {
+			for (j = 0; j < len; j++) {
+				uint32_t u = a[i + j], v = a[i + j + len];
+
+				a[i + j] = mod_add(u, v, m->p);
+				a[i + j + len] = mont_mul(mod_sub(u, v, m->p),
+							  w[len + j], m);
+			}
+		}
+	}
+}
+
+/* decimation in time: bit-reversed order in, natural order out */
+static void ntt_inverse(uint32_t *a, size_t n, const uint32_t *w,
+			const struct mont *m)
+{
+	size_t len, i, j;
+
+	for (len = 1; len < n; len <<= 1) {
+		for (i = 0; i < n; i += 2 * len) {
+			for (j = 0; j < len; j++) {
+				uint32_t u = a[i + j];
+				uint32_t v = mont_mul(a[i + j + len],
+						      w[len + j], m);
+
+				a[i + j] = mod_add(u, v, m->p);
+				a[i + j + len] = mod_sub(u, v, m->p);
+			}
+		}
+	}
+}
+
+static void to_residues(uint32_t *f, const struct dense *d, size_t n,
+			const struct mont *m)
+{
+	size_t i;
+
+	for (i = 0; i < d->n; i++) {
+		int64_t v = (int64_t)d->c[i] % (int64_t)m->p;
+
+		f[i] = mont_mul((uint32_t)(v < 0 ? v + m->p : v), m->r2, m);
+	}
+	memset(f + d->n, 0, sizeof(*f) * (n - d->n));
+}
+
+/* value = mid * 2^32 + low, mid < 2^62, correctly rounded */
+static double wide_to_double(uint64_t mid, uint32_t low)
+{
+	uint64_t top;
+	int s = 0;
+
+	if (!(mid >> 32))
+		return (double)(mid << 32 | low);
+	while (mid >> (32 + s))
+		s++;
+	/* keep 64 bits and a sticky bit for what is shifted out */
+	top = mid << (32 - s) | low >> s | ((low & ((1u << s) - 1)) != 0);
+	return ldexp((double)top, s);
+}
+
+/* x = t0 + p0 (t1 + p1 t2) as mid * 2^32 + low */
+static void garner_join(const uint32_t *t, const uint32_t *p, int k,
+			uint64_t *mid, uint32_t *low)
+{
+	uint64_t inner = k > 1 ? t[1] + (k > 2 ? (uint64_t)p[1] * t[2] : 0) : 0;
+	uint64_t lo = t[0] + (uint64_t)p[0] * (uint32_t)inner;
+
+	*low = (uint32_t)lo;
+	*mid = (lo >> 32) + (uint64_t)p[0] * (inner >> 32);
+}
+
+/*
+ * Exact product of integer polynomials: one NTT product per prime, then
+ * per coefficient the Chinese remainder theorem (Garner's form) and the
+ * shift from [0, M) to (-M/2, M/2)
+ */
+static int mul_ntt(double *r, const struct dense *a, const struct dense *b,
+		   int k)
+{
+	size_t len = a->n + b->n - 1, n = 1, i;
+	uint32_t *fa, *fb, *w, *wi, *res, p[NTT_PRIMES], q[2], inv[NTT_PRIMES];
+	uint32_t m_low, t[NTT_PRIMES] = { 0 };
+	uint64_t m_mid;
+	struct mont m[NTT_PRIMES];
+	int square = a == b, j;
+
+	while (n < len)
+		n <<= 1;
+	if (n > (size_t)1 << NTT_MAX_LOG)
+		return -1;
+	fa = malloc(sizeof(*fa) * (4 * n + (size_t)k * len));
+	if (!fa)
+		return -1;
+	fb = fa + n;
+	w = fb + n;
+	wi = w + n;
+	res = wi + n;
+
+	for (j = 0; j < NTT_PRIMES; j++)
+		p[j] = ntt_primes[j][0];
+	for (j = 0; j < k; j++) {
+		uint32_t scale;
+
+		mont_init(&m[j], p[j], ntt_primes[j][1]);
+		ntt_roots(w, n, 0, &m[j]);
+		ntt_roots(wi, n, 1, &m[j]);
+		to_residues(fa, a, n, &m[j]);
+		ntt_forward(fa, n, w, &m[j]);
+		if (!square) {
+			to_residues(fb, b, n, &m[j]);
+			ntt_forward(fb, n, w, &m[j]);
+		}
+		for (i = 0; i < n; i++)
+			fa[i] = mont_mul(fa[i], square ? fa[i] : fb[i], &m[j]);
+		ntt_inverse(fa, n, wi, &m[j]);
+		/* 1/n, which also takes the result out of Montgomery form */
+		scale = (uint32_t)pow_mod(n, p[j] - 2, p[j]);
+		for (i = 0; i < len; i++)
+			res[j * len + i] = mont_mul(fa[i], scale, &m[j]);
+	}
+
+	inv[1] = (uint32_t)pow_mod(p[0], p[1] - 2, p[1]);
+	inv[2] = (uint32_t)pow_mod((uint64_t)p[0] * p[1] % p[2], p[2] - 2, p[2]);
+	/* M, the product of the primes used, as a number with digits 0, 0, p2 */
+	t[2] = k > 2 ? p[2] : 1;
+	q[0] = p[0];
+	q[1] = k > 1 ? p[1] : 1;
+	garner_join(t, q, NTT_PRIMES, &m_mid, &m_low);
+
+	for (i = 0; i < len; i++) {
+		uint64_t mid, tmid;
+		uint32_t low, tlow;
+		int neg;
+
+		t[0] = res[i];
+		if (k > 1)
+			t[1] = (uint32_t)((uint64_t)mod_sub(res[len + i],
+							    t[0] % p[1], p[1]) *
+					  inv[1] % p[1]);
+		if (k > 2) {
+			uint64_t x = t[0] + (uint64_t)p[0] * t[1];
+
+			t[2] = (uint32_t)((uint64_t)mod_sub(res[2 * len + i],
+							    (uint32_t)(x % p[2]),
+							    p[2]) *
+					  inv[2] % p[2]);
+		}
+		garner_join(t, p, k, &mid, &low);
+
+		/* negative if 2x > M */
+		tmid = mid << 1 | low >> 31;
+		tlow = low << 1;
+		neg = tmid > m_mid || (tmid == m_mid && tlow > m_low);
+		if (neg) {
+			mid = m_mid - mid - (m_low < low);
+			low = m_low - low;
+		}
+		r[i] = neg ? -wide_to_double(mid, low) : wide_to_double(mid, low);
+	}
+	free(fa);
+	return 0;
+}
+
+/* primes needed to hold the coefficients of a * b, 0 if too many */
+static int ntt_primes_needed(const struct dense *a, const struct dense *b)
+{
+	double bound = 2.0 * (double)(a->n < b->n ? a->n : b->n) * a->max *
+		       b->max, m = 1.0;
+	int k;
+
+	if (!a->integer || !b->integer)
+		return 0;
+	for (k = 0; k < NTT_PRIMES; k++) {
+		m *= ntt_primes[k][0];
+		/* a little margin for the rounding of bound */
+		if (bound < m * 0.99)
+			return k + 1;
+	}
+	return 0;
+}
+
+/*
+ * Karatsuba in doubles is exact for integers if every intermediate sum
+ * stays below 2^53; the sums of halves double the inputs at each level
+ */
+static int karatsuba_exact(const struct dense *a, const struct dense *b)
+{
+	size_t n = a->n < b->n ? a->n : b->n;
+	double bound = 4.0 * (double)n * a->max * b->max;
+
+	for (; n >= KARATSUBA_MIN; n = (n + 1) / 2)
+		bound *= 4.0;
+	return bound < EXACT_MAX;
+}
+
+/**
+ * poly_mul_with - Multiply two polynomials with a given method
+ * @a: Normalized polynomial
+ * @b: Normalized polynomial
+ * @method: How to multiply; anything but POLY_MUL_AUTO is mostly for
+ *	    benchmarks
+ * @out: Initialized polynomial receiving a * b; may be @a or @b
+ *
+ * The dense methods work on coefficient arrays spanning each factor's
+ * exponents. POLY_MUL_NTT is exact, and fails unless all coefficients
+ * are integers and the product's fit the NTT primes.
+ *
+ * Returns 0 on success, -1 on exponent overflow, if memory runs out or
+ * @method can't be used
+ */
+int poly_mul_with(const struct polynomial *a, const struct polynomial *b,
+		  enum poly_mul_method method, struct polynomial *out)
+{
+	struct dense da, db;
+	size_t na, nb;
+	double *r, *support = NULL;
+	int automatic = method == POLY_MUL_AUTO, k = 0, ret = -1, exact;
+
+	if (!a->num_terms || !b->num_terms) {
+		struct polynomial zero;
+
+		poly_init(&zero);
+		poly_replace(out, &zero);
+		return 0;
+	}
+	if (a->terms[0].exp > UINT64_MAX - b->terms[0].exp)
+		return -1;
+
+	na = span(a);
+	nb = span(b);
+	if (automatic) {
+		if ((na < nb ? na : nb) < KARATSUBA_MIN || !is_dense(a) ||
+		    !is_dense(b))
+			method = POLY_MUL_HEAP;
+		else
+			method = POLY_MUL_KARATSUBA;
+	}
+	if (method == POLY_MUL_HEAP)
+		return mul_heap(a, b, out);
+
+	da.c = db.c = r = NULL;
+	if (to_dense(a, &da) < 0)
+		goto out;
+	if (b == a)
+		db = da;
+	else if (to_dense(b, &db) < 0)
+		goto out;
+	r = malloc(sizeof(*r) * (na + nb - 1));
+	if (!r)
+		goto out;
+
+	/* exact when the integers allow it, see the comment on top */
+	exact = da.integer && db.integer && karatsuba_exact(&da, &db);
+	if (method == POLY_MUL_NTT ||
+	    (automatic && ((na < nb ? na : nb) >= NTT_MIN || !exact)))
+		k = ntt_primes_needed(&da, &db);
+	if (k)
+		ret = mul_ntt(r, &da, b == a ? &da : &db, k);
+	if (ret < 0 && method == POLY_MUL_NTT)
+		goto out;
+	if (ret < 0) {
+		if (automatic && !exact)
+			method = POLY_MUL_SCHOOLBOOK;
+		if (method == POLY_MUL_SCHOOLBOOK) {
+			schoolbook(r, da.c, na, db.c, nb);
+			ret = 0;
+		} else {
+			ret = mul_karatsuba(r, da.c, na, db.c, nb);
+		}
+		/* forced to round; where no terms meet, what's left is residue */
+		if (ret == 0 && method == POLY_MUL_KARATSUBA && !exact) {
+			support = malloc(sizeof(*support) * (na + nb - 1));
+			if (!support || mul_support(support, &da, &db) < 0)
+				ret = -1;
+		}
+	}
+	if (ret == 0)
+		ret = from_dense(r, support, na + nb - 1, da.low + db.low,
+				 out);
+out:
+	free(da.c);
+	if (b != a)
+		free(db.c);
+	free(r);
+	free(support);
+	return ret;
+}
+
+/**
+ * poly_mul - Multiply two polynomials
+ * @a: Normalized polynomial
+ * @b: Normalized polynomial
+ * @out: Initialized polynomial receiving a * b; may be @a or @b
+ *
+ * Picks the method by the factors' shape, see the comment on top.
+ *
+ * Returns 0 on success, -1 on exponent overflow or if memory runs out
+ */
+int poly_mul(const struct polynomial *a, const struct polynomial *b,
+	     struct polynomial *out)
+{
+	return poly_mul_with(a, b, POLY_MUL_AUTO, out);
+}
+
+static int poly_copy(struct polynomial *dst, const struct polynomial *src)
+{
+	size_t i;
+
+	poly_init(dst);
+	for (i = 0; i < src->num_terms; i++) {
+		if (poly_push(dst, src->terms[i].coeff, src->terms[i].exp) < 0) {
+			poly_free(dst);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * poly_pow - Raise a polynomial to a power
+ * @poly: Normalized polynomial
+ * @k: Exponent; poly^0 is 1
+ * @out: Initialized polynomial receiving poly^k; may be @poly
+ *
+ * Squares from the top bit of @k down, so the big products are
+ * balanced squarings and the odd bits only multiply by @poly.
+ *
+ * Returns 0 on success, -1 on exponent overflow or if memory runs out
+ */
+int poly_pow(const struct polynomial *poly, uint64_t k, struct polynomial *out)
+{
+	struct polynomial base, result;
+	int bit = 63;
+
+	poly_init(&result);
+	if (poly_push(&result, 1.0, 0) < 0)
+		return -1;
+	if (!k) {
+		poly_replace(out, &result);
+		return 0;
+	}
+	if (poly_copy(&base, poly) < 0)
+		goto fail;
+
+	while (!(k >> bit & 1))
+		bit--;
+	for (; bit >= 0; bit--) {
+		if (poly_mul(&result, &result, &result) < 0 ||
+		    (k >> bit & 1 && poly_mul(&result, &base, &result) < 0))
+			goto fail;
+	}
+	poly_free(&base);
+	poly_replace(out, &result);
+	return 0;
+
+fail:
+	poly_free(&base);
+	poly_free(&result);
+	return -1;
+}
+
+/*
+ * sum of c q^(e - base) over the terms [lo, hi) of p, whose exponents
+ * are in [base, base + 2^level): the terms from base + 2^(level - 1) up
+ * are done the same way and multiplied by q^(2^(level - 1))
+ */
+static int compose_range(const struct polynomial *p, size_t lo, size_t hi,
+			 uint64_t base, int level,
+			 const struct polynomial *pows, struct polynomial *out)
+{
+	struct polynomial low, high;
+	uint64_t mid;
+	size_t split;
+
+	poly_init(out);
+	if (lo == hi)
+		return 0;
+	if (!level)
+		return poly_push(out, p->terms[lo].coeff, 0);
+
+	mid = base + ((uint64_t)1 << (level - 1));
+	for (split = lo; split < hi && p->terms[split].exp >= mid; split++)
+		;
+	if (compose_range(p, split, hi, base, level - 1, pows, &low) < 0)
+		return -1;
+	if (compose_range(p, lo, split, mid, level - 1, pows, &high) < 0 ||
+	    poly_mul(&high, &pows[level - 1], &high) < 0 ||
+	    poly_add(&low, &high, out) < 0) {
+		poly_free(&low);
+		poly_free(&high);
+		return -1;
+	}
+	poly_free(&low);
+	poly_free(&high);
+	return 0;
+}
+
+/**
+ * poly_compose - Substitute one polynomial into another
+ * @p: Normalized polynomial
+ * @q: Normalized polynomial
+ * @out: Initialized polynomial receiving p(q(x)); may be @p or @q
+ *
+ * Divide and conquer over the exponents of @p with the powers q^(2^i),
+ * so the work goes into few large, balanced products, where the fast
+ * multiplications pay off.
+ *
+ * Returns 0 on success, -1 on exponent overflow or if memory runs out
+ */
+int poly_compose(const struct polynomial *p, const struct polynomial *q,
+		 struct polynomial *out)
+{
+	struct polynomial pows[64], result;
+	int levels = 0, i, ret = -1;
+
+	for (i = 0; i < 64; i++)
+		poly_init(&pows[i]);
+	if (p->num_terms)
+		while (levels < 64 && p->terms[0].exp >> levels)
+			levels++;
+	for (i = 0; i < levels; i++)
+		if ((i ? poly_mul(&pows[i - 1], &pows[i - 1], &pows[i]) :
+		     poly_copy(&pows[0], q)) < 0)
+			goto out;
+	ret = compose_range(p, 0, p->num_terms, 0, levels, pows, &result);
+	if (ret == 0)
+		poly_replace(out, &result);
+out:
+	for (i = 0; i < levels; i++)
+		poly_free(&pows[i]);
+	return ret;
+}
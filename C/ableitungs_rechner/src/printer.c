@@ -0,0 +1,377 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "format.h"
+#include "printer.h"
+#include "symtab.h"
+
+enum {
+	PREC_ADD = 1,
+	PREC_MUL,
+	PREC_NEG,
+	PREC_POW,
+	PREC_ATOM,
+};
+
+/*
+ * The printer walks the tree with an explicit stack, so deep expressions
+ * (a sum of a million terms is a chain a million nodes deep) can't
+ * overflow the C stack. An item is either a node or a literal string.
+ */
+struct print_item {
+	uint32_t node;		/* NODE_NONE for text items */
+	int abs;		/* print a constant without its sign */
+	const char *text;
+};
+
+struct printer {
+	const struct expr_arena *arena;
+	const uint32_t *temp;	/* temporary number per node, 0 for none */
+	uint32_t self;		/* temporary being defined */
+	struct fmt_buf *out;
+	struct print_item *stack;
+	size_t depth;
+	size_t max_depth;
+	int failed;
+};
+
+static void put(struct printer *pr, const char *s, size_t n)
+{
+	fmt_put(pr->out, s, n);
+}
+
+static void push(struct printer *pr, uint32_t node, int abs, const char *text)
+{
+	if (pr->depth == pr->max_depth) {
+		size_t cap = pr->max_depth * 2;
+		struct print_item *p = realloc(pr->stack, sizeof(*p) * cap);
+
+		if (!p) {
+			pr->failed = 1;
+			return;
+		}
+		pr->stack = p;
+		pr->max_depth = cap;
+	}
+	pr->stack[pr->depth].node = node;
+	pr->stack[pr->depth].abs = abs;
+	pr->stack[pr->depth].text = text;
+	pr->depth++;
+}
+
+/* nodes printed as a temporary's name */
+static int is_temp(const struct printer *pr, uint32_t id)
+{
+	return pr->temp && pr->temp[id] && id != pr->self;
+}
+
+static int precedence(const struct printer *pr, uint32_t id)
+{
+	const struct expr_arena *arena = pr->arena;
+	const struct node *n = ast_node(arena, id);
+
+	if (is_temp(pr, id))
+		return PREC_ATOM;
+
+	switch (n->type) {
+	case NODE_CONST:
+		return signbit(arena->consts[n->lhs]) ? PREC_NEG : PREC_ATOM;
+	case NODE_ADD:
+	case NODE_SUB:
+		return PREC_ADD;
+	case NODE_MUL:
+	case NODE_DIV:
+		return PREC_MUL;
+	case NODE_NEG:
+		return PREC_NEG;
+	case NODE_POW:
+		return PREC_POW;
+	default:
+		return PREC_ATOM;
+	}
+}
+
+/* products and quotients whose leading constant is negative */
+static int leads_negative(const struct printer *pr, uint32_t id)
+{
+	const struct expr_arena *arena = pr->arena;
+
+	while (!is_temp(pr, id) && (ast_node(arena, id)->type == NODE_MUL ||
+				    ast_node(arena, id)->type == NODE_DIV))
+		id = ast_node(arena, id)->lhs;
+	return !is_temp(pr, id) && ast_node(arena, id)->type == NODE_CONST &&
+	       signbit(arena->consts[ast_node(arena, id)->lhs]);
+}
+
+/* push a child, wrapped in parentheses if needed (pushed in reverse) */
+static void push_operand(struct printer *pr, uint32_t child, int abs,
+			 int paren)
+{
+	if (paren)
+		push(pr, NODE_NONE, 0, ")");
+	push(pr, child, abs, NULL);
+	if (paren)
+		push(pr, NODE_NONE, 0, "(");
+}
+
+static void print_node(struct printer *pr, uint32_t id, int abs)
+{
+	const struct expr_arena *arena = pr->arena;
+	const struct node *n = ast_node(arena, id);
+	const char *op;
+	int p, lp, rp, rabs = 0, sub = 0;
+	uint32_t rhs;
+
+	if (is_temp(pr, id)) {
+		put(pr, "t", 1);
+		fmt_u64(pr->out, pr->temp[id]);
+		return;
+	}
+
+	switch (n->type) {
+	case NODE_CONST:
+		fmt_double(pr->out, abs ? fabs(arena->consts[n->lhs])
+					: arena->consts[n->lhs]);
+		return;
+	case NODE_VAR:
+		if (arena->symbols) {
+			const char *name = symtab_name(arena->symbols, n->lhs);
+
+			put(pr, name, strlen(name));
+		} else {
+			put(pr, "x", 1);
+		}
+		return;
+	case NODE_NEG:
+		put(pr, "-", 1);
+		push_operand(pr, n->lhs, 0,
+			     precedence(pr, n->lhs) < PREC_MUL);
+		return;
+	case NODE_FUNC:
+		put(pr, ast_func_name(n->op), strlen(ast_func_name(n->op)));
+		push_operand(pr, n->lhs, 0, 1);
+		return;
+	default:
+		break;
+	}
+
+	p = precedence(pr, id);
+	rhs = n->rhs;
+	switch (n->type) {
+	case NODE_ADD:
+	case NODE_SUB:
+		/* a + -b prints as a - b, a - -2*b as a + 2*b */
+		sub = n->type == NODE_SUB;
+		if (!is_temp(pr, rhs) &&
+		    ast_node(arena, rhs)->type == NODE_NEG) {
+			rhs = ast_node(arena, rhs)->lhs;
+			sub = !sub;
+		} else if (leads_negative(pr, rhs)) {
+			rabs = 1;
+			sub = !sub;
+		}
+		op = sub ? " - " : " + ";
+		break;
+	case NODE_MUL:
+		op = "*";
+		break;
+	case NODE_DIV:
+		op = "/";
+		break;
+	default:
+		op = "^";
+		break;
+	}
+
+	/* ^ is right-associative, - and / are not associative at all */
+	lp = precedence(pr, n->lhs) < p ||
+	     (n->type == NODE_POW && precedence(pr, n->lhs) == p);
+	rp = precedence(pr, rhs) < p ||
+	     (precedence(pr, rhs) == p &&
+	      (n->type == NODE_DIV || (p == PREC_ADD && sub))) ||
+	     (p != PREC_ADD && precedence(pr, rhs) == PREC_NEG);
+	if (rabs)
+		rp = 0;
+
+	push_operand(pr, rhs, rabs, rp);
+	push(pr, NODE_NONE, 0, op);
+	/* the sign of a product sits on its leading constant */
+	push_operand(pr, n->lhs, abs && p == PREC_MUL, lp);
+}
+
+static void print_tree(struct printer *pr, uint32_t root)
+{
+	push(pr, root, 0, NULL);
+	while (pr->depth > 0 && !pr->failed && !pr->out->failed) {
+		struct print_item item = pr->stack[--pr->depth];
+
+		if (item.node == NODE_NONE)
+			put(pr, item.text, strlen(item.text));
+		else
+			print_node(pr, item.node, item.abs);
+	}
+}
+
+static int printer_init(struct printer *pr, const struct expr_arena *arena,
+			struct fmt_buf *out)
+{
+	memset(pr, 0, sizeof(*pr));
+	pr->arena = arena;
+	pr->self = NODE_NONE;
+	pr->out = out;
+	pr->max_depth = 64;
+	pr->stack = malloc(sizeof(*pr->stack) * pr->max_depth);
+	return pr->stack ? 0 : -1;
+}
+
+/* returns 0, or -1 with @out marked failed */
+static int printer_finish(struct printer *pr)
+{
+	free(pr->stack);
+	if (pr->failed)
+		pr->out->failed = 1;
+	return pr->out->failed ? -1 : 0;
+}
+
+/**
+ * ast_format - Print an expression with as few parentheses as possible
+ * @out: Buffer the text is appended to
+ * @arena: Arena holding the expression
+ * @root: Expression to print
+ *
+ * Shared subexpressions are printed in full wherever they occur.
+ *
+ * Returns 0 on success, -1 if memory or room in @out runs out
+ */
+int ast_format(struct fmt_buf *out, const struct expr_arena *arena,
+	       uint32_t root)
+{
+	struct printer pr;
+
+	if (printer_init(&pr, arena, out) < 0 || root == NODE_NONE)
+		pr.failed = 1;
+	else
+		print_tree(&pr, root);
+	return printer_finish(&pr);
+}
+
+/**
+ * ast_to_string - Print an expression into a new string
+ * @arena: Arena holding the expression
+ * @root: Expression to print
+ *
+ * See ast_format().
+ *
+ * Returns a malloc'd string the caller has to free, or NULL if memory runs
+ * out
+ */
+char *ast_to_string(const struct expr_arena *arena, uint32_t root)
+{
+	struct fmt_buf out = { 0 };
+
+	ast_format(&out, arena, root);
+	return fmt_finish(&out);
+}
+
+/* operators whose operands are all constants or variables, like x^2 */
+static int is_small(const struct expr_arena *arena, uint32_t id)
+{
+	const struct node *n = ast_node(arena, id);
+
+	switch (n->type) {
+	case NODE_CONST:
+	case NODE_VAR:
+		return 1;
+	case NODE_NEG:
+	case NODE_FUNC:
+		return ast_node(arena, n->lhs)->type <= NODE_VAR;
+	default:
+		return ast_node(arena, n->lhs)->type <= NODE_VAR &&
+		       ast_node(arena, n->rhs)->type <= NODE_VAR;
+	}
+}
+
+/**
+ * ast_to_string_shared - Print an expression with shared temporaries
+ * @arena: Arena holding the expression
+ * @root: Expression to print
+ * @name: Name for the final line (e.g. "f'(x)")
+ *
+ * Every subexpression that is used more than once (and is bigger than
+ * something like x^2) is printed once as "tN = ..." on its own line and
+ * referred to by name afterwards. The last line is "name = ...". Lines
+ * end in '\n'. With hash-consing this keeps the output proportional to
+ * the size of the DAG rather than the size of the tree.
+ *
+ * Returns a malloc'd string the caller has to free, or NULL if memory runs
+ * out
+ */
+char *ast_to_string_shared(const struct expr_arena *arena, uint32_t root,
+			   const char *name)
+{
+	struct fmt_buf out = { 0 };
+	struct printer pr;
+	uint32_t *uses = NULL;
+	uint32_t i, temps = 0;
+
+	if (printer_init(&pr, arena, &out) < 0 || root == NODE_NONE)
+		goto fail;
+	uses = calloc((size_t)root + 1, sizeof(*uses));
+	if (!uses)
+		goto fail;
+
+	/* count references from reachable parents, parents first */
+	uses[root] = 1;
+	for (i = root + 1; i-- > 0;) {
+		const struct node *n = ast_node(arena, i);
+
+		if (!uses[i])
+			continue;
+		switch (n->type) {
+		case NODE_CONST:
+		case NODE_VAR:
+			break;
+		case NODE_NEG:
+		case NODE_FUNC:
+			uses[n->lhs]++;
+			break;
+		default:
+			uses[n->lhs]++;
+			uses[n->rhs]++;
+			break;
+		}
+	}
+
+	/* number the temporaries children first, then reuse uses[] for them */
+	for (i = 0; i <= root; i++)
+		uses[i] = i != root && uses[i] > 1 && !is_small(arena, i) ?
+			  ++temps : 0;
+	pr.temp = uses;
+
+	for (i = 0; i < root && !pr.failed && !out.failed; i++) {
+		if (!uses[i])
+			continue;
+		put(&pr, "t", 1);
+		fmt_u64(&out, uses[i]);
+		put(&pr, " = ", 3);
+		pr.self = i;
+		print_tree(&pr, i);
+		put(&pr, "\n", 1);
+	}
+	pr.self = root;
+	put(&pr, name, strlen(name));
+	put(&pr, " = ", 3);
+	print_tree(&pr, root);
+	put(&pr, "\n", 1);
+
+	free(uses);
+	printer_finish(&pr);
+	return fmt_finish(&out);
+
+fail:
+	free(uses);
+	pr.failed = 1;
+	printer_finish(&pr);
+	return fmt_finish(&out);
+}
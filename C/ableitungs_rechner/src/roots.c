@@ -0,0 +1,359 @@
+#include <complex.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include "derive.h"
+#include "roots.h"
+#include "vm.h"
+
+#define LANE_IDLE SIZE_MAX
+#define ABERTH_MAX_ITER 500
+
+/*
+ * Both Newton variants keep a set of lanes, each iterating one starting
+ * point. Every round computes f, f' and f'' for all lanes together, in
+ * loops over the lanes the compiler vectorizes, then takes a step per
+ * lane. A lane that has converged writes its root and is refilled with
+ * the next starting point; on polynomials idle lanes are masked (they
+ * compute but are never read), on expressions the active lanes are kept
+ * packed so the VM only evaluates those.
+ */
+
+/* 1 if a lane is done, with its root or NaN (no convergence) in *root */
+static int lane_done(double x, double xn, double f, unsigned int iter,
+		     double tol, double *root)
+{
+	if (f == 0.0) {
+		*root = x;
+		return 1;
+	}
+	if (!isfinite(xn) || iter >= ROOT_MAX_ITER) {
+		*root = NAN;
+		return 1;
+	}
+	if (fabs(xn - x) <= tol * (fabs(xn) + tol)) {
+		*root = xn;
+		return 1;
+	}
+	return 0;
+}
+
+/* f, f' and f'' in every lane, by Horner's rule over the sparse terms */
+static void poly_eval3(const struct polynomial *poly, const double *x,
+		       double *f, double *d1, double *d2)
+{
+	size_t t;
+	int l;
+
+	for (l = 0; l < ROOT_LANES; l++)
+		f[l] = d1[l] = d2[l] = 0.0;
+	for (t = 0; t < poly->num_terms; t++) {
+		uint64_t e = poly->terms[t].exp;
+		uint64_t gap = t + 1 < poly->num_terms ?
+			       e - poly->terms[t + 1].exp : e;
+		double c = poly->terms[t].coeff, g = (double)gap;
+
+		for (l = 0; l < ROOT_LANES; l++)
+			f[l] += c;
+		if (gap == 1) {
+			for (l = 0; l < ROOT_LANES; l++) {
+				d2[l] = d2[l] * x[l] + 2.0 * d1[l];
+				d1[l] = d1[l] * x[l] + f[l];
+				f[l] *= x[l];
+			}
+		} else if (gap) {
+			/* times m = x^gap, with m' and m'' */
+			for (l = 0; l < ROOT_LANES; l++) {
+				double p = pow(x[l], g - 2.0);
+				double m = p * x[l] * x[l], m1 = g * p * x[l];
+				double m2 = g * (g - 1.0) * p;
+
+				d2[l] = d2[l] * m + 2.0 * d1[l] * m1 + f[l] * m2;
+				d1[l] = d1[l] * m + f[l] * m1;
+				f[l] *= m;
+			}
+		}
+	}
+}
+
+/**
+ * poly_roots_from - Find a root of a polynomial from each starting point
+ * @poly: Normalized polynomial
+ * @method: ROOT_NEWTON or ROOT_HALLEY
+ * @starts: Starting points
+ * @n: Number of starting points
+ * @tol: Relative step size to stop at, e.g. 1e-12
+ * @roots: Output, the root each starting point led to, NaN if it
+ *	   didn't converge within ROOT_MAX_ITER steps
+ */
+void poly_roots_from(const struct polynomial *poly, enum root_method method,
+		     const double *starts, size_t n, double tol, double *roots)
+{
+	double x[ROOT_LANES], xn[ROOT_LANES];
+	double f[ROOT_LANES], d1[ROOT_LANES], d2[ROOT_LANES];
+	size_t idx[ROOT_LANES], next = 0;
+	unsigned int iter[ROOT_LANES];
+	int active = 0, l;
+
+	for (l = 0; l < ROOT_LANES; l++) {
+		x[l] = 0.0;
+		iter[l] = 0;
+		idx[l] = LANE_IDLE;
+		if (next < n) {
+			x[l] = starts[next];
+			idx[l] = next++;
+			active++;
+		}
+	}
+
+	while (active) {
+		poly_eval3(poly, x, f, d1, d2);
+		if (method == ROOT_HALLEY) {
+			for (l = 0; l < ROOT_LANES; l++)
+				xn[l] = x[l] - 2.0 * f[l] * d1[l] /
+					(2.0 * d1[l] * d1[l] - f[l] * d2[l]);
+		} else {
+			for (l = 0; l < ROOT_LANES; l++)
+				xn[l] = x[l] - f[l] / d1[l];
+		}
+
+		for (l = 0; l < ROOT_LANES; l++) {
+			if (idx[l] == LANE_IDLE)
+				continue;
+			if (!lane_done(x[l], xn[l], f[l], ++iter[l], tol,
+				       &roots[idx[l]])) {
+				x[l] = xn[l];
+				continue;
+			}
+			iter[l] = 0;
+			if (next < n) {
+				x[l] = starts[next];
+				idx[l] = next++;
+			} else {
+				x[l] = 0.0;
+				idx[l] = LANE_IDLE;
+				active--;
+			}
+		}
+	}
+}
+
+/**
+ * expr_roots_from - Find a root of an expression from each starting point
+ * @arena: Arena holding the expression; the derivatives are added to it
+ * @root: Expression, in @var alone
+ * @var: Variable to solve for
+ * @method: ROOT_NEWTON or ROOT_HALLEY
+ * @starts: Starting points
+ * @n: Number of starting points
+ * @tol: Relative step size to stop at, e.g. 1e-12
+ * @roots: Output, the root each starting point led to, NaN if it
+ *	   didn't converge within ROOT_MAX_ITER steps
+ *
+ * f, f' and f'' are compiled into one VM program and evaluated for a
+ * batch of points at a time.
+ *
+ * Returns 0 on success, -1 if memory runs out or @root uses other
+ * variables
+ */
+int expr_roots_from(struct expr_arena *arena, uint32_t root, uint32_t var,
+		    enum root_method method, const double *starts, size_t n,
+		    double tol, double *roots)
+{
+	const double *inputs[VM_MAX_VARS] = { NULL };
+	double *x, *f, *d1, *d2, *outputs[3];
+	struct vm_program prog;
+	uint32_t nodes[3], pc;
+	unsigned int *iter;
+	size_t *idx, next = 0, active = 0, l;
+	int ret = -1;
+
+	if (var >= VM_MAX_VARS)
+		return -1;
+	nodes[0] = root;
+	nodes[1] = derive(arena, root, var);
+	nodes[2] = derive(arena, nodes[1], var);
+	if (nodes[1] == NODE_NONE || nodes[2] == NODE_NONE ||
+	    vm_compile(arena, nodes, 3, &prog) < 0)
+		return -1;
+	for (pc = 0; pc < prog.num_insns; pc++)
+		if (prog.code[pc].op == OP_VAR && prog.code[pc].a != var)
+			goto out_prog;
+
+	x = malloc(sizeof(*x) * 4 * VM_BATCH);
+	idx = malloc(sizeof(*idx) * VM_BATCH);
+	iter = calloc(VM_BATCH, sizeof(*iter));
+	if (!x || !idx || !iter)
+		goto out;
+	f = x + VM_BATCH;
+	d1 = f + VM_BATCH;
+	d2 = d1 + VM_BATCH;
+	inputs[var] = x;
+	outputs[0] = f;
+	outputs[1] = d1;
+	outputs[2] = d2;
+
+	for (; active < VM_BATCH && next < n; active++) {
+		x[active] = starts[next];
+		idx[active] = next++;
+	}
+	while (active) {
+		if (vm_eval(&prog, inputs, active, outputs) < 0)
+			goto out;
+		/* backwards, so a lane moved into a finished one is done */
+		for (l = active; l-- > 0;) {
+			double xn = method == ROOT_HALLEY ?
+				    x[l] - 2.0 * f[l] * d1[l] /
+				    (2.0 * d1[l] * d1[l] - f[l] * d2[l]) :
+				    x[l] - f[l] / d1[l];
+
+			if (!lane_done(x[l], xn, f[l], ++iter[l], tol,
+				       &roots[idx[l]])) {
+				x[l] = xn;
+				continue;
+			}
+			if (next < n) {
+				x[l] = starts[next];
+				idx[l] = next++;
+				iter[l] = 0;
+			} else {
+				active--;
+				x[l] = x[active];
+				idx[l] = idx[active];
+				iter[l] = iter[active];
+			}
+		}
+	}
+	ret = 0;
+out:
+	free(x);
+	free(idx);
+	free(iter);
+out_prog:
+	vm_free(&prog);
+	return ret;
+}
+
+/*
+ * p(z)/p'(z) for monic p of degree m; outside the unit circle through
+ * the reversed polynomial q(w) = w^m p(1/w), which doesn't overflow:
+ * p/p' = z q(w) / (m q(w) - w q'(w)) with w = 1/z
+ */
+static double complex newton_ratio(const double *a, size_t m, double complex z)
+{
+	double complex p = 0.0, dp = 0.0, w;
+	size_t i;
+
+	if (cabs(z) <= 1.0) {
+		for (i = m + 1; i-- > 0;) {
+			dp = dp * z + p;
+			p = p * z + a[i];
+		}
+		return p / dp;
+	}
+	w = 1.0 / z;
+	for (i = 0; i <= m; i++) {
+		dp = dp * w + p;
+		p = p * w + a[i];
+	}
+	return z * p / ((double)m * p - w * dp);
+}
+
+/**
+ * poly_roots_all - Find all complex roots of a polynomial
+ * @poly: Normalized polynomial of degree 1 .. ROOT_MAX_DEGREE
+ * @tol: Relative correction to stop at, e.g. 1e-14
+ * @re: Output, real parts of the roots, as many as the degree
+ * @im: Output, imaginary parts
+ *
+ * Aberth-Ehrlich iteration: every root estimate takes the Newton step
+ * corrected for the repulsion of all others,
+ *
+ *	w_k = r_k / (1 - r_k sum_j!=k 1/(z_k - z_j)),  r_k = p(z_k)/p'(z_k)
+ *
+ * from starting points on a circle. Each sweep is O(m^2), done in place
+ * (new estimates are used right away); converged roots stop moving. A
+ * factor x^k gives k exact zeros.
+ *
+ * Returns the number of roots (the degree), -1 if memory runs out or the
+ * degree is out of range. Roots that didn't converge within the
+ * iteration limit are returned as they are.
+ */
+int poly_roots_all(const struct polynomial *poly, double tol, double *re,
+		   double *im)
+{
+	const double pi = 3.14159265358979323846;
+	uint64_t deg, low;
+	unsigned char *done;
+	double *a, r;
+	size_t m, i, j, left;
+	int iter;
+
+	if (!poly->num_terms || !poly->terms[0].exp ||
+	    poly->terms[0].exp > ROOT_MAX_DEGREE)
+		return -1;
+	deg = poly->terms[0].exp;
+	low = poly->terms[poly->num_terms - 1].exp;
+	m = (size_t)(deg - low);
+	for (i = 0; i < low; i++)
+		re[m + i] = im[m + i] = 0.0;
+	if (!m)
+		return (int)deg;
+
+	a = calloc(m + 1, sizeof(*a));
+	done = calloc(m, 1);
+	if (!a || !done) {
+		free(a);
+		free(done);
+		return -1;
+	}
+	/* monic, so p'(z) and the radius below need no scaling */
+	for (i = 0; i < poly->num_terms; i++)
+		a[poly->terms[i].exp - low] = poly->terms[i].coeff /
+					      poly->terms[0].coeff;
+
+	/* the geometric mean of the roots' moduli */
+	r = pow(fabs(a[0]), 1.0 / (double)m);
+	for (i = 0; i < m; i++) {
+		double t = 2.0 * pi * (double)i / (double)m + 0.4;
+
+		re[i] = r * cos(t);
+		im[i] = r * sin(t);
+	}
+
+	left = m;
+	for (iter = 0; iter < ABERTH_MAX_ITER && left; iter++) {
+		for (i = 0; i < m; i++) {
+			double complex z = re[i] + im[i] * I, ratio, w;
+			double sr = 0.0, si = 0.0;
+
+			if (done[i])
+				continue;
+			/* sum of 1/(z - z_j) = conj(z - z_j)/|z - z_j|^2 */
+			for (j = 0; j < m; j++) {
+				double dr = re[i] - re[j], di = im[i] - im[j];
+				double s = j == i ? 0.0 : 1.0 / (dr * dr + di * di);
+
+				sr += dr * s;
+				si -= di * s;
+			}
+			ratio = newton_ratio(a, m, z);
+			w = ratio / (1.0 - ratio * (sr + si * I));
+			if (!isfinite(creal(w)) || !isfinite(cimag(w))) {
+				/* on a critical point: nudge it off */
+				re[i] += 1e-8 * (fabs(re[i]) + 1.0);
+				continue;
+			}
+			z -= w;
+			re[i] = creal(z);
+			im[i] = cimag(z);
+			if (cabs(w) <= tol * cabs(z)) {
+				done[i] = 1;
+				left--;
+			}
+		}
+	}
+	free(a);
+	free(done);
+	return (int)deg;
+}
@@ -0,0 +1,842 @@
+#define _POSIX_C_SOURCE 199309L	/* clock_gettime() */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "simplify.h"
+
+/*
+ * A node's shape is its type, with calls told apart by function; an
+ * operand that doesn't exist (rhs of unary nodes) has SHAPE_NONE.
+ */
+#define SHAPE_NONE (NODE_FUNC + NUM_FUNCS)
+#define NUM_SHAPES (SHAPE_NONE + 1)
+
+#define S(type) (1u << (type))
+#define S_FUNC(func) (1u << (NODE_FUNC + (func)))
+#define S_ANY (S(SHAPE_NONE) - 1)
+#define S_SUM (S(NODE_ADD) | S(NODE_SUB))
+
+#define BUDGET_PER_NODE 16	/* rewrites allowed per node reached */
+#define MAX_TERMS 16		/* terms of a sum collected at once */
+
+typedef uint32_t (*rule_fn)(struct expr_arena *arena, uint32_t id,
+			    const struct node *n);
+
+struct rule_entry {
+	uint8_t rule;		/* enum simplify_rule */
+	uint16_t root;		/* shapes the node and its operands may have */
+	uint16_t lhs;
+	uint16_t rhs;
+	rule_fn apply;		/* rewritten node, @id if it doesn't apply */
+};
+
+struct frame {
+	uint32_t node;
+	uint32_t owner;		/* node that rewrote to this one, or NODE_NONE */
+};
+
+struct simplifier {
+	struct expr_arena *arena;
+	struct simplify_stats *stats;
+	uint64_t by_root[NUM_SHAPES];	/* rule entries per shape */
+	uint64_t by_lhs[NUM_SHAPES];
+	uint64_t by_rhs[NUM_SHAPES];
+	struct frame *stack;
+	size_t depth;
+	size_t cap;
+	uint64_t budget;
+};
+
+static const char *const rule_names[NUM_RULES] = {
+	[RULE_ADD_NEG] = "a + -b -> a - b",
+	[RULE_NEG_ADD] = "-a + b -> b - a",
+	[RULE_NEG_SUB] = "-a - b -> -(a + b)",
+	[RULE_CONST_LAST] = "c + a -> a + c",
+	[RULE_LIKE_TERMS] = "c1*a + c2*a -> c*a",
+	[RULE_PYTHAGORAS] = "sin(a)^2 + cos(a)^2 -> 1",
+	[RULE_NEG_DIFF] = "-(a - b) -> b - a",
+	[RULE_LIKE_FACTORS] = "a^m*b*a^n -> a^(m + n)*b",
+	[RULE_CANCEL] = "(a^m*b)/a^n -> a^(m - n)*b",
+	[RULE_POW_POW] = "(a^m)^n -> a^(m*n)",
+	[RULE_POW_PROD] = "(a*b)^n -> a^n*b^n",
+	[RULE_DIV_DIV] = "(a/b)/c -> a/(b*c)",
+	[RULE_EXP_MUL] = "exp(a)*exp(b) -> exp(a + b)",
+	[RULE_EXP_DIV] = "exp(a)/exp(b) -> exp(a - b)",
+	[RULE_LN_EXP] = "ln(exp(a)) -> a",
+	[RULE_EXP_LN] = "exp(ln(a)) -> a",
+	[RULE_SQRT_SQUARE] = "sqrt(a)^2 -> a",
+	[RULE_ODD_FUNC] = "sin(-a) -> -sin(a)",
+	[RULE_EVEN_FUNC] = "cos(-a) -> cos(a)",
+	[RULE_TAN] = "sin(a)/cos(a) -> tan(a)",
+};
+
+/*
+ * The terms of a sum as coefficient times base, with equal bases merged
+ * and the constant terms added up; or the factors of a product as base
+ * to a constant exponent. Only the top MAX_TERMS operands are taken
+ * apart, the rest stay whole, so a long sum costs the same per node as
+ * a short one.
+ */
+struct sum {
+	uint32_t base[MAX_TERMS];
+	double coeff[MAX_TERMS];
+	int num;
+	int leaves;		/* terms before merging */
+	int consts;		/* constant terms */
+	double constant;
+};
+
+static double const_of(const struct expr_arena *arena, uint32_t id)
+{
+	return arena->consts[arena->nodes[id].lhs];
+}
+
+static int is_type(const struct expr_arena *arena, uint32_t id,
+		   enum node_type type)
+{
+	return arena->nodes[id].type == type;
+}
+
+static int is_func(const struct expr_arena *arena, uint32_t id,
+		   enum func_id func)
+{
+	return is_type(arena, id, NODE_FUNC) && arena->nodes[id].op == func;
+}
+
+static int is_integer(const struct expr_arena *arena, uint32_t id)
+{
+	return is_type(arena, id, NODE_CONST) &&
+	       const_of(arena, id) == floor(const_of(arena, id));
+}
+
+/* a as c*b: returns c, b goes to *base */
+static double split_term(const struct expr_arena *arena, uint32_t id,
+			 uint32_t *base)
+{
+	struct node n = arena->nodes[id];
+	double c = 1.0;
+
+	if (n.type == NODE_NEG) {
+		c = -1.0;
+		id = n.lhs;
+		n = arena->nodes[id];
+	}
+	if (n.type == NODE_MUL && is_type(arena, n.lhs, NODE_CONST)) {
+		c *= const_of(arena, n.lhs);
+		id = n.rhs;
+	}
+	*base = id;
+	return c;
+}
+
+/*
+ * Add the terms of @id times @sign. @reserve slots are kept free for
+ * the right operands still to come, so every term finds room.
+ */
+static void gather(const struct expr_arena *arena, uint32_t id, double sign,
+		   int reserve, struct sum *sum)
+{
+	const struct node n = arena->nodes[id];
+	uint32_t base;
+	double c;
+	int i;
+
+	if ((n.type == NODE_ADD || n.type == NODE_SUB) &&
+	    sum->num + 2 + reserve <= MAX_TERMS) {
+		gather(arena, n.lhs, sign, reserve + 1, sum);
+		gather(arena, n.rhs, n.type == NODE_SUB ? -sign : sign,
+		       reserve, sum);
+		return;
+	}
+	if (n.type == NODE_NEG && (is_type(arena, n.lhs, NODE_ADD) ||
+				   is_type(arena, n.lhs, NODE_SUB))) {
+		gather(arena, n.lhs, -sign, reserve, sum);
+		return;
+	}
+
+	sum->leaves++;
+	if (n.type == NODE_CONST) {
+		sum->constant += sign * const_of(arena, id);
+		sum->consts++;
+		return;
+	}
+	c = sign * split_term(arena, id, &base);
+	for (i = 0; i < sum->num; i++) {
+		if (sum->base[i] == base) {
+			sum->coeff[i] += c;
+			return;
+		}
+	}
+	sum->base[sum->num] = base;
+	sum->coeff[sum->num++] = c;
+}
+
+/* left + c*base, as a subtraction if c is negative */
+static uint32_t add_term(struct expr_arena *arena, uint32_t left, double c,
+			 uint32_t base)
+{
+	if (c < 0.0)
+		return ast_binary(arena, NODE_SUB, left,
+				  ast_binary(arena, NODE_MUL,
+					     ast_const(arena, -c), base));
+	return ast_binary(arena, NODE_ADD, left,
+			  ast_binary(arena, NODE_MUL, ast_const(arena, c), base));
+}
+
+/* the sum left to right, constant last; @id if a coefficient overflowed */
+static uint32_t build_sum(struct expr_arena *arena, uint32_t id,
+			  const struct sum *sum)
+{
+	uint32_t acc = NODE_NONE;
+	int i, first = 1;
+
+	if (!isfinite(sum->constant))
+		return id;
+	for (i = 0; i < sum->num; i++) {
+		if (!isfinite(sum->coeff[i]))
+			return id;
+		if (sum->coeff[i] == 0.0)
+			continue;
+		if (first)
+			acc = ast_binary(arena, NODE_MUL,
+					 ast_const(arena, sum->coeff[i]),
+					 sum->base[i]);
+		else
+			acc = add_term(arena, acc, sum->coeff[i], sum->base[i]);
+		first = 0;
+	}
+	if (first)
+		return ast_const(arena, sum->constant);
+	if (sum->constant == 0.0)
+		return acc;
+	return add_term(arena, acc, sum->constant, ast_const(arena, 1.0));
+}
+
+/* a as b^e with a constant e: returns b, e goes to *expo, or NODE_NONE */
+static uint32_t split_pow(const struct expr_arena *arena, uint32_t id,
+			  double *expo)
+{
+	const struct node *n = &arena->nodes[id];
+
+	if (n->type != NODE_POW) {
+		*expo = 1.0;
+		return id;
+	}
+	if (!is_type(arena, n->rhs, NODE_CONST)) {
+		*expo = 0.0;
+		return NODE_NONE;
+	}
+	*expo = const_of(arena, n->rhs);
+	return n->lhs;
+}
+
+static uint32_t add_neg(struct expr_arena *arena, uint32_t id,
+			const struct node *n)
+{
+	(void)id;
+	return ast_binary(arena, NODE_SUB, n->lhs, arena->nodes[n->rhs].lhs);
+}
+
+static uint32_t neg_add(struct expr_arena *arena, uint32_t id,
+			const struct node *n)
+{
+	(void)id;
+	return ast_binary(arena, NODE_SUB, n->rhs, arena->nodes[n->lhs].lhs);
+}
+
+static uint32_t neg_sub(struct expr_arena *arena, uint32_t id,
+			const struct node *n)
+{
+	(void)id;
+	return ast_neg(arena, ast_binary(arena, NODE_ADD,
+					 arena->nodes[n->lhs].lhs, n->rhs));
+}
+
+static uint32_t const_last(struct expr_arena *arena, uint32_t id,
+			   const struct node *n)
+{
+	(void)id;
+	return ast_binary(arena, NODE_ADD, n->rhs, n->lhs);
+}
+
+static uint32_t like_terms(struct expr_arena *arena, uint32_t id,
+			   const struct node *n)
+{
+	struct sum sum = { .num = 0 };
+
+	(void)n;
+	gather(arena, id, 1.0, 0, &sum);
+	/* nothing merged and at most one constant: already collected */
+	if (sum.leaves - sum.consts == sum.num && sum.consts <= 1)
+		return id;
+	return build_sum(arena, id, &sum);
+}
+
+/* the base of sin(a)^2 or cos(a)^2 matching the other, or NODE_NONE */
+static uint32_t pythagoras_pair(const struct expr_arena *arena, uint32_t id)
+{
+	const struct node *n = &arena->nodes[id];
+	uint32_t f;
+
+	if (n->type != NODE_POW || !ast_is_const(arena, n->rhs, 2.0))
+		return NODE_NONE;
+	f = n->lhs;
+	if (!is_func(arena, f, FUNC_SIN) && !is_func(arena, f, FUNC_COS))
+		return NODE_NONE;
+	return f;
+}
+
+static uint32_t pythagoras(struct expr_arena *arena, uint32_t id,
+			   const struct node *n)
+{
+	struct sum sum = { .num = 0 };
+	int i, j;
+
+	(void)n;
+	gather(arena, id, 1.0, 0, &sum);
+	for (i = 0; i < sum.num; i++) {
+		uint32_t fi = pythagoras_pair(arena, sum.base[i]);
+
+		if (fi == NODE_NONE || !is_func(arena, fi, FUNC_SIN))
+			continue;
+		for (j = 0; j < sum.num; j++) {
+			uint32_t fj = pythagoras_pair(arena, sum.base[j]);
+
+			if (fj == NODE_NONE || !is_func(arena, fj, FUNC_COS) ||
+			    arena->nodes[fi].lhs != arena->nodes[fj].lhs ||
+			    sum.coeff[i] != sum.coeff[j])
+				continue;
+			/* c*sin(a)^2 + c*cos(a)^2 = c */
+			sum.constant += sum.coeff[i];
+			sum.coeff[i] = sum.coeff[j] = 0.0;
+			return build_sum(arena, id, &sum);
+		}
+	}
+	return id;
+}
+
+static uint32_t neg_diff(struct expr_arena *arena, uint32_t id,
+			 const struct node *n)
+{
+	const struct node l = arena->nodes[n->lhs];
+
+	(void)id;
+	return ast_binary(arena, NODE_SUB, l.rhs, l.lhs);
+}
+
+/* like gather(), for the factors of a product */
+static void gather_factors(const struct expr_arena *arena, uint32_t id,
+			   int reserve, struct sum *prod)
+{
+	const struct node n = arena->nodes[id];
+	uint32_t base;
+	double e;
+	int i;
+
+	if (n.type == NODE_MUL && prod->num + 2 + reserve <= MAX_TERMS) {
+		gather_factors(arena, n.lhs, reserve + 1, prod);
+		gather_factors(arena, n.rhs, reserve, prod);
+		return;
+	}
+	prod->leaves++;
+	if (n.type == NODE_CONST) {
+		prod->constant *= const_of(arena, id);
+		prod->consts++;
+		return;
+	}
+	base = split_pow(arena, id, &e);
+	if (base == NODE_NONE) {
+		base = id;
+		e = 1.0;
+	}
+	for (i = 0; i < prod->num; i++) {
+		if (prod->base[i] == base) {
+			prod->coeff[i] += e;
+			return;
+		}
+	}
+	prod->base[prod->num] = base;
+	prod->coeff[prod->num++] = e;
+}
+
+/*
+ * The product sorted by node index, so equal products meet whatever
+ * order built them; factors with exponent 0 drop out. Returns @id if an
+ * exponent or the constant overflowed.
+ */
+static uint32_t build_product(struct expr_arena *arena, uint32_t id,
+			      struct sum *prod)
+{
+	uint32_t acc = NODE_NONE, f;
+	int i, j;
+
+	if (!isfinite(prod->constant))
+		return id;
+	for (i = 1; i < prod->num; i++) {
+		uint32_t b = prod->base[i];
+		double e = prod->coeff[i];
+
+		for (j = i; j > 0 && prod->base[j - 1] > b; j--) {
+			prod->base[j] = prod->base[j - 1];
+			prod->coeff[j] = prod->coeff[j - 1];
+		}
+		prod->base[j] = b;
+		prod->coeff[j] = e;
+	}
+	for (i = 0; i < prod->num; i++) {
+		if (!isfinite(prod->coeff[i]))
+			return id;
+		if (prod->coeff[i] == 0.0)
+			continue;
+		f = ast_binary(arena, NODE_POW, prod->base[i],
+			       ast_const(arena, prod->coeff[i]));
+		acc = acc == NODE_NONE ? f : ast_binary(arena, NODE_MUL, acc, f);
+	}
+	if (acc == NODE_NONE)
+		return ast_const(arena, prod->constant);
+	return ast_binary(arena, NODE_MUL, ast_const(arena, prod->constant),
+			  acc);
+}
+
+static uint32_t like_factors(struct expr_arena *arena, uint32_t id,
+			     const struct node *n)
+{
+	struct sum prod = { .num = 0, .constant = 1.0 };
+
+	(void)n;
+	gather_factors(arena, id, 0, &prod);
+	/* the rebuilt product is @id itself if it was collected already */
+	return build_product(arena, id, &prod);
+}
+
+static uint32_t cancel(struct expr_arena *arena, uint32_t id,
+		       const struct node *n)
+{
+	struct sum num = { .num = 0, .constant = 1.0 };
+	struct sum den = { .num = 0, .constant = 1.0 };
+	int i, j, cancelled = 0;
+
+	gather_factors(arena, n->lhs, 0, &num);
+	gather_factors(arena, n->rhs, 0, &den);
+	for (i = 0; i < num.num; i++) {
+		for (j = 0; j < den.num; j++) {
+			double e;
+
+			if (num.base[i] != den.base[j])
+				continue;
+			/* what is left goes where its exponent is positive */
+			e = num.coeff[i] - den.coeff[j];
+			num.coeff[i] = e > 0.0 ? e : 0.0;
+			den.coeff[j] = e < 0.0 ? -e : 0.0;
+			cancelled = 1;
+		}
+	}
+	/* constants on both sides fold where that is exact: 6*x/3 */
+	if (num.constant != 1.0 && den.constant != 1.0 &&
+	    num.constant / den.constant * den.constant == num.constant) {
+		num.constant /= den.constant;
+		den.constant = 1.0;
+		cancelled = 1;
+	}
+	if (!cancelled)
+		return id;
+	return ast_binary(arena, NODE_DIV, build_product(arena, id, &num),
+			  build_product(arena, id, &den));
+}
+
+static uint32_t pow_prod(struct expr_arena *arena, uint32_t id,
+			 const struct node *n)
+{
+	const struct node l = arena->nodes[n->lhs];
+
+	if (!is_integer(arena, n->rhs))
+		return id;
+	return ast_binary(arena, NODE_MUL,
+			  ast_binary(arena, NODE_POW, l.lhs, n->rhs),
+			  ast_binary(arena, NODE_POW, l.rhs, n->rhs));
+}
+
+static uint32_t pow_pow(struct expr_arena *arena, uint32_t id,
+			const struct node *n)
+{
+	const struct node l = arena->nodes[n->lhs];
+
+	/* (a^m)^n = a^(m*n) needs an integer n, think of (x^2)^0.5 */
+	if (!is_integer(arena, n->rhs))
+		return id;
+	return ast_binary(arena, NODE_POW, l.lhs,
+			  ast_binary(arena, NODE_MUL, l.rhs, n->rhs));
+}
+
+static uint32_t sqrt_square(struct expr_arena *arena, uint32_t id,
+			    const struct node *n)
+{
+	double e = const_of(arena, n->rhs);
+
+	/* sqrt(a)^(2k) -> a^k */
+	if (!is_integer(arena, n->rhs) || fmod(e, 2.0) != 0.0)
+		return id;
+	return ast_binary(arena, NODE_POW, arena->nodes[n->lhs].lhs,
+			  ast_const(arena, e / 2.0));
+}
+
+static uint32_t div_div(struct expr_arena *arena, uint32_t id,
+			const struct node *n)
+{
+	(void)id;
+	if (is_type(arena, n->lhs, NODE_DIV)) {
+		const struct node l = arena->nodes[n->lhs];
+
+		return ast_binary(arena, NODE_DIV, l.lhs,
+				  ast_binary(arena, NODE_MUL, l.rhs, n->rhs));
+	}
+	return ast_binary(arena, NODE_DIV,
+			  ast_binary(arena, NODE_MUL, n->lhs,
+				     arena->nodes[n->rhs].rhs),
+			  arena->nodes[n->rhs].lhs);
+}
+
+static uint32_t exp_mul(struct expr_arena *arena, uint32_t id,
+			const struct node *n)
+{
+	(void)id;
+	return ast_func(arena, FUNC_EXP,
+			ast_binary(arena, n->type == NODE_MUL ? NODE_ADD :
+								NODE_SUB,
+				   arena->nodes[n->lhs].lhs,
+				   arena->nodes[n->rhs].lhs));
+}
+
+static uint32_t inverse(struct expr_arena *arena, uint32_t id,
+			const struct node *n)
+{
+	(void)id;
+	return arena->nodes[n->lhs].lhs;
+}
+
+static uint32_t odd_func(struct expr_arena *arena, uint32_t id,
+			 const struct node *n)
+{
+	(void)id;
+	return ast_neg(arena, ast_func(arena, n->op,
+				       arena->nodes[n->lhs].lhs));
+}
+
+static uint32_t even_func(struct expr_arena *arena, uint32_t id,
+			  const struct node *n)
+{
+	(void)id;
+	return ast_func(arena, n->op, arena->nodes[n->lhs].lhs);
+}
+
+static uint32_t tan_quot(struct expr_arena *arena, uint32_t id,
+			 const struct node *n)
+{
+	uint32_t arg = arena->nodes[n->lhs].lhs;
+
+	if (arg != arena->nodes[n->rhs].lhs)
+		return id;
+	return ast_func(arena, FUNC_TAN, arg);
+}
+
+/*
+ * Every identity holds wherever the expression it replaces is defined;
+ * the result may be defined at more points (x/x is 1 at 0, too). Rules
+ * that apply to two operand shapes have an entry for each. Entries are
+ * tried in this order.
+ */
+static const struct rule_entry rules[] = {
+	{ RULE_ADD_NEG, S(NODE_ADD), S_ANY, S(NODE_NEG), add_neg },
+	{ RULE_NEG_ADD, S(NODE_ADD), S(NODE_NEG), S_ANY, neg_add },
+	{ RULE_NEG_SUB, S(NODE_SUB), S(NODE_NEG), S_ANY, neg_sub },
+	{ RULE_PYTHAGORAS, S_SUM, S_ANY, S(NODE_POW), pythagoras },
+	{ RULE_LIKE_TERMS, S_SUM, S_ANY, S_ANY, like_terms },
+	{ RULE_CONST_LAST, S(NODE_ADD), S(NODE_CONST), S_ANY, const_last },
+	{ RULE_NEG_DIFF, S(NODE_NEG), S(NODE_SUB), S(SHAPE_NONE), neg_diff },
+	{ RULE_EXP_MUL, S(NODE_MUL), S_FUNC(FUNC_EXP), S_FUNC(FUNC_EXP),
+	  exp_mul },
+	{ RULE_LIKE_FACTORS, S(NODE_MUL), S_ANY, S_ANY, like_factors },
+	{ RULE_CANCEL, S(NODE_DIV), S_ANY, S_ANY, cancel },
+	{ RULE_EXP_DIV, S(NODE_DIV), S_FUNC(FUNC_EXP), S_FUNC(FUNC_EXP),
+	  exp_mul },
+	{ RULE_TAN, S(NODE_DIV), S_FUNC(FUNC_SIN), S_FUNC(FUNC_COS),
+	  tan_quot },
+	{ RULE_DIV_DIV, S(NODE_DIV), S(NODE_DIV), S_ANY, div_div },
+	{ RULE_DIV_DIV, S(NODE_DIV), S_ANY & ~S(NODE_DIV), S(NODE_DIV),
+	  div_div },
+	{ RULE_POW_POW, S(NODE_POW), S(NODE_POW), S(NODE_CONST), pow_pow },
+	{ RULE_POW_PROD, S(NODE_POW), S(NODE_MUL), S(NODE_CONST), pow_prod },
+	{ RULE_SQRT_SQUARE, S(NODE_POW), S_FUNC(FUNC_SQRT), S(NODE_CONST),
+	  sqrt_square },
+	{ RULE_LN_EXP, S_FUNC(FUNC_LN), S_FUNC(FUNC_EXP), S(SHAPE_NONE),
+	  inverse },
+	{ RULE_EXP_LN, S_FUNC(FUNC_EXP), S_FUNC(FUNC_LN), S(SHAPE_NONE),
+	  inverse },
+	{ RULE_ODD_FUNC, S_FUNC(FUNC_SIN) | S_FUNC(FUNC_TAN), S(NODE_NEG),
+	  S(SHAPE_NONE), odd_func },
+	{ RULE_EVEN_FUNC, S_FUNC(FUNC_COS), S(NODE_NEG), S(SHAPE_NONE),
+	  even_func },
+};
+
+#define NUM_ENTRIES (sizeof(rules) / sizeof(rules[0]))
+
+static unsigned int shape_of(const struct expr_arena *arena, uint32_t id)
+{
+	const struct node *n = &arena->nodes[id];
+
+	return n->type == NODE_FUNC ? NODE_FUNC + n->op : n->type;
+}
+
+static void build_index(struct simplifier *s)
+{
+	unsigned int e, sh;
+
+	memset(s->by_root, 0, sizeof(s->by_root));
+	memset(s->by_lhs, 0, sizeof(s->by_lhs));
+	memset(s->by_rhs, 0, sizeof(s->by_rhs));
+	for (e = 0; e < NUM_ENTRIES; e++) {
+		for (sh = 0; sh < NUM_SHAPES; sh++) {
+			if (rules[e].root & S(sh))
+				s->by_root[sh] |= 1ull << e;
+			if (rules[e].lhs & S(sh))
+				s->by_lhs[sh] |= 1ull << e;
+			if (rules[e].rhs & S(sh))
+				s->by_rhs[sh] |= 1ull << e;
+		}
+	}
+}
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Try the rules indexed under the node's shape, first match wins.
+ * Returns the rewritten node, @id if no rule applies, or NODE_NONE if
+ * memory runs out.
+ */
+static uint32_t rewrite(struct simplifier *s, uint32_t id)
+{
+	const struct node n = s->arena->nodes[id];
+	uint64_t match = s->by_root[shape_of(s->arena, id)];
+	uint32_t r;
+
+	if (!match)
+		return id;
+	match &= s->by_lhs[shape_of(s->arena, n.lhs)];
+	match &= n.type == NODE_NEG || n.type == NODE_FUNC ?
+		 s->by_rhs[SHAPE_NONE] : s->by_rhs[shape_of(s->arena, n.rhs)];
+
+	while (match) {
+		const struct rule_entry *e = &rules[__builtin_ctzll(match)];
+		double start = 0.0;
+
+		match &= match - 1;
+		if (s->stats)
+			start = now_s();
+		r = e->apply(s->arena, id, &n);
+		if (s->stats) {
+			s->stats->seconds[e->rule] += now_s() - start;
+			s->stats->tries[e->rule]++;
+			s->stats->hits[e->rule] += r != id;
+		}
+		if (r != id)
+			return r;
+	}
+	return id;
+}
+
+static int push(struct simplifier *s, uint32_t node, uint32_t owner)
+{
+	if (s->depth == s->cap) {
+		size_t cap = s->cap ? s->cap * 2 : 64;
+		struct frame *p = realloc(s->stack, sizeof(*p) * cap);
+
+		if (!p)
+			return -1;
+		s->stack = p;
+		s->cap = cap;
+	}
+	s->stack[s->depth].node = node;
+	s->stack[s->depth].owner = owner;
+	s->depth++;
+	return 0;
+}
+
+/* the node with its operands replaced by their simplified forms */
+static uint32_t rebuild(struct expr_arena *arena, uint32_t id)
+{
+	const struct node n = arena->nodes[id];
+
+	switch (n.type) {
+	case NODE_CONST:
+	case NODE_VAR:
+		return id;
+	case NODE_NEG:
+		return ast_neg(arena, ast_memo_get(arena, n.lhs, SIMPLIFY_TAG));
+	case NODE_FUNC:
+		return ast_func(arena, n.op,
+				ast_memo_get(arena, n.lhs, SIMPLIFY_TAG));
+	default:
+		return ast_binary(arena, n.type,
+				  ast_memo_get(arena, n.lhs, SIMPLIFY_TAG),
+				  ast_memo_get(arena, n.rhs, SIMPLIFY_TAG));
+	}
+}
+
+/*
+ * Push the operands that aren't simplified yet. Returns 1 if there were
+ * any, 0 if none, -1 if memory runs out.
+ */
+static int push_operands(struct simplifier *s, uint32_t id)
+{
+	const struct node n = s->arena->nodes[id];
+	int pending = 0;
+
+	if (n.type == NODE_CONST || n.type == NODE_VAR)
+		return 0;
+	if (ast_memo_get(s->arena, n.lhs, SIMPLIFY_TAG) == NODE_NONE) {
+		if (push(s, n.lhs, NODE_NONE) < 0)
+			return -1;
+		pending = 1;
+	}
+	if (n.type == NODE_NEG || n.type == NODE_FUNC)
+		return pending;
+	if (ast_memo_get(s->arena, n.rhs, SIMPLIFY_TAG) == NODE_NONE) {
+		if (push(s, n.rhs, NODE_NONE) < 0)
+			return -1;
+		pending = 1;
+	}
+	return pending;
+}
+
+static uint32_t count_nodes(const struct expr_arena *arena, uint32_t root)
+{
+	unsigned char *live = calloc((size_t)root + 1, 1);
+	uint32_t i, count = 0;
+
+	if (!live)
+		return 0;
+	live[root] = 1;
+	for (i = root + 1; i-- > 0;) {
+		const struct node *n = &arena->nodes[i];
+
+		if (!live[i])
+			continue;
+		count++;
+		if (n->type == NODE_CONST || n->type == NODE_VAR)
+			continue;
+		live[n->lhs] = 1;
+		if (n->type != NODE_NEG && n->type != NODE_FUNC)
+			live[n->rhs] = 1;
+	}
+	free(live);
+	return count;
+}
+
+/**
+ * simplify - Simplify an expression with rewrite rules
+ * @arena: Arena holding the expression; new nodes are added to it
+ * @root: Expression to simplify
+ * @stats: Output, node counts and per-rule figures (NULL if not wanted)
+ *
+ * Works bottom-up without recursion: a node is rebuilt from its
+ * simplified operands, then rewritten until no rule applies, and a
+ * rewritten node is simplified the same way before the original takes
+ * its result. Every node's result, which is a fixpoint itself, is
+ * memoised in the arena, so on an already simplified expression each
+ * node costs one rebuild (a hash lookup) and the few rules indexed under
+ * its shape. Rewriting stops after BUDGET_PER_NODE steps per node
+ * reached, in case rules ever undo each other. The result never has
+ * more distinct nodes than @root.
+ *
+ * Returns the simplified expression, or NODE_NONE if memory runs out
+ */
+uint32_t simplify(struct expr_arena *arena, uint32_t root,
+		  struct simplify_stats *stats)
+{
+	struct simplifier s = { .arena = arena, .stats = stats };
+	uint32_t result, before, after;
+
+	if (root == NODE_NONE)
+		return NODE_NONE;
+	if (stats)
+		stats->nodes_before = count_nodes(arena, root);
+	result = ast_memo_get(arena, root, SIMPLIFY_TAG);
+	if (result != NODE_NONE)
+		goto done;
+	before = stats ? stats->nodes_before : count_nodes(arena, root);
+
+	build_index(&s);
+	s.budget = (uint64_t)BUDGET_PER_NODE * ((uint64_t)root + 1);
+	if (push(&s, root, NODE_NONE) < 0)
+		goto out;
+	while (s.depth) {
+		const struct frame f = s.stack[s.depth - 1];
+		uint32_t r = ast_memo_get(arena, f.node, SIMPLIFY_TAG), u;
+		int pending;
+
+		if (r != NODE_NONE) {
+			if (f.owner != NODE_NONE &&
+			    ast_memo_put(arena, f.owner, SIMPLIFY_TAG, r) < 0)
+				goto out;
+			s.depth--;
+			continue;
+		}
+		pending = push_operands(&s, f.node);
+		if (pending < 0)
+			goto out;
+		if (pending)
+			continue;
+
+		u = rebuild(arena, f.node);
+		if (u == f.node && s.budget)
+			u = rewrite(&s, f.node);
+		if (u == NODE_NONE)
+			goto out;
+		if (u == f.node || !s.budget) {
+			/* a fixpoint, or out of budget with simplified operands */
+			if (ast_memo_put(arena, f.node, SIMPLIFY_TAG, u) < 0 ||
+			    (u != f.node &&
+			     ast_memo_put(arena, u, SIMPLIFY_TAG, u) < 0))
+				goto out;
+			continue;
+		}
+		s.budget--;
+		if (push(&s, u, f.node) < 0)
+			goto out;
+	}
+	result = ast_memo_get(arena, root, SIMPLIFY_TAG);
+
+	/*
+	 * Collecting terms and factors can split subexpressions the DAG
+	 * shared; if the whole came out larger, keep it as it was.
+	 */
+	after = count_nodes(arena, result);
+	if (after > before && before &&
+	    ast_memo_put(arena, root, SIMPLIFY_TAG, root) == 0)
+		result = root;
+out:
+	free(s.stack);
+done:
+	if (stats)
+		stats->nodes_after = result == NODE_NONE ? 0 :
+				     count_nodes(arena, result);
+	return result;
+}
+
+/**
+ * simplify_rule_name - The identity a rule applies, for reports
+ * @rule: Rule id
+ */
+const char *simplify_rule_name(enum simplify_rule rule)
+{
+	return rule_names[rule];
+}
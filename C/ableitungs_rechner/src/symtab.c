@@ -0,0 +1,145 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "ast.h"
+#include "symtab.h"
+
+#define MIN_SLOTS 16
+
+/* FNV-1a */
+static uint32_t name_hash(const char *name, size_t len)
+{
+	uint32_t h = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		h ^= (unsigned char)name[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+/**
+ * symtab_init - Set up a symbol table holding just x
+ * @st: Table to initialise
+ *
+ * Returns 0 on success, -1 if memory runs out
+ */
+int symtab_init(struct symtab *st)
+{
+	memset(st, 0, sizeof(*st));
+	st->slots = malloc(sizeof(*st->slots) * MIN_SLOTS);
+	if (!st->slots)
+		return -1;
+	memset(st->slots, 0xff, sizeof(*st->slots) * MIN_SLOTS);
+	st->slot_mask = MIN_SLOTS - 1;
+
+	if (symtab_intern(st, "x", 1) != VAR_X) {
+		symtab_destroy(st);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * symtab_destroy - Free a symbol table and its names
+ * @st: Table to free
+ */
+void symtab_destroy(struct symtab *st)
+{
+	uint32_t i;
+
+	for (i = 0; i < st->num; i++)
+		free(st->names[i]);
+	free(st->names);
+	free(st->slots);
+	memset(st, 0, sizeof(*st));
+}
+
+/* slot holding @name, or the empty slot where it would go */
+static uint32_t find_slot(const struct symtab *st, const char *name,
+			  size_t len)
+{
+	uint32_t i = name_hash(name, len) & st->slot_mask;
+
+	while (st->slots[i] != SYM_NONE) {
+		const char *s = st->names[st->slots[i]];
+
+		if (strncmp(s, name, len) == 0 && s[len] == '\0')
+			break;
+		i = (i + 1) & st->slot_mask;
+	}
+	return i;
+}
+
+static int rehash(struct symtab *st)
+{
+	uint32_t mask = st->slot_mask * 2 + 1;
+	uint32_t *slots = malloc(sizeof(*slots) * ((size_t)mask + 1));
+	uint32_t id;
+
+	if (!slots)
+		return -1;
+	memset(slots, 0xff, sizeof(*slots) * ((size_t)mask + 1));
+	free(st->slots);
+	st->slots = slots;
+	st->slot_mask = mask;
+	for (id = 0; id < st->num; id++)
+		slots[find_slot(st, st->names[id], strlen(st->names[id]))] = id;
+	return 0;
+}
+
+/**
+ * symtab_lookup - Find a variable by name
+ * @st: Table to search
+ * @name: Name, not necessarily NUL-terminated
+ * @len: Length of @name
+ *
+ * Returns the variable's id, or SYM_NONE if there is none
+ */
+uint32_t symtab_lookup(const struct symtab *st, const char *name, size_t len)
+{
+	return st->slots[find_slot(st, name, len)];
+}
+
+/**
+ * symtab_intern - Find a variable by name, adding it if it is new
+ * @st: Table to search
+ * @name: Name, not necessarily NUL-terminated
+ * @len: Length of @name
+ *
+ * Returns the variable's id, or SYM_NONE if memory runs out
+ */
+uint32_t symtab_intern(struct symtab *st, const char *name, size_t len)
+{
+	uint32_t i = find_slot(st, name, len);
+	char *copy;
+
+	if (st->slots[i] != SYM_NONE)
+		return st->slots[i];
+
+	/* keep the table at most half full */
+	if ((st->num + 1) * 2 > st->slot_mask + 1) {
+		if (rehash(st) < 0)
+			return SYM_NONE;
+		i = find_slot(st, name, len);
+	}
+	if (st->num == st->cap) {
+		uint32_t cap = st->cap ? st->cap * 2 : 8;
+		char **names = realloc(st->names, sizeof(*names) * cap);
+
+		if (!names)
+			return SYM_NONE;
+		st->names = names;
+		st->cap = cap;
+	}
+	copy = malloc(len + 1);
+	if (!copy)
+		return SYM_NONE;
+	memcpy(copy, name, len);
+	copy[len] = '\0';
+
+	st->names[st->num] = copy;
+	st->slots[i] = st->num;
+	return st->num++;
+}
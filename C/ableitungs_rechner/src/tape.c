@@ -0,0 +1,525 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tape.h"
+
+/*
+ * Recording works like vm_compile(): one instruction per reachable DAG
+ * node in index order, constants as immediates. The instructions first
+ * name each other by index; place_slots() then gives every value a slot
+ * in val[]. Values read by a later segment get a slot of their own, all
+ * others share the window of slots after them, indexed by position in
+ * the segment. Without checkpointing the whole tape is one segment.
+ *
+ * The forward pass stores values only. The backward sweep computes each
+ * local derivative from the values when it needs it, so a segment can
+ * be recomputed from its kept inputs alone and swept again: a gradient
+ * costs one forward pass, one more per segment but the last, and one
+ * sweep.
+ */
+struct recorder {
+	const struct expr_arena *arena;
+	struct tape *tape;
+	uint32_t *value;	/* node -> instruction, NODE_NONE if none */
+};
+
+static int grow(void **block, uint32_t *cap, uint32_t need, size_t size)
+{
+	uint32_t new_cap = *cap ? *cap : 64;
+	void *p;
+
+	if (need <= *cap)
+		return 0;
+	while (new_cap < need)
+		new_cap *= 2;
+	p = realloc(*block, size * new_cap);
+	if (!p)
+		return -1;
+	*block = p;
+	*cap = new_cap;
+	return 0;
+}
+
+static uint32_t emit(struct recorder *r, enum vm_opcode op, uint32_t a,
+		     uint32_t b)
+{
+	struct tape *tape = r->tape;
+	struct vm_insn *insn;
+
+	if (grow((void **)&tape->code, &tape->cap_insns, tape->num_insns + 1,
+		 sizeof(*tape->code)) < 0)
+		return NODE_NONE;
+
+	insn = &tape->code[tape->num_insns];
+	memset(insn, 0, sizeof(*insn));
+	insn->op = op;
+	insn->dst = tape->num_insns;
+	insn->a = a;
+	insn->b = b;
+	return tape->num_insns++;
+}
+
+static uint32_t add_const(struct recorder *r, uint32_t id)
+{
+	struct tape *tape = r->tape;
+
+	if (grow((void **)&tape->consts, &tape->cap_consts,
+		 tape->num_consts + 1, sizeof(*tape->consts)) < 0)
+		return NODE_NONE;
+	tape->consts[tape->num_consts] =
+		r->arena->consts[ast_node(r->arena, id)->lhs];
+	return tape->num_consts++;
+}
+
+static int is_const(const struct recorder *r, uint32_t id)
+{
+	return ast_node(r->arena, id)->type == NODE_CONST;
+}
+
+/* instruction computing a node; constants are only loaded when needed */
+static uint32_t value_of(struct recorder *r, uint32_t id)
+{
+	if (r->value[id] == NODE_NONE && is_const(r, id)) {
+		uint32_t k = add_const(r, id);
+
+		if (k != NODE_NONE)
+			r->value[id] = emit(r, OP_CONST, 0, k);
+	}
+	return r->value[id];
+}
+
+static uint32_t emit_k(struct recorder *r, enum vm_opcode op, uint32_t a,
+		       uint32_t const_node)
+{
+	uint32_t k = add_const(r, const_node);
+
+	if (a == NODE_NONE || k == NODE_NONE)
+		return NODE_NONE;
+	return emit(r, op, a, k);
+}
+
+static uint32_t record_binary(struct recorder *r, const struct node *n)
+{
+	int lc = is_const(r, n->lhs), rc = is_const(r, n->rhs);
+	uint32_t l, rv;
+
+	if (lc != rc) {
+		uint32_t a = value_of(r, lc ? n->rhs : n->lhs);
+		uint32_t k = lc ? n->lhs : n->rhs;
+
+		switch (n->type) {
+		case NODE_ADD:
+			return emit_k(r, OP_ADDK, a, k);
+		case NODE_SUB:
+			return emit_k(r, lc ? OP_RSUBK : OP_SUBK, a, k);
+		case NODE_MUL:
+			return emit_k(r, OP_MULK, a, k);
+		case NODE_DIV:
+			return emit_k(r, lc ? OP_RDIVK : OP_DIVK, a, k);
+		default:
+			if (!lc && ast_is_const(r->arena, k, 2.0))
+				return a == NODE_NONE ? NODE_NONE :
+				       emit(r, OP_MUL, a, a);
+			return emit_k(r, lc ? OP_RPOWK : OP_POWK, a, k);
+		}
+	}
+
+	l = value_of(r, n->lhs);
+	rv = value_of(r, n->rhs);
+	if (l == NODE_NONE || rv == NODE_NONE)
+		return NODE_NONE;
+	return emit(r, OP_ADD + (n->type - NODE_ADD), l, rv);
+}
+
+static uint32_t record_node(struct recorder *r, uint32_t id)
+{
+	const struct node *n = ast_node(r->arena, id);
+	uint32_t a;
+
+	switch (n->type) {
+	case NODE_VAR:
+		if (n->lhs >= r->tape->num_vars)
+			r->tape->num_vars = n->lhs + 1;
+		return emit(r, OP_VAR, n->lhs, 0);
+	case NODE_NEG:
+	case NODE_FUNC:
+		a = value_of(r, n->lhs);
+		if (a == NODE_NONE)
+			return NODE_NONE;
+		if (n->type == NODE_NEG)
+			return emit(r, OP_NEG, a, 0);
+		return emit(r, OP_SIN + n->op, a, 0);
+	default:
+		return record_binary(r, n);
+	}
+}
+
+/* which operand fields of an instruction name values */
+static int value_operands(const struct vm_insn *insn)
+{
+	switch (insn->op) {
+	case OP_CONST:
+	case OP_VAR:
+		return 0;
+	case OP_ADD:
+	case OP_SUB:
+	case OP_MUL:
+	case OP_DIV:
+	case OP_POW:
+		return 2;
+	default:
+		return 1;
+	}
+}
+
+/* turn instruction indices into slots, see the comment on top */
+static int place_slots(struct tape *tape, uint32_t checkpoint)
+{
+	uint32_t n = tape->num_insns, seg, i;
+	uint32_t *slot = calloc(n, sizeof(*slot));
+	double *block;
+
+	if (!slot)
+		return -1;
+	seg = checkpoint && checkpoint < n ? checkpoint : n;
+
+	for (i = 0; i < n; i++) {
+		const struct vm_insn *insn = &tape->code[i];
+		int ops = value_operands(insn);
+
+		if (ops >= 1 && insn->a / seg != i / seg)
+			slot[insn->a] = 1;
+		if (ops == 2 && insn->b / seg != i / seg)
+			slot[insn->b] = 1;
+	}
+	tape->num_kept = 0;
+	for (i = 0; i < n; i++)
+		slot[i] = slot[i] ? tape->num_kept++ : NODE_NONE;
+	for (i = 0; i < n; i++)
+		if (slot[i] == NODE_NONE)
+			slot[i] = tape->num_kept + i % seg;
+
+	for (i = 0; i < n; i++) {
+		struct vm_insn *insn = &tape->code[i];
+		int ops = value_operands(insn);
+
+		insn->dst = slot[i];
+		if (ops >= 1)
+			insn->a = slot[insn->a];
+		if (ops == 2)
+			insn->b = slot[insn->b];
+	}
+	tape->output = slot[n - 1];
+	free(slot);
+
+	tape->segment = seg;
+	tape->num_slots = (size_t)tape->num_kept + seg;
+	block = realloc(tape->val, sizeof(*block) * 2 * tape->num_slots);
+	if (!block)
+		return -1;
+	tape->val = block;
+	tape->adj = block + tape->num_slots;
+	return 0;
+}
+
+/**
+ * tape_init - Initialize an empty tape
+ * @tape: Tape to initialize
+ */
+void tape_init(struct tape *tape)
+{
+	memset(tape, 0, sizeof(*tape));
+}
+
+/**
+ * tape_record - Record an expression onto a tape
+ * @tape: Initialized tape; whatever it held before is replaced, and its
+ *	  buffers are reused
+ * @arena: Arena holding the expression
+ * @root: Expression to record
+ * @checkpoint: Instructions per checkpoint segment, 0 to keep every value
+ *	       for the backward sweep
+ *
+ * The tape doesn't refer to @arena afterwards.
+ *
+ * Returns 0 on success, -1 if memory runs out or @root is NODE_NONE
+ */
+int tape_record(struct tape *tape, const struct expr_arena *arena,
+		uint32_t root, uint32_t checkpoint)
+{
+	struct recorder r;
+	uint8_t *live;
+	uint32_t i;
+	int ret = -1;
+
+	tape->num_insns = 0;
+	tape->num_consts = 0;
+	tape->num_vars = 0;
+	if (root == NODE_NONE)
+		return -1;
+
+	r.arena = arena;
+	r.tape = tape;
+	r.value = malloc(sizeof(*r.value) * ((size_t)root + 1));
+	live = calloc((size_t)root + 1, 1);
+	if (!r.value || !live)
+		goto out;
+	memset(r.value, 0xff, sizeof(*r.value) * ((size_t)root + 1));
+
+	live[root] = 1;
+	for (i = root + 1; i-- > 0;) {
+		const struct node *n = ast_node(arena, i);
+
+		if (!live[i] || n->type <= NODE_VAR)
+			continue;
+		live[n->lhs] = 1;
+		if (n->type < NODE_NEG)
+			live[n->rhs] = 1;
+	}
+
+	for (i = 0; i <= root; i++) {
+		if (!live[i] || is_const(&r, i))
+			continue;
+		r.value[i] = record_node(&r, i);
+		if (r.value[i] == NODE_NONE)
+			goto out;
+	}
+	/* the result must be the last instruction */
+	if (value_of(&r, root) == NODE_NONE ||
+	    place_slots(tape, checkpoint) < 0)
+		goto out;
+	ret = 0;
+out:
+	if (ret < 0)
+		tape->num_insns = 0;
+	free(r.value);
+	free(live);
+	return ret;
+}
+
+static void forward(struct tape *tape, const double *vars, uint32_t begin,
+		    uint32_t end)
+{
+	const double *k = tape->consts;
+	double *v = tape->val;
+	uint32_t pc;
+
+	for (pc = begin; pc < end; pc++) {
+		const struct vm_insn *insn = &tape->code[pc];
+		uint32_t a = insn->a, b = insn->b;
+		double *d = &v[insn->dst];
+
+		switch (insn->op) {
+		case OP_CONST:
+			*d = k[b];
+			break;
+		case OP_VAR:
+			*d = vars[a];
+			break;
+		case OP_ADD:
+			*d = v[a] + v[b];
+			break;
+		case OP_SUB:
+			*d = v[a] - v[b];
+			break;
+		case OP_MUL:
+			*d = v[a] * v[b];
+			break;
+		case OP_DIV:
+			*d = v[a] / v[b];
+			break;
+		case OP_POW:
+			*d = pow(v[a], v[b]);
+			break;
+		case OP_ADDK:
+			*d = v[a] + k[b];
+			break;
+		case OP_SUBK:
+			*d = v[a] - k[b];
+			break;
+		case OP_RSUBK:
+			*d = k[b] - v[a];
+			break;
+		case OP_MULK:
+			*d = v[a] * k[b];
+			break;
+		case OP_DIVK:
+			*d = v[a] / k[b];
+			break;
+		case OP_RDIVK:
+			*d = k[b] / v[a];
+			break;
+		case OP_POWK:
+			*d = pow(v[a], k[b]);
+			break;
+		case OP_RPOWK:
+			*d = pow(k[b], v[a]);
+			break;
+		case OP_NEG:
+			*d = -v[a];
+			break;
+		case OP_SIN:
+			*d = sin(v[a]);
+			break;
+		case OP_COS:
+			*d = cos(v[a]);
+			break;
+		case OP_TAN:
+			*d = tan(v[a]);
+			break;
+		case OP_EXP:
+			*d = exp(v[a]);
+			break;
+		case OP_LN:
+			*d = log(v[a]);
+			break;
+		case OP_SQRT:
+			*d = sqrt(v[a]);
+			break;
+		}
+	}
+}
+
+/* pass the adjoints of [begin, end) on to the operands, last first */
+static void backward(struct tape *tape, uint32_t begin, uint32_t end,
+		     double *grad)
+{
+	const double *k = tape->consts, *v = tape->val;
+	double *adj = tape->adj;
+	uint32_t pc;
+
+	for (pc = end; pc-- > begin;) {
+		const struct vm_insn *insn = &tape->code[pc];
+		uint32_t a = insn->a, b = insn->b;
+		double g = adj[insn->dst], d = v[insn->dst];
+
+		switch (insn->op) {
+		case OP_CONST:
+			break;
+		case OP_VAR:
+			grad[a] += g;
+			break;
+		case OP_ADD:
+			adj[a] += g;
+			adj[b] += g;
+			break;
+		case OP_SUB:
+			adj[a] += g;
+			adj[b] -= g;
+			break;
+		case OP_MUL:
+			adj[a] += g * v[b];
+			adj[b] += g * v[a];
+			break;
+		case OP_DIV:
+			adj[a] += g / v[b];
+			adj[b] -= g * d / v[b];
+			break;
+		case OP_POW:
+			adj[a] += g * v[b] * pow(v[a], v[b] - 1.0);
+			adj[b] += g * d * log(v[a]);
+			break;
+		case OP_ADDK:
+		case OP_SUBK:
+			adj[a] += g;
+			break;
+		case OP_RSUBK:
+		case OP_NEG:
+			adj[a] -= g;
+			break;
+		case OP_MULK:
+			adj[a] += g * k[b];
+			break;
+		case OP_DIVK:
+			adj[a] += g / k[b];
+			break;
+		case OP_RDIVK:
+			adj[a] -= g * d / v[a];
+			break;
+		case OP_POWK:
+			adj[a] += g * k[b] * pow(v[a], k[b] - 1.0);
+			break;
+		case OP_RPOWK:
+			adj[a] += g * d * log(k[b]);
+			break;
+		case OP_SIN:
+			adj[a] += g * cos(v[a]);
+			break;
+		case OP_COS:
+			adj[a] -= g * sin(v[a]);
+			break;
+		case OP_TAN:
+			adj[a] += g * (1.0 + d * d);
+			break;
+		case OP_EXP:
+			adj[a] += g * d;
+			break;
+		case OP_LN:
+			adj[a] += g / v[a];
+			break;
+		case OP_SQRT:
+			adj[a] += g * 0.5 / d;
+			break;
+		}
+	}
+}
+
+/**
+ * tape_eval - Evaluate a recorded expression
+ * @tape: Tape filled by tape_record()
+ * @vars: Value of each variable id, tape->num_vars of them
+ *
+ * Returns the value of the expression
+ */
+double tape_eval(struct tape *tape, const double *vars)
+{
+	forward(tape, vars, 0, tape->num_insns);
+	return tape->val[tape->output];
+}
+
+/**
+ * tape_gradient - Evaluate a recorded expression and its gradient
+ * @tape: Tape filled by tape_record()
+ * @vars: Value of each variable id, tape->num_vars of them
+ * @grad: Output, the partial derivative by each variable id,
+ *	  tape->num_vars of them (0 for variables the expression lacks)
+ *
+ * One backward sweep gives every partial derivative; with checkpointing,
+ * each segment but the last is recomputed right before it is swept.
+ *
+ * Returns the value of the expression
+ */
+double tape_gradient(struct tape *tape, const double *vars, double *grad)
+{
+	uint32_t seg = tape->segment, last, s;
+	double value = tape_eval(tape, vars);
+
+	memset(grad, 0, sizeof(*grad) * tape->num_vars);
+	memset(tape->adj, 0, sizeof(*tape->adj) * tape->num_kept);
+	last = (tape->num_insns - 1) / seg;
+	for (s = last + 1; s-- > 0;) {
+		uint32_t begin = s * seg;
+		uint32_t end = s == last ? tape->num_insns : begin + seg;
+
+		if (s != last)
+			forward(tape, vars, begin, end);
+		memset(tape->adj + tape->num_kept, 0, sizeof(*tape->adj) * seg);
+		if (s == last)
+			tape->adj[tape->output] = 1.0;
+		backward(tape, begin, end, grad);
+	}
+	return value;
+}
+
+/**
+ * tape_free - Release a tape's memory
+ * @tape: Tape to release
+ */
+void tape_free(struct tape *tape)
+{
+	free(tape->code);
+	free(tape->consts);
+	free(tape->val);
+	memset(tape, 0, sizeof(*tape));
+}
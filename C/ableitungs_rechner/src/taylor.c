@@ -0,0 +1,318 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "taylor.h"
+
+#define TAYLOR_LIVE (NODE_NONE - 1)	/* reachable, not numbered yet */
+
+/*
+ * Taylor coefficients by propagating truncated power series through the
+ * DAG: with var = a + t, every node gets the first n coefficients of its
+ * expansion in t, computed from those of its children with the usual
+ * recurrences (each one follows from y' = g(u)*u' by comparing the
+ * coefficients of t^(k-1)). That is a single pass over the nodes and
+ * O(n^2) work per node, however many orders are asked for, where the
+ * symbolic n-th derivative grows with every order.
+ */
+
+/* out = a*b */
+static void ts_mul(double *out, const double *a, const double *b, size_t n)
+{
+	size_t k, j;
+
+	for (k = 0; k < n; k++) {
+		double sum = 0.0;
+
+		for (j = 0; j <= k; j++)
+			sum += a[j] * b[k - j];
+		out[k] = sum;
+	}
+}
+
+/* out = a/b */
+static void ts_div(double *out, const double *a, const double *b, size_t n)
+{
+	size_t k, j;
+
+	for (k = 0; k < n; k++) {
+		double sum = a[k];
+
+		for (j = 1; j <= k; j++)
+			sum -= b[j] * out[k - j];
+		out[k] = sum / b[0];
+	}
+}
+
+/* out = exp(u): k*y_k = sum j*u_j*y_(k-j) */
+static void ts_exp(double *out, const double *u, size_t n)
+{
+	size_t k, j;
+
+	out[0] = exp(u[0]);
+	for (k = 1; k < n; k++) {
+		double sum = 0.0;
+
+		for (j = 1; j <= k; j++)
+			sum += (double)j * u[j] * out[k - j];
+		out[k] = sum / (double)k;
+	}
+}
+
+/* out = ln(u): u_0*y_k = u_k - sum j*y_j*u_(k-j) / k */
+static void ts_ln(double *out, const double *u, size_t n)
+{
+	size_t k, j;
+
+	out[0] = log(u[0]);
+	for (k = 1; k < n; k++) {
+		double sum = 0.0;
+
+		for (j = 1; j < k; j++)
+			sum += (double)j * out[j] * u[k - j];
+		out[k] = (u[k] - sum / (double)k) / u[0];
+	}
+}
+
+/* s = sin(u), c = cos(u), which need each other */
+static void ts_sincos(double *s, double *c, const double *u, size_t n)
+{
+	size_t k, j;
+
+	s[0] = sin(u[0]);
+	c[0] = cos(u[0]);
+	for (k = 1; k < n; k++) {
+		double ss = 0.0, cs = 0.0;
+
+		for (j = 1; j <= k; j++) {
+			ss += (double)j * u[j] * c[k - j];
+			cs += (double)j * u[j] * s[k - j];
+		}
+		s[k] = ss / (double)k;
+		c[k] = -cs / (double)k;
+	}
+}
+
+/* out = sqrt(u): 2*y_0*y_k = u_k - sum y_j*y_(k-j) */
+static void ts_sqrt(double *out, const double *u, size_t n)
+{
+	size_t k, j;
+
+	out[0] = sqrt(u[0]);
+	for (k = 1; k < n; k++) {
+		double sum = u[k];
+
+		for (j = 1; j < k; j++)
+			sum -= out[j] * out[k - j];
+		out[k] = sum / (2.0 * out[0]);
+	}
+}
+
+/*
+ * out = u^p for a constant p: k*u_0*y_k = sum (p*j - k + j)*u_j*y_(k-j).
+ * That divides by u_0, so non-negative integer powers of a series
+ * starting with 0 (x^3 around 0) are multiplied out by squaring instead.
+ * @tmp holds 3n doubles.
+ */
+static void ts_pow_const(double *out, const double *u, double p, size_t n,
+			 double *tmp)
+{
+	size_t k, j;
+
+	if (u[0] == 0.0 && p >= 0.0 && p == floor(p) && p < 0x1p53) {
+		double *base = tmp, *next = tmp + n, *acc = tmp + 2 * n;
+		uint64_t e = (uint64_t)p;
+
+		memset(out, 0, sizeof(*out) * n);
+		out[0] = 1.0;
+		memcpy(base, u, sizeof(*base) * n);
+		while (e) {
+			if (e & 1) {
+				ts_mul(acc, out, base, n);
+				memcpy(out, acc, sizeof(*out) * n);
+			}
+			e >>= 1;
+			if (e) {
+				ts_mul(next, base, base, n);
+				memcpy(base, next, sizeof(*base) * n);
+			}
+		}
+		return;
+	}
+
+	out[0] = pow(u[0], p);
+	for (k = 1; k < n; k++) {
+		double sum = 0.0;
+
+		for (j = 1; j <= k; j++)
+			sum += (p * (double)j - (double)(k - j)) * u[j] *
+			       out[k - j];
+		out[k] = sum / ((double)k * u[0]);
+	}
+}
+
+static void taylor_node(const struct expr_arena *arena, uint32_t id,
+			uint32_t var, const double *vars, size_t n,
+			double *out, double *series, const uint32_t *slot,
+			double *tmp)
+{
+	const struct node *nd = ast_node(arena, id);
+	const double *a = NULL, *b = NULL;
+	size_t k;
+
+	memset(out, 0, sizeof(*out) * n);
+	switch (nd->type) {
+	case NODE_CONST:
+		out[0] = arena->consts[nd->lhs];
+		return;
+	case NODE_VAR:
+		out[0] = vars[nd->lhs];
+		if (nd->lhs == var && n > 1)
+			out[1] = 1.0;
+		return;
+	case NODE_NEG:
+	case NODE_FUNC:
+		a = series + (size_t)slot[nd->lhs] * n;
+		break;
+	default:
+		a = series + (size_t)slot[nd->lhs] * n;
+		b = series + (size_t)slot[nd->rhs] * n;
+		break;
+	}
+
+	switch (nd->type) {
+	case NODE_NEG:
+		for (k = 0; k < n; k++)
+			out[k] = -a[k];
+		return;
+	case NODE_ADD:
+		for (k = 0; k < n; k++)
+			out[k] = a[k] + b[k];
+		return;
+	case NODE_SUB:
+		for (k = 0; k < n; k++)
+			out[k] = a[k] - b[k];
+		return;
+	case NODE_MUL:
+		ts_mul(out, a, b, n);
+		return;
+	case NODE_DIV:
+		ts_div(out, a, b, n);
+		return;
+	case NODE_POW:
+		for (k = 1; k < n && b[k] == 0.0; k++)
+			;
+		if (k == n) {
+			ts_pow_const(out, a, b[0], n, tmp);
+			return;
+		}
+		/* f^g = exp(g*ln(f)) */
+		ts_ln(tmp, a, n);
+		ts_mul(tmp + n, b, tmp, n);
+		ts_exp(out, tmp + n, n);
+		return;
+	default:
+		break;
+	}
+
+	switch (nd->op) {
+	case FUNC_SIN:
+		ts_sincos(out, tmp, a, n);
+		break;
+	case FUNC_COS:
+		ts_sincos(tmp, out, a, n);
+		break;
+	case FUNC_TAN:
+		ts_sincos(tmp, tmp + n, a, n);
+		ts_div(out, tmp, tmp + n, n);
+		break;
+	case FUNC_EXP:
+		ts_exp(out, a, n);
+		break;
+	case FUNC_LN:
+		ts_ln(out, a, n);
+		break;
+	default:
+		ts_sqrt(out, a, n);
+		break;
+	}
+}
+
+/**
+ * ast_taylor - Taylor coefficients of an expression around a point
+ * @arena: Arena holding the expression
+ * @root: Expression to expand
+ * @var: Variable to expand in
+ * @vars: Value of each variable id; vars[@var] is the expansion point
+ * @n: Number of coefficients
+ * @coeffs: Output, the coefficients of (var - a)^0 to (var - a)^(n-1)
+ *
+ * Coefficient k is the k-th derivative at the point divided by k!, so this
+ * also gives the first n derivatives at one point without building any of
+ * them. Singular points (ln or sqrt of 0) yield infinities or NaNs.
+ *
+ * Returns 0 on success, -1 if memory runs out
+ */
+int ast_taylor(const struct expr_arena *arena, uint32_t root, uint32_t var,
+	       const double *vars, size_t n, double *coeffs)
+{
+	uint32_t *slot;
+	double *series = NULL, *tmp = NULL;
+	uint32_t i, live = 0;
+
+	if (root == NODE_NONE)
+		return -1;
+	if (!n)
+		return 0;
+
+	slot = malloc(sizeof(*slot) * ((size_t)root + 1));
+	if (!slot)
+		return -1;
+	memset(slot, 0xff, sizeof(*slot) * ((size_t)root + 1));
+
+	/* mark what the root uses, then number it children first */
+	slot[root] = TAYLOR_LIVE;
+	for (i = root + 1; i-- > 0;) {
+		const struct node *nd = ast_node(arena, i);
+
+		if (slot[i] != TAYLOR_LIVE)
+			continue;
+		switch (nd->type) {
+		case NODE_CONST:
+		case NODE_VAR:
+			break;
+		case NODE_NEG:
+		case NODE_FUNC:
+			slot[nd->lhs] = TAYLOR_LIVE;
+			break;
+		default:
+			slot[nd->lhs] = TAYLOR_LIVE;
+			slot[nd->rhs] = TAYLOR_LIVE;
+			break;
+		}
+	}
+	for (i = 0; i <= root; i++)
+		if (slot[i] == TAYLOR_LIVE)
+			slot[i] = live++;
+
+	series = malloc(sizeof(*series) * n * live);
+	tmp = malloc(sizeof(*tmp) * n * 3);
+	if (!series || !tmp) {
+		free(slot);
+		free(series);
+		free(tmp);
+		return -1;
+	}
+
+	for (i = 0; i <= root; i++)
+		if (slot[i] != NODE_NONE)
+			taylor_node(arena, i, var, vars, n,
+				    series + (size_t)slot[i] * n, series, slot,
+				    tmp);
+	memcpy(coeffs, series + (size_t)slot[root] * n, sizeof(*coeffs) * n);
+
+	free(slot);
+	free(series);
+	free(tmp);
+	return 0;
+}
@@ -0,0 +1,505 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vm.h"
+
+#define VM_MAX_POWI 32		/* larger integer exponents go through pow() */
+
+/*
+ * Compilation emits one instruction per reachable DAG node, so common
+ * subexpressions (which hash-consing has already merged into one node)
+ * are computed once. Instructions first write to virtual registers (their
+ * own index); a linear scan then maps those onto as few physical
+ * registers as possible, so the working set of a batch stays in cache.
+ */
+struct compiler {
+	const struct expr_arena *arena;
+	struct vm_program *prog;
+	uint32_t cap_insns;
+	uint32_t cap_consts;
+	uint32_t *value;	/* node -> virtual register, NODE_NONE if none */
+};
+
+static int grow(void **block, uint32_t *cap, uint32_t need, size_t size)
+{
+	uint32_t new_cap = *cap ? *cap : 64;
+	void *p;
+
+	if (need <= *cap)
+		return 0;
+	while (new_cap < need)
+		new_cap *= 2;
+	p = realloc(*block, size * new_cap);
+	if (!p)
+		return -1;
+	*block = p;
+	*cap = new_cap;
+	return 0;
+}
+
+static uint32_t emit(struct compiler *c, enum vm_opcode op, uint32_t a,
+		     uint32_t b)
+{
+	struct vm_program *prog = c->prog;
+	struct vm_insn *insn;
+
+	if (grow((void **)&prog->code, &c->cap_insns, prog->num_insns + 1,
+		 sizeof(*prog->code)) < 0)
+		return NODE_NONE;
+
+	insn = &prog->code[prog->num_insns];
+	memset(insn, 0, sizeof(*insn));
+	insn->op = op;
+	insn->dst = prog->num_insns;
+	insn->a = a;
+	insn->b = b;
+	return prog->num_insns++;
+}
+
+static uint32_t add_const(struct compiler *c, double v)
+{
+	struct vm_program *prog = c->prog;
+
+	if (grow((void **)&prog->consts, &c->cap_consts, prog->num_consts + 1,
+		 sizeof(*prog->consts)) < 0)
+		return NODE_NONE;
+	prog->consts[prog->num_consts] = v;
+	return prog->num_consts++;
+}
+
+static double const_of(const struct compiler *c, uint32_t id)
+{
+	return c->arena->consts[ast_node(c->arena, id)->lhs];
+}
+
+static int is_const(const struct compiler *c, uint32_t id)
+{
+	return ast_node(c->arena, id)->type == NODE_CONST;
+}
+
+/* register holding a node; constants are only loaded when needed */
+static uint32_t reg_of(struct compiler *c, uint32_t id)
+{
+	if (c->value[id] == NODE_NONE && is_const(c, id)) {
+		uint32_t k = add_const(c, const_of(c, id));
+
+		if (k != NODE_NONE)
+			c->value[id] = emit(c, OP_CONST, 0, k);
+	}
+	return c->value[id];
+}
+
+static uint32_t emit_k(struct compiler *c, enum vm_opcode op, uint32_t reg,
+		       uint32_t const_node)
+{
+	uint32_t k = add_const(c, const_of(c, const_node));
+
+	if (reg == NODE_NONE || k == NODE_NONE)
+		return NODE_NONE;
+	return emit(c, op, reg, k);
+}
+
+static uint32_t compile_binary(struct compiler *c, const struct node *n)
+{
+	int lc = is_const(c, n->lhs), rc = is_const(c, n->rhs);
+	uint32_t l, r;
+
+	if (lc != rc) {
+		uint32_t reg = reg_of(c, lc ? n->rhs : n->lhs);
+		uint32_t k = lc ? n->lhs : n->rhs;
+
+		switch (n->type) {
+		case NODE_ADD:
+			return emit_k(c, OP_ADDK, reg, k);
+		case NODE_SUB:
+			return emit_k(c, lc ? OP_RSUBK : OP_SUBK, reg, k);
+		case NODE_MUL:
+			return emit_k(c, OP_MULK, reg, k);
+		case NODE_DIV:
+			return emit_k(c, lc ? OP_RDIVK : OP_DIVK, reg, k);
+		default:
+			if (lc)
+				return emit_k(c, OP_RPOWK, reg, k);
+			if (const_of(c, k) == 2.0)
+				return emit(c, OP_MUL, reg, reg);
+			if (const_of(c, k) == floor(const_of(c, k)) &&
+			    fabs(const_of(c, k)) <= VM_MAX_POWI)
+				return emit(c, OP_POWI, reg,
+					    (uint32_t)(int32_t)const_of(c, k));
+			return emit_k(c, OP_POWK, reg, k);
+		}
+	}
+
+	/* both constant only happens when folding gave inf or NaN */
+	l = reg_of(c, n->lhs);
+	r = reg_of(c, n->rhs);
+	if (l == NODE_NONE || r == NODE_NONE)
+		return NODE_NONE;
+	return emit(c, OP_ADD + (n->type - NODE_ADD), l, r);
+}
+
+static uint32_t compile_node(struct compiler *c, uint32_t id)
+{
+	const struct node *n = ast_node(c->arena, id);
+	uint32_t a;
+
+	switch (n->type) {
+	case NODE_CONST:
+		return NODE_NONE;	/* loaded on demand by reg_of() */
+	case NODE_VAR:
+		if (n->lhs >= VM_MAX_VARS)
+			return NODE_NONE;
+		if (n->lhs >= c->prog->num_vars)
+			c->prog->num_vars = n->lhs + 1;
+		return emit(c, OP_VAR, n->lhs, 0);
+	case NODE_NEG:
+	case NODE_FUNC:
+		a = reg_of(c, n->lhs);
+		if (a == NODE_NONE)
+			return NODE_NONE;
+		if (n->type == NODE_NEG)
+			return emit(c, OP_NEG, a, 0);
+		return emit(c, OP_SIN + n->op, a, 0);
+	default:
+		return compile_binary(c, n);
+	}
+}
+
+/* which operand fields of an instruction name registers */
+static int reg_operands(const struct vm_insn *insn)
+{
+	switch (insn->op) {
+	case OP_CONST:
+	case OP_VAR:
+		return 0;
+	case OP_ADD:
+	case OP_SUB:
+	case OP_MUL:
+	case OP_DIV:
+	case OP_POW:
+		return 2;
+	default:
+		return 1;
+	}
+}
+
+/*
+ * Linear scan over the straight-line code: a register is freed after its
+ * last use and handed to the next instruction that needs one. The
+ * destination is allocated before the operands are released, so an
+ * instruction never writes a register it reads (the kernels rely on that).
+ */
+static int allocate_registers(struct vm_program *prog)
+{
+	uint32_t n = prog->num_insns;
+	uint32_t *last = malloc(sizeof(*last) * (n ? n : 1));
+	uint32_t *phys = malloc(sizeof(*phys) * (n ? n : 1));
+	uint32_t *free_regs = malloc(sizeof(*free_regs) * (n ? n : 1));
+	uint32_t num_free = 0, i, j;
+
+	if (!last || !phys || !free_regs) {
+		free(last);
+		free(phys);
+		free(free_regs);
+		return -1;
+	}
+
+	for (i = 0; i < n; i++)
+		last[i] = i;
+	for (i = 0; i < n; i++) {
+		const struct vm_insn *insn = &prog->code[i];
+
+		if (reg_operands(insn) >= 1)
+			last[insn->a] = i;
+		if (reg_operands(insn) == 2)
+			last[insn->b] = i;
+	}
+	for (i = 0; i < prog->num_outputs; i++)
+		last[prog->outputs[i]] = n;
+
+	prog->num_regs = 0;
+	for (i = 0; i < n; i++) {
+		struct vm_insn *insn = &prog->code[i];
+		int ops = reg_operands(insn);
+		uint32_t vregs[2] = { insn->a, insn->b };
+
+		phys[i] = num_free ? free_regs[--num_free] : prog->num_regs++;
+		insn->dst = phys[i];
+		for (j = 0; j < (uint32_t)ops; j++) {
+			if (j == 1 && vregs[1] == vregs[0])
+				break;
+			if (last[vregs[j]] == i)
+				free_regs[num_free++] = phys[vregs[j]];
+		}
+		if (ops >= 1)
+			insn->a = phys[vregs[0]];
+		if (ops == 2)
+			insn->b = phys[vregs[1]];
+		/* a value nobody reads is dead right away */
+		if (last[i] == i)
+			free_regs[num_free++] = phys[i];
+	}
+	for (i = 0; i < prog->num_outputs; i++)
+		prog->outputs[i] = phys[prog->outputs[i]];
+
+	free(last);
+	free(phys);
+	free(free_regs);
+	return 0;
+}
+
+/**
+ * vm_compile - Compile expressions into one bytecode program
+ * @arena: Arena holding the expressions
+ * @roots: Expressions to compile (e.g. f and f'); they share registers
+ *	   for their common subexpressions
+ * @num_roots: Number of roots
+ * @prog: Filled with the program; release with vm_free()
+ *
+ * Constant operands become immediates of the instruction (x*3, x^2 as a
+ * multiplication, x^5 by repeated squaring), and constant subexpressions
+ * have already been folded by the arena.
+ *
+ * Returns 0 on success, -1 if memory runs out or a variable id is out of
+ * range
+ */
+int vm_compile(const struct expr_arena *arena, const uint32_t *roots,
+	       uint32_t num_roots, struct vm_program *prog)
+{
+	struct compiler c;
+	uint32_t max_root = 0, i;
+	uint8_t *live = NULL;
+
+	memset(prog, 0, sizeof(*prog));
+	memset(&c, 0, sizeof(c));
+	c.arena = arena;
+	c.prog = prog;
+
+	for (i = 0; i < num_roots; i++) {
+		if (roots[i] == NODE_NONE)
+			return -1;
+		if (roots[i] > max_root)
+			max_root = roots[i];
+	}
+
+	prog->outputs = malloc(sizeof(*prog->outputs) * (num_roots ? num_roots : 1));
+	c.value = malloc(sizeof(*c.value) * ((size_t)max_root + 1));
+	live = calloc((size_t)max_root + 1, 1);
+	if (!prog->outputs || !c.value || !live)
+		goto fail;
+	memset(c.value, 0xff, sizeof(*c.value) * ((size_t)max_root + 1));
+
+	for (i = 0; i < num_roots; i++)
+		live[roots[i]] = 1;
+	for (i = max_root + 1; i-- > 0;) {
+		const struct node *n = ast_node(arena, i);
+
+		if (!live[i] || n->type <= NODE_VAR)
+			continue;
+		live[n->lhs] = 1;
+		if (n->type < NODE_NEG)
+			live[n->rhs] = 1;
+	}
+
+	for (i = 0; i <= max_root; i++) {
+		if (!live[i] || is_const(&c, i))
+			continue;
+		c.value[i] = compile_node(&c, i);
+		if (c.value[i] == NODE_NONE)
+			goto fail;
+	}
+	for (i = 0; i < num_roots; i++) {
+		prog->outputs[i] = reg_of(&c, roots[i]);
+		if (prog->outputs[i] == NODE_NONE)
+			goto fail;
+	}
+	prog->num_outputs = num_roots;
+
+	if (allocate_registers(prog) < 0)
+		goto fail;
+
+	free(c.value);
+	free(live);
+	return 0;
+
+fail:
+	free(c.value);
+	free(live);
+	vm_free(prog);
+	return -1;
+}
+
+/**
+ * vm_free - Release a compiled program
+ * @prog: Program from vm_compile()
+ */
+void vm_free(struct vm_program *prog)
+{
+	free(prog->code);
+	free(prog->consts);
+	free(prog->outputs);
+	memset(prog, 0, sizeof(*prog));
+}
+
+/*
+ * The kernels run over a full batch; the tail of the last batch is padded
+ * by the loads, which keeps the trip counts fixed for the vectoriser.
+ */
+#define KERNEL(expr)						\
+	do {							\
+		for (i = 0; i < VM_BATCH; i++)			\
+			d[i] = (expr);				\
+	} while (0)
+
+static void vm_powi(double *restrict d, const double *restrict a, int k)
+{
+	double base[VM_BATCH];
+	unsigned int e = k < 0 ? -(unsigned int)k : (unsigned int)k;
+	int i;
+
+	for (i = 0; i < VM_BATCH; i++) {
+		d[i] = 1.0;
+		base[i] = a[i];
+	}
+	while (e) {
+		if (e & 1) {
+			for (i = 0; i < VM_BATCH; i++)
+				d[i] *= base[i];
+		}
+		e >>= 1;
+		if (e) {
+			for (i = 0; i < VM_BATCH; i++)
+				base[i] *= base[i];
+		}
+	}
+	if (k < 0) {
+		for (i = 0; i < VM_BATCH; i++)
+			d[i] = 1.0 / d[i];
+	}
+}
+
+static void vm_run_batch(const struct vm_program *prog, double *regs,
+			 const double *const *inputs, size_t base, int m)
+{
+	uint32_t pc;
+	int i;
+
+	for (pc = 0; pc < prog->num_insns; pc++) {
+		const struct vm_insn *insn = &prog->code[pc];
+		double *restrict d = regs + (size_t)insn->dst * VM_BATCH;
+		const double *restrict a = regs + (size_t)insn->a * VM_BATCH;
+		const double *restrict b = regs + (size_t)insn->b * VM_BATCH;
+		double k = insn->op >= OP_ADDK && insn->op <= OP_RPOWK ?
+			   prog->consts[insn->b] : 0.0;
+
+		switch (insn->op) {
+		case OP_CONST:
+			KERNEL(prog->consts[insn->b]);
+			break;
+		case OP_VAR:
+			memcpy(d, inputs[insn->a] + base, sizeof(*d) * m);
+			for (i = m; i < VM_BATCH; i++)
+				d[i] = d[m - 1];
+			break;
+		case OP_ADD:
+			KERNEL(a[i] + b[i]);
+			break;
+		case OP_SUB:
+			KERNEL(a[i] - b[i]);
+			break;
+		case OP_MUL:
+			KERNEL(a[i] * b[i]);
+			break;
+		case OP_DIV:
+			KERNEL(a[i] / b[i]);
+			break;
+		case OP_POW:
+			KERNEL(pow(a[i], b[i]));
+			break;
+		case OP_ADDK:
+			KERNEL(a[i] + k);
+			break;
+		case OP_SUBK:
+			KERNEL(a[i] - k);
+			break;
+		case OP_RSUBK:
+			KERNEL(k - a[i]);
+			break;
+		case OP_MULK:
+			KERNEL(a[i] * k);
+			break;
+		case OP_DIVK:
+			KERNEL(a[i] / k);
+			break;
+		case OP_RDIVK:
+			KERNEL(k / a[i]);
+			break;
+		case OP_POWK:
+			KERNEL(pow(a[i], k));
+			break;
+		case OP_RPOWK:
+			KERNEL(pow(k, a[i]));
+			break;
+		case OP_POWI:
+			vm_powi(d, a, (int32_t)insn->b);
+			break;
+		case OP_NEG:
+			KERNEL(-a[i]);
+			break;
+		case OP_SIN:
+			KERNEL(sin(a[i]));
+			break;
+		case OP_COS:
+			KERNEL(cos(a[i]));
+			break;
+		case OP_TAN:
+			KERNEL(tan(a[i]));
+			break;
+		case OP_EXP:
+			KERNEL(exp(a[i]));
+			break;
+		case OP_LN:
+			KERNEL(log(a[i]));
+			break;
+		case OP_SQRT:
+			KERNEL(sqrt(a[i]));
+			break;
+		}
+	}
+}
+
+/**
+ * vm_eval - Evaluate a program over arrays of points
+ * @prog: Program from vm_compile()
+ * @inputs: One array of @n values per variable id (inputs[VAR_X] for x)
+ * @n: Number of points
+ * @outputs: One array of @n results per compiled root
+ *
+ * Returns 0 on success, -1 if the register file can't be allocated
+ */
+int vm_eval(const struct vm_program *prog, const double *const *inputs,
+	    size_t n, double *const *outputs)
+{
+	double *regs;
+	size_t base;
+	uint32_t j;
+
+	regs = malloc(sizeof(*regs) * VM_BATCH *
+		      (prog->num_regs ? prog->num_regs : 1));
+	if (!regs)
+		return -1;
+
+	for (base = 0; base < n; base += VM_BATCH) {
+		int m = n - base < VM_BATCH ? (int)(n - base) : VM_BATCH;
+
+		vm_run_batch(prog, regs, inputs, base, m);
+		for (j = 0; j < prog->num_outputs; j++)
+			memcpy(outputs[j] + base,
+			       regs + (size_t)prog->outputs[j] * VM_BATCH,
+			       sizeof(double) * m);
+	}
+
+	free(regs);
+	return 0;
+}
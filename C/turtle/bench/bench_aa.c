@@ -0,0 +1,125 @@
+/*
+    bench_aa.c
+
+    Compares the cost of the anti-aliased line and circle primitives against
+    the aliased ones and against the old workaround of rendering aliased at 4x
+    resolution and box-filtering back down.
+
+    Usage: bench_aa [lines] [circles]
+*/
+
+#define _POSIX_C_SOURCE 199309L
+
+#include "turtle.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define FIELD_SIZE  1024
+#define SUPERSAMPLE 4
+
+static double now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+// random coordinate comfortably inside a FIELD_SIZE field centered at (0,0)
+static double rand_coord()
+{
+    return (rand() / (double)RAND_MAX - 0.5) * (FIELD_SIZE - 8);
+}
+
+static void draw_shapes(int lines, int circles, int scale, int aa)
+{
+    srand(42);
+    for (int i = 0; i < lines; i++) {
+        double x0 = rand_coord(), y0 = rand_coord();
+        double x1 = rand_coord(), y1 = rand_coord();
+        if (aa) {
+            turtle_draw_line_aa(x0, y0, x1, y1);
+        } else {
+            turtle_draw_line((int)(x0 * scale), (int)(y0 * scale),
+                             (int)(x1 * scale), (int)(y1 * scale));
+        }
+    }
+    for (int i = 0; i < circles; i++) {
+        double x = rand_coord() / 2, y = rand_coord() / 2;
+        double r = 4 + rand() % (FIELD_SIZE / 4);
+        if (aa) {
+            turtle_draw_circle_aa(x, y, r);
+        } else {
+            turtle_draw_circle((int)(x * scale), (int)(y * scale),
+                               (int)(r * scale));
+        }
+    }
+}
+
+// box-filter the SUPERSAMPLE x field down to FIELD_SIZE x FIELD_SIZE
+static void downsample(rgb_t *dst)
+{
+    const rgb_t *src = turtle_get_field();
+    int src_width = FIELD_SIZE * SUPERSAMPLE;
+
+    for (int row = 0; row < FIELD_SIZE; row++) {
+        for (int col = 0; col < FIELD_SIZE; col++) {
+            int r = 0, g = 0, b = 0;
+            for (int sy = 0; sy < SUPERSAMPLE; sy++) {
+                const rgb_t *p = src + (size_t)(row * SUPERSAMPLE + sy) *
+                                 src_width + col * SUPERSAMPLE;
+                for (int sx = 0; sx < SUPERSAMPLE; sx++) {
+                    r += p[sx].red;
+                    g += p[sx].green;
+                    b += p[sx].blue;
+                }
+            }
+            rgb_t *out = &dst[(size_t)row * FIELD_SIZE + col];
+            out->red   = r / (SUPERSAMPLE * SUPERSAMPLE);
+            out->green = g / (SUPERSAMPLE * SUPERSAMPLE);
+            out->blue  = b / (SUPERSAMPLE * SUPERSAMPLE);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int lines   = argc > 1 ? atoi(argv[1]) : 20000;
+    int circles = argc > 2 ? atoi(argv[2]) : 2000;
+    double start, aliased, antialiased, supersampled;
+
+    turtle_init(FIELD_SIZE, FIELD_SIZE);
+    start = now_ms();
+    draw_shapes(lines, circles, 1, 0);
+    aliased = now_ms() - start;
+
+    turtle_init(FIELD_SIZE, FIELD_SIZE);
+    start = now_ms();
+    draw_shapes(lines, circles, 1, 1);
+    antialiased = now_ms() - start;
+    turtle_save_bmp("bench_aa.bmp");
+
+    rgb_t *small = malloc(sizeof(rgb_t) * FIELD_SIZE * FIELD_SIZE);
+    if (small == NULL) {
+        fprintf(stderr, "Can't allocate memory for downsampled image.\n");
+        return EXIT_FAILURE;
+    }
+    turtle_init(FIELD_SIZE * SUPERSAMPLE, FIELD_SIZE * SUPERSAMPLE);
+    start = now_ms();
+    draw_shapes(lines, circles, SUPERSAMPLE, 0);
+    downsample(small);
+    supersampled = now_ms() - start;
+    free(small);
+    turtle_cleanup();
+
+    printf("%d lines + %d circles on a %dx%d field\n",
+           lines, circles, FIELD_SIZE, FIELD_SIZE);
+    printf("  aliased            %9.2f ms\n", aliased);
+    printf("  anti-aliased       %9.2f ms  (%.2fx aliased)\n",
+           antialiased, antialiased / aliased);
+    printf("  %dx supersampled    %9.2f ms  (%.2fx anti-aliased, %dx memory)\n",
+           SUPERSAMPLE, supersampled, supersampled / antialiased,
+           SUPERSAMPLE * SUPERSAMPLE);
+    return 0;
+}
@@ -0,0 +1,53 @@
+/*
+    bench_ifs.c
+
+    Times the chaos game on the Sierpinski triangle and Barnsley's fern and
+    saves both images.
+
+    Usage: bench_ifs [points] [width] [height]
+*/
+
+#include "ifs.h"
+#include "parallel.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static void report(const char *name, const ifs_t *ifs, long long points,
+                   rgb_t color, const char *filename)
+{
+    ifs_stats_t stats;
+
+    turtle_init(turtle_get_width(), turtle_get_height());
+    ifs_render(ifs, points, 1, color, &stats);
+    turtle_save_bmp(filename);
+
+    printf("  %-12s %9.1f ms walk %6.1f ms reduce  %7.1f Mpoints/s"
+           "  %5.1f%% in field, max %u\n",
+           name, stats.walk_ms, stats.reduce_ms,
+           stats.points / (stats.walk_ms + stats.reduce_ms) / 1e3,
+           100.0 * stats.hits / stats.points, stats.max_density);
+}
+
+int main(int argc, char *argv[])
+{
+    ifs_t ifs;
+    long long points = argc > 1 ? atoll(argv[1]) : 1000000000LL;
+    int width  = argc > 2 ? atoi(argv[2]) : 1920;
+    int height = argc > 3 ? atoi(argv[3]) : 1080;
+    rgb_t green = { 0x10, 0x80, 0x20 };
+    rgb_t blue  = { 0x00, 0x07, 0x64 };
+
+    turtle_init(width, height);
+    printf("%lld points, %dx%d, %d threads\n",
+           points, width, height, parallel_thread_count());
+
+    ifs_sierpinski(&ifs);
+    report("sierpinski", &ifs, points, blue, "bench_ifs_sierpinski.bmp");
+
+    ifs_barnsley_fern(&ifs);
+    report("fern", &ifs, points, green, "bench_ifs_fern.bmp");
+
+    turtle_cleanup();
+    return 0;
+}
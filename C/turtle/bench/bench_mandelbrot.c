@@ -0,0 +1,80 @@
+/*
+    bench_mandelbrot.c
+
+    Times the native Mandelbrot renderer on the default view of
+    Python/Mandelbrot.py (1920x1080, 300 iterations) with each interior
+    shortcut switched on in turn, and saves the last frame. Run with
+    TURTLE_NO_AVX2=1 for the scalar kernel and TURTLE_THREADS=n to limit the
+    thread count. Python/bench_mandelbrot.py runs the same frame through the
+    NumPy version for comparison.
+
+    Usage: bench_mandelbrot [width] [height] [max_iter]
+*/
+
+#define _POSIX_C_SOURCE 199309L
+
+#include "mandelbrot.h"
+#include "parallel.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static double now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct {
+        const char *name;
+        int shortcuts;
+    } modes[] = {
+        { "no shortcuts",   0 },
+        { "cardioid",       MANDELBROT_CARDIOID },
+        { "+ periodicity",  MANDELBROT_CARDIOID | MANDELBROT_PERIODICITY },
+        { "+ Mariani-Silver", MANDELBROT_CARDIOID | MANDELBROT_PERIODICITY |
+                              MANDELBROT_MARIANI_SILVER },
+    };
+    mandelbrot_settings_t settings;
+    mandelbrot_stats_t stats;
+    int width  = argc > 1 ? atoi(argv[1]) : 1920;
+    int height = argc > 2 ? atoi(argv[2]) : 1080;
+
+    mandelbrot_default_settings(&settings);
+    if (argc > 3) {
+        settings.max_iter = atoi(argv[3]);
+    }
+
+    turtle_init(width, height);
+    printf("%dx%d, %d iterations, %s kernel, %d threads\n",
+           width, height, settings.max_iter,
+           mandelbrot_uses_avx2() ? "AVX2" : "scalar",
+           parallel_thread_count());
+    printf("  %-17s %9s  %12s %9s %9s %9s\n", "", "render", "iterations",
+           "cardioid", "periodic", "filled");
+
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        settings.shortcuts = modes[m].shortcuts;
+
+        // warm-up run, then best of three
+        mandelbrot_render(&settings, &stats);
+        double best = 1e300;
+        for (int i = 0; i < 3; i++) {
+            double start = now_ms();
+            mandelbrot_render(&settings, &stats);
+            double elapsed = now_ms() - start;
+            best = elapsed < best ? elapsed : best;
+        }
+        printf("  %-17s %6.2f ms  %12lld %9lld %9lld %9lld\n", modes[m].name,
+               best, stats.iterations, stats.cardioid, stats.periodic,
+               stats.filled);
+    }
+
+    turtle_save_bmp("bench_mandelbrot.bmp");
+    turtle_cleanup();
+    return 0;
+}
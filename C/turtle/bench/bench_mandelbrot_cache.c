@@ -0,0 +1,81 @@
+/*
+    bench_mandelbrot_cache.c
+
+    Times the Mandelbrot tile cache on the interactions of the Python viewer:
+    the first frame, redrawing the same view, panning by a few pixels and
+    raising max_iter, each against a plain mandelbrot_render() of the same
+    frame.
+
+    Usage: bench_mandelbrot_cache [width] [height] [pan pixels]
+*/
+
+#define _POSIX_C_SOURCE 199309L
+
+#include "mandelbrot_cache.h"
+#include "parallel.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static double now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static void report(const char *name, const mandelbrot_settings_t *settings)
+{
+    mandelbrot_cache_stats_t stats;
+
+    double start = now_ms();
+    mandelbrot_render(settings, NULL);
+    double plain = now_ms() - start;
+
+    mandelbrot_cache_reset_stats();
+    start = now_ms();
+    mandelbrot_cache_render(settings);
+    double cached = now_ms() - start;
+
+    mandelbrot_cache_get_stats(&stats);
+    printf("  %-16s %9.2f ms  %9.2f ms  %4lld hit %4lld resumed %4lld miss\n",
+           name, plain, cached, stats.hits, stats.resumed, stats.misses);
+}
+
+int main(int argc, char *argv[])
+{
+    mandelbrot_settings_t settings;
+    mandelbrot_cache_stats_t stats;
+    int width  = argc > 1 ? atoi(argv[1]) : 1920;
+    int height = argc > 2 ? atoi(argv[2]) : 1080;
+    int pan    = argc > 3 ? atoi(argv[3]) : 100;
+
+    mandelbrot_default_settings(&settings);
+    turtle_init(width, height);
+    mandelbrot_cache_init(0);
+
+    printf("%dx%d, %d threads                plain      cached\n",
+           width, height, parallel_thread_count());
+    report("first frame", &settings);
+    report("same view", &settings);
+
+    double dx = (settings.xmax - settings.xmin) / (width - 1);
+    settings.xmin += pan * dx;
+    settings.xmax += pan * dx;
+    report("pan", &settings);
+
+    settings.max_iter *= 2;
+    report("max_iter x2", &settings);
+
+    settings.max_iter /= 2;
+    report("max_iter back", &settings);
+
+    turtle_save_bmp("bench_mandelbrot_cache.bmp");
+    mandelbrot_cache_get_stats(&stats);
+    printf("  %d tiles cached, %.1f MB\n", stats.tiles, stats.bytes / 1e6);
+
+    mandelbrot_cache_cleanup();
+    turtle_cleanup();
+    return 0;
+}
@@ -0,0 +1,76 @@
+/*
+    bench_pyramid.c
+
+    Measures how quickly a thumbnail of a huge canvas can be produced: one full
+    pyramid build, then a handful of small edits followed by an incremental
+    update and export of a ~256 pixel preview level.
+
+    Usage: bench_pyramid [field size] [edits]
+*/
+
+#define _POSIX_C_SOURCE 199309L
+
+#include "turtle.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static double now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+    int size  = argc > 1 ? atoi(argv[1]) : 16384;
+    int edits = argc > 2 ? atoi(argv[2]) : 50;
+    double start, full, incremental, thumbnail;
+
+    turtle_init(size, size);
+    srand(7);
+
+    // something to look at: a spiral across the whole canvas
+    turtle_set_antialias(1);
+    for (int i = 0; i < 2000; i++) {
+        turtle_forward(i * (size / 4096 + 1));
+        turtle_turn_left(91);
+    }
+
+    start = now_ms();
+    turtle_update_pyramid();
+    full = now_ms() - start;
+
+    // small local edits: short lines scattered over the canvas
+    for (int i = 0; i < edits; i++) {
+        int x = rand() % (size - 64) - size / 2 + 32;
+        int y = rand() % (size - 64) - size / 2 + 32;
+        turtle_set_pen_color(rand() % 256, rand() % 256, rand() % 256);
+        turtle_draw_line_aa(x, y, x + 20, y + 13);
+    }
+
+    start = now_ms();
+    turtle_update_pyramid();
+    incremental = now_ms() - start;
+
+    // pick the first level no larger than 256 pixels across
+    int levels = turtle_pyramid_levels();
+    int level = 0;
+    while (level + 1 < levels && (size >> level) > 256) {
+        level++;
+    }
+    turtle_draw_line_aa(0, 0, 10, 10);
+    start = now_ms();
+    turtle_save_bmp_level("bench_pyramid.bmp", level);
+    thumbnail = now_ms() - start;
+
+    turtle_cleanup();
+
+    printf("%dx%d field, %d levels\n", size, size, levels);
+    printf("  full pyramid build          %9.2f ms\n", full);
+    printf("  update after %4d edits     %9.2f ms\n", edits, incremental);
+    printf("  update + export level %2d    %9.2f ms\n", level, thumbnail);
+    return 0;
+}
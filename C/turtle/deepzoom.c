@@ -0,0 +1,488 @@
+/*
+    deepzoom.c
+
+    Perturbation-theory deep zoom for the Mandelbrot set.
+
+    With Z the reference orbit through the view center and z = Z + d a pixel
+    orbit, z -> z^2 + c becomes d -> 2*Z*d + d^2 + dc, where dc is the
+    pixel's offset from the center. The offsets are tiny but perfectly
+    representable as doubles, so only the reference needs high precision.
+
+    Three refinements on top of that:
+
+        - Series approximation: d_n ~= A_n*dc + B_n*dc^2 + C_n*dc^3, where the
+          coefficients only depend on the reference orbit. While the cubic
+          term stays negligible, every pixel can jump straight to iteration n.
+
+        - Glitch detection: when |z| falls far below |Z| (Pauldelbrot's
+          criterion) the double-precision offset has lost its significant
+          digits relative to the reference and the pixel's orbit is garbage.
+
+        - Rebasing: glitched pixels (and any pixel with |z| < |d|, or that
+          runs off the end of the reference) restart against the reference
+          from iteration 0 with d = z, which is exact and avoids the glitch
+          without computing a second reference.
+
+    The reference orbit uses a small fixed-point bignum (one 32-bit integer
+    limb followed by fraction limbs), sized to the zoom depth.
+*/
+
+#define _POSIX_C_SOURCE 199309L
+
+#include "deepzoom.h"
+#include "mandelbrot.h"
+#include "parallel.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <math.h>
+
+
+/**  DEFINITIONS  **/
+
+#define BIG_MAX_LIMBS 40            // 1 integer + 39 fraction limbs (~375
+                                    // decimal digits)
+#define GUARD_BITS 64               // extra reference precision beyond the
+                                    // pixel spacing
+#define GLITCH_TOLERANCE 1e-6       // |z|^2 < tol * |Z|^2 means glitch
+#define SERIES_TOLERANCE 1e-7       // max cubic term relative to linear term
+#define SERIES_MAX_OFFSET 1e-3      // max |d| before pixels must iterate
+
+// fixed-point number: limb[0] is the integer part, limb[i] the i-th group of
+// 32 fraction bits
+typedef struct {
+    int      neg;
+    uint32_t limb[BIG_MAX_LIMBS];
+} big_t;
+
+typedef struct {
+    double re;
+    double im;
+} cplx_t;
+
+typedef struct {
+    int     max_n;          // last iteration (standard numbering, z_1 = c)
+    double  bailout;        // escape radius squared
+    int     length;         // reference orbit entries Z_0 .. Z_{length-1}
+    cplx_t *ref;            // reference orbit in doubles
+    double *ref_mag;        // |Z_n|^2
+    int     skip;           // iteration the series approximation reaches
+    cplx_t  a, b, c;        // series coefficients at iteration skip
+    double  pixel_re;       // pixel spacing along each axis
+    double  pixel_im;
+    int     width;
+    int     height;
+    double *values;
+    long long glitched;     // totals (updated atomically)
+    long long rebases;
+} deepzoom_ctx_t;
+
+
+/**  BIGNUM HELPERS  **/
+
+static int big_cmp_mag(const big_t *a, const big_t *b, int n)
+{
+    for (int i = 0; i < n; i++) {
+        if (a->limb[i] != b->limb[i]) {
+            return a->limb[i] < b->limb[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+static void big_add_mag(big_t *r, const big_t *a, const big_t *b, int n)
+{
+    uint64_t carry = 0;
+    for (int i = n - 1; i >= 0; i--) {
+        uint64_t t = (uint64_t)a->limb[i] + b->limb[i] + carry;
+        r->limb[i] = (uint32_t)t;
+        carry = t >> 32;
+    }
+}
+
+static void big_sub_mag(big_t *r, const big_t *a, const big_t *b, int n)
+{
+    // requires |a| >= |b|
+    int64_t borrow = 0;
+    for (int i = n - 1; i >= 0; i--) {
+        int64_t t = (int64_t)a->limb[i] - b->limb[i] - borrow;
+        borrow = t < 0;
+        r->limb[i] = (uint32_t)(t + (borrow << 32));
+    }
+}
+
+static void big_add(big_t *r, const big_t *a, const big_t *b, int n)
+{
+    big_t t;
+    if (a->neg == b->neg) {
+        big_add_mag(&t, a, b, n);
+        t.neg = a->neg;
+    } else if (big_cmp_mag(a, b, n) >= 0) {
+        big_sub_mag(&t, a, b, n);
+        t.neg = a->neg;
+    } else {
+        big_sub_mag(&t, b, a, n);
+        t.neg = b->neg;
+    }
+    *r = t;
+}
+
+static void big_sub(big_t *r, const big_t *a, const big_t *b, int n)
+{
+    big_t nb = *b;
+    nb.neg = !nb.neg;
+    big_add(r, a, &nb, n);
+}
+
+static void big_mul(big_t *r, const big_t *a, const big_t *b, int n)
+{
+    // schoolbook product of the little-endian limb sequences; the result
+    // keeps the same scale by dropping the n-1 lowest limbs
+    uint32_t prod[2 * BIG_MAX_LIMBS] = { 0 };
+
+    for (int i = 0; i < n; i++) {
+        uint64_t ai = a->limb[n - 1 - i];
+        uint64_t carry = 0;
+        if (ai == 0) {
+            continue;
+        }
+        for (int j = 0; j < n; j++) {
+            uint64_t t = ai * b->limb[n - 1 - j] + prod[i + j] + carry;
+            prod[i + j] = (uint32_t)t;
+            carry = t >> 32;
+        }
+        prod[i + n] = (uint32_t)carry;
+    }
+
+    for (int k = 0; k < n; k++) {
+        r->limb[k] = prod[2 * n - 2 - k];
+    }
+    r->neg = a->neg != b->neg;
+}
+
+static int big_from_string(big_t *r, const char *str, int n)
+{
+    // plain decimal notation only: [+-]digits[.digits]
+    const char *p = str;
+    memset(r, 0, sizeof(*r));
+
+    if (*p == '-' || *p == '+') {
+        r->neg = (*p == '-');
+        p++;
+    }
+    const char *int_start = p;
+    while (*p >= '0' && *p <= '9') {
+        r->limb[0] = r->limb[0] * 10 + (uint32_t)(*p - '0');
+        p++;
+    }
+    const char *frac_start = p, *frac_end = p;
+    if (*p == '.') {
+        frac_start = ++p;
+        while (*p >= '0' && *p <= '9') {
+            p++;
+        }
+        frac_end = p;
+    }
+    if (*p != '\0' || (frac_start == int_start && frac_end == frac_start)) {
+        return -1;
+    }
+
+    // fold the fraction in from its last digit: x = (digit + x) / 10
+    uint32_t integer = r->limb[0];
+    r->limb[0] = 0;
+    for (const char *d = frac_end; d > frac_start; d--) {
+        uint64_t rem = 0;
+        r->limb[0] = (uint32_t)(d[-1] - '0');
+        for (int i = 0; i < n; i++) {
+            uint64_t cur = (rem << 32) | r->limb[i];
+            r->limb[i] = (uint32_t)(cur / 10);
+            rem = cur % 10;
+        }
+    }
+    r->limb[0] = integer;
+    return 0;
+}
+
+static double big_to_double(const big_t *a, int n)
+{
+    double v = 0.0;
+    for (int i = (n < 4 ? n : 4) - 1; i >= 0; i--) {
+        v = v * 0x1p-32 + a->limb[i];
+    }
+    return a->neg ? -v : v;
+}
+
+
+/**  DEEP ZOOM FUNCTIONS  **/
+
+static double deepzoom_now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static inline cplx_t cplx_mul(cplx_t a, cplx_t b)
+{
+    cplx_t r = { a.re * b.re - a.im * b.im, a.re * b.im + a.im * b.re };
+    return r;
+}
+
+static inline double cplx_log_abs(cplx_t a)
+{
+    return log(hypot(a.re, a.im));
+}
+
+static int deepzoom_reference(deepzoom_ctx_t *ctx, const deepzoom_view_t *view,
+                              int limbs)
+{
+    big_t cr, ci, zr, zi, zr2, zi2, zri;
+
+    if (big_from_string(&cr, view->center_re, limbs) != 0 ||
+            big_from_string(&ci, view->center_im, limbs) != 0) {
+        return -1;
+    }
+    memset(&zr, 0, sizeof(zr));
+    memset(&zi, 0, sizeof(zi));
+
+    ctx->ref[0].re = ctx->ref[0].im = 0.0;
+    ctx->ref_mag[0] = 0.0;
+    ctx->length = ctx->max_n + 1;
+
+    for (int n = 1; n <= ctx->max_n; n++) {
+        // Z = Z^2 + C in full precision, stored rounded to double
+        big_mul(&zr2, &zr, &zr, limbs);
+        big_mul(&zi2, &zi, &zi, limbs);
+        big_mul(&zri, &zr, &zi, limbs);
+        big_sub(&zr, &zr2, &zi2, limbs);
+        big_add(&zr, &zr, &cr, limbs);
+        big_add(&zi, &zri, &zri, limbs);
+        big_add(&zi, &zi, &ci, limbs);
+
+        ctx->ref[n].re = big_to_double(&zr, limbs);
+        ctx->ref[n].im = big_to_double(&zi, limbs);
+        ctx->ref_mag[n] = ctx->ref[n].re * ctx->ref[n].re +
+                          ctx->ref[n].im * ctx->ref[n].im;
+
+        // an escaped reference is still usable up to here; pixels that run
+        // past its end are rebased
+        if (ctx->ref_mag[n] > ctx->bailout) {
+            ctx->length = n + 1;
+            break;
+        }
+    }
+    return 0;
+}
+
+static void deepzoom_series(deepzoom_ctx_t *ctx)
+{
+    // largest pixel offset in the view: a corner
+    double half_w = ctx->pixel_re * (ctx->width  - 1) / 2.0;
+    double half_h = ctx->pixel_im * (ctx->height - 1) / 2.0;
+    double log_delta = log(hypot(half_w, half_h));
+    cplx_t a = { 0, 0 }, b = { 0, 0 }, c = { 0, 0 };
+
+    ctx->skip = 0;
+    ctx->a = a;
+    ctx->b = b;
+    ctx->c = c;
+    if (!(log_delta > -INFINITY)) {
+        return;
+    }
+
+    // step the coefficients along the reference while the truncated series
+    // stays accurate; magnitudes are compared as logs because dc^3 underflows
+    // long before the zoom floor
+    for (int n = 0; n + 2 < ctx->length; n++) {
+        cplx_t z2 = { 2.0 * ctx->ref[n].re, 2.0 * ctx->ref[n].im };
+        cplx_t na = cplx_mul(z2, a);
+        cplx_t nb = cplx_mul(z2, b);
+        cplx_t nc = cplx_mul(z2, c);
+        cplx_t aa = cplx_mul(a, a);
+        cplx_t ab = cplx_mul(a, b);
+        na.re += 1.0;
+        nb.re += aa.re;
+        nb.im += aa.im;
+        nc.re += 2.0 * ab.re;
+        nc.im += 2.0 * ab.im;
+
+        double log_a = cplx_log_abs(na);
+        double log_c = cplx_log_abs(nc);
+        if (!isfinite(log_a) || log_a + log_delta > log(SERIES_MAX_OFFSET) ||
+                (isfinite(log_c) && log_c + 2.0 * log_delta >
+                 log_a + log(SERIES_TOLERANCE))) {
+            break;
+        }
+
+        a = na;
+        b = nb;
+        c = nc;
+        ctx->skip = n + 1;
+        ctx->a = a;
+        ctx->b = b;
+        ctx->c = c;
+    }
+}
+
+static double deepzoom_pixel(const deepzoom_ctx_t *ctx, cplx_t dc,
+                             int *glitches, int *rebases)
+{
+    const cplx_t *ref = ctx->ref;
+    int n = ctx->skip;
+    int m = ctx->skip;
+
+    // starting offset from the series: ((C*dc + B)*dc + A)*dc
+    cplx_t d = cplx_mul(ctx->c, dc);
+    d.re += ctx->b.re;
+    d.im += ctx->b.im;
+    d = cplx_mul(d, dc);
+    d.re += ctx->a.re;
+    d.im += ctx->a.im;
+    d = cplx_mul(d, dc);
+
+    while (n < ctx->max_n) {
+        // d = 2*Z*d + d^2 + dc
+        double zr = ref[m].re, zi = ref[m].im;
+        double dr = d.re, di = d.im;
+        d.re = 2.0 * (zr * dr - zi * di) + (dr * dr - di * di) + dc.re;
+        d.im = 2.0 * (zr * di + zi * dr) + 2.0 * dr * di + dc.im;
+        n++;
+        m++;
+
+        // full pixel value; escape is checked from z_2 on to match the
+        // Python viewer, whose loop starts from z = c
+        double pr = ref[m].re + d.re, pi = ref[m].im + d.im;
+        double mag = pr * pr + pi * pi;
+        if (mag > ctx->bailout && n >= 2) {
+            return n - 1 - log(0.5 * log(mag)) / log(2.0);
+        }
+
+        if (n == ctx->max_n) {
+            break;
+        }
+        bool glitch = mag < GLITCH_TOLERANCE * ctx->ref_mag[m];
+        if (glitch || mag < d.re * d.re + d.im * d.im ||
+                m == ctx->length - 1) {
+            d.re = pr;
+            d.im = pi;
+            m = 0;
+            *glitches += glitch;
+            (*rebases)++;
+        }
+    }
+    return 0.0;
+}
+
+static void deepzoom_rows(int begin, int end, void *arg)
+{
+    deepzoom_ctx_t *ctx = (deepzoom_ctx_t*)arg;
+    long long glitched = 0, rebases = 0;
+
+    for (int row = begin; row < end; row++) {
+        double *out = ctx->values + (size_t)row * ctx->width;
+        cplx_t dc;
+        dc.im = (row - (ctx->height - 1) / 2.0) * ctx->pixel_im;
+        for (int col = 0; col < ctx->width; col++) {
+            int pixel_glitches = 0, pixel_rebases = 0;
+            dc.re = (col - (ctx->width - 1) / 2.0) * ctx->pixel_re;
+            out[col] = deepzoom_pixel(ctx, dc, &pixel_glitches,
+                                      &pixel_rebases);
+            glitched += pixel_glitches > 0;
+            rebases += pixel_rebases;
+        }
+    }
+
+    __atomic_fetch_add(&ctx->glitched, glitched, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&ctx->rebases, rebases, __ATOMIC_RELAXED);
+}
+
+void deepzoom_escape_times(const deepzoom_view_t *view, int width, int height,
+                           double *values, deepzoom_stats_t *stats)
+{
+    deepzoom_ctx_t ctx;
+    double start;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.max_n   = view->max_iter + 1;
+    ctx.bailout = view->escape_radius * view->escape_radius;
+    ctx.pixel_re = width  > 1 ? view->width  / (width - 1)  : view->width;
+    ctx.pixel_im = height > 1 ? view->height / (height - 1) : view->height;
+    ctx.width   = width;
+    ctx.height  = height;
+    ctx.values  = values;
+
+    // enough fraction bits to resolve the pixel spacing, plus guard bits
+    double pixel = fmin(ctx.pixel_re, ctx.pixel_im);
+    int bits = (int)ceil(-log2(pixel)) + GUARD_BITS;
+    int limbs = 1 + (bits + 31) / 32;
+    if (limbs > BIG_MAX_LIMBS) {
+        fprintf(stderr, "Deep zoom limited to %d bits of precision.\n",
+                32 * (BIG_MAX_LIMBS - 1));
+        limbs = BIG_MAX_LIMBS;
+    } else if (limbs < 3) {
+        limbs = 3;
+    }
+
+    ctx.ref = (cplx_t*)malloc(sizeof(cplx_t) * (ctx.max_n + 1));
+    ctx.ref_mag = (double*)malloc(sizeof(double) * (ctx.max_n + 1));
+    if (ctx.ref == NULL || ctx.ref_mag == NULL) {
+        fprintf(stderr, "Can't allocate memory for reference orbit.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    start = deepzoom_now_ms();
+    if (deepzoom_reference(&ctx, view, limbs) != 0) {
+        fprintf(stderr, "Invalid deep zoom center: %s, %s\n",
+                view->center_re, view->center_im);
+        memset(values, 0, sizeof(double) * (size_t)width * height);
+        free(ctx.ref);
+        free(ctx.ref_mag);
+        return;
+    }
+    double reference_ms = deepzoom_now_ms() - start;
+
+    start = deepzoom_now_ms();
+    deepzoom_series(&ctx);
+    double series_ms = deepzoom_now_ms() - start;
+
+    start = deepzoom_now_ms();
+    parallel_for(height, 1, deepzoom_rows, &ctx);
+    double pixels_ms = deepzoom_now_ms() - start;
+
+    if (stats != NULL) {
+        stats->precision_bits   = 32 * (limbs - 1);
+        stats->reference_length = ctx.length - 1;
+        stats->skipped_iters    = ctx.skip;
+        stats->glitched_pixels  = ctx.glitched;
+        stats->rebases          = ctx.rebases;
+        stats->reference_ms     = reference_ms;
+        stats->series_ms        = series_ms;
+        stats->pixels_ms        = pixels_ms;
+    }
+
+    free(ctx.ref);
+    free(ctx.ref_mag);
+}
+
+void deepzoom_render(const deepzoom_view_t *view, deepzoom_stats_t *stats)
+{
+    int width = turtle_get_width();
+    int height = turtle_get_height();
+    double *values = (double*)malloc(sizeof(double) * (size_t)width * height);
+    if (values == NULL) {
+        fprintf(stderr, "Can't allocate memory for Mandelbrot values.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    deepzoom_escape_times(view, width, height, values, stats);
+    mandelbrot_colorize(values, width, height, turtle_get_field());
+    free(values);
+
+    turtle_mark_dirty(-width/2, -height/2, width - width/2 - 1,
+                      height - height/2 - 1);
+}
@@ -0,0 +1,66 @@
+#ifndef DEEPZOOM_H
+#define DEEPZOOM_H
+
+/*
+    deepzoom.h
+
+    Perturbation-theory deep zoom for the Mandelbrot set (power 2). A single
+    reference orbit through the view center is iterated in arbitrary
+    precision; every pixel is then iterated in plain doubles as a small
+    offset from that orbit, which lifts the ~1e-13 zoom floor of
+    mandelbrot.c down to view sizes of about 1e-300.
+
+    (header info only; see deepzoom.c for implementation)
+*/
+
+#include "turtle.h"
+
+
+/*
+    Deep zoom view. The center is given as decimal strings so it can carry
+    as many digits as the zoom depth needs; the view extents themselves are
+    ordinary doubles.
+*/
+typedef struct {
+    const char *center_re;  // e.g. "-0.743643887037158704752191506114774"
+    const char *center_im;
+    double width;           // extent along the real axis, e.g. 1e-100
+    double height;          // extent along the imaginary axis
+    int    max_iter;        // iteration limit
+    double escape_radius;   // bailout radius
+} deepzoom_view_t;
+
+
+/*
+    Per-frame statistics filled in by the renderer (pass NULL to skip).
+*/
+typedef struct {
+    int    precision_bits;      // precision of the reference orbit
+    int    reference_length;    // reference orbit iterations computed
+    int    skipped_iters;       // iterations skipped by series approximation
+    long long glitched_pixels;  // pixels with at least one detected glitch
+    long long rebases;          // total rebases over all pixels
+    double reference_ms;        // time spent on the reference orbit
+    double series_ms;           // time spent on the series approximation
+    double pixels_ms;           // time spent iterating pixels
+} deepzoom_stats_t;
+
+
+/*
+    Compute smooth escape times for a width x height grid over the view into
+    values (width*height doubles, row 0 at the bottom), using the same
+    conventions as mandelbrot_escape_times() so mandelbrot_colorize() can
+    color the result.
+*/
+void deepzoom_escape_times(const deepzoom_view_t *view, int width, int height,
+                           double *values, deepzoom_stats_t *stats);
+
+
+/*
+    Render the view over the whole turtle field in the Mandelbrot viewer's
+    palette.
+*/
+void deepzoom_render(const deepzoom_view_t *view, deepzoom_stats_t *stats);
+
+
+#endif
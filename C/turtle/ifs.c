@@ -0,0 +1,519 @@
+/*
+    ifs.c
+
+    Chaos-game renderer for iterated function systems.
+
+    The points are split into fixed-size tasks that worker threads claim from
+    a shared counter. Each task runs 8 walkers seeded from (seed, task), so
+    the result doesn't depend on how tasks land on threads. Every thread
+    counts hits into its own density buffer, and the buffers are summed row
+    by row at the end.
+
+    The walkers draw from xoshiro256+, one generator per walker. With AVX2
+    four generators and four walkers share a register set, and the affine
+    coefficients of the chosen maps are gathered from a small table. Two
+    such groups are interleaved like in mandelbrot.c. The vector path does
+    the same operations in the same order as the scalar one (no FMA), so
+    both produce identical images.
+*/
+
+#define _POSIX_C_SOURCE 199309L
+
+#include "ifs.h"
+#include "parallel.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <math.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_AVX2_KERNEL 1
+#include <immintrin.h>
+#endif
+
+
+/**  DEFINITIONS  **/
+
+#define LANES 4                     // doubles per AVX2 register
+#define WALKERS (2 * LANES)         // walkers per task
+#define TASK_POINTS (1 << 20)       // points per task
+#define WARMUP_STEPS 32             // steps before a walker starts counting
+#define THRESHOLD_BITS 31           // resolution of the map choice
+
+typedef struct {
+    const ifs_t *ifs;
+    int       width;
+    int       height;
+    double    sx;                   // pixels per unit
+    double    sy;
+    double    coef[6][IFS_MAX_MAPS];    // a..f of every map, for gathers
+    long long threshold[IFS_MAX_MAPS];  // cumulative weights, 31-bit scale
+    long long points;               // total, a multiple of WALKERS
+    int       tasks;
+    uint64_t  seed;
+    int       next_task;            // next unclaimed task (atomic)
+    uint32_t **buffers;             // density buffer per thread
+    long long *hits;                // hits per buffer
+} ifs_job_t;
+
+
+/**  IFS FUNCTIONS  **/
+
+static double ifs_now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+void ifs_add_map(ifs_t *ifs, double a, double b, double c, double d,
+                 double e, double f, double weight)
+{
+    if (ifs->count >= IFS_MAX_MAPS) {
+        fprintf(stderr, "Too many IFS maps (max %d).\n", IFS_MAX_MAPS);
+        exit(EXIT_FAILURE);
+    }
+    ifs_map_t *map = &ifs->maps[ifs->count++];
+    map->a = a;
+    map->b = b;
+    map->c = c;
+    map->d = d;
+    map->e = e;
+    map->f = f;
+    map->weight = weight;
+}
+
+void ifs_sierpinski(ifs_t *ifs)
+{
+    // halfway towards one of the three corners of an equilateral triangle
+    double h = sqrt(3.0) / 2.0;
+    ifs->count = 0;
+    ifs_add_map(ifs, 0.5, 0.0, 0.0, 0.5, 0.0,  0.0,     1.0);
+    ifs_add_map(ifs, 0.5, 0.0, 0.0, 0.5, 0.5,  0.0,     1.0);
+    ifs_add_map(ifs, 0.5, 0.0, 0.0, 0.5, 0.25, h / 2.0, 1.0);
+    ifs->xmin = -0.05;
+    ifs->xmax = 1.05;
+    ifs->ymin = -0.05;
+    ifs->ymax = h + 0.05;
+}
+
+void ifs_barnsley_fern(ifs_t *ifs)
+{
+    ifs->count = 0;
+    ifs_add_map(ifs,  0.00,  0.00,  0.00, 0.16, 0.0, 0.00, 0.01);  // stem
+    ifs_add_map(ifs,  0.85,  0.04, -0.04, 0.85, 0.0, 1.60, 0.85);  // leaflets
+    ifs_add_map(ifs,  0.20, -0.26,  0.23, 0.22, 0.0, 1.60, 0.07);  // left
+    ifs_add_map(ifs, -0.15,  0.28,  0.26, 0.24, 0.0, 0.44, 0.07);  // right
+    ifs->xmin = -2.75;
+    ifs->xmax = 3.25;
+    ifs->ymin = -0.25;
+    ifs->ymax = 10.25;
+}
+
+static uint64_t ifs_splitmix64(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static void ifs_seed(const ifs_job_t *job, int task, uint64_t s[4][WALKERS])
+{
+    // every walker of every task gets its own splitmix64-expanded state
+    for (int w = 0; w < WALKERS; w++) {
+        uint64_t sm = job->seed ^ ((uint64_t)task * WALKERS + w) *
+                                  0xD1B54A32D192ED03ull;
+        for (int k = 0; k < 4; k++) {
+            s[k][w] = ifs_splitmix64(&sm);
+        }
+    }
+}
+
+static inline uint64_t ifs_next(uint64_t s[4][WALKERS], int w)
+{
+    // xoshiro256+
+    uint64_t result = s[0][w] + s[3][w];
+    uint64_t t = s[1][w] << 17;
+    s[2][w] ^= s[0][w];
+    s[3][w] ^= s[1][w];
+    s[1][w] ^= s[2][w];
+    s[0][w] ^= s[3][w];
+    s[2][w] ^= t;
+    s[3][w] = (s[3][w] << 45) | (s[3][w] >> 19);
+    return result;
+}
+
+static inline void ifs_count(const ifs_job_t *job, double x, double y,
+                             uint32_t *density, long long *hits)
+{
+    double px = (x - job->ifs->xmin) * job->sx;
+    double py = (y - job->ifs->ymin) * job->sy;
+    if (px >= 0.0 && px < job->width && py >= 0.0 && py < job->height) {
+        density[(size_t)(int)py * job->width + (int)px]++;
+        (*hits)++;
+    }
+}
+
+static void ifs_walk_scalar(const ifs_job_t *job, int task, long long steps,
+                            uint32_t *density, long long *hits)
+{
+    uint64_t s[4][WALKERS];
+    double x[WALKERS] = { 0 }, y[WALKERS] = { 0 };
+    int last = job->ifs->count - 1;
+
+    ifs_seed(job, task, s);
+    for (long long i = -WARMUP_STEPS; i < steps; i++) {
+        for (int w = 0; w < WALKERS; w++) {
+            long long r = (long long)(ifs_next(s, w) >> (64 - THRESHOLD_BITS));
+            int k = 0;
+            for (int m = 0; m < last; m++) {
+                k += r >= job->threshold[m];
+            }
+
+            const ifs_map_t *map = &job->ifs->maps[k];
+            double nx = map->a * x[w] + map->b * y[w] + map->e;
+            double ny = map->c * x[w] + map->d * y[w] + map->f;
+            x[w] = nx;
+            y[w] = ny;
+            if (i >= 0) {
+                ifs_count(job, nx, ny, density, hits);
+            }
+        }
+    }
+}
+
+#ifdef HAVE_AVX2_KERNEL
+typedef struct {
+    __m256i s0, s1, s2, s3;     // xoshiro256+ state of four walkers
+    __m256d x, y;               // their positions
+} ifs_lanes_t;
+
+__attribute__((target("avx2"), always_inline))
+static inline __m256i ifs_lanes_next(ifs_lanes_t *v)
+{
+    __m256i result = _mm256_add_epi64(v->s0, v->s3);
+    __m256i t = _mm256_slli_epi64(v->s1, 17);
+    v->s2 = _mm256_xor_si256(v->s2, v->s0);
+    v->s3 = _mm256_xor_si256(v->s3, v->s1);
+    v->s1 = _mm256_xor_si256(v->s1, v->s2);
+    v->s0 = _mm256_xor_si256(v->s0, v->s3);
+    v->s2 = _mm256_xor_si256(v->s2, t);
+    v->s3 = _mm256_or_si256(_mm256_slli_epi64(v->s3, 45),
+                            _mm256_srli_epi64(v->s3, 19));
+    return result;
+}
+
+__attribute__((target("avx2"), always_inline))
+static inline void ifs_lanes_step(ifs_lanes_t *v, const ifs_job_t *job,
+                                  const __m256i *limits, int last)
+{
+    // map index = number of thresholds the random value is at or above;
+    // the compare masks are -1 where it is, so subtracting them counts
+    __m256i r = _mm256_srli_epi64(ifs_lanes_next(v), 64 - THRESHOLD_BITS);
+    __m256i k = _mm256_setzero_si256();
+    for (int m = 0; m < last; m++) {
+        k = _mm256_sub_epi64(k, _mm256_cmpgt_epi64(r, limits[m]));
+    }
+
+    __m256d a = _mm256_i64gather_pd(job->coef[0], k, 8);
+    __m256d b = _mm256_i64gather_pd(job->coef[1], k, 8);
+    __m256d c = _mm256_i64gather_pd(job->coef[2], k, 8);
+    __m256d d = _mm256_i64gather_pd(job->coef[3], k, 8);
+    __m256d e = _mm256_i64gather_pd(job->coef[4], k, 8);
+    __m256d f = _mm256_i64gather_pd(job->coef[5], k, 8);
+
+    __m256d nx = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(a, v->x),
+                                             _mm256_mul_pd(b, v->y)), e);
+    __m256d ny = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(c, v->x),
+                                             _mm256_mul_pd(d, v->y)), f);
+    v->x = nx;
+    v->y = ny;
+}
+
+__attribute__((target("avx2")))
+static void ifs_walk_avx2(const ifs_job_t *job, int task, long long steps,
+                          uint32_t *density, long long *hits)
+{
+    uint64_t s[4][WALKERS];
+    __m256i limits[IFS_MAX_MAPS];
+    int last = job->ifs->count - 1;
+
+    // r >= threshold is r > threshold - 1 for the signed 64-bit compare
+    for (int m = 0; m < last; m++) {
+        limits[m] = _mm256_set1_epi64x(job->threshold[m] - 1);
+    }
+
+    ifs_seed(job, task, s);
+    ifs_lanes_t g[2];
+    for (int n = 0; n < 2; n++) {
+        g[n].s0 = _mm256_loadu_si256((const __m256i*)&s[0][n * LANES]);
+        g[n].s1 = _mm256_loadu_si256((const __m256i*)&s[1][n * LANES]);
+        g[n].s2 = _mm256_loadu_si256((const __m256i*)&s[2][n * LANES]);
+        g[n].s3 = _mm256_loadu_si256((const __m256i*)&s[3][n * LANES]);
+        g[n].x = _mm256_setzero_pd();
+        g[n].y = _mm256_setzero_pd();
+    }
+
+    for (int i = 0; i < WARMUP_STEPS; i++) {
+        ifs_lanes_step(&g[0], job, limits, last);
+        ifs_lanes_step(&g[1], job, limits, last);
+    }
+
+    const __m256d xmin = _mm256_set1_pd(job->ifs->xmin);
+    const __m256d ymin = _mm256_set1_pd(job->ifs->ymin);
+    const __m256d sx = _mm256_set1_pd(job->sx);
+    const __m256d sy = _mm256_set1_pd(job->sy);
+    for (long long i = 0; i < steps; i++) {
+        ifs_lanes_step(&g[0], job, limits, last);
+        ifs_lanes_step(&g[1], job, limits, last);
+
+        // the scatter into the density buffer stays scalar: increments
+        // from different lanes may hit the same pixel
+        double px[WALKERS], py[WALKERS];
+        _mm256_storeu_pd(px, _mm256_mul_pd(_mm256_sub_pd(g[0].x, xmin), sx));
+        _mm256_storeu_pd(py, _mm256_mul_pd(_mm256_sub_pd(g[0].y, ymin), sy));
+        _mm256_storeu_pd(px + LANES,
+                         _mm256_mul_pd(_mm256_sub_pd(g[1].x, xmin), sx));
+        _mm256_storeu_pd(py + LANES,
+                         _mm256_mul_pd(_mm256_sub_pd(g[1].y, ymin), sy));
+        for (int w = 0; w < WALKERS; w++) {
+            if (px[w] >= 0.0 && px[w] < job->width &&
+                py[w] >= 0.0 && py[w] < job->height) {
+                density[(size_t)(int)py[w] * job->width + (int)px[w]]++;
+                (*hits)++;
+            }
+        }
+    }
+}
+
+static int ifs_uses_avx2()
+{
+    static int supported = -1;
+
+    // TURTLE_NO_AVX2 forces the scalar kernel, as in mandelbrot.c
+    if (supported < 0) {
+        __builtin_cpu_init();
+        supported = __builtin_cpu_supports("avx2") &&
+                    getenv("TURTLE_NO_AVX2") == NULL;
+    }
+    return supported;
+}
+#endif
+
+static void ifs_worker(int begin, int end, void *ctx)
+{
+    ifs_job_t *job = (ifs_job_t*)ctx;
+
+    // one call per density buffer; tasks are claimed until none are left
+    for (int b = begin; b < end; b++) {
+        long long hits = 0;
+        for (;;) {
+            int task = __atomic_fetch_add(&job->next_task, 1,
+                                          __ATOMIC_RELAXED);
+            if (task >= job->tasks) {
+                break;
+            }
+            long long first = (long long)task * TASK_POINTS;
+            long long count = job->points - first < TASK_POINTS ?
+                              job->points - first : TASK_POINTS;
+#ifdef HAVE_AVX2_KERNEL
+            if (ifs_uses_avx2()) {
+                ifs_walk_avx2(job, task, count / WALKERS, job->buffers[b],
+                              &hits);
+                continue;
+            }
+#endif
+            ifs_walk_scalar(job, task, count / WALKERS, job->buffers[b],
+                            &hits);
+        }
+        job->hits[b] = hits;
+    }
+}
+
+typedef struct {
+    uint32_t **buffers;
+    int      count;
+    int      width;
+} ifs_reduce_t;
+
+static void ifs_reduce_rows(int begin, int end, void *ctx)
+{
+    ifs_reduce_t *job = (ifs_reduce_t*)ctx;
+    size_t first = (size_t)begin * job->width;
+    size_t last = (size_t)end * job->width;
+
+    for (int b = 1; b < job->count; b++) {
+        const uint32_t *src = job->buffers[b];
+        uint32_t *dst = job->buffers[0];
+        for (size_t i = first; i < last; i++) {
+            dst[i] += src[i];
+        }
+    }
+}
+
+void ifs_density(const ifs_t *ifs, long long points, uint64_t seed,
+                 int width, int height, uint32_t *density,
+                 ifs_stats_t *stats)
+{
+    ifs_job_t job;
+    size_t pixels = (size_t)width * height;
+
+    if (ifs->count < 1) {
+        fprintf(stderr, "IFS has no maps.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    job.ifs = ifs;
+    job.width = width;
+    job.height = height;
+    job.sx = width / (ifs->xmax - ifs->xmin);
+    job.sy = height / (ifs->ymax - ifs->ymin);
+    job.points = (points + WALKERS - 1) / WALKERS * WALKERS;
+    job.tasks = (int)((job.points + TASK_POINTS - 1) / TASK_POINTS);
+    job.seed = seed;
+    job.next_task = 0;
+
+    // coefficient table for the gathers and cumulative weights for the
+    // map choice; map k is picked when threshold[k-1] <= r < threshold[k]
+    double total = 0.0, sum = 0.0;
+    for (int m = 0; m < ifs->count; m++) {
+        total += ifs->maps[m].weight;
+    }
+    for (int m = 0; m < IFS_MAX_MAPS; m++) {
+        const ifs_map_t *map = &ifs->maps[m < ifs->count ? m : 0];
+        job.coef[0][m] = map->a;
+        job.coef[1][m] = map->b;
+        job.coef[2][m] = map->c;
+        job.coef[3][m] = map->d;
+        job.coef[4][m] = map->e;
+        job.coef[5][m] = map->f;
+        sum += m < ifs->count ? map->weight : 0.0;
+        job.threshold[m] = (long long)llround(sum / total *
+                                              (double)(1LL << THRESHOLD_BITS));
+    }
+
+    // the caller's buffer doubles as the first thread's buffer
+    int nbuffers = parallel_thread_count();
+    if (nbuffers > job.tasks) {
+        nbuffers = job.tasks > 0 ? job.tasks : 1;
+    }
+    job.buffers = (uint32_t**)malloc(sizeof(uint32_t*) * nbuffers);
+    job.hits = (long long*)calloc(nbuffers, sizeof(long long));
+    if (job.buffers == NULL || job.hits == NULL) {
+        fprintf(stderr, "Can't allocate memory for IFS buffers.\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(density, 0, sizeof(uint32_t) * pixels);
+    job.buffers[0] = density;
+    for (int b = 1; b < nbuffers; b++) {
+        job.buffers[b] = (uint32_t*)calloc(pixels, sizeof(uint32_t));
+        if (job.buffers[b] == NULL) {
+            fprintf(stderr, "Can't allocate memory for IFS buffers.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+#ifdef HAVE_AVX2_KERNEL
+    // resolve the CPU check before the workers race to do it
+    ifs_uses_avx2();
+#endif
+    double start = ifs_now_ms();
+    parallel_for(nbuffers, 1, ifs_worker, &job);
+    double walked = ifs_now_ms();
+
+    ifs_reduce_t reduce = { job.buffers, nbuffers, width };
+    if (nbuffers > 1) {
+        parallel_for(height, 16, ifs_reduce_rows, &reduce);
+    }
+    double reduced = ifs_now_ms();
+
+    if (stats != NULL) {
+        stats->points = job.points;
+        stats->hits = 0;
+        for (int b = 0; b < nbuffers; b++) {
+            stats->hits += job.hits[b];
+        }
+        stats->max_density = 0;
+        for (size_t i = 0; i < pixels; i++) {
+            if (density[i] > stats->max_density) {
+                stats->max_density = density[i];
+            }
+        }
+        stats->walk_ms = walked - start;
+        stats->reduce_ms = reduced - walked;
+    }
+
+    for (int b = 1; b < nbuffers; b++) {
+        free(job.buffers[b]);
+    }
+    free(job.buffers);
+    free(job.hits);
+}
+
+typedef struct {
+    const uint32_t *density;
+    rgb_t   *pixels;
+    int      width;
+    rgb_t    color;
+    double   scale;             // 255 / log(1 + max density)
+} ifs_tone_t;
+
+static void ifs_tone_rows(int begin, int end, void *ctx)
+{
+    ifs_tone_t *job = (ifs_tone_t*)ctx;
+    size_t first = (size_t)begin * job->width;
+    size_t last = (size_t)end * job->width;
+
+    for (size_t i = first; i < last; i++) {
+        uint32_t n = job->density[i];
+        if (n == 0) {
+            continue;
+        }
+
+        // log scale, so a single hit still shows and the densest pixel
+        // gets the full color
+        int w = (int)(log1p((double)n) * job->scale) + 1;
+        w = w > 256 ? 256 : w;
+        rgb_t *p = &job->pixels[i];
+        p->red   = (unsigned char)((p->red   * (256 - w) + job->color.red   * w) >> 8);
+        p->green = (unsigned char)((p->green * (256 - w) + job->color.green * w) >> 8);
+        p->blue  = (unsigned char)((p->blue  * (256 - w) + job->color.blue  * w) >> 8);
+    }
+}
+
+void ifs_render(const ifs_t *ifs, long long points, uint64_t seed,
+                rgb_t color, ifs_stats_t *stats)
+{
+    int width = turtle_get_width();
+    int height = turtle_get_height();
+    ifs_stats_t local;
+    uint32_t *density = (uint32_t*)malloc(sizeof(uint32_t) *
+                                          (size_t)width * height);
+    if (density == NULL) {
+        fprintf(stderr, "Can't allocate memory for IFS density.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    ifs_density(ifs, points, seed, width, height, density, &local);
+
+    ifs_tone_t tone;
+    tone.density = density;
+    tone.pixels = turtle_get_field();
+    tone.width = width;
+    tone.color = color;
+    tone.scale = local.max_density > 0 ?
+                 255.0 / log1p((double)local.max_density) : 0.0;
+    parallel_for(height, 16, ifs_tone_rows, &tone);
+    free(density);
+
+    // the field was written directly, so tell the preview pyramid
+    turtle_mark_dirty(-width/2, -height/2, width - width/2 - 1,
+                      height - height/2 - 1);
+    if (stats != NULL) {
+        *stats = local;
+    }
+}
@@ -0,0 +1,94 @@
+#ifndef IFS_H
+#define IFS_H
+
+/*
+    ifs.h
+
+    Chaos-game renderer for iterated function systems (Sierpinski triangle,
+    Barnsley fern, ...) on the turtle field. Many independent walkers each
+    apply a randomly chosen affine map per step and count where they land;
+    the counts are tone-mapped into the field on a log scale.
+
+    (header info only; see ifs.c for implementation)
+*/
+
+#include "turtle.h"
+
+#include <stdint.h>
+
+
+#define IFS_MAX_MAPS 16
+
+
+/*
+    One affine map of the system, picked with probability proportional to
+    its weight:  x' = a*x + b*y + e,  y' = c*x + d*y + f.
+*/
+typedef struct {
+    double a, b, c, d;
+    double e, f;
+    double weight;
+} ifs_map_t;
+
+
+/*
+    An iterated function system and the region of the plane that is mapped
+    onto the field (row 0 at ymin, like the Mandelbrot renderer).
+*/
+typedef struct {
+    ifs_map_t maps[IFS_MAX_MAPS];
+    int    count;           // maps in use
+    double xmin;
+    double xmax;
+    double ymin;
+    double ymax;
+} ifs_t;
+
+
+/*
+    Per-render statistics filled in by the renderer (pass NULL to skip).
+*/
+typedef struct {
+    long long points;       // points generated (after rounding up)
+    long long hits;         // points that landed inside the field
+    uint32_t  max_density;  // hits in the busiest pixel
+    double    walk_ms;      // time spent generating points
+    double    reduce_ms;    // time spent merging the per-thread buffers
+} ifs_stats_t;
+
+
+/*
+    Fill ifs with a classic system: the Sierpinski triangle (the chaos game
+    with three corners) or Barnsley's fern, each with a region that frames it.
+*/
+void ifs_sierpinski(ifs_t *ifs);
+void ifs_barnsley_fern(ifs_t *ifs);
+
+
+/*
+    Append a map to the system; exits if there are already IFS_MAX_MAPS.
+*/
+void ifs_add_map(ifs_t *ifs, double a, double b, double c, double d,
+                 double e, double f, double weight);
+
+
+/*
+    Run the chaos game for the given number of points (rounded up to a
+    multiple of 8) and store the hit count of every pixel of a width x
+    height grid over the region into density. The result depends only on
+    the seed, not on the number of threads.
+*/
+void ifs_density(const ifs_t *ifs, long long points, uint64_t seed,
+                 int width, int height, uint32_t *density,
+                 ifs_stats_t *stats);
+
+
+/*
+    Run the chaos game over the whole field and blend each pixel towards
+    color by its log-scaled density; pixels that weren't hit are left alone.
+*/
+void ifs_render(const ifs_t *ifs, long long points, uint64_t seed,
+                rgb_t color, ifs_stats_t *stats);
+
+
+#endif
@@ -0,0 +1,913 @@
+/*
+    mandelbrot.c
+
+    Native escape-time Mandelbrot renderer for the turtle field.
+
+    Rows are handed out to worker threads one at a time from a shared counter
+    (see parallel.c), so the expensive rows through the middle of the set
+    don't leave other threads idle. Within a row, four pixels are iterated
+    together in AVX2 lanes; a lane that escapes is frozen while the others
+    keep going, and the group stops as soon as every lane is done. Two such
+    groups are interleaved so eight pixels are in flight per thread.
+
+    Interior points would otherwise run all max_iter iterations. Points in
+    the main cardioid and period-2 bulb are recognized up front; the rest
+    are compared against a checkpoint of their own orbit that moves at
+    doubling intervals (Brent), so attracting cycles of any period stop the
+    lane once z settles onto them. In Mariani-Silver mode the frame is cut
+    into 64x64 blocks handed out like rows, and each block is subdivided
+    recursively until the border of a piece has one escape iteration.
+*/
+
+#include "mandelbrot.h"
+#include "parallel.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <math.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_AVX2_KERNEL 1
+#include <immintrin.h>
+#endif
+
+
+/**  DEFINITIONS  **/
+
+#define LANES 4                 // doubles per AVX2 register
+#define PALETTE_SIZE 256        // matches matplotlib's default colormap size
+
+// palette stops of the Python viewer, evenly spaced from 0 to 1
+static const rgb_t PALETTE_STOPS[] = {
+    { 0x00, 0x07, 0x64 },
+    { 0x20, 0x6B, 0xCB },
+    { 0xED, 0xFF, 0xFF },
+    { 0xFF, 0xB8, 0x47 },
+    { 0xA4, 0x00, 0x00 },
+};
+#define NUM_PALETTE_STOPS (int)(sizeof(PALETTE_STOPS) / sizeof(rgb_t))
+
+#define PERIOD_EPSILON_SQ 1e-24     // |z - checkpoint|^2 that counts as a cycle
+#define PERIOD_FIRST_CHECK 16       // first checkpoint, then at doubling steps
+#define MS_BLOCK 64                 // Mariani-Silver top-level block size
+#define MS_MIN_SIZE 6               // rectangles thinner than this are iterated
+#define MS_POINTS 256               // points per batch for the vector kernel
+
+typedef struct {
+    const mandelbrot_settings_t *settings;
+    int     width;
+    int     height;
+    double  dx;                 // pixel spacing
+    double  dy;
+    double *values;
+    int    *iters;              // escape iteration per pixel, Mariani-Silver only
+    mandelbrot_stats_t *stats;  // frame totals, added to atomically
+} mandelbrot_job_t;
+
+
+/**  MANDELBROT FUNCTIONS  **/
+
+void mandelbrot_default_settings(mandelbrot_settings_t *settings)
+{
+    settings->xmin = -2.0;
+    settings->xmax = 0.8;
+    settings->ymin = -1.4;
+    settings->ymax = 1.4;
+    settings->max_iter = 300;
+    settings->escape_radius = 2.0;
+    settings->power = 2;
+    settings->shortcuts = MANDELBROT_DEFAULT_SHORTCUTS;
+}
+
+int mandelbrot_uses_avx2()
+{
+#ifdef HAVE_AVX2_KERNEL
+    static int supported = -1;
+
+    // TURTLE_NO_AVX2 forces the scalar kernel (handy for benchmarking)
+    if (supported < 0) {
+        __builtin_cpu_init();
+        supported = __builtin_cpu_supports("avx2") &&
+                    __builtin_cpu_supports("fma") &&
+                    getenv("TURTLE_NO_AVX2") == NULL;
+    }
+    return supported;
+#else
+    return 0;
+#endif
+}
+
+static double mandelbrot_smooth(int iter, double mag_sq, int power)
+{
+    // i + 1 - log(log|z|)/log(power), with log|z| = log(|z|^2) / 2
+    return iter + 1 - log(0.5 * log(mag_sq)) / log((double)power);
+}
+
+static int mandelbrot_in_cardioid(double cr, double ci)
+{
+    // inside the main cardioid or the period-2 bulb (power 2 only)
+    double xq = cr - 0.25, yy = ci * ci;
+    double q = xq * xq + yy;
+    return q * (q + xq) <= 0.25 * yy ||
+           (cr + 1.0) * (cr + 1.0) + yy <= 0.0625;
+}
+
+static double mandelbrot_pixel(const mandelbrot_settings_t *s,
+                               double cr, double ci, int *escape_iter,
+                               mandelbrot_stats_t *counts)
+{
+    double bailout = s->escape_radius * s->escape_radius;
+    bool periodicity = s->shortcuts & MANDELBROT_PERIODICITY;
+
+    *escape_iter = -1;
+    if ((s->shortcuts & MANDELBROT_CARDIOID) && s->power == 2 &&
+        mandelbrot_in_cardioid(cr, ci)) {
+        counts->cardioid++;
+        return 0.0;
+    }
+
+    double zr = cr, zi = ci;
+    double sr = zr, si = zi;    // z at the last periodicity checkpoint
+    int check = PERIOD_FIRST_CHECK;
+    for (int i = 0; i < s->max_iter; i++) {
+        // z = z^power + c
+        double wr = zr, wi = zi;
+        for (int k = 1; k < s->power; k++) {
+            double t = wr * zr - wi * zi;
+            wi = wr * zi + wi * zr;
+            wr = t;
+        }
+        zr = wr + cr;
+        zi = wi + ci;
+
+        double mag_sq = zr * zr + zi * zi;
+        if (mag_sq > bailout) {
+            counts->iterations += i + 1;
+            *escape_iter = i;
+            return mandelbrot_smooth(i, mag_sq, s->power);
+        }
+
+        // Brent: compare against a checkpoint that moves to the current z
+        // at doubling intervals, which catches cycles of any period
+        if (periodicity) {
+            double dr = zr - sr, di = zi - si;
+            if (dr * dr + di * di < PERIOD_EPSILON_SQ) {
+                counts->iterations += i + 1;
+                counts->periodic++;
+                return 0.0;
+            }
+            if (i == check) {
+                sr = zr;
+                si = zi;
+                check <<= 1;
+            }
+        }
+    }
+    counts->iterations += s->max_iter;
+    return 0.0;
+}
+
+static void mandelbrot_row_scalar(const mandelbrot_settings_t *s,
+                                  double ci, double x0, double dx,
+                                  int width, double *out, int *iters,
+                                  mandelbrot_stats_t *counts)
+{
+    for (int col = 0; col < width; col++) {
+        int escape_iter;
+        out[col] = mandelbrot_pixel(s, x0 + col * dx, ci, &escape_iter,
+                                    counts);
+        if (iters != NULL) {
+            iters[col] = escape_iter;
+        }
+    }
+}
+
+#ifdef HAVE_AVX2_KERNEL
+typedef struct {
+    __m256d cr, zr, zi;         // c (real part) and z for four pixels
+    __m256d sr, si;             // z at the last periodicity checkpoint
+    __m256d active;             // all-ones for lanes still iterating
+    __m256d esc_iter;           // iteration the lane stopped at, -1 if none
+    __m256d esc_mag;            // |z|^2 at escape, 0 if a cycle stopped it
+} mandelbrot_lanes_t;
+
+__attribute__((target("avx2,fma"), always_inline))
+static inline int mandelbrot_lanes_init(mandelbrot_lanes_t *v, __m256d cr,
+                                        __m256d ci, bool cardioid)
+{
+    v->cr = cr;
+    v->zr = v->sr = v->cr;
+    v->zi = v->si = ci;
+    v->active   = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+    v->esc_iter = _mm256_set1_pd(-1.0);
+    v->esc_mag  = _mm256_setzero_pd();
+    if (!cardioid) {
+        return 0;
+    }
+
+    // lanes inside the main cardioid or period-2 bulb never start
+    __m256d xq = _mm256_sub_pd(v->cr, _mm256_set1_pd(0.25));
+    __m256d yy = _mm256_mul_pd(ci, ci);
+    __m256d q  = _mm256_fmadd_pd(xq, xq, yy);
+    __m256d in_cardioid = _mm256_cmp_pd(
+            _mm256_mul_pd(q, _mm256_add_pd(q, xq)),
+            _mm256_mul_pd(yy, _mm256_set1_pd(0.25)), _CMP_LE_OQ);
+    __m256d xb = _mm256_add_pd(v->cr, _mm256_set1_pd(1.0));
+    __m256d in_bulb = _mm256_cmp_pd(_mm256_fmadd_pd(xb, xb, yy),
+                                    _mm256_set1_pd(0.0625), _CMP_LE_OQ);
+    __m256d inside = _mm256_or_pd(in_cardioid, in_bulb);
+    v->active = _mm256_andnot_pd(inside, v->active);
+    return _mm256_movemask_pd(inside);
+}
+
+__attribute__((target("avx2,fma"), always_inline))
+static inline void mandelbrot_lanes_step(mandelbrot_lanes_t *v, __m256d ci,
+                                         __m256d bailout, int power, int i,
+                                         bool periodicity)
+{
+    // z = z^power + c, computed for all lanes...
+    __m256d wr = v->zr, wi = v->zi;
+    for (int k = 1; k < power; k++) {
+        __m256d t = _mm256_fmsub_pd(wr, v->zr, _mm256_mul_pd(wi, v->zi));
+        wi = _mm256_fmadd_pd(wr, v->zi, _mm256_mul_pd(wi, v->zr));
+        wr = t;
+    }
+    wr = _mm256_add_pd(wr, v->cr);
+    wi = _mm256_add_pd(wi, ci);
+
+    // ...but only kept by lanes that haven't escaped yet
+    v->zr = _mm256_blendv_pd(v->zr, wr, v->active);
+    v->zi = _mm256_blendv_pd(v->zi, wi, v->active);
+
+    __m256d mag_sq = _mm256_fmadd_pd(v->zr, v->zr, _mm256_mul_pd(v->zi, v->zi));
+    __m256d escaped = _mm256_and_pd(v->active,
+            _mm256_cmp_pd(mag_sq, bailout, _CMP_GT_OQ));
+    v->esc_iter = _mm256_blendv_pd(v->esc_iter, _mm256_set1_pd((double)i),
+                                   escaped);
+    v->esc_mag  = _mm256_blendv_pd(v->esc_mag, mag_sq, escaped);
+    v->active   = _mm256_andnot_pd(escaped, v->active);
+
+    if (periodicity) {
+        __m256d dr = _mm256_sub_pd(v->zr, v->sr);
+        __m256d di = _mm256_sub_pd(v->zi, v->si);
+        __m256d cycle = _mm256_and_pd(v->active, _mm256_cmp_pd(
+                _mm256_fmadd_pd(dr, dr, _mm256_mul_pd(di, di)),
+                _mm256_set1_pd(PERIOD_EPSILON_SQ), _CMP_LT_OQ));
+        v->esc_iter = _mm256_blendv_pd(v->esc_iter,
+                                       _mm256_set1_pd((double)i), cycle);
+        v->active   = _mm256_andnot_pd(cycle, v->active);
+    }
+}
+
+__attribute__((target("avx2,fma"), always_inline))
+static inline void mandelbrot_lanes_run(mandelbrot_lanes_t *a,
+                                        mandelbrot_lanes_t *b,
+                                        __m256d ci_a, __m256d ci_b,
+                                        __m256d bailout, int max_iter,
+                                        int power, bool periodicity)
+{
+    int check = PERIOD_FIRST_CHECK;
+    for (int i = 0; i < max_iter; i++) {
+        if (_mm256_movemask_pd(_mm256_or_pd(a->active, b->active)) == 0) {
+            break;
+        }
+        mandelbrot_lanes_step(a, ci_a, bailout, power, i, periodicity);
+        mandelbrot_lanes_step(b, ci_b, bailout, power, i, periodicity);
+        if (periodicity && i == check) {
+            a->sr = a->zr;
+            a->si = a->zi;
+            b->sr = b->zr;
+            b->si = b->zi;
+            check <<= 1;
+        }
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void mandelbrot_lanes_store(const mandelbrot_lanes_t *v, int power,
+                                   int max_iter, int count, int cardioid,
+                                   double *out, int *out_iters,
+                                   mandelbrot_stats_t *counts)
+{
+    // the logs are rare enough (once per escaped pixel) to stay scalar
+    double iters[LANES], mags[LANES];
+    _mm256_storeu_pd(iters, v->esc_iter);
+    _mm256_storeu_pd(mags, v->esc_mag);
+    for (int l = 0; l < LANES && l < count; l++) {
+        int escape_iter = -1;
+        out[l] = 0.0;
+        if ((cardioid >> l) & 1) {
+            counts->cardioid++;
+        } else if (iters[l] < 0.0) {
+            counts->iterations += max_iter;
+        } else if (mags[l] == 0.0) {
+            counts->iterations += (int)iters[l] + 1;
+            counts->periodic++;
+        } else {
+            counts->iterations += (int)iters[l] + 1;
+            escape_iter = (int)iters[l];
+            out[l] = mandelbrot_smooth(escape_iter, mags[l], power);
+        }
+        if (out_iters != NULL) {
+            out_iters[l] = escape_iter;
+        }
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void mandelbrot_row_avx2(const mandelbrot_settings_t *s,
+                                double ci, double x0, double dx,
+                                int width, double *out, int *iters,
+                                mandelbrot_stats_t *counts)
+{
+    const __m256d bailout = _mm256_set1_pd(s->escape_radius *
+                                           s->escape_radius);
+    const __m256d ci_v = _mm256_set1_pd(ci);
+    const __m256d lane = _mm256_set_pd(3.0, 2.0, 1.0, 0.0);
+    bool cardioid = (s->shortcuts & MANDELBROT_CARDIOID) && s->power == 2;
+    bool periodicity = s->shortcuts & MANDELBROT_PERIODICITY;
+
+    // two independent groups of four pixels are interleaved so that one
+    // group's multiplies fill the other's FMA latency
+    for (int col = 0; col < width; col += 2 * LANES) {
+        mandelbrot_lanes_t a, b;
+        __m256d cr_a = _mm256_fmadd_pd(
+                _mm256_add_pd(_mm256_set1_pd((double)col), lane),
+                _mm256_set1_pd(dx), _mm256_set1_pd(x0));
+        __m256d cr_b = _mm256_fmadd_pd(
+                _mm256_add_pd(_mm256_set1_pd((double)(col + LANES)), lane),
+                _mm256_set1_pd(dx), _mm256_set1_pd(x0));
+        int inside_a = mandelbrot_lanes_init(&a, cr_a, ci_v, cardioid);
+        int inside_b = mandelbrot_lanes_init(&b, cr_b, ci_v, cardioid);
+
+        mandelbrot_lanes_run(&a, &b, ci_v, ci_v, bailout, s->max_iter,
+                             s->power, periodicity);
+
+        mandelbrot_lanes_store(&a, s->power, s->max_iter, width - col,
+                               inside_a, out + col,
+                               iters != NULL ? iters + col : NULL, counts);
+        if (col + LANES < width) {
+            mandelbrot_lanes_store(&b, s->power, s->max_iter,
+                                   width - col - LANES, inside_b,
+                                   out + col + LANES,
+                                   iters != NULL ? iters + col + LANES : NULL,
+                                   counts);
+        }
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void mandelbrot_points_avx2(const mandelbrot_settings_t *s,
+                                   const double *cr, const double *ci,
+                                   int count, double *out, int *iters,
+                                   mandelbrot_stats_t *counts)
+{
+    const __m256d bailout = _mm256_set1_pd(s->escape_radius *
+                                           s->escape_radius);
+    bool cardioid = (s->shortcuts & MANDELBROT_CARDIOID) && s->power == 2;
+    bool periodicity = s->shortcuts & MANDELBROT_PERIODICITY;
+
+    // like mandelbrot_row_avx2() but for arbitrary points; the inputs are
+    // padded to a multiple of 2 * LANES by the caller
+    for (int p = 0; p < count; p += 2 * LANES) {
+        mandelbrot_lanes_t a, b;
+        __m256d ci_a = _mm256_loadu_pd(ci + p);
+        __m256d ci_b = _mm256_loadu_pd(ci + p + LANES);
+        int inside_a = mandelbrot_lanes_init(&a, _mm256_loadu_pd(cr + p),
+                                             ci_a, cardioid);
+        int inside_b = mandelbrot_lanes_init(&b, _mm256_loadu_pd(cr + p + LANES),
+                                             ci_b, cardioid);
+
+        mandelbrot_lanes_run(&a, &b, ci_a, ci_b, bailout, s->max_iter,
+                             s->power, periodicity);
+
+        mandelbrot_lanes_store(&a, s->power, s->max_iter, count - p, inside_a,
+                               out + p, iters + p, counts);
+        if (p + LANES < count) {
+            mandelbrot_lanes_store(&b, s->power, s->max_iter,
+                                   count - p - LANES, inside_b,
+                                   out + p + LANES, iters + p + LANES, counts);
+        }
+    }
+}
+#endif
+
+static void mandelbrot_row(const mandelbrot_settings_t *s, double ci,
+                           double x0, double dx, int width, double *out,
+                           int *iters, mandelbrot_stats_t *counts)
+{
+#ifdef HAVE_AVX2_KERNEL
+    if (mandelbrot_uses_avx2()) {
+        mandelbrot_row_avx2(s, ci, x0, dx, width, out, iters, counts);
+        return;
+    }
+#endif
+    mandelbrot_row_scalar(s, ci, x0, dx, width, out, iters, counts);
+}
+
+double mandelbrot_state_value(const mandelbrot_state_t *state, int max_iter)
+{
+    return state->escaped && state->iter <= max_iter ? state->value : 0.0;
+}
+
+static void mandelbrot_resume_scalar(const mandelbrot_settings_t *s,
+                                     double ci, double x0, double dx,
+                                     int width, mandelbrot_state_t *state)
+{
+    double bailout = s->escape_radius * s->escape_radius;
+    bool cardioid = (s->shortcuts & MANDELBROT_CARDIOID) && s->power == 2;
+    bool periodicity = s->shortcuts & MANDELBROT_PERIODICITY;
+
+    for (int col = 0; col < width; col++) {
+        mandelbrot_state_t *st = &state[col];
+        double cr = x0 + col * dx;
+        if (st->iter == 0 && !st->escaped) {
+            st->zr = cr;
+            st->zi = ci;
+            if (cardioid && mandelbrot_in_cardioid(cr, ci)) {
+                st->iter = MANDELBROT_INTERIOR;
+            }
+        }
+
+        // cycle detection restarts from wherever this pixel resumes
+        double zr = st->zr, zi = st->zi;
+        double sr = zr, si = zi;
+        int i = st->iter, steps = 0, check = PERIOD_FIRST_CHECK;
+        while (!st->escaped && i < s->max_iter) {
+            double wr = zr, wi = zi;
+            for (int k = 1; k < s->power; k++) {
+                double t = wr * zr - wi * zi;
+                wi = wr * zi + wi * zr;
+                wr = t;
+            }
+            zr = wr + cr;
+            zi = wi + ci;
+            i++;
+
+            double mag_sq = zr * zr + zi * zi;
+            if (mag_sq > bailout) {
+                // the escape happened on loop iteration i - 1
+                st->value = mandelbrot_smooth(i - 1, mag_sq, s->power);
+                st->escaped = 1;
+            } else if (periodicity) {
+                double dr = zr - sr, di = zi - si;
+                if (dr * dr + di * di < PERIOD_EPSILON_SQ) {
+                    i = MANDELBROT_INTERIOR;
+                } else if (++steps == check) {
+                    sr = zr;
+                    si = zi;
+                    check <<= 1;
+                }
+            }
+        }
+        st->zr = zr;
+        st->zi = zi;
+        st->iter = i;
+    }
+}
+
+#ifdef HAVE_AVX2_KERNEL
+typedef struct {
+    __m256d cr, zr, zi;         // c (real part) and z for four pixels
+    __m256d sr, si;             // z at the last periodicity checkpoint
+    __m256d iter;               // iterations applied so far
+    __m256d active;             // all-ones for lanes still iterating
+    __m256d escaped;            // all-ones for lanes that have escaped
+    __m256d interior;           // all-ones for lanes proven to be inside
+} mandelbrot_resume_lanes_t;
+
+__attribute__((target("avx2,fma")))
+static void mandelbrot_resume_load(mandelbrot_resume_lanes_t *v,
+                                   const mandelbrot_settings_t *s,
+                                   const mandelbrot_state_t *state, int col,
+                                   int count, double x0, double dx, double ci)
+{
+    // lanes past the end of the row replay pixel 0 but never activate
+    bool cardioid = (s->shortcuts & MANDELBROT_CARDIOID) && s->power == 2;
+    double cr[LANES], zr[LANES], zi[LANES], iter[LANES];
+    long long active[LANES], escaped[LANES], interior[LANES];
+
+    for (int l = 0; l < LANES; l++) {
+        const mandelbrot_state_t *st = &state[l < count ? l : 0];
+        bool fresh = st->iter == 0 && !st->escaped;
+        cr[l]   = x0 + (col + l) * dx;     // same rounding as the scalar path
+        zr[l]   = fresh ? cr[l] : st->zr;
+        zi[l]   = fresh ? ci : st->zi;
+        iter[l] = st->iter;
+        interior[l] = -(long long)(st->iter == MANDELBROT_INTERIOR ||
+                                   (fresh && cardioid &&
+                                    mandelbrot_in_cardioid(cr[l], ci)));
+        active[l]   = -(long long)(l < count && !st->escaped && !interior[l] &&
+                                   st->iter < s->max_iter);
+        escaped[l]  = -(long long)(st->escaped != 0);
+    }
+    v->cr   = _mm256_loadu_pd(cr);
+    v->zr   = v->sr = _mm256_loadu_pd(zr);
+    v->zi   = v->si = _mm256_loadu_pd(zi);
+    v->iter = _mm256_loadu_pd(iter);
+    v->active   = _mm256_castsi256_pd(_mm256_loadu_si256((__m256i*)active));
+    v->escaped  = _mm256_castsi256_pd(_mm256_loadu_si256((__m256i*)escaped));
+    v->interior = _mm256_castsi256_pd(_mm256_loadu_si256((__m256i*)interior));
+}
+
+__attribute__((target("avx2,fma"), always_inline))
+static inline void mandelbrot_resume_step(mandelbrot_resume_lanes_t *v,
+                                          __m256d ci, __m256d bailout,
+                                          __m256d limit, int power,
+                                          bool periodicity)
+{
+    __m256d wr = v->zr, wi = v->zi;
+    for (int k = 1; k < power; k++) {
+        __m256d t = _mm256_fmsub_pd(wr, v->zr, _mm256_mul_pd(wi, v->zi));
+        wi = _mm256_fmadd_pd(wr, v->zi, _mm256_mul_pd(wi, v->zr));
+        wr = t;
+    }
+    wr = _mm256_add_pd(wr, v->cr);
+    wi = _mm256_add_pd(wi, ci);
+
+    // unlike mandelbrot_lanes_step() every lane keeps its own iteration
+    // count, since resumed pixels don't all start from the same one
+    v->zr   = _mm256_blendv_pd(v->zr, wr, v->active);
+    v->zi   = _mm256_blendv_pd(v->zi, wi, v->active);
+    v->iter = _mm256_add_pd(v->iter,
+                            _mm256_and_pd(v->active, _mm256_set1_pd(1.0)));
+
+    __m256d mag_sq = _mm256_fmadd_pd(v->zr, v->zr, _mm256_mul_pd(v->zi, v->zi));
+    __m256d escaped = _mm256_and_pd(v->active,
+            _mm256_cmp_pd(mag_sq, bailout, _CMP_GT_OQ));
+    v->escaped = _mm256_or_pd(v->escaped, escaped);
+    v->active  = _mm256_andnot_pd(escaped, v->active);
+    v->active  = _mm256_and_pd(v->active,
+                               _mm256_cmp_pd(v->iter, limit, _CMP_LT_OQ));
+
+    if (periodicity) {
+        __m256d dr = _mm256_sub_pd(v->zr, v->sr);
+        __m256d di = _mm256_sub_pd(v->zi, v->si);
+        __m256d cycle = _mm256_and_pd(v->active, _mm256_cmp_pd(
+                _mm256_fmadd_pd(dr, dr, _mm256_mul_pd(di, di)),
+                _mm256_set1_pd(PERIOD_EPSILON_SQ), _CMP_LT_OQ));
+        v->interior = _mm256_or_pd(v->interior, cycle);
+        v->active   = _mm256_andnot_pd(cycle, v->active);
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void mandelbrot_resume_store(const mandelbrot_resume_lanes_t *v,
+                                    int power, int count,
+                                    mandelbrot_state_t *state)
+{
+    double zr[LANES], zi[LANES], iter[LANES];
+    _mm256_storeu_pd(zr, v->zr);
+    _mm256_storeu_pd(zi, v->zi);
+    _mm256_storeu_pd(iter, v->iter);
+    int escaped = _mm256_movemask_pd(v->escaped);
+    int interior = _mm256_movemask_pd(v->interior);
+
+    for (int l = 0; l < LANES && l < count; l++) {
+        if (!state[l].escaped && ((escaped >> l) & 1)) {
+            state[l].value = mandelbrot_smooth((int)iter[l] - 1,
+                                               zr[l] * zr[l] + zi[l] * zi[l],
+                                               power);
+        }
+        state[l].zr = zr[l];
+        state[l].zi = zi[l];
+        state[l].iter = (interior >> l) & 1 ? MANDELBROT_INTERIOR
+                                            : (int)iter[l];
+        state[l].escaped = (escaped >> l) & 1;
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void mandelbrot_resume_avx2(const mandelbrot_settings_t *s,
+                                   double ci, double x0, double dx,
+                                   int width, mandelbrot_state_t *state)
+{
+    const __m256d bailout = _mm256_set1_pd(s->escape_radius *
+                                           s->escape_radius);
+    const __m256d limit = _mm256_set1_pd((double)s->max_iter);
+    const __m256d ci_v = _mm256_set1_pd(ci);
+    bool periodicity = s->shortcuts & MANDELBROT_PERIODICITY;
+
+    for (int col = 0; col < width; col += 2 * LANES) {
+        mandelbrot_resume_lanes_t a, b;
+        int count_b = width - col - LANES;
+        mandelbrot_resume_load(&a, s, state + col, col, width - col,
+                               x0, dx, ci);
+        mandelbrot_resume_load(&b, s, state + (count_b > 0 ? col + LANES : col),
+                               col + LANES, count_b, x0, dx, ci);
+
+        // checkpoints count from the start of this call, which works as
+        // well for lanes that resume from different iterations
+        int steps = 0, check = PERIOD_FIRST_CHECK;
+        while (_mm256_movemask_pd(_mm256_or_pd(a.active, b.active)) != 0) {
+            mandelbrot_resume_step(&a, ci_v, bailout, limit, s->power,
+                                   periodicity);
+            mandelbrot_resume_step(&b, ci_v, bailout, limit, s->power,
+                                   periodicity);
+            if (periodicity && ++steps == check) {
+                a.sr = a.zr;
+                a.si = a.zi;
+                b.sr = b.zr;
+                b.si = b.zi;
+                check <<= 1;
+            }
+        }
+
+        mandelbrot_resume_store(&a, s->power, width - col, state + col);
+        if (count_b > 0) {
+            mandelbrot_resume_store(&b, s->power, count_b, state + col + LANES);
+        }
+    }
+}
+#endif
+
+void mandelbrot_resume_row(const mandelbrot_settings_t *settings, double ci,
+                           double x0, double dx, int width,
+                           mandelbrot_state_t *state)
+{
+#ifdef HAVE_AVX2_KERNEL
+    if (mandelbrot_uses_avx2()) {
+        mandelbrot_resume_avx2(settings, ci, x0, dx, width, state);
+        return;
+    }
+#endif
+    mandelbrot_resume_scalar(settings, ci, x0, dx, width, state);
+}
+
+static void mandelbrot_add_stats(mandelbrot_stats_t *total,
+                                 const mandelbrot_stats_t *part)
+{
+    __atomic_fetch_add(&total->iterations, part->iterations, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&total->cardioid, part->cardioid, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&total->periodic, part->periodic, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&total->filled, part->filled, __ATOMIC_RELAXED);
+}
+
+static void mandelbrot_rows(int begin, int end, void *ctx)
+{
+    mandelbrot_job_t *job = (mandelbrot_job_t*)ctx;
+    const mandelbrot_settings_t *s = job->settings;
+    mandelbrot_stats_t counts = { 0 };
+
+    for (int row = begin; row < end; row++) {
+        mandelbrot_row(s, s->ymin + row * job->dy, s->xmin, job->dx,
+                       job->width, job->values + (size_t)row * job->width,
+                       NULL, &counts);
+    }
+    mandelbrot_add_stats(job->stats, &counts);
+}
+
+
+/**  MARIANI-SILVER SUBDIVISION  **/
+
+static void mandelbrot_ms_span(const mandelbrot_job_t *job, int row,
+                               int c0, int c1, mandelbrot_stats_t *counts)
+{
+    // pixels c0..c1 of a row, through the vectorized row kernel
+    const mandelbrot_settings_t *s = job->settings;
+    size_t idx = (size_t)row * job->width + c0;
+    if (c1 >= c0) {
+        mandelbrot_row(s, s->ymin + row * job->dy, s->xmin + c0 * job->dx,
+                       job->dx, c1 - c0 + 1, job->values + idx,
+                       job->iters + idx, counts);
+    }
+}
+
+static void mandelbrot_ms_area(const mandelbrot_job_t *job,
+                               int x0, int y0, int x1, int y1,
+                               mandelbrot_stats_t *counts)
+{
+    const mandelbrot_settings_t *s = job->settings;
+
+#ifdef HAVE_AVX2_KERNEL
+    // columns and small leftover rectangles are too narrow for the row
+    // kernel to fill its lanes, so they go through it as point lists
+    if (mandelbrot_uses_avx2()) {
+        double cr[MS_POINTS + 2 * LANES], ci[MS_POINTS + 2 * LANES];
+        double values[MS_POINTS];
+        int iters[MS_POINTS];
+        size_t idx[MS_POINTS];
+        int count = 0;
+        for (int row = y0; row <= y1; row++) {
+            for (int col = x0; col <= x1; col++) {
+                idx[count] = (size_t)row * job->width + col;
+                cr[count] = s->xmin + col * job->dx;
+                ci[count] = s->ymin + row * job->dy;
+                if (++count < MS_POINTS && (row < y1 || col < x1)) {
+                    continue;
+                }
+                for (int i = count; i < count + 2 * LANES; i++) {
+                    cr[i] = cr[0];
+                    ci[i] = ci[0];
+                }
+                mandelbrot_points_avx2(s, cr, ci, count, values, iters, counts);
+                for (int i = 0; i < count; i++) {
+                    job->values[idx[i]] = values[i];
+                    job->iters[idx[i]] = iters[i];
+                }
+                count = 0;
+            }
+        }
+        return;
+    }
+#endif
+    for (int row = y0; row <= y1; row++) {
+        for (int col = x0; col <= x1; col++) {
+            size_t idx = (size_t)row * job->width + col;
+            job->values[idx] = mandelbrot_pixel(s, s->xmin + col * job->dx,
+                                                s->ymin + row * job->dy,
+                                                &job->iters[idx], counts);
+        }
+    }
+}
+
+static bool mandelbrot_ms_uniform(const mandelbrot_job_t *job,
+                                  int x0, int y0, int x1, int y1)
+{
+    const int *top = job->iters + (size_t)y1 * job->width;
+    const int *bottom = job->iters + (size_t)y0 * job->width;
+    int iter = bottom[x0];
+
+    for (int col = x0; col <= x1; col++) {
+        if (bottom[col] != iter || top[col] != iter) {
+            return false;
+        }
+    }
+    for (int row = y0 + 1; row < y1; row++) {
+        const int *line = job->iters + (size_t)row * job->width;
+        if (line[x0] != iter || line[x1] != iter) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void mandelbrot_ms_fill(const mandelbrot_job_t *job,
+                               int x0, int y0, int x1, int y1,
+                               mandelbrot_stats_t *counts)
+{
+    int iter = job->iters[(size_t)y0 * job->width + x0];
+
+    // interior stays 0; a uniform escape band keeps its smooth gradient by
+    // interpolating between the left and right border of each row
+    for (int row = y0 + 1; row < y1; row++) {
+        double *values = job->values + (size_t)row * job->width;
+        int *iters = job->iters + (size_t)row * job->width;
+        double step = (values[x1] - values[x0]) / (x1 - x0);
+        for (int col = x0 + 1; col < x1; col++) {
+            values[col] = iter < 0 ? 0.0 : values[x0] + step * (col - x0);
+            iters[col] = iter;
+        }
+    }
+    counts->filled += (long long)(x1 - x0 - 1) * (y1 - y0 - 1);
+}
+
+static void mandelbrot_ms_rect(const mandelbrot_job_t *job,
+                               int x0, int y0, int x1, int y1,
+                               mandelbrot_stats_t *counts)
+{
+    // the border (rows y0, y1 and columns x0, x1) is already computed
+    if (x1 - x0 < 2 || y1 - y0 < 2) {
+        return;
+    }
+    if (mandelbrot_ms_uniform(job, x0, y0, x1, y1)) {
+        mandelbrot_ms_fill(job, x0, y0, x1, y1, counts);
+        return;
+    }
+    if (x1 - x0 < MS_MIN_SIZE || y1 - y0 < MS_MIN_SIZE) {
+        mandelbrot_ms_area(job, x0 + 1, y0 + 1, x1 - 1, y1 - 1, counts);
+        return;
+    }
+
+    // split across the longer side; the cut becomes the shared border
+    if (x1 - x0 >= y1 - y0) {
+        int xm = (x0 + x1) / 2;
+        mandelbrot_ms_area(job, xm, y0 + 1, xm, y1 - 1, counts);
+        mandelbrot_ms_rect(job, x0, y0, xm, y1, counts);
+        mandelbrot_ms_rect(job, xm, y0, x1, y1, counts);
+    } else {
+        int ym = (y0 + y1) / 2;
+        mandelbrot_ms_span(job, ym, x0 + 1, x1 - 1, counts);
+        mandelbrot_ms_rect(job, x0, y0, x1, ym, counts);
+        mandelbrot_ms_rect(job, x0, ym, x1, y1, counts);
+    }
+}
+
+static void mandelbrot_ms_blocks(int begin, int end, void *ctx)
+{
+    mandelbrot_job_t *job = (mandelbrot_job_t*)ctx;
+    int blocks_x = (job->width + MS_BLOCK - 1) / MS_BLOCK;
+    mandelbrot_stats_t counts = { 0 };
+
+    for (int b = begin; b < end; b++) {
+        int x0 = (b % blocks_x) * MS_BLOCK;
+        int y0 = (b / blocks_x) * MS_BLOCK;
+        int x1 = (x0 + MS_BLOCK < job->width  ? x0 + MS_BLOCK : job->width)  - 1;
+        int y1 = (y0 + MS_BLOCK < job->height ? y0 + MS_BLOCK : job->height) - 1;
+
+        mandelbrot_ms_span(job, y0, x0, x1, &counts);
+        if (y1 > y0) {
+            mandelbrot_ms_span(job, y1, x0, x1, &counts);
+        }
+        mandelbrot_ms_area(job, x0, y0 + 1, x0, y1 - 1, &counts);
+        if (x1 > x0) {
+            mandelbrot_ms_area(job, x1, y0 + 1, x1, y1 - 1, &counts);
+        }
+        mandelbrot_ms_rect(job, x0, y0, x1, y1, &counts);
+    }
+    mandelbrot_add_stats(job->stats, &counts);
+}
+
+void mandelbrot_escape_times(const mandelbrot_settings_t *settings,
+                             int width, int height, double *values,
+                             mandelbrot_stats_t *stats)
+{
+    mandelbrot_stats_t totals = { 0 };
+    mandelbrot_job_t job;
+    job.settings = settings;
+    job.width = width;
+    job.height = height;
+    job.values = values;
+    job.iters = NULL;
+    job.stats = &totals;
+
+    // grid includes both endpoints, like numpy's ogrid with a complex step
+    job.dx = width  > 1 ? (settings->xmax - settings->xmin) / (width - 1)  : 0;
+    job.dy = height > 1 ? (settings->ymax - settings->ymin) / (height - 1) : 0;
+
+    // resolve the CPU check before the workers race to do it
+    mandelbrot_uses_avx2();
+
+    if (settings->shortcuts & MANDELBROT_MARIANI_SILVER) {
+        job.iters = (int*)malloc(sizeof(int) * (size_t)width * height);
+        if (job.iters == NULL) {
+            fprintf(stderr, "Can't allocate memory for Mandelbrot iterations.\n");
+            exit(EXIT_FAILURE);
+        }
+        int blocks = ((width + MS_BLOCK - 1) / MS_BLOCK) *
+                     ((height + MS_BLOCK - 1) / MS_BLOCK);
+        parallel_for(blocks, 1, mandelbrot_ms_blocks, &job);
+        free(job.iters);
+    } else {
+        parallel_for(height, 1, mandelbrot_rows, &job);
+    }
+
+    totals.pixels = (long long)width * height;
+    if (stats != NULL) {
+        *stats = totals;
+    }
+}
+
+void mandelbrot_colorize(const double *values, int width, int height,
+                         rgb_t *pixels)
+{
+    size_t count = (size_t)width * height;
+    rgb_t palette[PALETTE_SIZE];
+
+    // interpolate the palette stops into a lookup table
+    for (int i = 0; i < PALETTE_SIZE; i++) {
+        double pos = (double)i / (PALETTE_SIZE - 1) * (NUM_PALETTE_STOPS - 1);
+        int stop = (int)pos < NUM_PALETTE_STOPS - 1 ? (int)pos
+                                                     : NUM_PALETTE_STOPS - 2;
+        double t = pos - stop;
+        const rgb_t *a = &PALETTE_STOPS[stop], *b = &PALETTE_STOPS[stop + 1];
+        palette[i].red   = (unsigned char)(a->red   + (b->red   - a->red)   * t);
+        palette[i].green = (unsigned char)(a->green + (b->green - a->green) * t);
+        palette[i].blue  = (unsigned char)(a->blue  + (b->blue  - a->blue)  * t);
+    }
+
+    // normalize to the value range of this frame
+    double vmin = INFINITY, vmax = -INFINITY;
+    for (size_t i = 0; i < count; i++) {
+        vmin = values[i] < vmin ? values[i] : vmin;
+        vmax = values[i] > vmax ? values[i] : vmax;
+    }
+    double scale = vmax > vmin ? PALETTE_SIZE / (vmax - vmin) : 0.0;
+
+    for (size_t i = 0; i < count; i++) {
+        int idx = (int)((values[i] - vmin) * scale);
+        pixels[i] = palette[idx < PALETTE_SIZE ? idx : PALETTE_SIZE - 1];
+    }
+}
+
+void mandelbrot_render(const mandelbrot_settings_t *settings,
+                       mandelbrot_stats_t *stats)
+{
+    int width = turtle_get_width();
+    int height = turtle_get_height();
+    double *values = (double*)malloc(sizeof(double) * (size_t)width * height);
+    if (values == NULL) {
+        fprintf(stderr, "Can't allocate memory for Mandelbrot values.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    mandelbrot_escape_times(settings, width, height, values, stats);
+    mandelbrot_colorize(values, width, height, turtle_get_field());
+    free(values);
+
+    // the field was written directly, so tell the preview pyramid
+    turtle_mark_dirty(-width/2, -height/2, width - width/2 - 1,
+                      height - height/2 - 1);
+}
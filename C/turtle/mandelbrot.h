@@ -0,0 +1,139 @@
+#ifndef MANDELBROT_H
+#define MANDELBROT_H
+
+/*
+    mandelbrot.h
+
+    Native escape-time Mandelbrot renderer for the turtle field. Mirrors
+    Python/Mandelbrot.py (same settings, same smooth coloring and palette) but
+    iterates 4 pixels at a time with AVX2 where available and spreads rows
+    over all cores.
+
+    (header info only; see mandelbrot.c for implementation)
+*/
+
+#include "turtle.h"
+
+#include <limits.h>
+
+
+/*
+    Shortcut flags for mandelbrot_settings_t.shortcuts. The cardioid/bulb test
+    (power 2 only) and periodicity detection just stop iterating points that
+    are known to be inside the set, so they don't change the picture.
+    Mariani-Silver fills rectangles whose border has a uniform escape
+    iteration without iterating their inside; it is much faster on large
+    uniform areas but can miss filaments that don't cross a border.
+*/
+#define MANDELBROT_CARDIOID       1     // main cardioid and period-2 bulb test
+#define MANDELBROT_PERIODICITY    2     // Brent-style cycle detection
+#define MANDELBROT_MARIANI_SILVER 4     // rectangle subdivision
+#define MANDELBROT_DEFAULT_SHORTCUTS (MANDELBROT_CARDIOID | MANDELBROT_PERIODICITY)
+
+
+/*
+    View and iteration settings; the same fields and defaults as
+    MandelbrotSettings in Python/Mandelbrot.py. Iteration is z -> z^power + c
+    starting from z = c.
+*/
+typedef struct {
+    double xmin;            // real range of the view
+    double xmax;
+    double ymin;            // imaginary range of the view
+    double ymax;
+    int    max_iter;        // iteration limit
+    double escape_radius;   // bailout radius
+    int    power;           // integer exponent (2 = classic Mandelbrot)
+    int    shortcuts;       // MANDELBROT_* shortcut flags
+} mandelbrot_settings_t;
+
+
+/*
+    Per-frame statistics filled in by the renderer (pass NULL to skip).
+*/
+typedef struct {
+    long long pixels;           // pixels in the frame
+    long long iterations;       // iterations actually run
+    long long cardioid;         // pixels skipped by the cardioid/bulb test
+    long long periodic;         // pixels stopped early by a detected cycle
+    long long filled;           // pixels filled by Mariani-Silver
+} mandelbrot_stats_t;
+
+
+/*
+    Fill settings with the defaults: [-2.0, 0.8] x [-1.4, 1.4], 300 iterations,
+    escape radius 2, power 2, MANDELBROT_DEFAULT_SHORTCUTS.
+*/
+void mandelbrot_default_settings(mandelbrot_settings_t *settings);
+
+
+/*
+    Compute the smooth escape time of every pixel of a width x height grid
+    spanning the view (endpoints included, row 0 at ymin) into values, which
+    must hold width*height doubles. Escaping points get
+    i + 1 - log(log|z|)/log(power); points that never escape get 0.
+*/
+void mandelbrot_escape_times(const mandelbrot_settings_t *settings,
+                             int width, int height, double *values,
+                             mandelbrot_stats_t *stats);
+
+
+/*
+    Resumable iteration state of one pixel. A fresh pixel is all zeroes;
+    iter counts the iterations applied so far, and once a pixel has escaped
+    z holds the first value outside the escape radius. Pixels that a
+    shortcut proved to be inside the set get iter = MANDELBROT_INTERIOR.
+*/
+#define MANDELBROT_INTERIOR INT_MAX
+
+typedef struct {
+    double zr;
+    double zi;
+    double value;       // smooth escape time, once escaped
+    int    iter;
+    int    escaped;
+} mandelbrot_state_t;
+
+
+/*
+    Continue iterating a row of pixels with c = (x0 + col*dx, ci) until each
+    one escapes or reaches settings->max_iter. Pixels that are already done
+    are left alone, so raising max_iter only pays for the new iterations.
+    The cardioid and periodicity shortcuts apply; Mariani-Silver doesn't.
+*/
+void mandelbrot_resume_row(const mandelbrot_settings_t *settings, double ci,
+                           double x0, double dx, int width,
+                           mandelbrot_state_t *state);
+
+
+/*
+    Smooth escape time of a pixel state under the given iteration limit, with
+    the same conventions as mandelbrot_escape_times(); 0 if the pixel hasn't
+    escaped within max_iter iterations.
+*/
+double mandelbrot_state_value(const mandelbrot_state_t *state, int max_iter);
+
+
+/*
+    Map escape times to the viewer's palette, normalized between the smallest
+    and largest value like matplotlib's imshow does.
+*/
+void mandelbrot_colorize(const double *values, int width, int height,
+                         rgb_t *pixels);
+
+
+/*
+    Render the view over the whole turtle field. Export the result with
+    turtle_save_bmp() as usual.
+*/
+void mandelbrot_render(const mandelbrot_settings_t *settings,
+                       mandelbrot_stats_t *stats);
+
+
+/*
+    Returns non-zero if the AVX2 iteration kernel is in use on this machine.
+*/
+int mandelbrot_uses_avx2();
+
+
+#endif
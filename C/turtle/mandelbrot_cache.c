@@ -0,0 +1,385 @@
+/*
+    mandelbrot_cache.c
+
+    Tile cache for interactive Mandelbrot pan and zoom.
+
+    A view with pixel spacing (dx, dy) is placed on the lattice of points
+    (i*dx, j*dy). The spacing is rounded to 32 mantissa bits first, so views
+    that were panned in floating point still land on the same lattice. Tiles
+    are looked up in a chained hash table and kept on an LRU list; a frame
+    acquires all of its tiles up front (evicting old ones as needed), then
+    computes and copies them out in parallel, one tile per task.
+
+    If a frame needs more tiles than fit in the budget it is processed in
+    several passes, so the budget always holds.
+*/
+
+#include "mandelbrot_cache.h"
+#include "parallel.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <math.h>
+
+
+/**  DEFINITIONS  **/
+
+#define TILE_SHIFT 6                            // 64x64 pixels per tile
+#define TILE_SIZE  (1 << TILE_SHIFT)
+#define TILE_PIXELS (TILE_SIZE * TILE_SIZE)
+#define TILE_BYTES (sizeof(mandelbrot_state_t) * TILE_PIXELS)
+#define DEFAULT_CACHE_BYTES ((size_t)256 << 20)
+#define SPACING_BITS 32                         // mantissa bits kept of dx, dy
+#define NO_TILE (-1)
+
+typedef struct {
+    // key
+    long long tx, ty;           // tile position on the lattice
+    double dx, dy;              // lattice spacing, i.e. the zoom level
+    double escape_radius;
+    int    power;
+
+    int    max_iter;            // iteration limit the state is computed to
+    int    prev, next;          // LRU list, most recently used first
+    int    hash_next;           // chain in the hash bucket
+    mandelbrot_state_t *state;  // TILE_PIXELS pixels, row by row
+} cache_tile_t;
+
+typedef struct {
+    const mandelbrot_settings_t *settings;
+    double dx, dy;              // lattice spacing of the frame
+    long long col0, row0;       // lattice position of frame pixel (0, 0)
+    int    width, height;
+    double *values;
+    const int *tiles;           // tile indices of this pass
+} cache_job_t;
+
+cache_tile_t *main_cache_tiles = NULL;  // tile slots, capacity of them
+int    main_cache_capacity = 0;
+int    main_cache_used = 0;             // slots handed out so far
+int   *main_cache_buckets = NULL;       // hash table heads
+int    main_cache_bucket_mask = 0;
+int    main_cache_lru_head = NO_TILE;
+int    main_cache_lru_tail = NO_TILE;
+mandelbrot_cache_stats_t main_cache_stats;
+
+
+/**  CACHE FUNCTIONS  **/
+
+void mandelbrot_cache_cleanup()
+{
+    for (int i = 0; i < main_cache_used; i++) {
+        free(main_cache_tiles[i].state);
+    }
+    free(main_cache_tiles);
+    free(main_cache_buckets);
+    main_cache_tiles = NULL;
+    main_cache_buckets = NULL;
+    main_cache_capacity = 0;
+    main_cache_used = 0;
+    main_cache_lru_head = NO_TILE;
+    main_cache_lru_tail = NO_TILE;
+    memset(&main_cache_stats, 0, sizeof(main_cache_stats));
+}
+
+void mandelbrot_cache_init(size_t max_bytes)
+{
+    mandelbrot_cache_cleanup();
+
+    if (max_bytes == 0) {
+        max_bytes = DEFAULT_CACHE_BYTES;
+    }
+    size_t capacity = max_bytes / TILE_BYTES;
+    main_cache_capacity = capacity < 1 ? 1 :
+                          capacity > INT32_MAX / 4 ? INT32_MAX / 4 :
+                          (int)capacity;
+
+    // at least two buckets per tile keeps the chains short
+    int buckets = 1;
+    while (buckets < 2 * main_cache_capacity) {
+        buckets <<= 1;
+    }
+    main_cache_bucket_mask = buckets - 1;
+
+    main_cache_tiles = (cache_tile_t*)calloc(main_cache_capacity,
+                                             sizeof(cache_tile_t));
+    main_cache_buckets = (int*)malloc(sizeof(int) * buckets);
+    if (main_cache_tiles == NULL || main_cache_buckets == NULL) {
+        fprintf(stderr, "Can't allocate memory for Mandelbrot tile cache.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < buckets; i++) {
+        main_cache_buckets[i] = NO_TILE;
+    }
+}
+
+void mandelbrot_cache_get_stats(mandelbrot_cache_stats_t *stats)
+{
+    *stats = main_cache_stats;
+    stats->tiles = main_cache_used;
+    stats->bytes = (size_t)main_cache_used * TILE_BYTES;
+}
+
+void mandelbrot_cache_reset_stats()
+{
+    memset(&main_cache_stats, 0, sizeof(main_cache_stats));
+}
+
+static double cache_quantize(double spacing)
+{
+    int exp;
+    double mant = frexp(spacing, &exp);
+    return ldexp(nearbyint(ldexp(mant, SPACING_BITS)), exp - SPACING_BITS);
+}
+
+static long long cache_floor_div(long long a, int shift)
+{
+    // arithmetic shift rounds towards negative infinity, unlike division
+    return a >= 0 ? a >> shift : -((-a - 1) >> shift) - 1;
+}
+
+static uint64_t cache_mix(uint64_t h, uint64_t v)
+{
+    // splitmix64 finalizer over the running hash
+    h ^= v + 0x9E3779B97F4A7C15ull + (h << 6) + (h >> 2);
+    h ^= h >> 30;
+    h *= 0xBF58476D1CE4E5B9ull;
+    h ^= h >> 27;
+    h *= 0x94D049BB133111EBull;
+    return h ^ (h >> 31);
+}
+
+static uint64_t cache_bits(double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static int cache_bucket(const cache_tile_t *key)
+{
+    uint64_t h = cache_mix(0, (uint64_t)key->tx);
+    h = cache_mix(h, (uint64_t)key->ty);
+    h = cache_mix(h, cache_bits(key->dx));
+    h = cache_mix(h, cache_bits(key->dy));
+    h = cache_mix(h, cache_bits(key->escape_radius));
+    h = cache_mix(h, (uint64_t)key->power);
+    return (int)(h & (uint64_t)main_cache_bucket_mask);
+}
+
+static int cache_same_key(const cache_tile_t *a, const cache_tile_t *b)
+{
+    return a->tx == b->tx && a->ty == b->ty && a->dx == b->dx &&
+           a->dy == b->dy && a->escape_radius == b->escape_radius &&
+           a->power == b->power;
+}
+
+static void cache_lru_unlink(int idx)
+{
+    cache_tile_t *tile = &main_cache_tiles[idx];
+    if (tile->prev != NO_TILE) {
+        main_cache_tiles[tile->prev].next = tile->next;
+    } else {
+        main_cache_lru_head = tile->next;
+    }
+    if (tile->next != NO_TILE) {
+        main_cache_tiles[tile->next].prev = tile->prev;
+    } else {
+        main_cache_lru_tail = tile->prev;
+    }
+}
+
+static void cache_lru_push_front(int idx)
+{
+    cache_tile_t *tile = &main_cache_tiles[idx];
+    tile->prev = NO_TILE;
+    tile->next = main_cache_lru_head;
+    if (main_cache_lru_head != NO_TILE) {
+        main_cache_tiles[main_cache_lru_head].prev = idx;
+    } else {
+        main_cache_lru_tail = idx;
+    }
+    main_cache_lru_head = idx;
+}
+
+static void cache_hash_remove(int idx)
+{
+    int *link = &main_cache_buckets[cache_bucket(&main_cache_tiles[idx])];
+    while (*link != idx) {
+        link = &main_cache_tiles[*link].hash_next;
+    }
+    *link = main_cache_tiles[idx].hash_next;
+}
+
+static int cache_new_slot()
+{
+    if (main_cache_used < main_cache_capacity) {
+        cache_tile_t *tile = &main_cache_tiles[main_cache_used];
+        tile->state = (mandelbrot_state_t*)malloc(TILE_BYTES);
+        if (tile->state == NULL) {
+            fprintf(stderr, "Can't allocate memory for Mandelbrot tile.\n");
+            exit(EXIT_FAILURE);
+        }
+        return main_cache_used++;
+    }
+
+    // reuse the least recently used tile; tiles acquired for the current
+    // pass were all moved to the front, so this is never one of them
+    int idx = main_cache_lru_tail;
+    cache_lru_unlink(idx);
+    cache_hash_remove(idx);
+    main_cache_stats.evictions++;
+    return idx;
+}
+
+static int cache_acquire(const cache_tile_t *key, int max_iter)
+{
+    int bucket = cache_bucket(key);
+    for (int idx = main_cache_buckets[bucket]; idx != NO_TILE;
+         idx = main_cache_tiles[idx].hash_next) {
+        if (cache_same_key(&main_cache_tiles[idx], key)) {
+            if (main_cache_tiles[idx].max_iter >= max_iter) {
+                main_cache_stats.hits++;
+            } else {
+                main_cache_stats.resumed++;
+            }
+            cache_lru_unlink(idx);
+            cache_lru_push_front(idx);
+            return idx;
+        }
+    }
+
+    main_cache_stats.misses++;
+    int idx = cache_new_slot();
+    cache_tile_t *tile = &main_cache_tiles[idx];
+    mandelbrot_state_t *state = tile->state;
+    *tile = *key;
+    tile->state = state;
+    tile->max_iter = 0;
+    memset(state, 0, TILE_BYTES);
+
+    tile->hash_next = main_cache_buckets[bucket];
+    main_cache_buckets[bucket] = idx;
+    cache_lru_push_front(idx);
+    return idx;
+}
+
+static void cache_tiles(int begin, int end, void *ctx)
+{
+    cache_job_t *job = (cache_job_t*)ctx;
+    const mandelbrot_settings_t *s = job->settings;
+
+    for (int t = begin; t < end; t++) {
+        cache_tile_t *tile = &main_cache_tiles[job->tiles[t]];
+        long long tile_col = tile->tx * TILE_SIZE;
+        long long tile_row = tile->ty * TILE_SIZE;
+
+        // bring the whole tile up to the requested limit
+        if (tile->max_iter < s->max_iter) {
+            double x0 = tile_col * job->dx;
+            for (int r = 0; r < TILE_SIZE; r++) {
+                mandelbrot_resume_row(s, (tile_row + r) * job->dy, x0, job->dx,
+                                      TILE_SIZE, tile->state + r * TILE_SIZE);
+            }
+            tile->max_iter = s->max_iter;
+        }
+
+        // copy out the part of the tile that overlaps the frame
+        int c0 = (int)(tile_col > job->col0 ? tile_col - job->col0 : 0);
+        int c1 = (int)(tile_col + TILE_SIZE - job->col0);
+        int r0 = (int)(tile_row > job->row0 ? tile_row - job->row0 : 0);
+        int r1 = (int)(tile_row + TILE_SIZE - job->row0);
+        c1 = c1 < job->width  ? c1 : job->width;
+        r1 = r1 < job->height ? r1 : job->height;
+
+        for (int row = r0; row < r1; row++) {
+            const mandelbrot_state_t *src = tile->state +
+                (job->row0 + row - tile_row) * TILE_SIZE +
+                (job->col0 - tile_col);
+            double *dst = job->values + (size_t)row * job->width;
+            for (int col = c0; col < c1; col++) {
+                dst[col] = mandelbrot_state_value(&src[col], s->max_iter);
+            }
+        }
+    }
+}
+
+void mandelbrot_cache_escape_times(const mandelbrot_settings_t *settings,
+                                   int width, int height, double *values)
+{
+    if (main_cache_tiles == NULL) {
+        mandelbrot_cache_init(0);
+    }
+
+    cache_job_t job;
+    job.settings = settings;
+    job.width = width;
+    job.height = height;
+    job.values = values;
+
+    // snap the view to the lattice
+    double dx = width  > 1 ? (settings->xmax - settings->xmin) / (width - 1)  : 0;
+    double dy = height > 1 ? (settings->ymax - settings->ymin) / (height - 1) : 0;
+    job.dx = dx > 0 ? cache_quantize(dx) : 1.0;
+    job.dy = dy > 0 ? cache_quantize(dy) : 1.0;
+    job.col0 = llround(settings->xmin / job.dx);
+    job.row0 = llround(settings->ymin / job.dy);
+
+    long long tx0 = cache_floor_div(job.col0, TILE_SHIFT);
+    long long ty0 = cache_floor_div(job.row0, TILE_SHIFT);
+    long long tx1 = cache_floor_div(job.col0 + width - 1, TILE_SHIFT);
+    long long ty1 = cache_floor_div(job.row0 + height - 1, TILE_SHIFT);
+    int tiles_x = (int)(tx1 - tx0 + 1);
+    int count = tiles_x * (int)(ty1 - ty0 + 1);
+
+    int pass_size = count < main_cache_capacity ? count : main_cache_capacity;
+    int *tiles = (int*)malloc(sizeof(int) * pass_size);
+    if (tiles == NULL) {
+        fprintf(stderr, "Can't allocate memory for Mandelbrot tile list.\n");
+        exit(EXIT_FAILURE);
+    }
+    job.tiles = tiles;
+
+    cache_tile_t key;
+    memset(&key, 0, sizeof(key));
+    key.dx = job.dx;
+    key.dy = job.dy;
+    key.escape_radius = settings->escape_radius;
+    key.power = settings->power;
+
+    // resolve the CPU check before the workers race to do it
+    mandelbrot_uses_avx2();
+
+    for (int first = 0; first < count; first += pass_size) {
+        int n = count - first < pass_size ? count - first : pass_size;
+        for (int i = 0; i < n; i++) {
+            key.tx = tx0 + (first + i) % tiles_x;
+            key.ty = ty0 + (first + i) / tiles_x;
+            tiles[i] = cache_acquire(&key, settings->max_iter);
+        }
+        parallel_for(n, 1, cache_tiles, &job);
+    }
+    free(tiles);
+}
+
+void mandelbrot_cache_render(const mandelbrot_settings_t *settings)
+{
+    int width = turtle_get_width();
+    int height = turtle_get_height();
+    double *values = (double*)malloc(sizeof(double) * (size_t)width * height);
+    if (values == NULL) {
+        fprintf(stderr, "Can't allocate memory for Mandelbrot values.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    mandelbrot_cache_escape_times(settings, width, height, values);
+    mandelbrot_colorize(values, width, height, turtle_get_field());
+    free(values);
+
+    // the field was written directly, so tell the preview pyramid
+    turtle_mark_dirty(-width/2, -height/2, width - width/2 - 1,
+                      height - height/2 - 1);
+}
@@ -0,0 +1,73 @@
+#ifndef MANDELBROT_CACHE_H
+#define MANDELBROT_CACHE_H
+
+/*
+    mandelbrot_cache.h
+
+    Tile cache for interactive Mandelbrot pan and zoom. Views are snapped to
+    a lattice of pixels fixed in the complex plane, and the lattice is split
+    into 64x64 tiles that keep their per-pixel iteration state. Panning only
+    computes the tiles that come into view, and raising max_iter resumes the
+    cached tiles instead of starting over. Memory is bounded; the least
+    recently used tiles are evicted first.
+
+    (header info only; see mandelbrot_cache.c for implementation)
+*/
+
+#include "mandelbrot.h"
+
+#include <stddef.h>
+
+
+/*
+    Cache counters, per tile looked up (reset with mandelbrot_cache_reset_stats).
+*/
+typedef struct {
+    long long hits;         // tiles served without iterating
+    long long resumed;      // tiles continued from a lower max_iter
+    long long misses;       // tiles computed from scratch
+    long long evictions;    // tiles dropped to stay within the budget
+    int       tiles;        // tiles currently cached
+    size_t    bytes;        // memory held by the cached tiles
+} mandelbrot_cache_stats_t;
+
+
+/*
+    Set up the cache with the given memory budget in bytes (0 for the
+    default of 256 MB). Drops any previously cached tiles. The cache sets
+    itself up with the default budget on first use if this isn't called.
+*/
+void mandelbrot_cache_init(size_t max_bytes);
+
+
+/*
+    Free all cached tiles.
+*/
+void mandelbrot_cache_cleanup();
+
+
+/*
+    Cached equivalent of mandelbrot_escape_times(). The view is snapped to
+    the nearest lattice pixel (a shift of at most half a pixel) so that views
+    panned by whole pixels share tiles. Tiles are keyed by their lattice
+    position, the pixel spacing (the zoom level), the power and the escape
+    radius; a tile computed with a higher max_iter serves lower ones too.
+*/
+void mandelbrot_cache_escape_times(const mandelbrot_settings_t *settings,
+                                   int width, int height, double *values);
+
+
+/*
+    Cached equivalent of mandelbrot_render().
+*/
+void mandelbrot_cache_render(const mandelbrot_settings_t *settings);
+
+
+/*
+    Read or reset the cache counters.
+*/
+void mandelbrot_cache_get_stats(mandelbrot_cache_stats_t *stats);
+void mandelbrot_cache_reset_stats();
+
+
+#endif
@@ -0,0 +1,90 @@
+/*
+    parallel.c
+
+    Minimal pthread-based parallel loop for the turtle engine.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "parallel.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+
+/**  DEFINITIONS  **/
+
+#define MAX_THREADS 256
+
+typedef struct {
+    parallel_body_t body;   // loop body and its context
+    void *ctx;
+    int   count;            // total iterations
+    int   chunk;            // iterations claimed per grab
+    int   next;             // next unclaimed iteration (atomic)
+} parallel_job_t;
+
+
+/**  PARALLEL FUNCTIONS  **/
+
+int parallel_thread_count()
+{
+    static int thread_count = 0;
+
+    if (thread_count == 0) {
+        const char *env = getenv("TURTLE_THREADS");
+        long n = env != NULL ? atol(env) : sysconf(_SC_NPROCESSORS_ONLN);
+        if (n < 1) {
+            n = 1;
+        } else if (n > MAX_THREADS) {
+            n = MAX_THREADS;
+        }
+        thread_count = (int)n;
+    }
+    return thread_count;
+}
+
+static void *parallel_worker(void *arg)
+{
+    parallel_job_t *job = (parallel_job_t*)arg;
+
+    // keep claiming chunks until the counter runs past the end
+    for (;;) {
+        int begin = __atomic_fetch_add(&job->next, job->chunk,
+                                       __ATOMIC_RELAXED);
+        if (begin >= job->count) {
+            break;
+        }
+        int end = begin + job->chunk;
+        job->body(begin, end < job->count ? end : job->count, job->ctx);
+    }
+    return NULL;
+}
+
+void parallel_for(int count, int chunk, parallel_body_t body, void *ctx)
+{
+    pthread_t threads[MAX_THREADS];
+    parallel_job_t job = { body, ctx, count, chunk < 1 ? 1 : chunk, 0 };
+    int nthreads = parallel_thread_count();
+    int started = 0;
+
+    // don't spin up threads that would never get a chunk
+    if (nthreads > (count + job.chunk - 1) / job.chunk) {
+        nthreads = (count + job.chunk - 1) / job.chunk;
+    }
+
+    // the calling thread works too, so start one fewer helper
+    for (int i = 1; i < nthreads; i++) {
+        if (pthread_create(&threads[started], NULL, parallel_worker,
+                           &job) != 0) {
+            break;
+        }
+        started++;
+    }
+    parallel_worker(&job);
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+/*
+    parallel.h
+
+    Minimal pthread-based parallel loop used by the bulk operations of the
+    turtle engine (preview pyramid, fractal renderers). Iterations are handed
+    out to the worker threads in chunks from a shared counter, so rows that
+    are much more expensive than others balance themselves out.
+
+    (header info only; see parallel.c for implementation)
+*/
+
+
+/*
+    Loop body: process iterations [begin, end). The context pointer is passed
+    through unchanged from parallel_for().
+*/
+typedef void (*parallel_body_t)(int begin, int end, void *ctx);
+
+
+/*
+    Returns the number of worker threads parallel_for() will use. This is the
+    number of online processors unless overridden by the TURTLE_THREADS
+    environment variable.
+*/
+int parallel_thread_count();
+
+
+/*
+    Run body over iterations [0, count) in chunks of the given size spread
+    across all worker threads, and return once every iteration is done. The
+    body must be safe to run concurrently on disjoint ranges.
+*/
+void parallel_for(int count, int chunk, parallel_body_t body, void *ctx);
+
+
+#endif
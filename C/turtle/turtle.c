@@ -27,29 +27,48 @@
 */
 
 #include "turtle.h"
+#include "parallel.h"
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include <math.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 
 /**  DEFINITIONS  **/
 
 #define ABS(X) ((X)>0 ? (X) : (-(X)))
 
 #define PI 3.141592653589793
+#define SQRT_HALF 0.7071067811865476
 
 #define MAX_POLYGON_VERTICES 128
 
-// pixel data (red, green, blue triplet)
+#define AA_FRAC_BITS 16                 // fixed-point bits for Wu lines
+
+#define TILE_SHIFT 6                    // dirty tiles are 64x64 pixels
+#define TILE_SIZE  (1 << TILE_SHIFT)
+
+#define MAX_PYRAMID_LEVELS 32
+
+// one level of the preview pyramid (level 0 is the field itself)
 typedef struct {
-    unsigned char red;
-    unsigned char green;
-    unsigned char blue;
-} rgb_t;
+    rgb_t *pixels;          // image data, bottom-up rows like the field
+    unsigned char *dirty;   // per-tile flags: tile changed since the next
+                            // level down was last updated
+    int    width;           // size in pixels
+    int    height;
+    int    tiles_x;         // size in tiles
+    int    tiles_y;
+} turtle_level_t;
 
 
 /**  GLOBAL TURTLE STATE  **/
@@ -63,6 +82,7 @@ typedef struct {
     rgb_t  fill_color;  // current fill color
     bool   pendown;     // currently drawing?
     bool   filled;      // currently filling?
+    bool   antialias;   // draw movement lines anti-aliased?
 } turtle_t;
 
 turtle_t main_turtle;
@@ -78,6 +98,9 @@ int    main_field_frame_count    = 0;   // current video frame counter
 int    main_field_frame_interval = 10;  // pixels per frame
 int    main_field_pixel_count    = 0;   // total pixels drawn by turtle since
                                         // beginning of video
+turtle_level_t main_pyramid[MAX_PYRAMID_LEVELS]; // preview pyramid levels
+int    main_pyramid_levels = 0;         // levels currently allocated
+
 int    main_turtle_poly_vertex_count = 0;       // polygon vertex count
 double main_turtle_polyX[MAX_POLYGON_VERTICES]; // polygon vertex x-coords
 double main_turtle_polyY[MAX_POLYGON_VERTICES]; // polygon vertex y-coords
@@ -85,11 +108,36 @@ double main_turtle_polyY[MAX_POLYGON_VERTICES]; // polygon vertex y-coords
 
 /**  TURTLE FUNCTIONS  **/
 
+static void turtle_free_pyramid()
+{
+    // level 0 shares the field image, which is owned elsewhere
+    for (int i = 0; i < main_pyramid_levels; i++) {
+        if (i > 0) {
+            free(main_pyramid[i].pixels);
+        }
+        free(main_pyramid[i].dirty);
+    }
+    memset(main_pyramid, 0, sizeof(main_pyramid));
+    main_pyramid_levels = 0;
+}
+
+static bool turtle_alloc_level(turtle_level_t *level, int width, int height)
+{
+    level->width   = width;
+    level->height  = height;
+    level->tiles_x = (width  + TILE_SIZE - 1) >> TILE_SHIFT;
+    level->tiles_y = (height + TILE_SIZE - 1) >> TILE_SHIFT;
+    level->dirty   = (unsigned char*)calloc(
+            (size_t)level->tiles_x * level->tiles_y, 1);
+    return level->dirty != NULL;
+}
+
 void turtle_init(int width, int height)
 {
-    int total_size = sizeof(rgb_t) * width * height;
+    size_t total_size = sizeof(rgb_t) * (size_t)width * (size_t)height;
 
-    // free previous image array if necessary
+    // free previous image array and pyramid if necessary
+    turtle_free_pyramid();
     if (main_turtle_image != NULL) {
         free(main_turtle_image);
         main_turtle_image = NULL;
@@ -107,6 +155,17 @@ void turtle_init(int width, int height)
     main_field_width = width;
     main_field_height = height;
 
+    // the field is the base of the preview pyramid; every tile starts out
+    // dirty so the first update builds the whole pyramid
+    main_pyramid[0].pixels = main_turtle_image;
+    if (!turtle_alloc_level(&main_pyramid[0], width, height)) {
+        fprintf(stderr, "Can't allocate memory for turtle dirty tiles.\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(main_pyramid[0].dirty, 1,
+           (size_t)main_pyramid[0].tiles_x * main_pyramid[0].tiles_y);
+    main_pyramid_levels = 1;
+
     // disable video
     main_field_save_frames = false;
 
@@ -138,6 +197,9 @@ void turtle_reset()
 
     // default fill status is off
     main_turtle.filled = false;
+
+    // default lines are aliased
+    main_turtle.antialias = false;
     main_turtle_poly_vertex_count = 0;
 }
 
@@ -287,7 +349,9 @@ void turtle_goto(int x, int y)
 void turtle_goto_real(double x, double y)
 {
     // draw line if pen is down
-    if (main_turtle.pendown) {
+    if (main_turtle.pendown && main_turtle.antialias) {
+        turtle_draw_line_aa(main_turtle.xpos, main_turtle.ypos, x, y);
+    } else if (main_turtle.pendown) {
         turtle_draw_line((int)round(main_turtle.xpos),
                          (int)round(main_turtle.ypos),
                          (int)round(x),
@@ -335,6 +399,28 @@ void turtle_dot()
 
 static size_t num_pixels_out_of_bounds = 0;
 
+static inline void turtle_mark_tile(int col, int row)
+{
+    // flag the tile containing an image column/row as changed
+    main_pyramid[0].dirty[(row >> TILE_SHIFT) * main_pyramid[0].tiles_x +
+                          (col >> TILE_SHIFT)] = 1;
+}
+
+static inline void turtle_mark_index(int idx)
+{
+    turtle_mark_tile(idx % main_field_width, idx / main_field_width);
+}
+
+static void turtle_track_frame()
+{
+    // track total pixels drawn and emit video frame if a frame interval has
+    // been crossed (and only if video saving is enabled, of course)
+    if (main_field_save_frames &&
+            main_field_pixel_count++ % main_field_frame_interval == 0) {
+        turtle_save_frame();
+    }
+}
+
 void turtle_draw_pixel(int x, int y)
 {
     if (x < (- main_field_width/2)  || x > (main_field_width/2) ||
@@ -356,14 +442,10 @@ void turtle_draw_pixel(int x, int y)
         main_turtle_image[idx].red   = main_turtle.pen_color.red;
         main_turtle_image[idx].green = main_turtle.pen_color.green;
         main_turtle_image[idx].blue  = main_turtle.pen_color.blue;
+        turtle_mark_index(idx);
     }
 
-    // track total pixels drawn and emit video frame if a frame interval has
-    // been crossed (and only if video saving is enabled, of course)
-    if (main_field_save_frames &&
-            main_field_pixel_count++ % main_field_frame_interval == 0) {
-        turtle_save_frame();
-    }
+    turtle_track_frame();
 }
 
 void turtle_fill_pixel(int x, int y)
@@ -377,6 +459,7 @@ void turtle_fill_pixel(int x, int y)
         main_turtle_image[idx].red   = main_turtle.fill_color.red;
         main_turtle_image[idx].green = main_turtle.fill_color.green;
         main_turtle_image[idx].blue  = main_turtle.fill_color.blue;
+        turtle_mark_index(idx);
     }
 }
 
@@ -475,6 +558,227 @@ void turtle_fill_circle_here(int radius)
     turtle_fill_circle(main_turtle.xpos, main_turtle.ypos, radius);
 }
 
+void turtle_set_antialias(int enabled)
+{
+    main_turtle.antialias = (enabled != 0);
+}
+
+static inline void turtle_blend_rgb(rgb_t *p, rgb_t color, int weight)
+{
+    // mix color into the existing pixel; weight is the fraction of the pixel
+    // covered, in 1/256ths (256 replaces the pixel outright)
+    int keep = 256 - weight;
+    p->red   = (p->red   * keep + color.red   * weight) >> 8;
+    p->green = (p->green * keep + color.green * weight) >> 8;
+    p->blue  = (p->blue  * keep + color.blue  * weight) >> 8;
+}
+
+static void turtle_blend_pixel(int x, int y, rgb_t color, int weight)
+{
+    // convert to image row/column; anti-aliased fringes routinely spill over
+    // the edge of the field, so out-of-bounds pixels are silently dropped
+    int col = x + main_field_width/2;
+    int row = y + main_field_height/2;
+    if (weight <= 0 || col < 0 || col >= main_field_width ||
+            row < 0 || row >= main_field_height) {
+        return;
+    }
+    if (weight > 256) {
+        weight = 256;
+    }
+
+    turtle_blend_rgb(&main_turtle_image[(size_t)main_field_width * row + col],
+                     color, weight);
+    turtle_mark_tile(col, row);
+}
+
+static void turtle_plot_aa(bool steep, int major, int minor, int weight)
+{
+    // Wu lines are walked along their major axis; swap back for steep lines
+    if (steep) {
+        turtle_blend_pixel(minor, major, main_turtle.pen_color, weight);
+    } else {
+        turtle_blend_pixel(major, minor, main_turtle.pen_color, weight);
+    }
+    turtle_track_frame();
+}
+
+static void turtle_plot_aa_split(bool steep, int major, double minor,
+                                    double gap)
+{
+    // split a crossing between the two pixels straddling it, scaled by how
+    // much of the pixel the shape actually reaches (line endpoints only)
+    double base = floor(minor);
+    double frac = minor - base;
+    turtle_plot_aa(steep, major, (int)base,
+                   (int)((1.0 - frac) * gap * 256.0 + 0.5));
+    turtle_plot_aa(steep, major, (int)base + 1,
+                   (int)(frac * gap * 256.0 + 0.5));
+}
+
+void turtle_draw_line_aa(double x0, double y0, double x1, double y1)
+{
+    // uses Xiaolin Wu's line algorithm:
+    //   https://en.wikipedia.org/wiki/Xiaolin_Wu%27s_line_algorithm
+    // the minor-axis position is carried in fixed point so that the inner
+    // loop is integer-only, just like the Bresenham version
+
+    bool steep = fabs(y1-y0) > fabs(x1-x0);
+    double temp;
+
+    // walk along the major axis from left to right
+    if (steep) {
+        temp = x0; x0 = y0; y0 = temp;
+        temp = x1; x1 = y1; y1 = temp;
+    }
+    if (x0 > x1) {
+        temp = x0; x0 = x1; x1 = temp;
+        temp = y0; y0 = y1; y1 = temp;
+    }
+
+    double dx = x1 - x0;
+    double gradient = (dx == 0.0) ? 1.0 : (y1 - y0) / dx;
+
+    // first endpoint
+    double xend = floor(x0 + 0.5);
+    double yend = y0 + gradient * (xend - x0);
+    double xgap = 1.0 - ((x0 + 0.5) - floor(x0 + 0.5));
+    int xpxl1 = (int)xend;
+    turtle_plot_aa_split(steep, xpxl1, yend, xgap);
+    double intery = yend + gradient;
+
+    // second endpoint
+    xend = floor(x1 + 0.5);
+    yend = y1 + gradient * (xend - x1);
+    xgap = (x1 + 0.5) - floor(x1 + 0.5);
+    int xpxl2 = (int)xend;
+    if (xpxl2 != xpxl1) {
+        turtle_plot_aa_split(steep, xpxl2, yend, xgap);
+    }
+
+    // interior pixels: the integer part of the fixed-point minor coordinate
+    // selects the pixel pair and the top fraction bits are the coverage
+    int64_t fy   = llround(intery   * (1 << AA_FRAC_BITS));
+    int64_t step = llround(gradient * (1 << AA_FRAC_BITS));
+    int x = xpxl1 + 1;
+
+    // fast path: when the whole run (plus the pixel below/left of the line)
+    // is on the field and no video is being recorded, blend straight into
+    // the image without per-pixel bounds checks
+    int minor_lo = (int)floor(fmin(y0, y1)) - 1;
+    int minor_hi = (int)ceil(fmax(y0, y1)) + 1;
+    int major_half = (steep ? main_field_height : main_field_width) / 2;
+    int minor_half = (steep ? main_field_width : main_field_height) / 2;
+    int major_size = steep ? main_field_height : main_field_width;
+    int minor_size = steep ? main_field_width : main_field_height;
+    if (!main_field_save_frames &&
+            x + major_half >= 0 && xpxl2 - 1 + major_half < major_size &&
+            minor_lo + minor_half >= 0 && minor_hi + minor_half < minor_size) {
+
+        // pixel pairs are vertically adjacent for shallow lines and
+        // horizontally adjacent for steep ones
+        ptrdiff_t major_stride = steep ? main_field_width : 1;
+        ptrdiff_t minor_stride = steep ? 1 : main_field_width;
+        rgb_t *base = main_turtle_image + (x + major_half) * major_stride +
+                      minor_half * minor_stride;
+        rgb_t color = main_turtle.pen_color;
+
+        for (; x < xpxl2; x++) {
+            int y = (int)(fy >> AA_FRAC_BITS);
+            int w = (int)((fy & ((1 << AA_FRAC_BITS) - 1)) >>
+                          (AA_FRAC_BITS - 8));
+            rgb_t *p = base + y * minor_stride;
+            turtle_blend_rgb(p, color, 256 - w);
+            turtle_blend_rgb(p + minor_stride, color, w);
+            if (steep) {
+                turtle_mark_tile(y + minor_half, x + major_half);
+                turtle_mark_tile(y + 1 + minor_half, x + major_half);
+            } else {
+                turtle_mark_tile(x + major_half, y + minor_half);
+                turtle_mark_tile(x + major_half, y + 1 + minor_half);
+            }
+            base += major_stride;
+            fy += step;
+        }
+        return;
+    }
+
+    for (; x < xpxl2; x++) {
+        int y = (int)(fy >> AA_FRAC_BITS);
+        int w = (int)((fy & ((1 << AA_FRAC_BITS) - 1)) >> (AA_FRAC_BITS - 8));
+        turtle_plot_aa(steep, x, y,     256 - w);
+        turtle_plot_aa(steep, x, y + 1, w);
+        fy += step;
+    }
+}
+
+void turtle_draw_circle_aa(double x0, double y0, double radius)
+{
+    // Wu-style circle: the left and right quarters of the outline cross each
+    // row exactly once and the top and bottom quarters cross each column
+    // exactly once, so every crossing is split between the two pixels that
+    // straddle it, just like the interior of a Wu line
+
+    double diag = radius * SQRT_HALF;
+    double r_sq = radius * radius;
+
+    if (main_turtle.filled) {
+        turtle_fill_circle_aa(x0, y0, radius);
+    }
+
+    for (int y = (int)ceil(y0 - diag); y <= (int)floor(y0 + diag); y++) {
+        double dy = y - y0;
+        double span = sqrt(fmax(r_sq - dy * dy, 0.0));
+        turtle_plot_aa_split(true, y, x0 - span, 1.0);
+        turtle_plot_aa_split(true, y, x0 + span, 1.0);
+    }
+    for (int x = (int)floor(x0 - diag) + 1; x < (int)ceil(x0 + diag); x++) {
+        double dx = x - x0;
+        double span = sqrt(fmax(r_sq - dx * dx, 0.0));
+        turtle_plot_aa_split(false, x, y0 - span, 1.0);
+        turtle_plot_aa_split(false, x, y0 + span, 1.0);
+    }
+}
+
+void turtle_fill_circle_aa(double x0, double y0, double radius)
+{
+    // pixels whose centers are at least half a pixel inside the circle are
+    // fully covered and filled directly; only the one-pixel band around the
+    // edge needs a distance and a blend
+
+    double outer = radius + 0.5;
+    double inner = radius - 0.5;
+    int ymin = (int)ceil(y0 - outer);
+    int ymax = (int)floor(y0 + outer);
+
+    for (int y = ymin; y <= ymax; y++) {
+        double dy = y - y0;
+        double dy_sq = dy * dy;
+        double xo = sqrt(fmax(outer * outer - dy_sq, 0.0));
+        int left  = (int)ceil(x0 - xo);
+        int right = (int)floor(x0 + xo);
+        int solid_left  = right + 1;
+        int solid_right = right;
+
+        if (inner > fabs(dy)) {
+            double xi = sqrt(inner * inner - dy_sq);
+            solid_left  = (int)ceil(x0 - xi);
+            solid_right = (int)floor(x0 + xi);
+        }
+
+        for (int x = left; x <= right; x++) {
+            if (x >= solid_left && x <= solid_right) {
+                turtle_blend_pixel(x, y, main_turtle.fill_color, 256);
+                continue;
+            }
+            double dx = x - x0;
+            double cover = outer - sqrt(dx * dx + dy_sq);
+            turtle_blend_pixel(x, y, main_turtle.fill_color,
+                               (int)(fmin(cover, 1.0) * 256.0 + 0.5));
+        }
+    }
+}
+
 void turtle_draw_turtle()
 {
     // We are going to make our own backup of the turtle, since turtle_backup()
@@ -578,6 +882,71 @@ double turtle_get_y()
     return main_turtle.ypos;
 }
 
+rgb_t *turtle_get_field()
+{
+    return main_turtle_image;
+}
+
+int turtle_get_width()
+{
+    return main_field_width;
+}
+
+int turtle_get_height()
+{
+    return main_field_height;
+}
+
+void turtle_draw_pixels(const int *coords, int count)
+{
+    for (int i = 0; i < count; i++) {
+        turtle_draw_pixel(coords[2*i], coords[2*i+1]);
+    }
+}
+
+void turtle_draw_lines(const double *coords, int count)
+{
+    for (int i = 0; i < count; i++) {
+        const double *c = coords + 4*i;
+        if (main_turtle.antialias) {
+            turtle_draw_line_aa(c[0], c[1], c[2], c[3]);
+        } else {
+            turtle_draw_line((int)round(c[0]), (int)round(c[1]),
+                             (int)round(c[2]), (int)round(c[3]));
+        }
+    }
+}
+
+int turtle_run_commands(const double *commands, int count)
+{
+    for (int i = 0; i < count; i++) {
+        const double *c = commands + TURTLE_CMD_WIDTH*i;
+        switch ((int)c[0]) {
+            case TURTLE_CMD_FORWARD:    turtle_forward((int)c[1]);          break;
+            case TURTLE_CMD_BACKWARD:   turtle_backward((int)c[1]);         break;
+            case TURTLE_CMD_TURN_LEFT:  turtle_turn_left(c[1]);             break;
+            case TURTLE_CMD_TURN_RIGHT: turtle_turn_right(c[1]);            break;
+            case TURTLE_CMD_GOTO:       turtle_goto_real(c[1], c[2]);       break;
+            case TURTLE_CMD_HEADING:    turtle_set_heading(c[1]);           break;
+            case TURTLE_CMD_PEN_UP:     turtle_pen_up();                    break;
+            case TURTLE_CMD_PEN_DOWN:   turtle_pen_down();                  break;
+            case TURTLE_CMD_PEN_COLOR:
+                turtle_set_pen_color((int)c[1], (int)c[2], (int)c[3]);
+                break;
+            case TURTLE_CMD_FILL_COLOR:
+                turtle_set_fill_color((int)c[1], (int)c[2], (int)c[3]);
+                break;
+            case TURTLE_CMD_BEGIN_FILL: turtle_begin_fill();                break;
+            case TURTLE_CMD_END_FILL:   turtle_end_fill();                  break;
+            case TURTLE_CMD_DOT:        turtle_dot();                       break;
+            default:
+                fprintf(stderr, "Unknown turtle command: %g\n", c[0]);
+                return i;
+        }
+    }
+    return count;
+}
+
 const int TURTLE_DIGITS[10][20] = {
 
     {0,1,1,0,       // 0
@@ -666,7 +1035,8 @@ void turtle_draw_int(int value)
 
 void turtle_cleanup()
 {
-    // free image array if allocated
+    // free pyramid levels and image array if allocated
+    turtle_free_pyramid();
     if (main_turtle_image != NULL) {
         free(main_turtle_image);
         main_turtle_image = NULL;
@@ -674,6 +1044,170 @@ void turtle_cleanup()
 }
 
 
+/**  PREVIEW PYRAMID  **/
+
+void turtle_mark_dirty(int x0, int y0, int x1, int y1)
+{
+    // clamp the rectangle to the field, then flag every tile it touches
+    int col0 = x0 + main_field_width/2,  col1 = x1 + main_field_width/2;
+    int row0 = y0 + main_field_height/2, row1 = y1 + main_field_height/2;
+    if (col0 < 0) col0 = 0;
+    if (row0 < 0) row0 = 0;
+    if (col1 >= main_field_width)  col1 = main_field_width - 1;
+    if (row1 >= main_field_height) row1 = main_field_height - 1;
+
+    for (int ty = row0 >> TILE_SHIFT; ty <= row1 >> TILE_SHIFT; ty++) {
+        for (int tx = col0 >> TILE_SHIFT; tx <= col1 >> TILE_SHIFT; tx++) {
+            main_pyramid[0].dirty[ty * main_pyramid[0].tiles_x + tx] = 1;
+        }
+    }
+}
+
+static void turtle_build_pyramid()
+{
+    // allocate halved levels until the image is down to a single pixel; the
+    // new levels start clean because level 0 starts out (or already is)
+    // entirely dirty relative to them
+    while (main_pyramid_levels < MAX_PYRAMID_LEVELS) {
+        turtle_level_t *prev = &main_pyramid[main_pyramid_levels - 1];
+        turtle_level_t *next = &main_pyramid[main_pyramid_levels];
+        if (prev->width == 1 && prev->height == 1) {
+            break;
+        }
+        int width  = (prev->width  + 1) / 2;
+        int height = (prev->height + 1) / 2;
+        next->pixels = (rgb_t*)malloc(sizeof(rgb_t) * (size_t)width * height);
+        if (next->pixels == NULL || !turtle_alloc_level(next, width, height)) {
+            fprintf(stderr, "Can't allocate memory for turtle pyramid.\n");
+            exit(EXIT_FAILURE);
+        }
+        main_pyramid_levels++;
+    }
+
+    // a freshly allocated level has no content yet, so everything above it
+    // has to be pushed down again
+    for (int i = 0; i < main_pyramid_levels - 1; i++) {
+        memset(main_pyramid[i].dirty, 1,
+               (size_t)main_pyramid[i].tiles_x * main_pyramid[i].tiles_y);
+    }
+}
+
+static void turtle_downsample_row(const unsigned char *row0,
+                                  const unsigned char *row1,
+                                  unsigned char *out, int src_pixels)
+{
+    // 2x2 box filter over one pair of source rows: sum the rows vertically
+    // into 16-bit lanes (16 channels per step with SSE2), then fold each
+    // horizontal pixel pair and divide by four with rounding
+    unsigned short sum[TILE_SIZE * 3];
+    int n = src_pixels * 3;
+    int i = 0;
+
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(row0 + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(row1 + i));
+        __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero),
+                                   _mm_unpacklo_epi8(b, zero));
+        __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero),
+                                   _mm_unpackhi_epi8(b, zero));
+        _mm_storeu_si128((__m128i*)(sum + i), lo);
+        _mm_storeu_si128((__m128i*)(sum + i + 8), hi);
+    }
+#endif
+    for (; i < n; i++) {
+        sum[i] = row0[i] + row1[i];
+    }
+
+    // an odd trailing pixel is paired with itself
+    for (int j = 0; j < (src_pixels + 1) / 2; j++) {
+        const unsigned short *a = sum + 6 * j;
+        const unsigned short *b = (2 * j + 1 < src_pixels) ? a + 3 : a;
+        out[3*j]   = (a[0] + b[0] + 2) >> 2;
+        out[3*j+1] = (a[1] + b[1] + 2) >> 2;
+        out[3*j+2] = (a[2] + b[2] + 2) >> 2;
+    }
+}
+
+typedef struct {
+    const turtle_level_t *src;
+    turtle_level_t *dst;
+} turtle_pyramid_job_t;
+
+static void turtle_downsample_band(int ty_begin, int ty_end, void *ctx)
+{
+    // every tile row of the source maps to its own band of destination rows,
+    // so bands can be filtered concurrently without any locking
+    turtle_pyramid_job_t *job = (turtle_pyramid_job_t*)ctx;
+    const turtle_level_t *src = job->src;
+    turtle_level_t *dst = job->dst;
+
+    for (int ty = ty_begin; ty < ty_end; ty++) {
+        for (int tx = 0; tx < src->tiles_x; tx++) {
+            if (!src->dirty[ty * src->tiles_x + tx]) {
+                continue;
+            }
+            int col0 = tx << TILE_SHIFT;
+            int col1 = col0 + TILE_SIZE < src->width ? col0 + TILE_SIZE
+                                                     : src->width;
+            int row_end = ((ty << TILE_SHIFT) + TILE_SIZE) / 2;
+            if (row_end > dst->height) {
+                row_end = dst->height;
+            }
+            for (int row = (ty << TILE_SHIFT) / 2; row < row_end; row++) {
+                int r0 = 2 * row;
+                int r1 = r0 + 1 < src->height ? r0 + 1 : r0;
+                turtle_downsample_row(
+                    (const unsigned char*)(src->pixels +
+                                           (size_t)r0 * src->width + col0),
+                    (const unsigned char*)(src->pixels +
+                                           (size_t)r1 * src->width + col0),
+                    (unsigned char*)(dst->pixels +
+                                     (size_t)row * dst->width + col0 / 2),
+                    col1 - col0);
+            }
+        }
+    }
+}
+
+void turtle_update_pyramid()
+{
+    if (main_pyramid_levels <= 1) {
+        turtle_build_pyramid();
+    }
+
+    for (int i = 0; i + 1 < main_pyramid_levels; i++) {
+        turtle_level_t *src = &main_pyramid[i];
+        turtle_level_t *dst = &main_pyramid[i + 1];
+        turtle_pyramid_job_t job = { src, dst };
+
+        // filter the dirty tiles in parallel row bands
+        parallel_for(src->tiles_y, 1, turtle_downsample_band, &job);
+
+        // then hand the dirtiness down one level (a 64x64 tile shrinks to a
+        // quarter of a tile on the next level) and clear this one
+        for (int ty = 0; ty < src->tiles_y; ty++) {
+            for (int tx = 0; tx < src->tiles_x; tx++) {
+                unsigned char *flag = &src->dirty[ty * src->tiles_x + tx];
+                if (*flag) {
+                    dst->dirty[(ty >> 1) * dst->tiles_x + (tx >> 1)] = 1;
+                    *flag = 0;
+                }
+            }
+        }
+    }
+}
+
+int turtle_pyramid_levels()
+{
+    if (main_pyramid_levels <= 1) {
+        turtle_build_pyramid();
+    }
+    return main_pyramid_levels;
+}
+
+
 // the rest of this file is based on GPL'ed code from:
 // http://cpansearch.perl.org/src/DHUNT/PDL-Planet-0.12/libimage/bmp.c
 
@@ -698,21 +1232,21 @@ struct BMPHeader
                           // are important
 };
 
-void turtle_save_bmp(const char *filename)
+static void turtle_write_bmp(const char *filename, const rgb_t *pixels,
+                             int width, int height)
 {
-    int i, j, ipos;
+    int i, j;
+    size_t ipos;
     int bytesPerLine;
     unsigned char *line;
     FILE *file;
     struct BMPHeader bmph;
-    int width = main_field_width;
-    int height = main_field_height;
-    char *rgb = (char*)main_turtle_image;
+    const char *rgb = (const char*)pixels;
 
     // the length of each line must be a multiple of 4 bytes
     bytesPerLine = (3 * (width + 1) / 4) * 4;
 
-    strncpy(bmph.bfType, "BM", 2);
+    memcpy(bmph.bfType, "BM", 2);
     bmph.bfOffBits = 54;
     bmph.bfSize = bmph.bfOffBits + bytesPerLine * height;
     bmph.bfReserved = 0;
@@ -759,7 +1293,7 @@ void turtle_save_bmp(const char *filename)
 
     for (i = 0; i < height; i++) {
         for (j = 0; j < width; j++) {
-            ipos = 3 * (width * i + j);
+            ipos = 3 * ((size_t)width * i + j);
             line[3*j] = rgb[ipos + 2];
             line[3*j+1] = rgb[ipos + 1];
             line[3*j+2] = rgb[ipos];
@@ -769,4 +1303,24 @@ void turtle_save_bmp(const char *filename)
 
     free(line);
     fclose(file);
-}
\ No newline at end of file
+}
+
+void turtle_save_bmp(const char *filename)
+{
+    turtle_write_bmp(filename, main_turtle_image,
+                     main_field_width, main_field_height);
+}
+
+void turtle_save_bmp_level(const char *filename, int level)
+{
+    // bring the pyramid up to date first; only dirty tiles are refiltered
+    turtle_update_pyramid();
+
+    if (level < 0 || level >= main_pyramid_levels) {
+        fprintf(stderr, "Invalid pyramid level: %d (field has %d levels)\n",
+                level, main_pyramid_levels);
+        return;
+    }
+    turtle_write_bmp(filename, main_pyramid[level].pixels,
+                     main_pyramid[level].width, main_pyramid[level].height);
+}
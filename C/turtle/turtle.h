@@ -25,6 +25,14 @@
 */
 
 
+// pixel data (red, green, blue triplet)
+typedef struct {
+    unsigned char red;
+    unsigned char green;
+    unsigned char blue;
+} rgb_t;
+
+
 /*
     Initialize the 2d field that the turtle moves on. This must be called
     before any of the other functions in this library.
@@ -184,6 +192,37 @@ void turtle_draw_circle(int x, int y, int radius);
 void turtle_fill_circle(int x0, int y0, int radius);
 
 
+/*
+    Enable (non-zero) or disable (zero) anti-aliasing for the lines drawn by
+    turtle movement (forward, backward, goto). Disabled by default.
+*/
+void turtle_set_antialias(int enabled);
+
+
+/*
+    Draw an anti-aliased straight line between the given real-numbered
+    coordinates using the current draw color, regardless of current turtle
+    location or pen status. Edge pixels are blended onto the field in
+    proportion to how much of them the line covers.
+*/
+void turtle_draw_line_aa(double x0, double y0, double x1, double y1);
+
+
+/*
+    Draw an anti-aliased circle outline at the given real-numbered coordinates
+    with the given radius, regardless of current turtle location or pen status.
+*/
+void turtle_draw_circle_aa(double x, double y, double radius);
+
+
+/*
+    Fill an anti-aliased circle at the given real-numbered coordinates with the
+    given radius using the current fill color, regardless of current turtle
+    location or pen status.
+*/
+void turtle_fill_circle_aa(double x, double y, double radius);
+
+
 /*
     Draw a turtle at the current pen location.
  */
@@ -196,6 +235,37 @@ void turtle_draw_turtle();
 void turtle_save_bmp(const char *filename);
 
 
+/*
+    Save one level of the preview pyramid to a .bmp file. Level 0 is the full
+    field and every following level halves both dimensions (rounding up) down
+    to a single pixel. The pyramid is brought up to date first.
+*/
+void turtle_save_bmp_level(const char *filename, int level);
+
+
+/*
+    Bring the preview pyramid up to date with the field. The first call builds
+    every level; after that only the 64x64 tiles changed since the last update
+    are filtered down again.
+*/
+void turtle_update_pyramid();
+
+
+/*
+    Returns the number of preview pyramid levels for the current field
+    (including level 0, the field itself).
+*/
+int turtle_pyramid_levels();
+
+
+/*
+    Flag the rectangle between the given corners (inclusive) as changed so the
+    next pyramid update refilters it. Drawing functions do this on their own;
+    call it after writing pixels directly through turtle_get_field().
+*/
+void turtle_mark_dirty(int x0, int y0, int x1, int y1);
+
+
 /*
     Enable video output. When enabled, periodic frame bitmaps will be saved
     with sequentially-ordered filenames matching the following pattern:
@@ -237,6 +307,72 @@ double turtle_get_y();
 void turtle_draw_int(int value);
 
 
+/*
+    Returns the field width in pixels.
+*/
+int turtle_get_width();
+
+
+/*
+    Returns the field height in pixels.
+*/
+int turtle_get_height();
+
+
+/*
+    Draw count 1-pixel dots using the current draw color. The coordinates are
+    packed as x0,y0,x1,y1,... (2*count ints).
+*/
+void turtle_draw_pixels(const int *coords, int count);
+
+
+/*
+    Draw count straight lines, regardless of current turtle location or pen
+    status. The endpoints are packed as x0,y0,x1,y1 per line (4*count
+    doubles); lines are anti-aliased if turtle_set_antialias() is enabled.
+*/
+void turtle_draw_lines(const double *coords, int count);
+
+
+/*
+    Turtle command opcodes for turtle_run_commands(). Each command is
+    TURTLE_CMD_WIDTH doubles: the opcode followed by up to three arguments
+    (unused arguments are ignored).
+*/
+#define TURTLE_CMD_WIDTH      4
+
+#define TURTLE_CMD_FORWARD    0     // pixels
+#define TURTLE_CMD_BACKWARD   1     // pixels
+#define TURTLE_CMD_TURN_LEFT  2     // angle
+#define TURTLE_CMD_TURN_RIGHT 3     // angle
+#define TURTLE_CMD_GOTO       4     // x, y
+#define TURTLE_CMD_HEADING    5     // angle
+#define TURTLE_CMD_PEN_UP     6
+#define TURTLE_CMD_PEN_DOWN   7
+#define TURTLE_CMD_PEN_COLOR  8     // red, green, blue
+#define TURTLE_CMD_FILL_COLOR 9     // red, green, blue
+#define TURTLE_CMD_BEGIN_FILL 10
+#define TURTLE_CMD_END_FILL   11
+#define TURTLE_CMD_DOT        12
+
+
+/*
+    Run count turtle commands in order (TURTLE_CMD_WIDTH*count doubles, see
+    above). This lets callers in other languages drive the turtle with one
+    call per batch instead of one per step. Returns the number of commands
+    run, which is less than count if an unknown opcode was found.
+*/
+int turtle_run_commands(const double *commands, int count);
+
+
+/*
+    Returns a pointer to the raw field pixels. Rows are stored bottom-up (row 0
+    is y = -height/2) and each row holds width pixels. The pointer becomes
+    invalid after turtle_init() or turtle_cleanup().
+*/
+rgb_t *turtle_get_field();
+
+
 /*
     Clean up any memory used by the turtle graphics system. Call this at the
     end of the program to ensure there are no memory leaks.
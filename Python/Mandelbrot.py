@@ -5,9 +5,19 @@ import matplotlib.pyplot as plt
 from matplotlib.widgets import Slider, Button
 import threading
 import time
+from decimal import Decimal, getcontext
 from matplotlib.animation import FuncAnimation
 from matplotlib.patches import Circle, Rectangle
 
+try:
+    # native engine (make -C C/turtle lib); enables perturbation deep zoom
+    import cturtle
+except OSError:
+    cturtle = None
+
+# enough digits for the center of a 1e-300 wide view
+getcontext().prec = 350
+
 class MandelbrotSettings:
     def __init__(self):
         self.xmin = -2.0
@@ -46,6 +56,14 @@ class MandelbrotViewer:
         self.zoom_rect = None
         self.zoom_factor = 0.4  # Changed for smoother zoom
         self.min_size = 1e-13  # Prevent infinite zoom
+        self.deep_min_size = 1e-300  # Floor of the perturbation deep zoom
+        self.deep_zoom_below = 1e-10  # Switch to deep zoom below this width
+        # The view is tracked as an exact center plus float extents, since
+        # xmin/xmax stop being distinguishable as doubles in deep zoom
+        self.center_re = Decimal(self.settings.xmin + self.settings.xmax) / 2
+        self.center_im = Decimal(self.settings.ymin + self.settings.ymax) / 2
+        self.x_range = self.settings.xmax - self.settings.xmin
+        self.y_range = self.settings.ymax - self.settings.ymin
         self.setup_layout()
         self.setup_controls()
         self.setup_zoom_events()
@@ -149,31 +167,64 @@ class MandelbrotViewer:
         finally:
             self.stop_loading_animation()
 
+    def deep_zoom_available(self):
+        return cturtle is not None and self.settings.power == 2
+
+    def in_deep_zoom(self):
+        # In deep zoom the axes show offsets from the exact center
+        return self.deep_zoom_available() and self.x_range < self.deep_zoom_below
+
     def draw(self):
-        mandel = mandelbrot(self.settings.resolution[1], 
-                          self.settings.resolution[0], 
-                          self.settings)
+        if self.in_deep_zoom():
+            mandel, stats = cturtle.deepzoom(self.settings.resolution[1],
+                                             self.settings.resolution[0],
+                                             self.center_re, self.center_im,
+                                             self.x_range, self.y_range,
+                                             self.settings.max_iter,
+                                             self.settings.escape_radius)
+            extent = [-self.x_range/2, self.x_range/2,
+                      -self.y_range/2, self.y_range/2]
+        elif cturtle is not None:
+            # tile cache: pans and higher max_iter only compute what's new
+            mandel = cturtle.mandelbrot_cached(self.settings.resolution[1],
+                                               self.settings.resolution[0],
+                                               self.settings)
+            extent = [self.settings.xmin, self.settings.xmax, 
+                      self.settings.ymin, self.settings.ymax]
+        else:
+            mandel = mandelbrot(self.settings.resolution[1], 
+                              self.settings.resolution[0], 
+                              self.settings)
+            extent = [self.settings.xmin, self.settings.xmax, 
+                      self.settings.ymin, self.settings.ymax]
         
         colors = ['#000764', '#206BCB', '#EDFFFF', '#FFB847', '#A40000']
         custom_cmap = matplotlib.colors.LinearSegmentedColormap.from_list('custom', colors)
         
         self.ax.clear()
-        self.im = self.ax.imshow(mandel, cmap=custom_cmap,
-                                extent=[self.settings.xmin, self.settings.xmax, 
-                                       self.settings.ymin, self.settings.ymax])
+        self.im = self.ax.imshow(mandel, cmap=custom_cmap, extent=extent)
         if hasattr(self, 'colorbar'):
             self.colorbar.remove()
         self.colorbar = self.fig.colorbar(self.im, label='Escape time')
         
         self.ax.set_title(f'Mandelbrot-Menge (Power: {self.settings.power}, Iter: {self.settings.max_iter})')
-        self.ax.set_xlabel('Re(c)')
-        self.ax.set_ylabel('Im(c)')
+        if self.in_deep_zoom():
+            self.ax.set_xlabel(f'Re(c) - {self.center_re:.{self.center_digits()}f}')
+            self.ax.set_ylabel(f'Im(c) - {self.center_im:.{self.center_digits()}f}')
+        else:
+            self.ax.set_xlabel('Re(c)')
+            self.ax.set_ylabel('Im(c)')
         self.fig.canvas.draw_idle()
 
+    def center_digits(self):
+        # Digits of the center that still matter at the current zoom
+        return max(2, int(-np.log10(self.x_range)) + 3)
+
     def setup_zoom_events(self):
         self.fig.canvas.mpl_connect('button_press_event', self.on_mouse_click)
         self.fig.canvas.mpl_connect('motion_notify_event', self.on_mouse_move)
         self.fig.canvas.mpl_connect('axes_leave_event', self.on_mouse_leave)
+        self.fig.canvas.mpl_connect('key_press_event', self.on_key_press)
 
     def update_zoom_preview(self, x, y):
         if self.zoom_rect:
@@ -183,8 +234,8 @@ class MandelbrotViewer:
         if x is None or y is None or not hasattr(self, 'ax'):
             return
 
-        x_range = (self.settings.xmax - self.settings.xmin) * self.zoom_factor
-        y_range = (self.settings.ymax - self.settings.ymin) * self.zoom_factor
+        x_range = self.x_range * self.zoom_factor
+        y_range = self.y_range * self.zoom_factor
 
         self.zoom_rect = Rectangle(
             (x - x_range/2, y - y_range/2),
@@ -209,6 +260,31 @@ class MandelbrotViewer:
             self.zoom_rect = None
             self.fig.canvas.draw_idle()
 
+    def on_key_press(self, event):
+        # Arrow keys pan by an eighth of the view, in whole pixels so the
+        # tile cache can reuse everything that stays visible
+        steps = {'left': (-1, 0), 'right': (1, 0), 'up': (0, 1), 'down': (0, -1)}
+        if event.key not in steps:
+            return
+        width, height = self.settings.resolution
+        cols = steps[event.key][0] * (width // 8)
+        rows = steps[event.key][1] * (height // 8)
+        dx = self.x_range / (width - 1)
+        dy = self.y_range / (height - 1)
+
+        self.center_re += Decimal(cols * dx)
+        self.center_im += Decimal(rows * dy)
+        self.settings.xmin += cols * dx
+        self.settings.xmax += cols * dx
+        self.settings.ymin += rows * dy
+        self.settings.ymax += rows * dy
+
+        self.start_loading_animation()
+        try:
+            self.draw()
+        finally:
+            self.stop_loading_animation()
+
     def on_mouse_click(self, event):
         if event.inaxes != self.ax:
             return
@@ -219,8 +295,8 @@ class MandelbrotViewer:
             self.zoom_rect = None
 
         x, y = event.xdata, event.ydata
-        x_range = self.settings.xmax - self.settings.xmin
-        y_range = self.settings.ymax - self.settings.ymin
+        x_range = self.x_range
+        y_range = self.y_range
 
         # Calculate zoom factor
         if event.button == 1:  # Left click - zoom in
@@ -238,10 +314,22 @@ class MandelbrotViewer:
         new_y_range = y_range * factor
 
         # Check minimum zoom size
-        if new_x_range < self.min_size or new_y_range < self.min_size:
+        min_size = self.deep_min_size if self.deep_zoom_available() else self.min_size
+        if new_x_range < min_size or new_y_range < min_size:
             return
 
+        # Move the exact center to the clicked point
+        if self.in_deep_zoom():
+            self.center_re += Decimal(x)
+            self.center_im += Decimal(y)
+        else:
+            self.center_re = Decimal(x)
+            self.center_im = Decimal(y)
+        self.x_range = new_x_range
+        self.y_range = new_y_range
+
         # Update boundaries with centered zoom
+        x, y = float(self.center_re), float(self.center_im)
         self.settings.xmin = x - new_x_range/2
         self.settings.xmax = x + new_x_range/2
         self.settings.ymin = y - new_y_range/2
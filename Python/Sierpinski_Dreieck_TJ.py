@@ -1 +1,61 @@
-#placeholder
\ No newline at end of file
+import matplotlib
+matplotlib.use('TkAgg')
+import numpy as np
+import matplotlib.pyplot as plt
+import sys
+import time
+
+try:
+    # native engine (make -C C/turtle lib); billions of points in seconds
+    import cturtle
+except OSError:
+    cturtle = None
+
+# corners of the triangle; every step jumps halfway towards a random one
+CORNERS = np.array([[0.0, 0.0], [1.0, 0.0], [0.5, np.sqrt(3.0) / 2.0]])
+XMIN, XMAX = -0.05, 1.05
+YMIN, YMAX = -0.05, np.sqrt(3.0) / 2.0 + 0.05
+
+def chaos_game(h, w, points, walkers=10000, seed=1):
+    # NumPy reference: many walkers step together, hits are binned per pixel
+    rng = np.random.default_rng(seed)
+    pos = rng.random((walkers, 2))
+    density = np.zeros(h * w, dtype=np.int64)
+    for _ in range(20):
+        pos = (pos + CORNERS[rng.integers(0, 3, walkers)]) / 2.0
+    for _ in range(max(1, points // walkers)):
+        pos = (pos + CORNERS[rng.integers(0, 3, walkers)]) / 2.0
+        px = ((pos[:, 0] - XMIN) / (XMAX - XMIN) * w).astype(np.int64)
+        py = ((pos[:, 1] - YMIN) / (YMAX - YMIN) * h).astype(np.int64)
+        density += np.bincount(py * w + px, minlength=h * w)
+    return density.reshape(h, w)
+
+def native_chaos_game(h, w, points, seed=1):
+    system = cturtle.ifs([(0.5, 0.0, 0.0, 0.5, x / 2.0, y / 2.0, 1.0)
+                          for x, y in CORNERS], XMIN, XMAX, YMIN, YMAX)
+    density, _ = cturtle.ifs_density(h, w, system, points, seed)
+    return density
+
+def main():
+    w, h = 1200, 1000
+    points = int(float(sys.argv[1])) if len(sys.argv) > 1 else None
+
+    start = time.time()
+    if cturtle is not None:
+        points = points or 1_000_000_000
+        density = native_chaos_game(h, w, points)
+    else:
+        points = points or 10_000_000
+        density = chaos_game(h, w, points)
+    elapsed = time.time() - start
+    print(f"{points:,} Punkte in {elapsed:.2f} s")
+
+    fig, ax = plt.subplots(figsize=(10, 8))
+    ax.imshow(np.log1p(density), cmap='magma', origin='lower',
+              extent=[XMIN, XMAX, YMIN, YMAX])
+    ax.set_title(f"Sierpinski-Dreieck (Chaosspiel, {points:,} Punkte)")
+    ax.set_axis_off()
+    plt.show()
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,38 @@
+"""
+Compares the NumPy Mandelbrot in Mandelbrot.py with the native renderer in
+C/turtle (through cturtle) on the viewer's default 1920x1080 frame.
+
+    make -C C/turtle lib
+    python3 Python/bench_mandelbrot.py
+"""
+import time
+
+import numpy as np
+
+import cturtle
+from Mandelbrot import MandelbrotSettings, mandelbrot
+
+
+def best_of(runs, func, *args):
+    best, result = float('inf'), None
+    for _ in range(runs):
+        start = time.perf_counter()
+        result = func(*args)
+        best = min(best, time.perf_counter() - start)
+    return best, result
+
+
+if __name__ == '__main__':
+    settings = MandelbrotSettings()
+    width, height = settings.resolution
+
+    t_python, expected = best_of(1, mandelbrot, height, width, settings)
+    t_native, actual = best_of(3, cturtle.mandelbrot, height, width, settings)
+
+    # both escape-time arrays should agree up to floating-point noise
+    # (the native kernel uses FMA)
+    err = np.max(np.abs(expected - actual))
+    print(f'{width}x{height}, {settings.max_iter} iterations')
+    print(f'  NumPy   {t_python * 1000:9.1f} ms')
+    print(f'  native  {t_native * 1000:9.1f} ms  ({t_python / t_native:.0f}x)')
+    print(f'  max |difference| {err:.3g}')
@@ -0,0 +1,426 @@
+"""
+Thin ctypes binding for the native turtle engine in C/turtle.
+
+Build the shared library first:
+
+    make -C C/turtle lib
+
+The library is looked up next to this repo layout (../C/turtle/libturtle.so)
+unless the LIBTURTLE environment variable points somewhere else.
+
+Besides the one-call-per-step turtle API this exposes batched entry points
+that take NumPy arrays, so a whole drawing crosses the FFI boundary once:
+
+    import numpy as np
+    import cturtle as t
+
+    t.init(800, 600)
+    t.run([[t.CMD_FORWARD, 100, 0, 0], [t.CMD_TURN_LEFT, 90, 0, 0]] * 4)
+    t.draw_lines(np.array([[-100, -100, 100, 100]], dtype=np.float64))
+    img = t.field()          # zero-copy (height, width, 3) view, top row first
+    t.save_bmp('out.bmp')
+"""
+import ctypes
+import os
+from decimal import Decimal
+
+import numpy as np
+
+_LIB_PATH = os.environ.get(
+    'LIBTURTLE',
+    os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                 '..', 'C', 'turtle', 'libturtle.so'))
+
+_lib = ctypes.CDLL(_LIB_PATH)
+
+# command opcodes, must match TURTLE_CMD_* in turtle.h
+CMD_WIDTH = 4
+CMD_FORWARD = 0
+CMD_BACKWARD = 1
+CMD_TURN_LEFT = 2
+CMD_TURN_RIGHT = 3
+CMD_GOTO = 4
+CMD_HEADING = 5
+CMD_PEN_UP = 6
+CMD_PEN_DOWN = 7
+CMD_PEN_COLOR = 8
+CMD_FILL_COLOR = 9
+CMD_BEGIN_FILL = 10
+CMD_END_FILL = 11
+CMD_DOT = 12
+
+_int = ctypes.c_int
+_double = ctypes.c_double
+_str = ctypes.c_char_p
+_int_p = ctypes.POINTER(ctypes.c_int)
+_double_p = ctypes.POINTER(ctypes.c_double)
+
+
+def _declare(name, restype, *argtypes):
+    func = getattr(_lib, name)
+    func.restype = restype
+    func.argtypes = list(argtypes)
+    return func
+
+
+init = _declare('turtle_init', None, _int, _int)
+reset = _declare('turtle_reset', None)
+backup = _declare('turtle_backup', None)
+restore = _declare('turtle_restore', None)
+forward = _declare('turtle_forward', None, _int)
+backward = _declare('turtle_backward', None, _int)
+turn_left = _declare('turtle_turn_left', None, _double)
+turn_right = _declare('turtle_turn_right', None, _double)
+pen_up = _declare('turtle_pen_up', None)
+pen_down = _declare('turtle_pen_down', None)
+begin_fill = _declare('turtle_begin_fill', None)
+end_fill = _declare('turtle_end_fill', None)
+goto = _declare('turtle_goto_real', None, _double, _double)
+set_heading = _declare('turtle_set_heading', None, _double)
+set_pen_color = _declare('turtle_set_pen_color', None, _int, _int, _int)
+set_fill_color = _declare('turtle_set_fill_color', None, _int, _int, _int)
+set_antialias = _declare('turtle_set_antialias', None, _int)
+dot = _declare('turtle_dot', None)
+draw_pixel = _declare('turtle_draw_pixel', None, _int, _int)
+fill_pixel = _declare('turtle_fill_pixel', None, _int, _int)
+draw_line = _declare('turtle_draw_line', None, _int, _int, _int, _int)
+draw_line_aa = _declare('turtle_draw_line_aa', None,
+                        _double, _double, _double, _double)
+draw_circle = _declare('turtle_draw_circle', None, _int, _int, _int)
+draw_circle_aa = _declare('turtle_draw_circle_aa', None,
+                          _double, _double, _double)
+fill_circle = _declare('turtle_fill_circle', None, _int, _int, _int)
+fill_circle_aa = _declare('turtle_fill_circle_aa', None,
+                          _double, _double, _double)
+draw_turtle = _declare('turtle_draw_turtle', None)
+draw_int = _declare('turtle_draw_int', None, _int)
+get_x = _declare('turtle_get_x', _double)
+get_y = _declare('turtle_get_y', _double)
+get_width = _declare('turtle_get_width', _int)
+get_height = _declare('turtle_get_height', _int)
+update_pyramid = _declare('turtle_update_pyramid', None)
+pyramid_levels = _declare('turtle_pyramid_levels', _int)
+mark_dirty = _declare('turtle_mark_dirty', None, _int, _int, _int, _int)
+begin_video = _declare('turtle_begin_video', None, _int)
+save_frame = _declare('turtle_save_frame', None)
+end_video = _declare('turtle_end_video', None)
+cleanup = _declare('turtle_cleanup', None)
+
+_save_bmp = _declare('turtle_save_bmp', None, _str)
+_save_bmp_level = _declare('turtle_save_bmp_level', None, _str, _int)
+_draw_pixels = _declare('turtle_draw_pixels', None, _int_p, _int)
+_draw_lines = _declare('turtle_draw_lines', None, _double_p, _int)
+_run_commands = _declare('turtle_run_commands', _int, _double_p, _int)
+_get_field = _declare('turtle_get_field', ctypes.POINTER(ctypes.c_uint8))
+
+
+# interior shortcut flags, must match MANDELBROT_* in mandelbrot.h
+MANDELBROT_CARDIOID = 1
+MANDELBROT_PERIODICITY = 2
+MANDELBROT_MARIANI_SILVER = 4
+MANDELBROT_DEFAULT_SHORTCUTS = MANDELBROT_CARDIOID | MANDELBROT_PERIODICITY
+
+
+class _MandelbrotSettings(ctypes.Structure):
+    # must match mandelbrot_settings_t in mandelbrot.h
+    _fields_ = [('xmin', _double), ('xmax', _double),
+                ('ymin', _double), ('ymax', _double),
+                ('max_iter', _int), ('escape_radius', _double),
+                ('power', _int), ('shortcuts', _int)]
+
+
+class _MandelbrotStats(ctypes.Structure):
+    # must match mandelbrot_stats_t in mandelbrot.h
+    _fields_ = [('pixels', ctypes.c_longlong),
+                ('iterations', ctypes.c_longlong),
+                ('cardioid', ctypes.c_longlong),
+                ('periodic', ctypes.c_longlong),
+                ('filled', ctypes.c_longlong)]
+
+
+_mandelbrot_escape_times = _declare(
+    'mandelbrot_escape_times', None,
+    ctypes.POINTER(_MandelbrotSettings), _int, _int, _double_p,
+    ctypes.POINTER(_MandelbrotStats))
+_mandelbrot_render = _declare(
+    'mandelbrot_render', None, ctypes.POINTER(_MandelbrotSettings),
+    ctypes.POINTER(_MandelbrotStats))
+_mandelbrot_cache_escape_times = _declare(
+    'mandelbrot_cache_escape_times', None,
+    ctypes.POINTER(_MandelbrotSettings), _int, _int, _double_p)
+_mandelbrot_cache_render = _declare(
+    'mandelbrot_cache_render', None, ctypes.POINTER(_MandelbrotSettings))
+
+
+class _MandelbrotCacheStats(ctypes.Structure):
+    # must match mandelbrot_cache_stats_t in mandelbrot_cache.h
+    _fields_ = [('hits', ctypes.c_longlong), ('resumed', ctypes.c_longlong),
+                ('misses', ctypes.c_longlong), ('evictions', ctypes.c_longlong),
+                ('tiles', _int), ('bytes', ctypes.c_size_t)]
+
+
+cache_init = _declare('mandelbrot_cache_init', None, ctypes.c_size_t)
+cache_cleanup = _declare('mandelbrot_cache_cleanup', None)
+cache_reset_stats = _declare('mandelbrot_cache_reset_stats', None)
+_cache_get_stats = _declare('mandelbrot_cache_get_stats', None,
+                            ctypes.POINTER(_MandelbrotCacheStats))
+
+
+class _DeepzoomView(ctypes.Structure):
+    # must match deepzoom_view_t in deepzoom.h
+    _fields_ = [('center_re', _str), ('center_im', _str),
+                ('width', _double), ('height', _double),
+                ('max_iter', _int), ('escape_radius', _double)]
+
+
+class _DeepzoomStats(ctypes.Structure):
+    # must match deepzoom_stats_t in deepzoom.h
+    _fields_ = [('precision_bits', _int), ('reference_length', _int),
+                ('skipped_iters', _int), ('glitched_pixels', ctypes.c_longlong),
+                ('rebases', ctypes.c_longlong), ('reference_ms', _double),
+                ('series_ms', _double), ('pixels_ms', _double)]
+
+
+_deepzoom_escape_times = _declare(
+    'deepzoom_escape_times', None, ctypes.POINTER(_DeepzoomView), _int, _int,
+    _double_p, ctypes.POINTER(_DeepzoomStats))
+
+
+def save_bmp(filename):
+    _save_bmp(os.fsencode(filename))
+
+
+def save_bmp_level(filename, level):
+    _save_bmp_level(os.fsencode(filename), level)
+
+
+def _as_buffer(values, dtype, width):
+    # only copies if the caller's array isn't already contiguous and typed
+    arr = np.ascontiguousarray(values, dtype=dtype).reshape(-1, width)
+    ctype = np.ctypeslib.as_ctypes_type(arr.dtype)
+    return arr, arr.ctypes.data_as(ctypes.POINTER(ctype))
+
+
+def draw_pixels(coords):
+    """Draw an (n, 2) array of integer x, y pixel coordinates."""
+    arr, ptr = _as_buffer(coords, np.intc, 2)
+    _draw_pixels(ptr, len(arr))
+
+
+def draw_lines(segments):
+    """Draw an (n, 4) array of x0, y0, x1, y1 line segments."""
+    arr, ptr = _as_buffer(segments, np.float64, 4)
+    _draw_lines(ptr, len(arr))
+
+
+def run(commands):
+    """Run an (n, CMD_WIDTH) array of [opcode, arg, arg, arg] commands."""
+    arr, ptr = _as_buffer(commands, np.float64, CMD_WIDTH)
+    done = _run_commands(ptr, len(arr))
+    if done != len(arr):
+        raise ValueError(f'unknown turtle command at index {done}')
+
+
+def field():
+    """
+    Zero-copy (height, width, 3) uint8 RGB view of the field, top row first.
+    The view is only valid until the next init() or cleanup(). Pixels written
+    through it are not tracked for the preview pyramid; call mark_dirty()
+    afterwards if the pyramid is used.
+    """
+    width, height = get_width(), get_height()
+    ptr = _get_field()
+    if not ptr or width == 0 or height == 0:
+        raise RuntimeError('turtle field is not initialized')
+    flat = np.ctypeslib.as_array(ptr, shape=(height * width * 3,))
+    # the engine stores rows bottom-up; flipping is just a negative stride
+    return flat.reshape(height, width, 3)[::-1]
+
+
+def _mandelbrot_settings(settings):
+    # accepts MandelbrotSettings from Mandelbrot.py or anything shaped like it
+    return _MandelbrotSettings(
+        settings.xmin, settings.xmax, settings.ymin, settings.ymax,
+        int(settings.max_iter), float(settings.escape_radius),
+        int(settings.power),
+        int(getattr(settings, 'shortcuts', MANDELBROT_DEFAULT_SHORTCUTS)))
+
+
+def _stats_dict(stats):
+    return {name: getattr(stats, name) for name, _ in stats._fields_}
+
+
+def mandelbrot(height, width, settings, with_stats=False):
+    """
+    Native drop-in for mandelbrot() in Mandelbrot.py: returns the (height,
+    width) array of smooth escape times for the given settings. Settings may
+    carry a `shortcuts` attribute (MANDELBROT_* flags); with_stats=True also
+    returns a dict of what each shortcut skipped.
+    """
+    stats = _MandelbrotStats()
+    values = np.empty((height, width), dtype=np.float64)
+    _mandelbrot_escape_times(ctypes.byref(_mandelbrot_settings(settings)),
+                             width, height,
+                             values.ctypes.data_as(_double_p),
+                             ctypes.byref(stats))
+    return (values, _stats_dict(stats)) if with_stats else values
+
+
+def mandelbrot_render(settings):
+    """
+    Render the settings' view over the whole field in the viewer palette and
+    return the frame statistics.
+    """
+    stats = _MandelbrotStats()
+    _mandelbrot_render(ctypes.byref(_mandelbrot_settings(settings)),
+                       ctypes.byref(stats))
+    return _stats_dict(stats)
+
+
+def mandelbrot_cached(height, width, settings):
+    """
+    Like mandelbrot(), but through the tile cache: redrawing, panning by
+    whole pixels and raising max_iter reuse earlier work. The view is snapped
+    to the cache's pixel lattice, which moves it by at most half a pixel.
+    """
+    values = np.empty((height, width), dtype=np.float64)
+    _mandelbrot_cache_escape_times(
+        ctypes.byref(_mandelbrot_settings(settings)), width, height,
+        values.ctypes.data_as(_double_p))
+    return values
+
+
+def mandelbrot_cache_render(settings):
+    """Cached variant of mandelbrot_render()."""
+    _mandelbrot_cache_render(ctypes.byref(_mandelbrot_settings(settings)))
+
+
+def cache_stats():
+    """Tile cache counters as a dict (hits, resumed, misses, evictions, ...)."""
+    stats = _MandelbrotCacheStats()
+    _cache_get_stats(ctypes.byref(stats))
+    return _stats_dict(stats)
+
+
+def _decimal_string(value):
+    # the engine parses plain decimals only, so never hand it an exponent
+    if isinstance(value, str):
+        value = Decimal(value)
+    return format(Decimal(value), 'f').encode('ascii')
+
+
+def deepzoom(height, width, center_re, center_im, view_width, view_height,
+             max_iter, escape_radius=2.0):
+    """
+    Perturbation deep zoom (power 2 only). The center may be a str, Decimal
+    or float and keeps every digit it is given; view_width and view_height
+    are the extents of the view and may go down to about 1e-300. Returns the
+    (height, width) escape time array, laid out like mandelbrot(), and a dict
+    of per-frame statistics.
+    """
+    view = _DeepzoomView(_decimal_string(center_re), _decimal_string(center_im),
+                         float(view_width), float(view_height),
+                         int(max_iter), float(escape_radius))
+    stats = _DeepzoomStats()
+    values = np.empty((height, width), dtype=np.float64)
+    _deepzoom_escape_times(ctypes.byref(view), width, height,
+                           values.ctypes.data_as(_double_p),
+                           ctypes.byref(stats))
+    return values, _stats_dict(stats)
+
+
+IFS_MAX_MAPS = 16
+
+
+class _IfsMap(ctypes.Structure):
+    # must match ifs_map_t in ifs.h
+    _fields_ = [('a', _double), ('b', _double), ('c', _double),
+                ('d', _double), ('e', _double), ('f', _double),
+                ('weight', _double)]
+
+
+class _Ifs(ctypes.Structure):
+    # must match ifs_t in ifs.h
+    _fields_ = [('maps', _IfsMap * IFS_MAX_MAPS), ('count', _int),
+                ('xmin', _double), ('xmax', _double),
+                ('ymin', _double), ('ymax', _double)]
+
+
+class _IfsStats(ctypes.Structure):
+    # must match ifs_stats_t in ifs.h
+    _fields_ = [('points', ctypes.c_longlong), ('hits', ctypes.c_longlong),
+                ('max_density', ctypes.c_uint32), ('walk_ms', _double),
+                ('reduce_ms', _double)]
+
+
+class _Rgb(ctypes.Structure):
+    # must match rgb_t in turtle.h
+    _fields_ = [('red', ctypes.c_uint8), ('green', ctypes.c_uint8),
+                ('blue', ctypes.c_uint8)]
+
+
+_ifs_sierpinski = _declare('ifs_sierpinski', None, ctypes.POINTER(_Ifs))
+_ifs_barnsley_fern = _declare('ifs_barnsley_fern', None, ctypes.POINTER(_Ifs))
+_ifs_density = _declare(
+    'ifs_density', None, ctypes.POINTER(_Ifs), ctypes.c_longlong,
+    ctypes.c_uint64, _int, _int, ctypes.POINTER(ctypes.c_uint32),
+    ctypes.POINTER(_IfsStats))
+_ifs_render = _declare(
+    'ifs_render', None, ctypes.POINTER(_Ifs), ctypes.c_longlong,
+    ctypes.c_uint64, _Rgb, ctypes.POINTER(_IfsStats))
+
+
+def ifs(maps, xmin, xmax, ymin, ymax):
+    """
+    Build an iterated function system from (a, b, c, d, e, f, weight) maps,
+    x' = a*x + b*y + e and y' = c*x + d*y + f, and the region to draw.
+    """
+    maps = list(maps)
+    if not 0 < len(maps) <= IFS_MAX_MAPS:
+        raise ValueError(f'an IFS needs 1 to {IFS_MAX_MAPS} maps')
+    system = _Ifs()
+    for i, m in enumerate(maps):
+        system.maps[i] = _IfsMap(*(float(v) for v in m))
+    system.count = len(maps)
+    system.xmin, system.xmax, system.ymin, system.ymax = xmin, xmax, ymin, ymax
+    return system
+
+
+def sierpinski():
+    """The chaos game on a triangle, framed by its region."""
+    system = _Ifs()
+    _ifs_sierpinski(ctypes.byref(system))
+    return system
+
+
+def barnsley_fern():
+    """Barnsley's fern, framed by its region."""
+    system = _Ifs()
+    _ifs_barnsley_fern(ctypes.byref(system))
+    return system
+
+
+def ifs_density(height, width, system, points, seed=1):
+    """
+    Run the chaos game for `points` points and return the (height, width)
+    uint32 hit counts over the system's region (row 0 at ymin, like
+    mandelbrot()) and a dict of statistics. The counts depend only on the
+    seed, not on the number of threads.
+    """
+    stats = _IfsStats()
+    density = np.empty((height, width), dtype=np.uint32)
+    _ifs_density(ctypes.byref(system), int(points), int(seed), width, height,
+                 density.ctypes.data_as(ctypes.POINTER(ctypes.c_uint32)),
+                 ctypes.byref(stats))
+    return density, _stats_dict(stats)
+
+
+def ifs_render(system, points, color, seed=1):
+    """
+    Run the chaos game over the whole field, blend the hit pixels towards the
+    (red, green, blue) color on a log scale and return the statistics.
+    """
+    stats = _IfsStats()
+    _ifs_render(ctypes.byref(system), int(points), int(seed), _Rgb(*color),
+                ctypes.byref(stats))
+    return _stats_dict(stats)